@@ -0,0 +1,91 @@
+// bvh_build_bench.cpp : BVH construction time from 1e3 to 1e7 primitives,
+// thread scaling of the SAH and LBVH builders when built with _USE_THREAD (CMake WITH_THREAD)
+// usage: bvh_build_bench [max primitives] [max threads]
+//
+#include <Scene.hpp>
+#include <profile/timeprofile.hpp>
+#include <iostream>
+
+
+// spheres in a cube with constant density
+void make_spheres(IntersectList& list, const size_t count, const shared_ptr<Material>& material)
+{
+	list.objects.reserve(count);
+	const real side = std::cbrt(static_cast<real>(count));
+	for (size_t i = 0; i < count; ++i)
+		list.add(make_shared<Sphere>(generate_random_vec(0.0, side), random_double(0.05, 0.5), material));
+}
+
+
+int main(int argc, char* argv[])
+{
+	// upper bound of primitive count, 1e7 spheres need several GB of memory
+	const size_t max_count = argc > 1 ? std::stoull(argv[1]) : 10000000;
+
+	BVHBuildOption option;
+	BVHBuildOption lbvh_option;
+	lbvh_option.builder = BVH_BUILDER_LBVH;
+	auto material = make_shared<Lambertian>(color(0.5, 0.5, 0.5));
+
+	std::cout << "primitives, build ms, ns per primitive, flatten ms, SAH cost, LBVH build ms, LBVH SAH cost\n";
+	for (size_t count = 1000; count <= max_count; count *= 10) {
+		IntersectList list;
+		make_spheres(list, count, material);
+
+		TimeProfile build_time;
+		BVH_Node bvh(list, 0.0, 1.0, option);
+		auto build_ms = build_time.getTime();
+
+		TimeProfile flatten_time;
+		FlatBVH flat(bvh);
+		auto flatten_ms = flatten_time.getTime();
+
+		TimeProfile lbvh_time;
+		auto lbvh = LBVHBuilder(lbvh_option).build(list.objects, 0, count, 0.0, 1.0);
+		auto lbvh_ms = lbvh_time.getTime();
+
+		std::cout << count << ", " << build_ms << ", " << (build_ms * 1e6) / count << ", "
+				  << flatten_ms << ", " << bvh.cost_report(option).sah_cost << ", "
+				  << lbvh_ms << ", " << lbvh->cost_report(lbvh_option).sah_cost << "\n";
+	}
+
+#ifdef _USE_THREAD
+	// powers of two up to the hardware concurrency, the largest scene of at most 1e6 primitives
+	const size_t scaling_count = std::min<size_t>(max_count, 1000000);
+	const size_t max_threads = argc > 2 ? std::max<size_t>(std::stoull(argv[2]), 1) : std::max<size_t>(std::thread::hardware_concurrency(), 1);
+	std::vector<size_t> thread_counts;
+	for (size_t threads = 1; threads < max_threads; threads *= 2)
+		thread_counts.push_back(threads);
+	thread_counts.push_back(max_threads);
+
+	IntersectList list;
+	make_spheres(list, scaling_count, material);
+
+	std::cout << "\nthread scaling, " << scaling_count << " primitives\n";
+	std::cout << "threads, build ms, speedup, LBVH build ms, LBVH speedup\n";
+	int64_t serial_ms = 0, lbvh_serial_ms = 0;
+	for (const auto threads : thread_counts) {
+		option.build_threads = threads;
+		lbvh_option.build_threads = threads;
+
+		TimeProfile build_time;
+		BVH_Node bvh(list, 0.0, 1.0, option);
+		const auto build_ms = std::max<int64_t>(build_time.getTime(), 1);
+
+		TimeProfile lbvh_time;
+		auto lbvh = LBVHBuilder(lbvh_option).build(list.objects, 0, scaling_count, 0.0, 1.0);
+		const auto lbvh_ms = std::max<int64_t>(lbvh_time.getTime(), 1);
+
+		if (threads == 1) {
+			serial_ms = build_ms;
+			lbvh_serial_ms = lbvh_ms;
+		}
+		std::cout << threads << ", " << build_ms << ", " << static_cast<double>(serial_ms) / build_ms << ", "
+				  << lbvh_ms << ", " << static_cast<double>(lbvh_serial_ms) / lbvh_ms << "\n";
+	}
+#else
+	std::cout << "\nbuilt without _USE_THREAD (CMake WITH_THREAD) - the builders are serial, no thread scaling\n";
+#endif
+
+	return 0;
+}
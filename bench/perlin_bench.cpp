@@ -0,0 +1,83 @@
+// perlin_bench.cpp : accuracy and lookups per second of the turbulence of PerlinTexture, scalar double reference
+// against the SIMD kernel and baked grids, on a marble sphere - of the final scene by default (radius 80)
+// usage: perlin_bench [points] [sphere radius]
+//
+#include <Scene.hpp>
+#include <profile/timeprofile.hpp>
+#include <iostream>
+
+
+struct TurbulenceError
+{
+	real mean = 0.0;
+	real max = 0.0;
+};
+
+
+TurbulenceError turbulence_error(const PerlinTexture& texture, const std::vector<point3>& points, const std::vector<real>& reference)
+{
+	TurbulenceError error;
+	for (size_t i = 0; i < points.size(); ++i) {
+		// error of the shaded value, turbulence is scaled by 10 inside the sine
+		const real e = std::fabs(texture.value(0, 0, points[i]).x - reference[i]);
+		error.mean += e;
+		error.max = std::max(error.max, e);
+	}
+	error.mean /= points.size();
+	return error;
+}
+
+
+real lookups_per_second(const PerlinTexture& texture, const std::vector<point3>& points, real& checksum)
+{
+	TimeProfile time;
+	checksum = 0.0;
+	for (const auto& p : points)
+		checksum += texture.value(0, 0, p).x;
+	const auto ms = std::max<int64_t>(time.getTime(), 1);
+	return 1000.0 * points.size() / ms;
+}
+
+
+int main(int argc, char* argv[])
+{
+	const size_t point_count = argc > 1 ? std::stoull(argv[1]) : 1000000;
+	// noise has a cell per unit: a grid resolves it on spheres of a few units only
+	const real radius = argc > 2 ? std::stod(argv[2]) : 80.0;
+
+	// points on the surface of the marble sphere
+	const point3 center(220, 280, 300);
+	std::vector<point3> points(point_count);
+	for (auto& p : points)
+		p = center + radius * random_unit_vector();
+
+	PerlinTexture texture(0.1, PERLIN_SCALAR);
+	std::vector<real> reference(point_count);
+	for (size_t i = 0; i < point_count; ++i)
+		reference[i] = texture.value(0, 0, points[i]).x;
+
+	real checksum = 0.0;
+	std::cout << "method, million lookups/s, mean error, max error, bake ms, memory MB\n";
+	const auto scalar = lookups_per_second(texture, points, checksum);
+	std::cout << "scalar double, " << scalar * 1e-6 << ", 0, 0, 0, 0\n";
+
+	texture.mode = PERLIN_SIMD;
+	const auto simd = lookups_per_second(texture, points, checksum);
+	const auto simd_error = turbulence_error(texture, points, reference);
+	std::cout << "SIMD " << select_perlin_kernel().lanes << " lanes, " << simd * 1e-6 << ", "
+			  << simd_error.mean << ", " << simd_error.max << ", 0, 0\n";
+
+	texture.mode = PERLIN_BAKED;
+	const AABB box(center - vec3(radius), center + vec3(radius));
+	for (const int resolution : { 64, 128, 256 }) {
+		TimeProfile bake_time;
+		texture.bake(box, resolution);
+		const auto bake_ms = bake_time.getTime();
+		const auto baked = lookups_per_second(texture, points, checksum);
+		const auto baked_error = turbulence_error(texture, points, reference);
+		std::cout << "baked " << resolution << "^3, " << baked * 1e-6 << ", " << baked_error.mean << ", " << baked_error.max
+				  << ", " << bake_ms << ", " << texture.baked_memory() / (1024.0 * 1024.0) << "\n";
+	}
+
+	return 0;
+}
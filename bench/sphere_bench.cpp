@@ -0,0 +1,49 @@
+// sphere_bench.cpp : rays per second through a cluster of spheres, BVH of Sphere objects against SphereSet
+//
+#include <Scene.hpp>
+#include <profile/timeprofile.hpp>
+#include <iostream>
+
+
+real rays_per_second(const IIntersect& object, const std::vector<Ray>& rays, size_t& hits)
+{
+	TimeProfile time;
+	IntersectRecord irc;
+	hits = 0;
+	for (const auto& ray : rays)
+		hits += object.intersect(ray, 0.001, infinity, irc) ? 1 : 0;
+	const auto ms = std::max<int64_t>(time.getTime(), 1);
+	return 1000.0 * rays.size() / ms;
+}
+
+
+int main(int argc, char* argv[])
+{
+	const size_t ray_count = argc > 1 ? std::stoull(argv[1]) : 1000000;
+	auto material = make_shared<Lambertian>(color(0.73, 0.73, 0.73));
+
+	// sphere cluster of the final scene, rays from a surrounding box towards it
+	std::vector<point3> centers;
+	IntersectList list;
+	for (int i = 0; i < 1000; ++i) {
+		centers.push_back(generate_random_vec(0, 165));
+		list.add(make_shared<Sphere>(centers.back(), 10, material));
+	}
+	std::vector<Ray> rays;
+	for (size_t i = 0; i < ray_count; ++i) {
+		const point3 origin = generate_random_vec(-100, 265);
+		rays.emplace_back(origin, generate_random_vec(0, 165) - origin, 0.0);
+	}
+
+	auto accel = make_accel(list, 0.0, 1.0);
+	SphereSet set(centers, std::vector<real>(centers.size(), 10.0), material);
+
+	size_t hits = 0, set_hits = 0;
+	const auto spheres = rays_per_second(*accel, rays, hits);
+	const auto sphere_set = rays_per_second(set, rays, set_hits);
+	std::cout << "method, million rays/s, hits\n"
+			  << "BVH of Sphere, " << spheres * 1e-6 << ", " << hits << "\n"
+			  << "SphereSet, " << sphere_set * 1e-6 << ", " << set_hits << "\n";
+
+	return 0;
+}
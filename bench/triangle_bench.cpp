@@ -0,0 +1,88 @@
+// triangle_bench.cpp : ray-triangle tests per second, Möller-Trumbore against the precomputed Baldwin-Weber transform
+//
+#include <Scene.hpp>
+#include <profile/timeprofile.hpp>
+#include <iostream>
+
+
+template<typename Primitive>
+real tests_per_second(const std::vector<Primitive>& triangles, const std::vector<Ray>& rays, size_t& hits)
+{
+	TimeProfile time;
+	IntersectRecord irc;
+	hits = 0;
+	for (const auto& ray : rays) {
+		for (const auto& triangle : triangles)
+			hits += triangle.intersect(ray, 0.001, infinity, irc) ? 1 : 0;
+	}
+	const auto ms = std::max<int64_t>(time.getTime(), 1);
+	return 1000.0 * rays.size() * triangles.size() / ms;
+}
+
+
+int main(int argc, char* argv[])
+{
+	const size_t ray_count = argc > 1 ? std::stoull(argv[1]) : 20000;
+	const size_t triangle_count = 1000;
+	auto material = make_shared<Lambertian>(color(0.5, 0.5, 0.5));
+
+	// triangles of random orientation in a unit cube, rays from a surrounding box towards it
+	std::vector<Triangle> triangles;
+	std::vector<PrecomputedTriangle> precomputed;
+	for (size_t i = 0; i < triangle_count; ++i) {
+		const point3 a = generate_random_vec(0.0, 1.0);
+		const point3 b = a + generate_random_vec(-0.3, 0.3);
+		const point3 c = a + generate_random_vec(-0.3, 0.3);
+		triangles.emplace_back(a, b, c, material);
+		precomputed.emplace_back(a, b, c, material);
+	}
+	std::vector<Ray> rays;
+	for (size_t i = 0; i < ray_count; ++i) {
+		const point3 origin = generate_random_vec(-2.0, 3.0);
+		rays.emplace_back(origin, generate_random_vec(0.0, 1.0) - origin, 0.0);
+	}
+
+	size_t hits = 0, precomputed_hits = 0;
+	const auto moller = tests_per_second(triangles, rays, hits);
+	const auto baldwin_weber = tests_per_second(precomputed, rays, precomputed_hits);
+	std::cout << "method, million rays/s per triangle, hits\n"
+			  << "Moller-Trumbore, " << moller * 1e-6 << ", " << hits << "\n"
+			  << "Baldwin-Weber, " << baldwin_weber * 1e-6 << ", " << precomputed_hits << "\n";
+
+	// whole mesh traversal, height field of 2 * 300 * 300 triangles
+	const uint32_t side = 300;
+	std::vector<point3> positions;
+	std::vector<uint32_t> indices;
+	for (uint32_t i = 0; i <= side; ++i) {
+		for (uint32_t j = 0; j <= side; ++j)
+			positions.emplace_back(i * 0.1, sin(i * 0.05) * cos(j * 0.07) * 3.0, j * 0.1);
+	}
+	for (uint32_t i = 0; i < side; ++i) {
+		for (uint32_t j = 0; j < side; ++j) {
+			const uint32_t a = i * (side + 1) + j;
+			indices.insert(indices.end(), { a, a + 1, a + side + 1, a + 1, a + side + 2, a + side + 1 });
+		}
+	}
+	TriangleMesh mesh(positions, indices, material);
+	std::vector<Ray> mesh_rays;
+	for (size_t i = 0; i < 10 * ray_count; ++i) {
+		point3 origin = generate_random_vec(-5.0, side * 0.1 + 5.0);
+		origin.y = random_double(5.0, 10.0);
+		mesh_rays.emplace_back(origin, generate_random_vec(-1.0, 1.0) - vec3(0.0, 0.5, 0.0), 0.0);
+	}
+
+	std::cout << "mesh, million rays/s\n";
+	for (int pass = 0; pass < 2; ++pass) {
+		if (pass == 1)
+			mesh.precompute_transforms();
+		TimeProfile time;
+		IntersectRecord irc;
+		size_t mesh_hits = 0;
+		for (const auto& ray : mesh_rays)
+			mesh_hits += mesh.intersect(ray, 0.001, infinity, irc) ? 1 : 0;
+		const auto ms = std::max<int64_t>(time.getTime(), 1);
+		std::cout << (pass == 0 ? "Moller-Trumbore, " : "Baldwin-Weber, ") << 1e-3 * mesh_rays.size() / ms << ", " << mesh_hits << "\n";
+	}
+
+	return 0;
+}
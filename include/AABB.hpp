@@ -13,21 +13,47 @@ public:
 	point3 max() const { return bb; }
 	point3 set_min(const point3 a) { aa = a; }
 	point3 set_max(const point3 b) { bb = b; }
-	bool intersect(const Ray& ray, double t_min, double t_max) const;
+	bool intersect(const Ray& ray, real t_min, real t_max) const;
+	bool intersect(const Ray& ray, const vec3& inv_dir, const int dir_is_neg[3], real t_min, real t_max) const;
+	real surface_area() const;
 protected:
-	bool intersect_slow(const Ray& ray, double t_min, double t_max) const;
-	bool intersect_fast(const Ray& ray, double t_min, double t_max) const;
+	bool intersect_slow(const Ray& ray, real t_min, real t_max) const;
+	bool intersect_fast(const Ray& ray, real t_min, real t_max) const;
 private:
 	point3 aa;
 	point3 bb;
 };
 
-bool AABB::intersect(const Ray& ray, double t_min, double t_max) const
+bool AABB::intersect(const Ray& ray, real t_min, real t_max) const
 {
 	return intersect_fast(ray, t_min, t_max);
 }
 
-bool AABB::intersect_slow(const Ray& ray, double t_min, double t_max) const
+bool AABB::intersect(const Ray& ray, const vec3& inv_dir, const int dir_is_neg[3], real t_min, real t_max) const
+{
+	/*
+		inverse direction and its signs are computed once per ray by the caller,
+		near/far slab planes are picked by sign instead of swap
+	*/
+	const auto orig = ray.origin();
+	for (auto i = 0; i < 3; ++i) { // xyz
+		auto t0 = ((dir_is_neg[i] ? bb[i] : aa[i]) - orig[i]) * inv_dir[i];
+		auto t1 = ((dir_is_neg[i] ? aa[i] : bb[i]) - orig[i]) * inv_dir[i];
+		t_min = t0 > t_min ? t0 : t_min;
+		t_max = t1 < t_max ? t1 : t_max;
+		if (t_max <= t_min)
+			return false;
+	}
+	return true;
+}
+
+real AABB::surface_area() const
+{
+	auto d = bb - aa;
+	return 2.0 * (d.x * d.y + d.y * d.z + d.z * d.x);
+}
+
+bool AABB::intersect_slow(const Ray& ray, real t_min, real t_max) const
 {
 	/*
 	*	Find Ray-slab overlap interval [t0, t1] for xyz-coordinates:
@@ -45,10 +71,10 @@ bool AABB::intersect_slow(const Ray& ray, double t_min, double t_max) const
 	return true;
 }
 
-bool AABB::intersect_fast(const Ray& ray, double t_min, double t_max) const
+bool AABB::intersect_fast(const Ray& ray, real t_min, real t_max) const
 {
 	for (auto i = 0; i < 3; ++i) { // xyz
-		auto invDir = 1.0 / ray.direction()[i];
+		auto invDir = real(1) / ray.direction()[i];
 		auto t0 = (min()[i] - ray.origin()[i]) * invDir;
 		auto t1 = (max()[i] - ray.origin()[i]) * invDir;
 		if (invDir < 0.0)
@@ -17,6 +17,10 @@ private:
 	size_t num_ch;
 	size_t buffer_size = 0;
 	byte* framebuffer = nullptr;
+	bool stb_buffer = false; // framebuffer is the buffer of stbi_load, freed by stbi_image_free
+
+	void load(const std::string& filepath, const int components_per_pixel);
+	void release();
 
 public:
 	Image(const lint img_width, const lint img_height, const size_t num_channel = 3) : 
@@ -28,25 +32,13 @@ public:
 	}
 
 	Image(const std::string& filepath, const int components_per_pixel = 0) {
-		// stbi_set_flip_vertically_on_load(true);
-		auto texwidth = 0; auto texheight = 0; auto nrComponents = 0;
-		uchar* data = nullptr;
-		data = stbi_load(filepath.c_str(), &texwidth, &texheight, &nrComponents, components_per_pixel);
-		if (data) {
-			width = texwidth; height = texheight; num_ch = nrComponents;
-			buffer_size = texwidth * texheight * nrComponents;
-			framebuffer = new byte[buffer_size]{ 0 };
-			std::memcpy(framebuffer, data, buffer_size);
-		}
-		else
-		{
-			stbi_image_free(data);
-			assert(false && "Texture failed to load at path");
-		}
-		stbi_image_free(data);
+		load(filepath, components_per_pixel);
 	}
 
-	~Image() { if (framebuffer) delete[] framebuffer; }
+	Image(const Image&) = delete;
+	Image& operator=(const Image&) = delete;
+
+	~Image() { release(); }
 	lint get_width() const { return width; }
 	lint get_height() const { return height; }
 	size_t get_num_ch() const { return num_ch; }
@@ -56,29 +48,8 @@ public:
 
 
 	void read_from_file(const std::string& filepath, const int components_per_pixel = 0) {
-
-		if (framebuffer) {
-			std::memset(framebuffer, 0, buffer_size);
-			delete[] framebuffer;
-			framebuffer = nullptr;
-		}
-
-		// stbi_set_flip_vertically_on_load(true);
-		auto texwidth = 0; auto texheight = 0; auto nrComponents = 0;
-		uchar* data = nullptr;
-		data = stbi_load(filepath.c_str(), &texwidth, &texheight, &nrComponents, components_per_pixel);
-		if (data) {
-			width = texwidth; height = texheight; num_ch = nrComponents;
-			buffer_size = texwidth * texheight * nrComponents;
-			framebuffer = new byte[buffer_size]{ 0 };
-			std::memcpy(framebuffer, data, buffer_size);
-		}
-		else
-		{
-			stbi_image_free(data);
-			assert(false && "Texture failed to load at path");
-		}
-		stbi_image_free(data);
+		release();
+		load(filepath, components_per_pixel);
 	}
 
 
@@ -212,4 +183,38 @@ public:
 		}
 		return true;
 	}
-};
\ No newline at end of file
+};
+
+
+// the decoded buffer is owned as it is, without a copy
+void Image::load(const std::string& filepath, const int components_per_pixel)
+{
+	// stbi_set_flip_vertically_on_load(true);
+	auto texwidth = 0; auto texheight = 0; auto nrComponents = 0;
+	uchar* data = stbi_load(filepath.c_str(), &texwidth, &texheight, &nrComponents, components_per_pixel);
+	if (data == nullptr) {
+		width = 0; height = 0; num_ch = 0;
+		assert(false && "Texture failed to load at path");
+		return;
+	}
+	width = texwidth; height = texheight;
+	// stbi_load converts to the requested count of components
+	num_ch = components_per_pixel != 0 ? components_per_pixel : nrComponents;
+	buffer_size = width * height * num_ch;
+	framebuffer = data;
+	stb_buffer = true;
+}
+
+
+void Image::release()
+{
+	if (framebuffer == nullptr)
+		return;
+	if (stb_buffer)
+		stbi_image_free(framebuffer);
+	else
+		delete[] framebuffer;
+	framebuffer = nullptr;
+	buffer_size = 0;
+	stb_buffer = false;
+}
@@ -1,8 +1,16 @@
 #pragma once
 #include <vector>
+#include <array>
+#include <ostream>
+#include <cassert>
 #include <AABB.hpp>
+#include <option.hpp>
+#ifdef _USE_THREAD
+#include <ThreadPool.h>
+#endif
 
 class Material;
+class IIntersect;
 
 /*
 	class IntersectRecord - contain some detail about intersect with surface
@@ -11,9 +19,11 @@ struct IntersectRecord
 {
 	point3 p; // intersect point
 	vec3 normal; // normal vector
-	shared_ptr<Material> material;
+	const Material* material = nullptr; // owned by the object of the hit
 	vec2 uv;
-	double t; // parameter
+	real t; // parameter
+	real uv_scale = 0.0; // world length of a unit of uv, 0 - no texture parametrization
+	real footprint = 0.0; // width of the ray cone at the hit in uv units - level of detail of textures
 	bool front_face = false;
 	inline void set_face_normal(const Ray& ray, const vec3& outward_normal) {
 		front_face = glm::dot(ray.direction(), outward_normal) < 0.0; // determining position intersection ray and normal surface
@@ -21,17 +31,257 @@ struct IntersectRecord
 	}
 };
 
+
+/*
+	interface IInstance - node which places an object by a transform: hits below it are found in object space,
+	their surface is evaluated in object space and mapped to the space of the node
+*/
+class IInstance
+{
+public:
+	virtual Ray to_object(const Ray& ray) const = 0;
+	virtual void to_world(const Ray& ray, IntersectRecord& irc) const = 0;
+};
+
+
+/*
+	struct HitInfo - closest hit of the traversal: distance, primitive and its parametric coordinates only.
+	Hits which are superseded by closer ones cost no surface evaluation, no material reference counting
+	and no record copies - position, normal, uv and material are evaluated once for the final hit (surface).
+*/
+struct HitInfo
+{
+	static constexpr int max_instance_depth = 4;
+
+	real t = 0.0;
+	const IIntersect* object = nullptr; // primitive of the hit, evaluates its surface
+	uint32_t prim = 0; // part of the object - triangle of a mesh, sphere of a set, face of a box
+	vec2 uv{ 0.0 }; // barycentrics of triangles
+	const IInstance* instances[max_instance_depth]; // instances above the primitive, innermost first
+	int instance_count = 0;
+
+	// a closer hit of a primitive, instances of the former hit are dropped
+	void set(const real hit_t, const IIntersect* hit_object, const uint32_t hit_prim = 0, const vec2& hit_uv = vec2(0.0)) {
+		t = hit_t;
+		object = hit_object;
+		prim = hit_prim;
+		uv = hit_uv;
+		instance_count = 0;
+	}
+	// called by an instance on the way up from a hit below it, instances deeper than the record are not traversed
+	void add_instance(const IInstance* instance) {
+		assert(instance_count < max_instance_depth && "Instances are nested too deep.\n");
+		instances[instance_count++] = instance;
+	}
+	// surface attributes of the hit of ray
+	void surface(const Ray& ray, IntersectRecord& irc) const;
+};
+
+
+/*
+	Packet of coherent rays (camera rays of a pixel tile) traced together, each ray keeps its own
+	closest distance and record. Rays with the same direction signs are coherent: bounds of their origins
+	and inverse directions give a conservative slab test of the whole packet by interval arithmetic.
+	Ingo Wald, Solomon Boulos, Peter Shirley, "Ray Tracing Deformable Scenes using Dynamic Bounding Volume Hierarchies", 2007
+*/
+struct RayPacket
+{
+	static constexpr size_t max_size = 64; // 8x8 tile
+
+	size_t size = 0;
+	Ray rays[max_size];
+	vec3 inv_dir[max_size];
+	int dir_signs[max_size][3]; // dir_is_neg of each ray
+	real t_max[max_size];
+	bool hit[max_size];
+	HitInfo hits[max_size];
+
+	bool coherent = false; // direction signs are shared, no zero direction components
+	int dir_is_neg[3] = { 0, 0, 0 }; // of the first ray, of all rays if coherent
+	point3 orig_min, orig_max;
+	vec3 inv_dir_min, inv_dir_max;
+	real packet_t_max = 0.0; // largest t_max of the rays
+
+	void clear() { size = 0; }
+	void add(const Ray& ray) {
+		assert(size < max_size);
+		rays[size++] = ray;
+	}
+	// prepares the added rays for tracing in [t_min, t_max]
+	void prepare(const real t_max_all);
+	// every ray misses the box - conservative, false if the packet is not coherent
+	bool miss(const AABB& box, real t_min) const;
+	// after a closest hit of ray i is stored, packet_t_max may only shrink
+	void update_t_max();
+};
+
+
+void RayPacket::prepare(const real t_max_all)
+{
+	coherent = size > 0;
+	for (size_t i = 0; i < size; ++i) {
+		inv_dir[i] = real(1) / rays[i].direction();
+		t_max[i] = t_max_all;
+		hit[i] = false;
+		int* neg = dir_signs[i];
+		for (int a = 0; a < 3; ++a)
+			neg[a] = inv_dir[i][a] < 0.0;
+		if (i == 0) {
+			orig_min = orig_max = rays[i].origin();
+			inv_dir_min = inv_dir_max = inv_dir[i];
+			std::copy(neg, neg + 3, dir_is_neg);
+		}
+		orig_min = glm::min(orig_min, rays[i].origin());
+		orig_max = glm::max(orig_max, rays[i].origin());
+		inv_dir_min = glm::min(inv_dir_min, inv_dir[i]);
+		inv_dir_max = glm::max(inv_dir_max, inv_dir[i]);
+		for (int a = 0; a < 3; ++a)
+			coherent = coherent && neg[a] == dir_is_neg[a] && std::isfinite(inv_dir[i][a]);
+	}
+	packet_t_max = t_max_all;
+}
+
+
+bool RayPacket::miss(const AABB& box, real t_min) const
+{
+	if (!coherent)
+		return false;
+
+	// interval of (plane - origin) * inv_dir over the packet, per slab
+	auto interval_mul = [](real a0, real a1, real b0, real b1, real& lo, real& hi) {
+		const real p[4] = { a0 * b0, a0 * b1, a1 * b0, a1 * b1 };
+		lo = std::min(std::min(p[0], p[1]), std::min(p[2], p[3]));
+		hi = std::max(std::max(p[0], p[1]), std::max(p[2], p[3]));
+	};
+	real t_near = t_min;
+	real t_far = packet_t_max;
+	for (int a = 0; a < 3; ++a) {
+		const real near_plane = dir_is_neg[a] ? box.max()[a] : box.min()[a];
+		const real far_plane = dir_is_neg[a] ? box.min()[a] : box.max()[a];
+		real lo, hi;
+		interval_mul(near_plane - orig_max[a], near_plane - orig_min[a], inv_dir_min[a], inv_dir_max[a], lo, hi);
+		t_near = std::max(t_near, lo);
+		interval_mul(far_plane - orig_max[a], far_plane - orig_min[a], inv_dir_min[a], inv_dir_max[a], lo, hi);
+		t_far = std::min(t_far, hi);
+	}
+	return t_near > t_far;
+}
+
+
+void RayPacket::update_t_max()
+{
+	packet_t_max = 0.0;
+	for (size_t i = 0; i < size; ++i)
+		packet_t_max = std::max(packet_t_max, t_max[i]);
+}
+
 /*
 	interface IIntersect - provide interface for computin intersectin shapes
 */
 class IIntersect
 {
 public:
-	virtual bool intersect(const Ray& ray, double t_min, double t_max, IntersectRecord& ir) const = 0;
-	virtual bool bounding_box(double time0, double time1, AABB& output_box) const = 0;
+	// closest hit in [t_min, t_max] with its surface
+	bool intersect(const Ray& ray, real t_min, real t_max, IntersectRecord& ir) const;
+	// closest hit in [t_min, t_max] - distance and primitive only, hit is changed by a closer hit only
+	virtual bool closest_hit(const Ray& ray, real t_min, real t_max, HitInfo& hit) const = 0;
+	// surface of a hit of this primitive, ray is in the space of the primitive
+	virtual void surface(const Ray& ray, const HitInfo& hit, IntersectRecord& ir) const;
+	virtual bool bounding_box(real time0, real time1, AABB& output_box) const = 0;
+	// any hit in [t_min, t_max] - for shadow rays and visibility tests, stops at the first hit and fills no record
+	virtual bool occluded(const Ray& ray, real t_min, real t_max) const;
+	// bounds of the part of the object inside region, used by the spatial split BVH to clip references
+	virtual bool clipped_bounding_box(real time0, real time1, const AABB& region, AABB& output_box) const;
+	// closest hits of the rays of a prepared packet, rays before first are known to miss the object
+	virtual void intersect_packet(RayPacket& packet, real t_min, size_t first = 0) const;
+	// instances on the deepest path into the object, an Instance counts itself - checked against HitInfo at scene build
+	virtual int instance_depth() const { return 0; }
 };
 
 
+void HitInfo::surface(const Ray& ray, IntersectRecord& irc) const
+{
+	// ray in the space of every instance on the way down, rays[instance_count] is the world ray
+	Ray rays[max_instance_depth + 1];
+	rays[instance_count] = ray;
+	for (int i = instance_count - 1; i >= 0; --i)
+		rays[i] = instances[i]->to_object(rays[i + 1]);
+
+	irc.uv_scale = 0.0;
+	object->surface(rays[0], *this, irc);
+	irc.t = t;
+	for (int i = 0; i < instance_count; ++i)
+		instances[i]->to_world(rays[i + 1], irc);
+
+	// cone width is projected onto the surface, grazing hits cover more of the texture
+	const real cos_theta = std::abs(glm::dot(ray.direction(), irc.normal)) / glm::length(ray.direction());
+	irc.footprint = irc.uv_scale > 0.0 ? ray.cone_width_at(t) / (std::max(cos_theta, real(1e-3)) * irc.uv_scale) : 0.0;
+}
+
+
+bool IIntersect::intersect(const Ray& ray, real t_min, real t_max, IntersectRecord& ir) const
+{
+	HitInfo hit;
+	if (!closest_hit(ray, t_min, t_max, hit))
+		return false;
+	hit.surface(ray, ir);
+	return true;
+}
+
+
+void IIntersect::surface(const Ray& /*ray*/, const HitInfo& /*hit*/, IntersectRecord& /*ir*/) const
+{
+	// aggregates pass hits of their objects, they are never the object of a hit
+	assert(false && "Object has no surface.\n");
+}
+
+
+bool IIntersect::occluded(const Ray& ray, real t_min, real t_max) const
+{
+	// closest hit - for objects without a cheaper any-hit test
+	HitInfo hit;
+	return closest_hit(ray, t_min, t_max, hit);
+}
+
+
+void IIntersect::intersect_packet(RayPacket& packet, real t_min, size_t first) const
+{
+	// ray by ray - for objects without a packet traversal, a hit is changed by a closer one only
+	for (size_t i = first; i < packet.size; ++i) {
+		if (closest_hit(packet.rays[i], t_min, packet.t_max[i], packet.hits[i])) {
+			packet.hit[i] = true;
+			packet.t_max[i] = packet.hits[i].t;
+		}
+	}
+}
+
+
+bool IIntersect::clipped_bounding_box(real time0, real time1, const AABB& region, AABB& output_box) const
+{
+	// box of the object clipped by region - conservative for any shape
+	if (!bounding_box(time0, time1, output_box))
+		return false;
+
+	const point3 small = glm::max(output_box.min(), region.min());
+	const point3 big = glm::min(output_box.max(), region.max());
+	if (small.x > big.x || small.y > big.y || small.z > big.z)
+		return false;
+
+	output_box = AABB(small, big);
+	return true;
+}
+
+
+
+
+// deepest instance nesting of the objects
+int nested_instance_depth(const std::vector<shared_ptr<IIntersect>>& objects)
+{
+	int depth = 0;
+	for (const auto& object : objects)
+		depth = std::max(depth, object->instance_depth());
+	return depth;
+}
 
 
 class IntersectList : public IIntersect
@@ -46,30 +296,43 @@ public:
 	void clear() { objects.clear(); }
 	void add(shared_ptr<IIntersect> object) { objects.push_back(object); }
 
-	virtual bool intersect(const Ray& ray, double t_min, double t_max, IntersectRecord& ir) const override;
-	virtual bool bounding_box(double time0, double time1, AABB& output_box) const override;
+	virtual bool closest_hit(const Ray& ray, real t_min, real t_max, HitInfo& hit) const override;
+	virtual bool occluded(const Ray& ray, real t_min, real t_max) const override;
+	virtual bool bounding_box(real time0, real time1, AABB& output_box) const override;
+	virtual void intersect_packet(RayPacket& packet, real t_min, size_t first = 0) const override {
+		for (const auto& object : objects)
+			object->intersect_packet(packet, t_min, first);
+	}
+	virtual int instance_depth() const override { return nested_instance_depth(objects); }
 public:
 	std::vector<shared_ptr<IIntersect>> objects; // array with intersection shapes
 };
 
-bool IntersectList::intersect(const Ray& ray, double t_min, double t_max, IntersectRecord& ir) const
+bool IntersectList::closest_hit(const Ray& ray, real t_min, real t_max, HitInfo& hit) const
 {
-	IntersectRecord temp_irc;
 	bool is_intersect = false;
 	auto closest_dist = t_max; 
 
 	for (const auto& object : objects) {
-		if (object->intersect(ray, t_min, closest_dist, temp_irc)) {
+		if (object->closest_hit(ray, t_min, closest_dist, hit)) {
 			is_intersect = true;
-			closest_dist = temp_irc.t;
-			ir = temp_irc;
+			closest_dist = hit.t;
 		}
 	}
 
 	return is_intersect;
 }
 
-bool IntersectList::bounding_box(double time0, double time1, AABB& output_box) const
+bool IntersectList::occluded(const Ray& ray, real t_min, real t_max) const
+{
+	for (const auto& object : objects) {
+		if (object->occluded(ray, t_min, t_max))
+			return true;
+	}
+	return false;
+}
+
+bool IntersectList::bounding_box(real time0, real time1, AABB& output_box) const
 {
 	if (objects.empty())
 		return false;
@@ -89,274 +352,435 @@ bool IntersectList::bounding_box(double time0, double time1, AABB& output_box) c
 
 /*
 	Bounding Volume Hierarchy
+	Top-down build with binned surface area heuristic (SAH):
+	Ingo Wald, "On fast Construction of SAH-based Bounding Volume Hierarchies", 2007
 */
 
+// SAH cost model summary of a built hierarchy
+struct BVHCostReport
+{
+	size_t interior_nodes = 0;
+	size_t leaf_nodes = 0;
+	size_t primitives = 0; // references in leaves
+	size_t duplicates = 0; // references to a primitive already referenced by another leaf (SBVH spatial splits)
+	size_t max_depth = 0;
+	real sah_cost = 0.0; // expected cost of a ray which hits the root bounding box
+	size_t memory = 0; // bytes of nodes and primitive references
+};
+
+std::ostream& operator<<(std::ostream& os, const BVHCostReport& report)
+{
+	os << "BVH: interior nodes " << report.interior_nodes
+	   << ", leaves " << report.leaf_nodes
+	   << ", primitives " << report.primitives - report.duplicates;
+	if (report.duplicates > 0)
+		os << ", references " << report.primitives << " (+" << report.duplicates << ")";
+	os << ", max depth " << report.max_depth
+	   << ", SAH cost " << report.sah_cost
+	   << ", memory " << report.memory / 1024 << " KB\n";
+	return os;
+}
+
+
+// references beyond copies per distinct primitive, only SBVH builds duplicate references
+size_t duplicate_references(const std::vector<shared_ptr<IIntersect>>& references, const size_t copies = 1)
+{
+	std::vector<const IIntersect*> objects(references.size());
+	for (size_t i = 0; i < references.size(); ++i)
+		objects[i] = references[i].get();
+	std::sort(objects.begin(), objects.end());
+	const auto distinct = static_cast<size_t>(std::unique(objects.begin(), objects.end()) - objects.begin());
+	return references.size() - copies * distinct;
+}
+
+
 class BVH_Node : public IIntersect
 {
 public:
 	BVH_Node() {}
 
-	BVH_Node(const IntersectList& ilist, double time0, double time1) :
-		BVH_Node(ilist.objects, 0, ilist.objects.size(), time0, time1) {}
+	BVH_Node(const IntersectList& ilist, real time0, real time1, const BVHBuildOption& option = BVHBuildOption()) :
+		BVH_Node(ilist.objects, 0, ilist.objects.size(), time0, time1, option) {}
 
 	BVH_Node(const std::vector<shared_ptr<IIntersect>>& src_objects,
-		size_t start, size_t end, double time0, double time1);
+		size_t start, size_t end, real time0, real time1, const BVHBuildOption& option = BVHBuildOption());
+
+	virtual bool closest_hit(const Ray& ray, real t_min, real t_max, HitInfo& hit) const override;
+	virtual bool occluded(const Ray& ray, real t_min, real t_max) const override;
+	virtual bool bounding_box(real time0, real time1, AABB& output_box) const override;
+	virtual int instance_depth() const override {
+		return is_leaf() ? nested_instance_depth(objects) : std::max(left->instance_depth(), right->instance_depth());
+	}
 
-	virtual bool intersect(const Ray& ray, double t_min, double t_max, IntersectRecord& irc) const override;
-	virtual bool bounding_box(double time0, double time1, AABB& output_box) const override;
+	bool is_leaf() const { return left == nullptr; }
+	BVHCostReport cost_report(const BVHBuildOption& option = BVHBuildOption()) const;
+	// primitives of all leaves of the subtree in depth-first order
+	void collect_objects(std::vector<shared_ptr<IIntersect>>& output) const;
 
 public:
-	shared_ptr<IIntersect> left;
-	shared_ptr<IIntersect> right;
+	// deeper ranges end in one leaf - bounds the traversal stacks of the compiled hierarchies (bvh/flatbvh.hpp)
+	static constexpr size_t max_depth = 64;
+	// compiled leaves count primitives in 16 bits, a longer range is split in halves below its node:
+	// UINT16_MAX * 2^17 > UINT32_MAX, the traversal stacks have room for these levels
+	static constexpr size_t leaf_split_depth = 17;
+
+	shared_ptr<BVH_Node> left;
+	shared_ptr<BVH_Node> right;
+	std::vector<shared_ptr<IIntersect>> objects; // primitives of leaf node
 	AABB box;
+	int axis = 0; // split axis of interior node
+
+private:
+	static constexpr size_t max_sah_bins = 64;
+
+	// cached bounds of a primitive, entries are partitioned in place during the build
+	struct BuildEntry
+	{
+		AABB box;
+		point3 centroid;
+		size_t index; // index of the object in the source list
+	};
+
+	struct SAHBin
+	{
+		AABB box;
+		size_t count = 0;
+	};
+
+	// best binned SAH plane, separate from build() - bins do not stay on the stack during recursion
+	struct SAHSplit
+	{
+		int axis = -1; // -1 - no plane separates the centroids
+		size_t bin = 0; // last bin on the left side
+		size_t bin_count = 0;
+		real origin = 0.0;
+		real scale = 0.0;
+		real cost = infinity;
+
+		size_t bin_index(const point3& centroid) const {
+			auto b = static_cast<size_t>((centroid[axis] - origin) * scale);
+			return b < bin_count ? b : bin_count - 1;
+		}
+	};
+
+	struct BuildContext
+	{
+		BuildContext(const std::vector<shared_ptr<IIntersect>>& objs, const BVHBuildOption& opt) : objects(objs), option(opt) {}
+
+		const std::vector<shared_ptr<IIntersect>>& objects;
+		const BVHBuildOption& option;
+		std::vector<BuildEntry> entries;
+#ifdef _USE_THREAD
+		ThreadPool* pool = nullptr;
+		std::mutex tasks_mutex;
+		std::vector<std::future<void>> tasks;
+#endif
+	};
+
+	void build(BuildContext& context, size_t start, size_t end, const size_t depth);
+	SAHSplit find_split(const BuildContext& context, size_t start, size_t end, const point3& centroid_min, const point3& centroid_max) const;
+	void build_child(BuildContext& context, shared_ptr<BVH_Node>& child, size_t start, size_t end, const size_t depth);
+	void make_leaf(const BuildContext& context, size_t start, size_t end);
+	void collect_cost(BVHCostReport& report, const BVHBuildOption& option, const real root_area, const size_t depth) const;
 };
 
-bool BVH_Node::intersect(const Ray& ray, double t_min, double t_max, IntersectRecord& irc) const
+bool BVH_Node::closest_hit(const Ray& ray, real t_min, real t_max, HitInfo& hit) const
 {
 	if (!box.intersect(ray, t_min, t_max))
 		return false;
-	bool intersect_left = left->intersect(ray, t_min, t_max, irc);
-	bool intersect_right = right->intersect(ray, t_min, intersect_left ? irc.t : t_max, irc);
 
-	return intersect_left || intersect_right;
-}
-
-bool BVH_Node::bounding_box(double time0, double time1, AABB& output_box) const
-{
-	output_box = box;
-	return true;
-}
+	if (is_leaf()) {
+		bool is_intersect = false;
+		for (const auto& object : objects) {
+			if (object->closest_hit(ray, t_min, t_max, hit)) {
+				is_intersect = true;
+				t_max = hit.t;
+			}
+		}
+		return is_intersect;
+	}
 
-inline bool box_compare(const shared_ptr<IIntersect> a, const shared_ptr<IIntersect> b, int axis)
-{
-	AABB box_a;
-	AABB box_b;
-	if (!a->bounding_box(0, 0, box_a) || !b->bounding_box(0, 0, box_b))
-		assert(false && "No bounding box in BVH_Node constructor.\n");
+	bool intersect_left = left->closest_hit(ray, t_min, t_max, hit);
+	bool intersect_right = right->closest_hit(ray, t_min, intersect_left ? hit.t : t_max, hit);
 
-	return box_a.min()[axis] < box_b.min()[axis];
+	return intersect_left || intersect_right;
 }
 
+bool BVH_Node::occluded(const Ray& ray, real t_min, real t_max) const
+{
+	if (!box.intersect(ray, t_min, t_max))
+		return false;
 
-bool box_x_compare(const shared_ptr<IIntersect> a, const shared_ptr<IIntersect> b) {
-	return box_compare(a, b, 0);
-}
+	if (is_leaf()) {
+		for (const auto& object : objects) {
+			if (object->occluded(ray, t_min, t_max))
+				return true;
+		}
+		return false;
+	}
 
-bool box_y_compare(const shared_ptr<IIntersect> a, const shared_ptr<IIntersect> b) {
-	return box_compare(a, b, 1);
+	return left->occluded(ray, t_min, t_max) || right->occluded(ray, t_min, t_max);
 }
 
-bool box_z_compare(const shared_ptr<IIntersect> a, const shared_ptr<IIntersect> b) {
-	return box_compare(a, b, 2);
+bool BVH_Node::bounding_box(real time0, real time1, AABB& output_box) const
+{
+	output_box = box;
+	return true;
 }
 
 
-
 BVH_Node::BVH_Node(const std::vector<shared_ptr<IIntersect>>& src_objects,
-					size_t start, size_t end, double time0, double time1)
+					size_t start, size_t end, real time0, real time1, const BVHBuildOption& option)
 {
-	// Create a modifiable array of the source scene objects:
-	auto objects = src_objects;
-	int axis = random_int(0, 2); // choose random axis
-	auto comparator = (axis == 0) ? box_x_compare
-					: (axis == 1) ? box_y_compare
-								  : box_z_compare;
-	size_t object_span = end - start;
-
-	
-	if (object_span == 1) {
-		// if only one object on the scene - copy them to subtree
-		left = right = objects[start];
-	}
-	else if (object_span == 2) {
-		if (comparator(objects[start], objects[start + 1])) {
-			left = objects[start];
-			right = objects[start + 1];
+	assert(end > start && "Empty object list in BVH_Node constructor.\n");
+	assert(option.sah_bins <= max_sah_bins);
+
+	BuildContext context(src_objects, option);
+	context.entries.resize(end - start);
+
+	// bounding boxes and centroids are evaluated once, the build works on this cache only
+	auto compute_entries = [&](size_t first, size_t last) {
+		for (size_t i = first; i < last; ++i) {
+			auto& entry = context.entries[i - start];
+			entry.index = i;
+			if (!src_objects[i]->bounding_box(time0, time1, entry.box))
+				assert(false && "No bounding box in BVH_Node constructor.\n");
+			entry.centroid = real(0.5) * (entry.box.min() + entry.box.max());
 		}
-		else {
-			left = objects[start + 1];
-			right = objects[start];
+	};
+
+#ifdef _USE_THREAD
+	const size_t object_span = end - start;
+	if (object_span >= option.parallel_min_span) {
+		size_t thread_num = option.build_threads > 0 ? option.build_threads : std::thread::hardware_concurrency();
+		thread_num = std::max<size_t>(thread_num, 1);
+		ThreadPool pool(thread_num);
+		context.pool = &pool;
+
+		const size_t chunk = (object_span + thread_num - 1) / thread_num;
+		for (size_t first = start; first < end; first += chunk)
+			context.tasks.push_back(pool.enqueue(compute_entries, first, std::min(first + chunk, end)));
+		for (auto& task : context.tasks)
+			task.get();
+		context.tasks.clear();
+
+		build(context, 0, object_span, 1);
+
+		// subtree tasks enqueue tasks of their own subtrees - wait until none is left
+		while (true) {
+			std::future<void> task;
+			{
+				std::lock_guard<std::mutex> lock(context.tasks_mutex);
+				if (context.tasks.empty())
+					break;
+				task = std::move(context.tasks.back());
+				context.tasks.pop_back();
+			}
+			task.get();
 		}
+		return;
 	}
-	else {
-		std::sort(objects.begin() + start, objects.begin() + end, comparator);
-		auto mid = start + (object_span >> 1);
-		left = make_shared<BVH_Node>(objects, start, mid, time0, time1);
-		right = make_shared<BVH_Node>(objects, mid, end, time0, time1);
-	}
+#endif
 
-	AABB box_left, box_right;
-	if (!left->bounding_box(time0, time1, box_left) || !right->bounding_box(time0, time1, box_right))
-		assert(false && "No bounding box in BVH_Node constructor.\n");
-
-	box = surrounding_box(box_left, box_right);
+	compute_entries(start, end);
+	build(context, 0, context.entries.size(), 1);
 }
 
 
-
-
-
-/* ============================================== */
-//               Transformation
-class Translate : public IIntersect
+void BVH_Node::build(BuildContext& context, size_t start, size_t end, const size_t depth)
 {
-public:
-	Translate(shared_ptr<IIntersect> i_p, const vec3& displacement) : i_ptr(i_p), offset(displacement) {}
-
-	virtual bool intersect(const Ray& ray, double t_min, double t_max, IntersectRecord& ir) const override;
-	virtual bool bounding_box(double time0, double time1, AABB& output_box) const override {
-		if (!i_ptr->bounding_box(time0, time1, output_box))
-			return false;
+	auto& entries = context.entries;
+	const auto& option = context.option;
+	const size_t object_span = end - start;
+
+	box = entries[start].box;
+	point3 centroid_min = entries[start].centroid;
+	point3 centroid_max = entries[start].centroid;
+	for (size_t i = start + 1; i < end; ++i) {
+		box = surrounding_box(box, entries[i].box);
+		centroid_min = glm::min(centroid_min, entries[i].centroid);
+		centroid_max = glm::max(centroid_max, entries[i].centroid);
+	}
 
-		output_box = AABB(output_box.min() + offset, output_box.max() + offset);
-		return true;
+	if (object_span == 1 || depth >= max_depth) {
+		make_leaf(context, start, end);
+		return;
 	}
 
-public:
-	shared_ptr<IIntersect> i_ptr;
-	vec3 offset;
-};
+	SAHSplit split = find_split(context, start, end, centroid_min, centroid_max);
 
-bool Translate::intersect(const Ray& ray, double t_min, double t_max, IntersectRecord& irc) const
-{
-	Ray moved_ray(ray.origin() - offset, ray.direction(), ray.time());
-	if (!i_ptr->intersect(moved_ray, t_min, t_max, irc))
-		return false;
+	const real leaf_cost = option.intersect_cost * object_span;
+	if (object_span <= option.max_leaf_size && (split.axis < 0 || split.cost >= leaf_cost)) {
+		make_leaf(context, start, end);
+		return;
+	}
 
-	irc.p += offset;
-	irc.set_face_normal(moved_ray, irc.normal);
-	return true;
-}
+	size_t mid = start + (object_span >> 1);
+	if (split.axis >= 0) {
+		axis = split.axis;
+		auto it = std::partition(entries.begin() + start, entries.begin() + end,
+			[&](const BuildEntry& entry) { return split.bin_index(entry.centroid) <= split.bin; });
+		mid = static_cast<size_t>(it - entries.begin());
+	}
+	else {
+		// all centroids coincide - no plane separates them, split the list in halves
+		auto extent = box.max() - box.min();
+		axis = (extent.x > extent.y && extent.x > extent.z) ? 0 : (extent.y > extent.z ? 1 : 2);
+	}
 
+	build_child(context, left, start, mid, depth + 1);
+	build_child(context, right, mid, end, depth + 1);
+}
 
 
-class Rotate : public IIntersect
+/*
+	SAH cost of a split into subsets L and R:
+	C = C_trav + C_isect * (S(L) * N(L) + S(R) * N(R)) / S(node)
+	candidate planes are the boundaries of equal-width centroid bins, all three axes are binned in one pass
+*/
+BVH_Node::SAHSplit BVH_Node::find_split(const BuildContext& context, size_t start, size_t end,
+										const point3& centroid_min, const point3& centroid_max) const
 {
-public:
-	Rotate(shared_ptr<IIntersect> i_p, const vec3& axis_rot, const double angle);
+	const auto& entries = context.entries;
+	const auto& option = context.option;
+	const size_t object_span = end - start;
+	const size_t bin_count = std::min(std::max<size_t>(option.sah_bins, 2), max_sah_bins);
+	const real node_area = box.surface_area();
+	const real inv_area = node_area > 0.0 ? 1.0 / node_area : 1.0;
+
+	SAHSplit splits[3];
+	for (int a = 0; a < 3; ++a) { // xyz
+		auto extent = centroid_max[a] - centroid_min[a];
+		splits[a].axis = a;
+		splits[a].bin_count = bin_count;
+		splits[a].origin = centroid_min[a];
+		splits[a].scale = extent > 0.0 ? bin_count / extent : 0.0;
+	}
 
-	virtual bool intersect(const Ray& ray, double t_min, double t_max, IntersectRecord& ir) const override;
-	virtual bool bounding_box(double time0, double time1, AABB& output_box) const override {
-		output_box = bbox;
-		return hasbox;
+	// only bin_count bins per axis are initialized, node count is large for big scenes
+	std::vector<SAHBin> bin_storage(3 * bin_count);
+	SAHBin* bins[3] = { bin_storage.data(), bin_storage.data() + bin_count, bin_storage.data() + 2 * bin_count };
+	for (size_t i = start; i < end; ++i) {
+		for (int a = 0; a < 3; ++a) {
+			auto& bin = bins[a][splits[a].bin_index(entries[i].centroid)];
+			bin.box = bin.count == 0 ? entries[i].box : surrounding_box(bin.box, entries[i].box);
+			bin.count += 1;
+		}
 	}
-public:
-	shared_ptr<IIntersect> i_ptr;
-	vec3 axis;
-	double sin_theta;
-	double cos_theta;
-	bool hasbox;
-	AABB bbox;
-};
 
+	SAHSplit best;
+	std::array<real, max_sah_bins> right_cost;
+	for (int a = 0; a < 3; ++a) {
+		if (splits[a].scale <= 0.0)
+			continue;
+
+		// sweep from the right: right_cost[b] - area-weighted count of bins [b, bin_count)
+		AABB acc_box;
+		size_t acc_count = 0;
+		for (size_t b = bin_count - 1; b > 0; --b) {
+			if (bins[a][b].count > 0) {
+				acc_box = acc_count == 0 ? bins[a][b].box : surrounding_box(acc_box, bins[a][b].box);
+				acc_count += bins[a][b].count;
+			}
+			right_cost[b] = acc_count > 0 ? acc_box.surface_area() * acc_count : 0.0;
+		}
 
-Rotate::Rotate(shared_ptr<IIntersect> i_p, const vec3& axis_rot, const double angle) : i_ptr(i_p), axis(glm::normalize(axis_rot))
-{
-	auto rad = glm::radians(angle);
-	sin_theta = glm::sin(rad);
-	cos_theta = glm::cos(rad);
-	hasbox = i_ptr->bounding_box(0, 1, bbox);
-
-	point3 min(infinity, infinity, infinity);
-	point3 max(-infinity, -infinity, -infinity);
-
-	for (auto i = 0; i < 2; i++) {
-		for (auto j = 0; j < 2; j++) {
-			for (auto k = 0; k < 2; k++) {
-				auto x = i * bbox.max().x + (1 - i) * bbox.min().x;
-				auto y = j * bbox.max().y + (1 - j) * bbox.min().y;
-				auto z = k * bbox.max().z + (1 - k) * bbox.min().z;
-				
-				vec3 tester;
-
-				if (axis.x >= 1) {
-					auto newy = cos_theta * y - sin_theta * z;
-					auto newz = sin_theta * y + cos_theta * z;
-					tester = vec3(x, newy, newz);
-				}
-				else if (axis.y >= 1) {
-					auto newx = cos_theta * x + sin_theta * z;
-					auto newz = -sin_theta * x + cos_theta * z;
-					tester = vec3(newx, y, newz);
-				}
-				else {
-					auto newx = cos_theta * x - sin_theta * y;
-					auto newy = sin_theta * x + cos_theta * y;
-					tester = vec3(newx, newy, z);
-				}
-
-				for (int c = 0; c < 3; c++) {
-					min[c] = fmin(min[c], tester[c]);
-					max[c] = fmax(max[c], tester[c]);
-				}
+		// sweep from the left and evaluate the plane between bins b and b + 1
+		acc_count = 0;
+		for (size_t b = 0; b + 1 < bin_count; ++b) {
+			if (bins[a][b].count > 0) {
+				acc_box = acc_count == 0 ? bins[a][b].box : surrounding_box(acc_box, bins[a][b].box);
+				acc_count += bins[a][b].count;
+			}
+			if (acc_count == 0 || acc_count == object_span)
+				continue;
+
+			auto cost = option.traversal_cost +
+				option.intersect_cost * (acc_box.surface_area() * acc_count + right_cost[b + 1]) * inv_area;
+			if (cost < best.cost) {
+				best = splits[a];
+				best.cost = cost;
+				best.bin = b;
 			}
 		}
 	}
 
-	bbox = AABB(min, max);
+	return best;
 }
 
 
-bool Rotate::intersect(const Ray& ray, double t_min, double t_max, IntersectRecord& irc) const
+void BVH_Node::build_child(BuildContext& context, shared_ptr<BVH_Node>& child, size_t start, size_t end, const size_t depth)
 {
-	auto orig = ray.origin();
-	auto dir = ray.direction();
-
-	/* https://github.com/RayTracing/raytracing.github.io/issues/544 */
-	if (axis.x >= 1) {
-		orig[1] = cos_theta * ray.origin()[1] + sin_theta * ray.origin()[2];
-		orig[2] = -sin_theta * ray.origin()[1] + cos_theta * ray.origin()[2];
-		dir[1] = cos_theta * ray.direction()[1] + sin_theta * ray.direction()[2];
-		dir[2] = -sin_theta * ray.direction()[1] + cos_theta * ray.direction()[2];
+	child = make_shared<BVH_Node>();
+#ifdef _USE_THREAD
+	// large subtrees are built by the thread pool, ranges of entries of subtrees do not overlap
+	if (context.pool != nullptr && end - start >= context.option.parallel_min_span) {
+		BVH_Node* node = child.get();
+		auto task = context.pool->enqueue([node, &context, start, end, depth]() { node->build(context, start, end, depth); });
+		std::lock_guard<std::mutex> lock(context.tasks_mutex);
+		context.tasks.push_back(std::move(task));
+		return;
 	}
-	else if (axis.y >= 1) {
-		orig[0] = cos_theta * ray.origin()[0] - sin_theta * ray.origin()[2];
-		orig[2] = sin_theta * ray.origin()[0] + cos_theta * ray.origin()[2];
-		dir[0] = cos_theta * ray.direction()[0] - sin_theta * ray.direction()[2];
-		dir[2] = sin_theta * ray.direction()[0] + cos_theta * ray.direction()[2];
-	}
-	else {
-		orig[0] = cos_theta * ray.origin()[0] + sin_theta * ray.origin()[1];
-		orig[1] = -sin_theta * ray.origin()[0] + cos_theta * ray.origin()[1];
-		dir[0] = cos_theta * ray.direction()[0] + sin_theta * ray.direction()[1];
-		dir[1] = -sin_theta * ray.direction()[0] + cos_theta * ray.direction()[1];
-	}
-
-	Ray r_rot(orig, dir, ray.time());
+#endif
+	child->build(context, start, end, depth);
+}
 
-	if (!i_ptr->intersect(r_rot, t_min, t_max, irc))
-		return false;
 
-	auto p = irc.p;
-	auto normal = irc.normal;
+void BVH_Node::make_leaf(const BuildContext& context, size_t start, size_t end)
+{
+	objects.reserve(end - start);
+	for (size_t i = start; i < end; ++i)
+		objects.push_back(context.objects[context.entries[i].index]);
+}
 
 
-	if (axis.x >= 1) {
-		p[1] = cos_theta * irc.p[1] - sin_theta * irc.p[2];
-		p[2] = sin_theta * irc.p[1] + cos_theta * irc.p[2];
-		normal[1] = cos_theta * irc.normal[1] - sin_theta * irc.normal[2];
-		normal[2] = sin_theta * irc.normal[1] + cos_theta * irc.normal[2];
-	}
-	else if (axis.y >= 1) {
-		p[0] = cos_theta * irc.p[0] + sin_theta * irc.p[2];
-		p[2] = -sin_theta * irc.p[0] + cos_theta * irc.p[2];
-		normal[0] = cos_theta * irc.normal[0] + sin_theta * irc.normal[2];
-		normal[2] = -sin_theta * irc.normal[0] + cos_theta * irc.normal[2];
+void BVH_Node::collect_objects(std::vector<shared_ptr<IIntersect>>& output) const
+{
+	if (is_leaf()) {
+		output.insert(output.end(), objects.begin(), objects.end());
+		return;
 	}
-	else {
-		p[0] = cos_theta * irc.p[0] - sin_theta * irc.p[1];
-		p[1] = sin_theta * irc.p[0] + cos_theta * irc.p[1];
-		normal[0] = cos_theta * irc.normal[0] - sin_theta * irc.normal[1];
-		normal[1] = sin_theta * irc.normal[0] + cos_theta * irc.normal[1];
+	left->collect_objects(output);
+	right->collect_objects(output);
+}
+
+
+BVHCostReport BVH_Node::cost_report(const BVHBuildOption& option) const
+{
+	BVHCostReport report;
+	collect_cost(report, option, box.surface_area(), 1);
+	if (option.builder == BVH_BUILDER_SBVH) {
+		std::vector<shared_ptr<IIntersect>> references;
+		references.reserve(report.primitives);
+		collect_objects(references);
+		report.duplicates = duplicate_references(references);
 	}
+	return report;
+}
 
-	irc.p = p;
-	irc.set_face_normal(r_rot, normal);
 
-	return true;
+void BVH_Node::collect_cost(BVHCostReport& report, const BVHBuildOption& option, const real root_area, const size_t depth) const
+{
+	auto area_ratio = root_area > 0.0 ? box.surface_area() / root_area : 1.0;
+	report.max_depth = std::max(report.max_depth, depth);
+	report.memory += sizeof(BVH_Node) + objects.capacity() * sizeof(shared_ptr<IIntersect>);
+
+	if (is_leaf()) {
+		report.leaf_nodes += 1;
+		report.primitives += objects.size();
+		report.sah_cost += area_ratio * option.intersect_cost * objects.size();
+		return;
+	}
+
+	report.interior_nodes += 1;
+	report.sah_cost += area_ratio * option.traversal_cost;
+	left->collect_cost(report, option, root_area, depth + 1);
+	right->collect_cost(report, option, root_area, depth + 1);
 }
 
 
+
+
 using intersect_record = IntersectRecord;
 using IntersectionList = IntersectList;
 //using World = IntersectList;
\ No newline at end of file
@@ -4,21 +4,21 @@
 #include <Material.hpp>
 
 
-class DiffuseLight : public Material
+class DiffuseLight final : public Material
 {
 public:
-	DiffuseLight(shared_ptr<Texture> tex) : emit(tex) {}
-	DiffuseLight(const color c) : emit(make_shared<SolidColor>(c)) {}
+	DiffuseLight(shared_ptr<Texture> tex) : Material(MATERIAL_DIFFUSE_LIGHT), emit(tex) {}
+	DiffuseLight(const color c) : Material(MATERIAL_DIFFUSE_LIGHT), emit(c) {}
 
 	virtual bool scatter(const Ray& ray, const IntersectRecord& irc, color& attenuation, Ray& scattered) const override
 	{
 		return false;
 	}
 	
-	virtual color emitted(double u, double v, const point3& p) const override {
-		return emit->value(u, v, p);
+	virtual color emitted(real u, real v, const point3& p) const override {
+		return emit.value(u, v, p);
 	}
 public:
-	shared_ptr<Texture> emit;
+	TextureRef emit;
 };
 
@@ -8,31 +8,56 @@ struct IntersectRecord;
 #define whitecolor color(1.0, 1.0, 1.0)
 
 
+/*
+	Built-in materials are a closed set tagged by material_type and evaluated by material_scatter
+	and material_emitted (shading.hpp) with a switch: their classes are final, so the calls are direct.
+	User-defined materials keep MATERIAL_USER and are evaluated by the virtual functions.
+*/
+enum material_type {
+	MATERIAL_USER = 0,
+	MATERIAL_LAMBERTIAN,
+	MATERIAL_METAL,
+	MATERIAL_DIELECTRIC,
+	MATERIAL_ISOTROPIC,
+	MATERIAL_DIFFUSE_LIGHT
+};
+
+
 class Material
 {
 private:
 	/* use default value */
 public:
+	Material() : type(MATERIAL_USER) {}
+private:
+	// only the built-in classes pass their tag - material_scatter casts the object by it
 #pragma warning(push)
 #pragma warning(disable : 26812)
-	Material() {}
+	Material(const material_type t) : type(t) {}
 #pragma warning(pop)
+	friend class Lambertian;
+	friend class Metal;
+	friend class Dielectric;
+	friend class Isotropic;
+	friend class DiffuseLight;
 public:
-	virtual color emitted(double u, double v, const point3& p) const { return blackcolor; }
+	virtual color emitted(real u, real v, const point3& p) const { return blackcolor; }
 	virtual bool scatter(const Ray& ray, const IntersectRecord& irc, color& attenuation, Ray& scattered) const = 0;
+public:
+	const material_type type;
 };
 
 
 
 // diffuse case
-class Lambertian : public Material
+class Lambertian final : public Material
 {
 public:
-	shared_ptr<Texture> albedo;
+	TextureRef albedo;
 public:
 
-	Lambertian(const color& c) : albedo(make_shared<SolidColor>(c)) {}
-	Lambertian(shared_ptr<Texture> tex) : albedo(tex) {}
+	Lambertian(const color& c) : Material(MATERIAL_LAMBERTIAN), albedo(c) {}
+	Lambertian(shared_ptr<Texture> tex) : Material(MATERIAL_LAMBERTIAN), albedo(tex) {}
 
 	virtual bool scatter(const Ray& ray, const IntersectRecord& irc, color& attenuation, Ray& scattered) const override
 	{
@@ -43,20 +68,20 @@ public:
 			scattered_dir = irc.normal;
 
 		scattered = Ray(irc.p, scattered_dir, ray.time());
-		attenuation = albedo->value(irc.uv.x, irc.uv.y, irc.p);
+		attenuation = albedo.value(irc.uv.x, irc.uv.y, irc.p, irc.footprint);
 		return true;
 	}
 };
 
 
 // reflection case
-class Metal : public Material
+class Metal final : public Material
 {
 public:
 	color albedo;
-	double fuzzier;
+	real fuzzier;
 public:
-	Metal(const color& c, const double fuzz) : albedo(c), fuzzier(fuzz < 1.0 ? fuzz : 1.0) {}
+	Metal(const color& c, const real fuzz) : Material(MATERIAL_METAL), albedo(c), fuzzier(fuzz < 1.0 ? fuzz : 1.0) {}
 	virtual bool scatter(const Ray& ray, const IntersectRecord& irc, color& attenuation, Ray& scattered) const override
 	{
 		vec3 reflected = glm::reflect(glm::normalize(ray.direction()), irc.normal);
@@ -69,21 +94,21 @@ public:
 
 
 // refraction case
-class Dielectric : public Material
+class Dielectric final : public Material
 {
 public:
-	double ir; // Index of Refraction
+	real ir; // Index of Refraction
 public:
-	Dielectric(const double index_of_refraction) : ir(index_of_refraction) {}
+	Dielectric(const real index_of_refraction) : Material(MATERIAL_DIELECTRIC), ir(index_of_refraction) {}
 
 	virtual bool scatter(const Ray& ray, const IntersectRecord& irc, color& attenuation, Ray& scattered) const override
 	{
 		attenuation = color(1.0, 1.0, 1.0);
-		double refraction_ratio = irc.front_face ? (1.0 / ir) : ir;
+		real refraction_ratio = irc.front_face ? (1.0 / ir) : ir;
 		vec3 unit_dir = glm::normalize(ray.direction());
 
-		double cos_theta = fmin(glm::dot(-unit_dir, irc.normal), 1.0);
-		double sin_theta = sqrt(1.0 - cos_theta * cos_theta);
+		real cos_theta = fmin(glm::dot(-unit_dir, irc.normal), 1.0);
+		real sin_theta = sqrt(1.0 - cos_theta * cos_theta);
 
 		bool is_reflect = (refraction_ratio * sin_theta) > 1.0;
 		vec3 dir;
@@ -97,7 +122,7 @@ public:
 		return true;
 	}
 private:
-	static inline double reflectance(const double cosine, const double ref_idx) {
+	static inline real reflectance(const real cosine, const real ref_idx) {
 		// Use Schlick's approximation for reflectance.
 		auto r0 = (1.0 - ref_idx) / (1.0 + ref_idx);
 		r0 = r0 * r0;
@@ -106,16 +131,16 @@ private:
 };
 
 
-class Isotropic : public Material
+class Isotropic final : public Material
 {
 public:
-	Isotropic(const color c) : albedo(make_shared<SolidColor>(c)) {}
-	Isotropic(shared_ptr<Texture> a) : albedo(a) {}
+	Isotropic(const color c) : Material(MATERIAL_ISOTROPIC), albedo(c) {}
+	Isotropic(shared_ptr<Texture> a) : Material(MATERIAL_ISOTROPIC), albedo(a) {}
 	bool scatter(const Ray& ray, const IntersectRecord& irc, color& attenuation, Ray& scattered) const override {
 		scattered = Ray(irc.p, random_unit_in_sphere(), ray.time());
-		attenuation = albedo->value(irc.uv.x, irc.uv.y, irc.p);
+		attenuation = albedo.value(irc.uv.x, irc.uv.y, irc.p, irc.footprint);
 		return true;
 	}
 public:
-	shared_ptr<Texture> albedo;
+	TextureRef albedo;
 };
\ No newline at end of file
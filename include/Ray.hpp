@@ -1,5 +1,9 @@
 #pragma once
 #include <types.hpp>
+#include <cstdint>
+#include <cstring>
+#include <cmath>
+#include <type_traits>
 
 
 class Ray
@@ -7,14 +11,55 @@ class Ray
 private:
 	point3 orig;
 	vec3 dir;
-	double tm;
+	real tm;
+	/* ray cone - width at the origin and spread angle, footprint of the ray for texture filtering */
+	real cone_w = 0.0;
+	real cone_a = 0.0;
 public:
 	Ray() : orig(0.0), dir(0.0), tm(0.0) {}
-	Ray(const point3& orig_, const vec3& dir_, const double time=0.0) : orig(orig_), dir(dir_), tm(time) {}
+	Ray(const point3& orig_, const vec3& dir_, const real time=0.0) : orig(orig_), dir(dir_), tm(time) {}
 	point3 origin() const { return orig; }
 	vec3 direction() const { return dir; }
-	double time() const { return tm; }
-	point3 at(double t) const { return orig + t * dir; }
+	real time() const { return tm; }
+	point3 at(real t) const { return orig + t * dir; }
 	void setorigin(const point3& orig_) noexcept { orig = orig_; }
 	void setdir(const vec3& dir_) noexcept { dir = dir_; }
-};
\ No newline at end of file
+
+	real cone_width() const { return cone_w; }
+	real cone_spread() const { return cone_a; }
+	// width of the cone at t, the direction is not normalized
+	real cone_width_at(real t) const { return cone_w + cone_a * t * glm::length(dir); }
+	void setcone(const real width, const real spread) noexcept { cone_w = width; cone_a = spread; }
+};
+
+
+/*
+	Origin of a ray which leaves a surface at p, n is the geometric normal on the side of the new ray.
+	The point is moved along n by a number of ulps (integer steps of the float representation),
+	near zero, where ulps are too small, by a fixed step.
+	Carsten Wachter, Nikolaus Binder, "A Fast and Robust Method for Avoiding Self-Intersection", Ray Tracing Gems, 2019
+*/
+
+// the offset covers the error of p, ray_t_min the error of shapes far from the origin of the world
+// (the ground sphere of radius 1000 is exact to the ulp of 1000 only) - much less than the former 0.001
+constexpr real ray_t_min = std::is_same<real, float>::value ? real(1e-4) : real(1e-6);
+
+inline point3 offset_ray_origin(const point3& p, const vec3& n)
+{
+	using bits_type = std::conditional<sizeof(real) == sizeof(int32_t), int32_t, int64_t>::type;
+	constexpr real origin = 1.0 / 32.0;
+	constexpr real float_scale = 1.0 / 65536.0;
+	constexpr real int_scale = 256.0;
+
+	point3 moved;
+	for (int i = 0; i < 3; ++i) {
+		const auto of_i = static_cast<bits_type>(int_scale * n[i]);
+		bits_type bits;
+		std::memcpy(&bits, &p[i], sizeof(real));
+		bits += (p[i] < 0) ? -of_i : of_i;
+		real p_i;
+		std::memcpy(&p_i, &bits, sizeof(real));
+		moved[i] = std::fabs(p[i]) < origin ? p[i] + float_scale * n[i] : p_i;
+	}
+	return moved;
+}
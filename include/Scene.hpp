@@ -3,12 +3,19 @@
 #include <utility.hpp>
 #include <sphere.hpp>
 #include <triangle.hpp>
+#include <mesh.hpp>
+#include <sphereset.hpp>
 #include <box.hpp>
 #include <volumetric.hpp>
+#include <instance.hpp>
+#include <bvh/accel.hpp>
+#include <bvh/bvhstats.hpp>
 #include <option.hpp>
 #include <Material.hpp>
 #include <Light.hpp>
+#include <shading.hpp>
 #include <Image.hpp>
+#include <wavefront.hpp>
 #ifdef _USE_THREAD
 #include <ThreadPool.h>
 #endif
@@ -29,7 +36,11 @@ public:
 
 private:
 	void draw_pixel(const IntersectList& world, const lint i, const lint j, color& pixel);
+	// packet mode: pixels of columns [i_begin, i_end) by tiles, first hits of a tile are traced as one packet
+	void draw_tiles(Image& image, const IntersectList& world, const lint i_begin, const lint i_end);
+	void draw_tile(Image& image, const IntersectList& world, const lint i0, const lint j0, const lint i1, const lint j1);
 	color ray_color(const Ray& ray, const IntersectList& world, lint depth);
+	color shade(const Ray& ray, const IntersectRecord& irc, const IntersectList& world, lint depth);
 private:
 	shared_ptr<Camera> camera;
 	shared_ptr<Screen> screen;
@@ -38,7 +49,9 @@ private:
 	lint img_height = 0;
 	lint sample_per_pixel = 0;
 	int maxdepth = 0;
-	double gammacorrection = 1.0;
+	int packet_side = 0;
+	integrator_type integrator = INTEGRATOR_RECURSIVE;
+	real gammacorrection = 1.0;
 	bool isInit = false;
 };
 
@@ -56,6 +69,9 @@ bool Scene::init(const shared_ptr<Screen>& scn, const shared_ptr<Camera>& cam, c
 	img_height = screen->screenheight;
 	sample_per_pixel = option.sample_per_pixel;
 	this->maxdepth = option.maxdepth;
+	assert(option.packet_side * option.packet_side <= static_cast<int>(RayPacket::max_size));
+	packet_side = option.packet_side;
+	integrator = option.integrator;
 	gammacorrection = scn->gammacorrection;
 	backcolor = screen->backgroundcolor;
 
@@ -68,6 +84,15 @@ void Scene::render(Image& image, const IntersectList& world)
 {
 	assert(isInit == true);
 
+	if (integrator == INTEGRATOR_WAVEFRONT) {
+		WavefrontIntegrator(*camera, backcolor, maxdepth, sample_per_pixel).render(image, world, 0, img_width, gammacorrection);
+		return;
+	}
+	if (packet_side > 0) {
+		draw_tiles(image, world, 0, img_width);
+		return;
+	}
+
 	lint base = 0;
 	color pixel{ 0 };
 	for (lint j = img_height - 1; j >= 0; --j) {
@@ -97,6 +122,49 @@ void Scene::draw_pixel(const IntersectList& world, const lint i, const lint j, c
 	AA_RGBPixel(pixel, pixel_color, sample_per_pixel, gammacorrection);
 }
 
+
+void Scene::draw_tiles(Image& image, const IntersectList& world, const lint i_begin, const lint i_end)
+{
+	for (lint j0 = 0; j0 < img_height; j0 += packet_side) {
+		for (lint i0 = i_begin; i0 < i_end; i0 += packet_side)
+			draw_tile(image, world, i0, j0, std::min(i0 + packet_side, i_end), std::min(j0 + packet_side, img_height));
+	}
+}
+
+
+void Scene::draw_tile(Image& image, const IntersectList& world, const lint i0, const lint j0, const lint i1, const lint j1)
+{
+	RayPacket packet;
+	std::array<color, RayPacket::max_size> pixel_color;
+	pixel_color.fill(color(0, 0, 0));
+
+	// first hits of a sample of all pixels are traced together, bounces diverge and are traced ray by ray
+	for (lint s = 0; s < sample_per_pixel; ++s) {
+		camera->get_ray_packet(i0, j0, i1, j1, packet);
+		packet.prepare(infinity);
+		world.intersect_packet(packet, ray_t_min);
+		IntersectRecord irc;
+		for (size_t k = 0; k < packet.size; ++k) {
+			if (!packet.hit[k]) {
+				pixel_color[k] += backcolor;
+				continue;
+			}
+			packet.hits[k].surface(packet.rays[k], irc);
+			pixel_color[k] += shade(packet.rays[k], irc, world, maxdepth);
+		}
+	}
+
+	color pixel{ 0 };
+	size_t k = 0;
+	for (lint j = j0; j < j1; ++j) {
+		for (lint i = i0; i < i1; ++i) {
+			AA_RGBPixel(pixel, pixel_color[k++], sample_per_pixel, gammacorrection);
+			image.set_color((img_height - 1 - j) * img_width + i, pixel);
+		}
+	}
+}
+
+
 color Scene::ray_color(const Ray& ray, const IntersectList& world, lint depth)
 {
 	// If we've exceeded the ray bounce limit, no more light is gathered.
@@ -104,25 +172,33 @@ color Scene::ray_color(const Ray& ray, const IntersectList& world, lint depth)
 		return backcolor;  //screen->backgroundcolor
 
 	IntersectRecord irc;
-	if (!world.intersect(ray, 0.001, infinity, irc)) 
+	if (!world.intersect(ray, ray_t_min, infinity, irc)) 
 		return backcolor;
-	
-	Ray scattered;
-	color attenuation(0.0);
-	color emitted = irc.material->emitted(irc.uv.x, irc.uv.y, irc.p);
-	if (!irc.material->scatter(ray, irc, attenuation, scattered)) 
-		return emitted;
-	
-	return emitted + attenuation * ray_color(scattered, world, depth - 1);
+
+	return shade(ray, irc, world, depth);
 
 #ifdef NO
 	vec3 unit_dir = glm::normalize(ray.direction());
-	auto t = 0.5 * (unit_dir.y + 1.0); // blend respect y position
+	auto t = real(0.5) * (unit_dir.y + 1.0); // blend respect y position
 	return (1.0 - t) * whitecolor + t * backcolor; // final background blend color
 #endif
 }
 
 
+color Scene::shade(const Ray& ray, const IntersectRecord& irc, const IntersectList& world, lint depth)
+{
+	Ray scattered;
+	color attenuation(0.0);
+	color emitted = material_emitted(*irc.material, irc.uv.x, irc.uv.y, irc.p);
+	if (!material_scatter(*irc.material, ray, irc, attenuation, scattered)) 
+		return emitted;
+	scattered.setorigin(offset_ray_origin(irc.p, glm::dot(scattered.direction(), irc.normal) < 0.0 ? -irc.normal : irc.normal));
+	scattered.setcone(ray.cone_width_at(irc.t), ray.cone_spread() + material_cone_spread(*irc.material));
+	
+	return emitted + attenuation * ray_color(scattered, world, depth - 1);
+}
+
+
 
 #ifdef _USE_THREAD
 void Scene::thread_render(Image& image, const IntersectList& world)
@@ -130,7 +206,8 @@ void Scene::thread_render(Image& image, const IntersectList& world)
 	assert(isInit == true);
 	// srand(time(NULL));
 
-	lint thread_num = std::thread::hardware_concurrency() - 1;
+	// one core or unknown concurrency (0) still renders with one thread
+	lint thread_num = std::max<lint>(static_cast<lint>(std::thread::hardware_concurrency()) - 1, 1);
 	lint total_block = img_width;
 	lint block = img_width / thread_num;
 
@@ -142,6 +219,14 @@ void Scene::thread_render(Image& image, const IntersectList& world)
 			if ((total_block - block) > 0) {
 
 				thp.enqueue([=](Image& image, const IntersectList& world) {
+					if (integrator == INTEGRATOR_WAVEFRONT) {
+						WavefrontIntegrator(*camera, backcolor, maxdepth, sample_per_pixel).render(image, world, base, base + block, gammacorrection);
+						return;
+					}
+					if (packet_side > 0) {
+						draw_tiles(image, world, base, base + block);
+						return;
+					}
 					lint offset = base;
 					color pixel{ 0 };
 					for (lint j = img_height - 1; j >= 0; --j) {
@@ -158,6 +243,14 @@ void Scene::thread_render(Image& image, const IntersectList& world)
 			else {
 
 				thp.enqueue([=](Image& image, const IntersectList& world) {
+					if (integrator == INTEGRATOR_WAVEFRONT) {
+						WavefrontIntegrator(*camera, backcolor, maxdepth, sample_per_pixel).render(image, world, base, base + total_block, gammacorrection);
+						return;
+					}
+					if (packet_side > 0) {
+						draw_tiles(image, world, base, base + total_block);
+						return;
+					}
 					lint offset = base;
 					color pixel{ 0 };
 					for (lint j = img_height - 1; j >= 0; --j) {
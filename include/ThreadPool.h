@@ -4,6 +4,7 @@
 #include <queue>
 #include <thread>
 #include <exception>
+#include <stdexcept>
 #include <vector>
 #include <atomic>
 #include <queue>
@@ -21,7 +22,7 @@ public:
 
 	explicit ThreadPool(const size_t numThreads) {
 		if (numThreads == 0)
-			throw std::exception("invalid input value");
+			throw std::invalid_argument("invalid input value");
 
 		start(numThreads);
 	}
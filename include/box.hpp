@@ -2,42 +2,163 @@
 #include <rect.hpp>
 
 
+// faces of an axis-aligned box, index = 2 * axis + (0 - min side, 1 - max side)
+enum box_face {
+	BOX_FACE_X0 = 0,
+	BOX_FACE_X1,
+	BOX_FACE_Y0,
+	BOX_FACE_Y1,
+	BOX_FACE_Z0,
+	BOX_FACE_Z1
+};
+
 
+/*
+	Axis-aligned box primitive with one material. One slab test gives the hit distance,
+	the face and the outward normal are of the slab where the ray enters the box
+	(or leaves it, if the ray starts inside).
+*/
 class Box : public IIntersect
 {
 public:
-	Box() : sides(nullptr) {}
-	Box(const point3& p0, const point3& p1, shared_ptr<Material> m_ptr);
+	Box() : box_low(0.0), box_up(0.0), mp(nullptr) {}
+	Box(const point3& p0, const point3& p1, shared_ptr<Material> m_ptr) : box_low(p0), box_up(p1), mp(m_ptr) {}
 
-	virtual bool intersect(const Ray& ray, double t_min, double t_max, IntersectRecord& ir) const override;
-	virtual bool bounding_box(double time0, double time1, AABB& output_box) const override {
+	virtual bool closest_hit(const Ray& ray, real t_min, real t_max, HitInfo& hit) const override;
+	// face of the hit is passed as prim = 2 * axis + entering
+	virtual void surface(const Ray& ray, const HitInfo& hit, IntersectRecord& ir) const override;
+	virtual bool occluded(const Ray& ray, real t_min, real t_max) const override {
+		real t;
+		int axis;
+		bool entering;
+		return slab_hit(ray, t_min, t_max, t, axis, entering);
+	}
+	virtual bool bounding_box(real time0, real time1, AABB& output_box) const override {
 		output_box = AABB(box_low, box_up);
 		return true;
 	}
 
+private:
+	bool slab_hit(const Ray& ray, real t_min, real t_max, real& t, int& axis, bool& entering) const;
+
 public:
 	point3 box_low;
 	point3 box_up;
-	shared_ptr<IntersectionList> sides;
+	shared_ptr<Material> mp;
 };
- 
-Box::Box(const point3& p0, const point3& p1, shared_ptr<Material> m_ptr) : sides(make_shared<IntersectionList>())
+
+
+bool Box::slab_hit(const Ray& ray, real t_min, real t_max, real& t, int& axis, bool& entering) const
 {
-	box_low = p0;
-	box_up = p1;
+	const auto orig = ray.origin();
+	const auto dir = ray.direction();
+
+	// entry and exit distances and the slabs they belong to
+	real t_near = -infinity;
+	real t_far = infinity;
+	int near_axis = 0;
+	int far_axis = 0;
+	for (int i = 0; i < 3; ++i) { // xyz
+		const auto inv_d = 1.0 / dir[i];
+		auto t0 = (box_low[i] - orig[i]) * inv_d;
+		auto t1 = (box_up[i] - orig[i]) * inv_d;
+		if (inv_d < 0.0)
+			std::swap(t0, t1);
+		if (t0 > t_near) {
+			t_near = t0;
+			near_axis = i;
+		}
+		if (t1 < t_far) {
+			t_far = t1;
+			far_axis = i;
+		}
+	}
+	if (t_far < t_near)
+		return false;
 
-	sides->add(make_shared<xyRect>(p0.x, p1.x, p0.y, p1.y, p1.z, m_ptr));
-	sides->add(make_shared<xyRect>(p0.x, p1.x, p0.y, p1.y, p0.z, m_ptr));
+	entering = t_near >= t_min;
+	t = entering ? t_near : t_far;
+	axis = entering ? near_axis : far_axis;
+	return t >= t_min && t <= t_max;
+}
 
-	sides->add(make_shared<xzRect>(p0.x, p1.x, p0.z, p1.z, p1.y, m_ptr));
-	sides->add(make_shared<xzRect>(p0.x, p1.x, p0.z, p1.z, p0.y, m_ptr));
 
-	sides->add(make_shared<yzRect>(p0.y, p1.y, p0.z, p1.z, p1.x, m_ptr));
-	sides->add(make_shared<yzRect>(p0.y, p1.y, p0.z, p1.z, p0.x, m_ptr));
+bool Box::closest_hit(const Ray& ray, real t_min, real t_max, HitInfo& hit) const
+{
+	real t;
+	int axis;
+	bool entering;
+	if (!slab_hit(ray, t_min, t_max, t, axis, entering))
+		return false;
+
+	hit.set(t, this, 2 * axis + (entering ? 1 : 0));
+	return true;
 }
 
 
-bool Box::intersect(const Ray& ray, double t_min, double t_max, IntersectRecord& irc) const
+void Box::surface(const Ray& ray, const HitInfo& hit, IntersectRecord& irc) const
 {
-	return sides->intersect(ray, t_min, t_max, irc);
+	const int axis = hit.prim >> 1;
+	const bool entering = hit.prim & 1;
+	const auto dir = ray.direction();
+	auto p = ray.at(hit.t);
+	// the point lies on the plane of the face exactly
+	p[axis] = std::abs(p[axis] - box_low[axis]) < std::abs(p[axis] - box_up[axis]) ? box_low[axis] : box_up[axis];
+	// rect of the face parametrizes the two other axes in xyz order
+	const int u_axis = axis == 0 ? 1 : 0;
+	const int v_axis = axis == 2 ? 1 : 2;
+	irc.uv.x = (p[u_axis] - box_low[u_axis]) / (box_up[u_axis] - box_low[u_axis]);
+	irc.uv.y = (p[v_axis] - box_low[v_axis]) / (box_up[v_axis] - box_low[v_axis]);
+	irc.uv_scale = std::sqrt((box_up[u_axis] - box_low[u_axis]) * (box_up[v_axis] - box_low[v_axis]));
+	vec3 outward_normal(0.0);
+	// the ray enters through the face turned against it and leaves through the face along it
+	outward_normal[axis] = (dir[axis] < 0.0) == entering ? 1.0 : -1.0;
+	irc.set_face_normal(ray, outward_normal);
+	irc.material = mp.get();
+	irc.p = p;
 }
+
+
+/*
+	Box of six rects, for boxes with a material per face (indexed by box_face).
+	Costs six intersections per ray - Box is preferred where one material is enough.
+*/
+class RectBox : public IIntersect
+{
+public:
+	RectBox() : sides(nullptr) {}
+	RectBox(const point3& p0, const point3& p1, const std::array<shared_ptr<Material>, 6>& face_materials);
+
+	// a hit is the hit of a side, the side evaluates the surface
+	virtual bool closest_hit(const Ray& ray, real t_min, real t_max, HitInfo& hit) const override {
+		return sides->closest_hit(ray, t_min, t_max, hit);
+	}
+	virtual bool occluded(const Ray& ray, real t_min, real t_max) const override {
+		return sides->occluded(ray, t_min, t_max);
+	}
+	virtual bool bounding_box(real time0, real time1, AABB& output_box) const override {
+		output_box = AABB(box_low, box_up);
+		return true;
+	}
+
+public:
+	point3 box_low;
+	point3 box_up;
+	shared_ptr<IntersectionList> sides;
+};
+
+RectBox::RectBox(const point3& p0, const point3& p1, const std::array<shared_ptr<Material>, 6>& face_materials) : sides(make_shared<IntersectionList>())
+{
+	box_low = p0;
+	box_up = p1;
+
+	sides->add(make_shared<xyRect>(p0.x, p1.x, p0.y, p1.y, p1.z, face_materials[BOX_FACE_Z1]));
+	sides->add(make_shared<xyRect>(p0.x, p1.x, p0.y, p1.y, p0.z, face_materials[BOX_FACE_Z0]));
+
+	sides->add(make_shared<xzRect>(p0.x, p1.x, p0.z, p1.z, p1.y, face_materials[BOX_FACE_Y1]));
+	sides->add(make_shared<xzRect>(p0.x, p1.x, p0.z, p1.z, p0.y, face_materials[BOX_FACE_Y0]));
+
+	sides->add(make_shared<yzRect>(p0.y, p1.y, p0.z, p1.z, p1.x, face_materials[BOX_FACE_X1]));
+	sides->add(make_shared<yzRect>(p0.y, p1.y, p0.z, p1.z, p0.x, face_materials[BOX_FACE_X0]));
+}
+
@@ -0,0 +1,59 @@
+#pragma once
+#include <bvh/flatbvh.hpp>
+#include <bvh/widebvh.hpp>
+#include <bvh/motionbvh.hpp>
+#include <bvh/bvhcache.hpp>
+
+/*
+	Acceleration structure factory - builds the structure selected by BVHBuildOption::accel
+	from the hierarchy of BVHBuildOption::builder
+*/
+
+shared_ptr<IIntersect> make_accel(const IntersectList& ilist, real time0, real time1, const BVHBuildOption& option = BVHBuildOption())
+{
+	if (option.accel == ACCEL_BVH_FLAT && !option.cache_dir.empty())
+		return make_cached_flat_bvh(ilist, time0, time1, option);
+	// motion BVH builds a hierarchy per time segment
+	if (option.accel == ACCEL_MOTION_BVH)
+		return make_shared<MotionBVH>(ilist, time0, time1, option);
+
+	auto root = build_bvh(ilist, time0, time1, option);
+	switch (option.accel)
+	{
+	case ACCEL_BVH_FLAT:
+		return make_shared<FlatBVH>(*root);
+	case ACCEL_BVH4:
+		return make_shared<BVH4>(*root);
+	case ACCEL_BVH8:
+		return make_shared<BVH8>(*root);
+	case ACCEL_BVH_TREE:
+	default:
+		return root;
+	}
+}
+
+
+bool accel_cost_report(const shared_ptr<IIntersect>& accel, const BVHBuildOption& option, BVHCostReport& report)
+{
+	if (auto bvh = std::dynamic_pointer_cast<BVH_Node>(accel)) {
+		report = bvh->cost_report(option);
+		return true;
+	}
+	if (auto flat = std::dynamic_pointer_cast<FlatBVH>(accel)) {
+		report = flat->cost_report(option);
+		return true;
+	}
+	if (auto bvh4 = std::dynamic_pointer_cast<BVH4>(accel)) {
+		report = bvh4->cost_report(option);
+		return true;
+	}
+	if (auto bvh8 = std::dynamic_pointer_cast<BVH8>(accel)) {
+		report = bvh8->cost_report(option);
+		return true;
+	}
+	if (auto motion = std::dynamic_pointer_cast<MotionBVH>(accel)) {
+		report = motion->cost_report(option);
+		return true;
+	}
+	return false;
+}
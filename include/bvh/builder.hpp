@@ -0,0 +1,21 @@
+#pragma once
+#include <bvh/lbvh.hpp>
+#include <bvh/sbvh.hpp>
+
+/*
+	BVH_Node hierarchy built by the builder selected in BVHBuildOption::builder
+*/
+
+shared_ptr<BVH_Node> build_bvh(const IntersectList& ilist, real time0, real time1, const BVHBuildOption& option = BVHBuildOption())
+{
+	switch (option.builder)
+	{
+	case BVH_BUILDER_LBVH:
+		return LBVHBuilder(option).build(ilist.objects, 0, ilist.objects.size(), time0, time1);
+	case BVH_BUILDER_SBVH:
+		return SBVHBuilder(option).build(ilist.objects, 0, ilist.objects.size(), time0, time1);
+	case BVH_BUILDER_SAH:
+	default:
+		return make_shared<BVH_Node>(ilist, time0, time1, option);
+	}
+}
@@ -0,0 +1,215 @@
+#pragma once
+#include <bvh/flatbvh.hpp>
+#include <fstream>
+#include <cstdio>
+#include <cstring>
+#include <typeinfo>
+#include <unordered_map>
+
+/*
+	On-disk cache of FlatBVH. File is keyed by a hash of the scene: types and bounds of the objects,
+	shutter interval and build parameters. Layout of a cache file:
+		BVHCacheHeader, LinearBVHNode[node_count] at nodes_offset, uint32_t[primitive_count] at indices_offset
+	indices are positions of the leaf primitives in the source object list.
+	SBVH hierarchies are not cached: their node bounds are clipped to the shapes of the primitives,
+	objects of equal bounds but other shapes would reuse bounds which cut them off.
+	Loading maps the file and traverses the nodes in place, only the primitive pointers are gathered.
+	Files are native-endian and are not portable between architectures.
+*/
+
+constexpr uint32_t bvh_cache_version = 2;
+
+struct BVHCacheHeader
+{
+	char magic[8];
+	uint32_t version;
+	uint32_t node_size; // sizeof(LinearBVHNode) of the writer
+	uint64_t scene_hash;
+	uint64_t node_count;
+	uint64_t primitive_count;
+	uint64_t nodes_offset;
+	uint64_t indices_offset;
+};
+
+static constexpr char bvh_cache_magic[8] = { 'R', 'T', 'B', 'V', 'H', 'C', 0, 0 };
+
+
+uint64_t bvh_scene_hash(const IntersectList& ilist, real time0, real time1, const BVHBuildOption& option)
+{
+	uint64_t hash = 0xcbf29ce484222325ull;
+	hash = hash_value(hash, bvh_cache_version);
+	hash = hash_value(hash, sizeof(LinearBVHNode));
+	hash = hash_value(hash, sizeof(real)); // float and double builds keep separate caches
+	hash = hash_value(hash, time0);
+	hash = hash_value(hash, time1);
+
+	// parameters which change the hierarchy
+	hash = hash_value(hash, static_cast<int>(option.builder));
+	hash = hash_value(hash, option.max_leaf_size);
+	hash = hash_value(hash, option.sah_bins);
+	hash = hash_value(hash, option.traversal_cost);
+	hash = hash_value(hash, option.intersect_cost);
+	hash = hash_value(hash, option.morton_bits);
+	hash = hash_value(hash, option.treelet_size);
+	hash = hash_value(hash, option.max_duplication);
+	hash = hash_value(hash, option.spatial_split_alpha);
+
+	hash = hash_value(hash, ilist.objects.size());
+	for (const auto& object : ilist.objects) {
+		const char* type_name = typeid(*object).name();
+		hash = hash_bytes(hash, type_name, std::strlen(type_name));
+		AABB box;
+		if (object->bounding_box(time0, time1, box)) {
+			const real bounds[6] = { box.min().x, box.min().y, box.min().z, box.max().x, box.max().y, box.max().z };
+			hash = hash_bytes(hash, bounds, sizeof(bounds));
+		}
+	}
+	return hash;
+}
+
+
+std::string bvh_cache_path(const std::string& cache_dir, uint64_t scene_hash)
+{
+	char name[32];
+	std::snprintf(name, sizeof(name), "bvh_%016llx.bin", static_cast<unsigned long long>(scene_hash));
+	return cache_dir + "/" + name;
+}
+
+
+bool save_bvh_cache(const std::string& path, const FlatBVH& bvh, const IntersectList& ilist, uint64_t scene_hash)
+{
+	std::unordered_map<const IIntersect*, uint32_t> object_index;
+	object_index.reserve(ilist.objects.size());
+	for (size_t i = 0; i < ilist.objects.size(); ++i)
+		object_index.emplace(ilist.objects[i].get(), static_cast<uint32_t>(i));
+
+	std::vector<uint32_t> indices(bvh.primitives.size());
+	for (size_t i = 0; i < bvh.primitives.size(); ++i) {
+		auto it = object_index.find(bvh.primitives[i].get());
+		if (it == object_index.end())
+			return false;
+		indices[i] = it->second;
+	}
+
+	BVHCacheHeader header;
+	std::memcpy(header.magic, bvh_cache_magic, sizeof(header.magic));
+	header.version = bvh_cache_version;
+	header.node_size = sizeof(LinearBVHNode);
+	header.scene_hash = scene_hash;
+	header.node_count = bvh.node_count;
+	header.primitive_count = indices.size();
+	// nodes start on a cache line, mapping of the file is page aligned
+	header.nodes_offset = (sizeof(BVHCacheHeader) + alignof(LinearBVHNode) - 1) / alignof(LinearBVHNode) * alignof(LinearBVHNode);
+	header.indices_offset = header.nodes_offset + header.node_count * sizeof(LinearBVHNode);
+
+	// written under a temporary name, a concurrent reader never sees a partial file
+	const std::string temp_path = path + ".tmp";
+	{
+		std::ofstream file(temp_path, std::ios::binary | std::ios::trunc);
+		if (!file)
+			return false;
+
+		const char padding[alignof(LinearBVHNode)] = {};
+		file.write(reinterpret_cast<const char*>(&header), sizeof(header));
+		file.write(padding, header.nodes_offset - sizeof(header));
+		file.write(reinterpret_cast<const char*>(bvh.nodes), header.node_count * sizeof(LinearBVHNode));
+		file.write(reinterpret_cast<const char*>(indices.data()), indices.size() * sizeof(uint32_t));
+		if (!file)
+			return false;
+	}
+
+	std::remove(path.c_str());
+	return std::rename(temp_path.c_str(), path.c_str()) == 0;
+}
+
+
+/*
+	Offsets of the nodes are checked before any traversal: the nodes must form a depth-first tree -
+	the first child follows its parent, the second child starts the rest of the parent's range -
+	so every node is visited once, leaves address only the loaded primitives
+	and no path is deeper than the traversal stacks.
+*/
+bool valid_bvh_cache_nodes(const LinearBVHNode* nodes, const size_t node_count, const size_t primitive_count)
+{
+	if (node_count == 0)
+		return primitive_count == 0;
+
+	// nodes [index, end) of a subtree, depth - count of its interior ancestors
+	struct Subtree
+	{
+		uint64_t index;
+		uint64_t end;
+		size_t depth;
+	};
+	std::vector<Subtree> subtrees = { { 0, node_count, 0 } };
+	while (!subtrees.empty()) {
+		const auto subtree = subtrees.back();
+		subtrees.pop_back();
+		const auto& node = nodes[subtree.index];
+		if (node.primitives_count > 0) {
+			if (subtree.end != subtree.index + 1 ||
+				static_cast<uint64_t>(node.primitives_offset) + node.primitives_count > primitive_count)
+				return false;
+			continue;
+		}
+		if (subtree.depth >= FlatBVH::max_depth || node.axis > 2 ||
+			node.second_child_offset <= subtree.index + 1 || node.second_child_offset >= subtree.end)
+			return false;
+		subtrees.push_back({ subtree.index + 1, node.second_child_offset, subtree.depth + 1 });
+		subtrees.push_back({ node.second_child_offset, subtree.end, subtree.depth + 1 });
+	}
+	return true;
+}
+
+
+// nullptr if the file is missing, of other version, of other scene or malformed
+shared_ptr<FlatBVH> load_bvh_cache(const std::string& path, const IntersectList& ilist, uint64_t scene_hash)
+{
+	auto file = make_shared<MappedFile>(path);
+	if (!file->is_open() || file->size() < sizeof(BVHCacheHeader))
+		return nullptr;
+
+	BVHCacheHeader header;
+	std::memcpy(&header, file->data(), sizeof(header));
+	if (std::memcmp(header.magic, bvh_cache_magic, sizeof(header.magic)) != 0 ||
+		header.version != bvh_cache_version ||
+		header.node_size != sizeof(LinearBVHNode) ||
+		header.scene_hash != scene_hash ||
+		header.node_count > file->size() / sizeof(LinearBVHNode) ||
+		header.primitive_count > file->size() / sizeof(uint32_t) ||
+		header.nodes_offset < sizeof(BVHCacheHeader) ||
+		header.nodes_offset % alignof(LinearBVHNode) != 0 ||
+		header.indices_offset != header.nodes_offset + header.node_count * sizeof(LinearBVHNode) ||
+		file->size() < header.indices_offset + header.primitive_count * sizeof(uint32_t))
+		return nullptr;
+
+	const auto* indices = reinterpret_cast<const uint32_t*>(file->data() + header.indices_offset);
+	std::vector<shared_ptr<IIntersect>> primitives(header.primitive_count);
+	for (size_t i = 0; i < header.primitive_count; ++i) {
+		if (indices[i] >= ilist.objects.size())
+			return nullptr;
+		primitives[i] = ilist.objects[indices[i]];
+	}
+
+	const auto* nodes = reinterpret_cast<const LinearBVHNode*>(file->data() + header.nodes_offset);
+	if (!valid_bvh_cache_nodes(nodes, static_cast<size_t>(header.node_count), primitives.size()))
+		return nullptr;
+	return make_shared<FlatBVH>(file, nodes, static_cast<size_t>(header.node_count), std::move(primitives));
+}
+
+
+// FlatBVH from the cache in BVHBuildOption::cache_dir, built and stored there on a miss
+shared_ptr<FlatBVH> make_cached_flat_bvh(const IntersectList& ilist, real time0, real time1, const BVHBuildOption& option)
+{
+	if (option.builder == BVH_BUILDER_SBVH)
+		return make_shared<FlatBVH>(ilist, time0, time1, option);
+
+	const auto scene_hash = bvh_scene_hash(ilist, time0, time1, option);
+	const auto path = bvh_cache_path(option.cache_dir, scene_hash);
+	if (auto bvh = load_bvh_cache(path, ilist, scene_hash))
+		return bvh;
+
+	auto bvh = make_shared<FlatBVH>(ilist, time0, time1, option);
+	save_bvh_cache(path, *bvh, ilist, scene_hash);
+	return bvh;
+}
@@ -0,0 +1,413 @@
+#pragma once
+#include <bvh/flatbvh.hpp>
+#include <camera.hpp>
+#include <instance.hpp>
+#include <mesh.hpp>
+#include <sphereset.hpp>
+#include <ostream>
+#include <random>
+
+/*
+	Quality and traversal statistics of the hierarchies of a world, written as JSON to compare builds against each other.
+	Hierarchy: node counts, depth and leaf size histograms, SAH cost and overlap of sibling boxes.
+	Hierarchies in leaves of other ones, under instances and of SphereSet and TriangleMesh (IndexBVH) are walked too,
+	their nodes continue the depth of the leaf above them.
+	Traversal: bounding box tests and primitive tests per camera ray, measured by a traversal
+	which follows BVH_Node::closest_hit / FlatBVH::closest_hit and counts instead of the real ones.
+	Leaves of SphereSet and TriangleMesh are tested by the objects: the real test finds the hit and a traversal
+	of their IndexBVH bounded by it counts - a lower bound of the nodes and primitives the object visits.
+	Wide and motion BVHs and single primitives are counted as one primitive test.
+	Camera rays are drawn from a generator of the collector. Objects which sample in their hit test (ConstantVolume)
+	draw from the global generator, its state is restored after the traversal - the render stream does not change.
+*/
+
+struct BVHStats
+{
+	size_t hierarchies = 0; // top-level and nested
+	size_t instances = 0;
+	size_t interior_nodes = 0;
+	size_t leaf_nodes = 0;
+	size_t primitives = 0; // references in leaves
+	size_t other_objects = 0; // objects of the world outside of a hierarchy
+	size_t max_depth = 0; // root is at depth 0
+	std::vector<size_t> depth_histogram; // [d] - nodes at depth d
+	std::vector<size_t> leaf_size_histogram; // [n] - leaves with n primitives
+	double sah_cost = 0.0; // expected cost of a ray which hits the bounding box of the world
+	double mean_sibling_overlap = 0.0; // S(left & right) / S(node), mean over interior nodes
+	double max_sibling_overlap = 0.0;
+
+	size_t rays = 0;
+	size_t ray_hits = 0;
+	size_t nodes_visited = 0;
+	size_t primitives_tested = 0;
+};
+
+
+class BVHStatsCollector
+{
+public:
+	BVHStatsCollector(const BVHBuildOption& opt = BVHBuildOption()) : option(opt) {}
+
+	// hierarchy statistics of all objects of the world and traversal statistics of ray_count camera rays
+	BVHStats collect(const IntersectList& world, const Camera& camera, size_t ray_count);
+	BVHStats collect(const shared_ptr<IIntersect>& accel, const Camera& camera, size_t ray_count);
+
+private:
+	BVHBuildOption option;
+	BVHStats stats;
+	double overlap_sum = 0.0;
+
+	void add_node(size_t depth);
+	void add_leaf(size_t primitive_count);
+	void add_interior(const AABB& box, const AABB& left, const AABB& right);
+
+	// SAH cost of a ray which reaches the object relative to its root box, false for a primitive
+	bool walk(const IIntersect& object, const size_t depth, double& cost);
+	double walk_leaf(const shared_ptr<IIntersect>* objects, const size_t count, const size_t depth);
+	// SAH cost relative to the root bounding box of the hierarchy
+	double walk(const BVH_Node& node, const double root_area, const size_t depth);
+	double walk(const LinearBVHNode* nodes, const uint32_t index, const double root_area, const size_t depth,
+		const shared_ptr<IIntersect>* primitives);
+
+	bool trace(const IIntersect& object, const Ray& ray, double t_min, double t_max, HitInfo& hit);
+	bool trace(const BVH_Node& node, const Ray& ray, double t_min, double t_max, HitInfo& hit);
+	// leaf(offset, count, t_min, t_max) - hit of a leaf, t_max is the distance of the hit
+	template<typename LeafHit>
+	bool trace(const LinearBVHNode* nodes, const Ray& ray, double t_min, double t_max, LeafHit&& leaf);
+};
+
+
+std::ostream& write_json(std::ostream& os, const BVHStats& stats);
+
+
+BVHStats BVHStatsCollector::collect(const IntersectList& world, const Camera& camera, size_t ray_count)
+{
+	stats = BVHStats();
+	overlap_sum = 0.0;
+
+	// the list tests every object - each hierarchy contributes by the probability to hit its root box
+	AABB world_box;
+	const bool has_box = world.bounding_box(camera.get_time0(), camera.get_time1(), world_box);
+	const double world_area = has_box ? world_box.surface_area() : 0.0;
+	for (const auto& object : world.objects) {
+		double cost = 0.0;
+		if (!walk(*object, 0, cost)) {
+			stats.other_objects += 1;
+			stats.sah_cost += option.intersect_cost;
+			continue;
+		}
+
+		AABB root_box;
+		const double root_area = object->bounding_box(camera.get_time0(), camera.get_time1(), root_box) ? root_box.surface_area() : world_area;
+		stats.sah_cost += world_area > 0.0 ? cost * root_area / world_area : cost;
+	}
+	if (stats.interior_nodes > 0)
+		stats.mean_sibling_overlap = overlap_sum / stats.interior_nodes;
+
+	const std::mt19937 render_generator = random_generator();
+	std::mt19937 generator;
+	std::uniform_real_distribution<real> uniform(0.0, 1.0);
+	for (size_t i = 0; i < ray_count; ++i) {
+		// lens and shutter samples of Camera::get_ray(s, t)
+		vec3 lens;
+		do {
+			lens = vec3(2 * uniform(generator) - 1, 2 * uniform(generator) - 1, 0.0);
+		} while (glm::length2(lens) >= 1.0);
+		const real time = uniform(generator);
+		const real s = uniform(generator);
+		const real t = uniform(generator);
+		const Ray ray = camera.get_ray(s, t, lens, time);
+
+		HitInfo hit;
+		auto closest_dist = infinity;
+		bool is_intersect = false;
+		for (const auto& object : world.objects) {
+			if (trace(*object, ray, ray_t_min, closest_dist, hit)) {
+				is_intersect = true;
+				closest_dist = hit.t;
+			}
+		}
+		stats.rays += 1;
+		stats.ray_hits += is_intersect ? 1 : 0;
+	}
+	random_generator() = render_generator;
+	return stats;
+}
+
+
+BVHStats BVHStatsCollector::collect(const shared_ptr<IIntersect>& accel, const Camera& camera, size_t ray_count)
+{
+	IntersectList world(accel);
+	return collect(world, camera, ray_count);
+}
+
+
+void BVHStatsCollector::add_node(size_t depth)
+{
+	stats.max_depth = std::max(stats.max_depth, depth);
+	if (stats.depth_histogram.size() <= depth)
+		stats.depth_histogram.resize(depth + 1, 0);
+	stats.depth_histogram[depth] += 1;
+}
+
+
+void BVHStatsCollector::add_leaf(size_t primitive_count)
+{
+	stats.leaf_nodes += 1;
+	stats.primitives += primitive_count;
+	if (stats.leaf_size_histogram.size() <= primitive_count)
+		stats.leaf_size_histogram.resize(primitive_count + 1, 0);
+	stats.leaf_size_histogram[primitive_count] += 1;
+}
+
+
+void BVHStatsCollector::add_interior(const AABB& box, const AABB& left, const AABB& right)
+{
+	stats.interior_nodes += 1;
+
+	const point3 small = glm::max(left.min(), right.min());
+	const point3 big = glm::min(left.max(), right.max());
+	const double area = box.surface_area();
+	// boxes which only touch do not overlap
+	if (small.x < big.x && small.y < big.y && small.z < big.z && area > 0.0) {
+		const double overlap = AABB(small, big).surface_area() / area;
+		overlap_sum += overlap;
+		stats.max_sibling_overlap = std::max(stats.max_sibling_overlap, overlap);
+	}
+}
+
+
+bool BVHStatsCollector::walk(const IIntersect& object, const size_t depth, double& cost)
+{
+	// the hierarchy under an instance is walked in object space
+	if (const auto* instance = dynamic_cast<const Instance*>(&object)) {
+		stats.instances += 1;
+		return walk(*instance->i_ptr, depth, cost);
+	}
+
+	const IndexBVH* index_bvh = nullptr;
+	if (const auto* spheres = dynamic_cast<const SphereSet*>(&object))
+		index_bvh = &spheres->bvh;
+	else if (const auto* mesh = dynamic_cast<const TriangleMesh*>(&object))
+		index_bvh = &mesh->bvh;
+
+	const auto* bvh = dynamic_cast<const BVH_Node*>(&object);
+	const auto* flat = dynamic_cast<const FlatBVH*>(&object);
+	if (bvh != nullptr)
+		cost = walk(*bvh, bvh->box.surface_area(), depth);
+	else if (flat != nullptr && flat->node_count > 0)
+		cost = walk(flat->nodes, 0, flat->nodes[0].box.surface_area(), depth, flat->primitives.data());
+	else if (index_bvh != nullptr && !index_bvh->empty())
+		cost = walk(index_bvh->nodes.data(), 0, index_bvh->bounds().surface_area(), depth, nullptr);
+	else
+		return false;
+
+	stats.hierarchies += 1;
+	return true;
+}
+
+
+// primitives of a leaf, nested hierarchies are tested whenever the leaf is
+double BVHStatsCollector::walk_leaf(const shared_ptr<IIntersect>* objects, const size_t count, const size_t depth)
+{
+	double cost = 0.0;
+	for (size_t i = 0; i < count; ++i) {
+		double object_cost = 0.0;
+		cost += walk(*objects[i], depth, object_cost) ? object_cost : option.intersect_cost;
+	}
+	return cost;
+}
+
+
+double BVHStatsCollector::walk(const BVH_Node& node, const double root_area, const size_t depth)
+{
+	const double area_ratio = root_area > 0.0 ? node.box.surface_area() / root_area : 1.0;
+	add_node(depth);
+
+	if (node.is_leaf()) {
+		add_leaf(node.objects.size());
+		return area_ratio * walk_leaf(node.objects.data(), node.objects.size(), depth + 1);
+	}
+
+	add_interior(node.box, node.left->box, node.right->box);
+	return area_ratio * option.traversal_cost +
+		walk(*node.left, root_area, depth + 1) + walk(*node.right, root_area, depth + 1);
+}
+
+
+// node array of FlatBVH or IndexBVH, primitives - leaf primitives of FlatBVH, nullptr - indices of IndexBVH
+double BVHStatsCollector::walk(const LinearBVHNode* nodes, const uint32_t index, const double root_area, const size_t depth,
+	const shared_ptr<IIntersect>* primitives)
+{
+	const auto& node = nodes[index];
+	const double area_ratio = root_area > 0.0 ? node.box.surface_area() / root_area : 1.0;
+	add_node(depth);
+
+	if (node.primitives_count > 0) {
+		add_leaf(node.primitives_count);
+		if (primitives == nullptr)
+			return area_ratio * option.intersect_cost * node.primitives_count;
+		return area_ratio * walk_leaf(primitives + node.primitives_offset, node.primitives_count, depth + 1);
+	}
+
+	add_interior(node.box, nodes[index + 1].box, nodes[node.second_child_offset].box);
+	return area_ratio * option.traversal_cost +
+		walk(nodes, index + 1, root_area, depth + 1, primitives) +
+		walk(nodes, node.second_child_offset, root_area, depth + 1, primitives);
+}
+
+
+bool BVHStatsCollector::trace(const IIntersect& object, const Ray& ray, double t_min, double t_max, HitInfo& hit)
+{
+	// as Instance::closest_hit
+	if (const auto* instance = dynamic_cast<const Instance*>(&object)) {
+		if (Instance::traversal_depth == HitInfo::max_instance_depth)
+			return false;
+		++Instance::traversal_depth;
+		const bool is_hit = trace(*instance->i_ptr, instance->to_object(ray), t_min, t_max, hit);
+		--Instance::traversal_depth;
+		if (!is_hit)
+			return false;
+		hit.add_instance(instance);
+		return true;
+	}
+
+	if (const auto* bvh = dynamic_cast<const BVH_Node*>(&object))
+		return trace(*bvh, ray, t_min, t_max, hit);
+
+	if (const auto* flat = dynamic_cast<const FlatBVH*>(&object)) {
+		if (flat->node_count == 0)
+			return false;
+		return trace(flat->nodes, ray, t_min, t_max, [&](uint32_t offset, uint16_t count, double tmin, double& tmax) {
+			bool is_intersect = false;
+			for (uint16_t i = 0; i < count; ++i) {
+				if (trace(*flat->primitives[offset + i], ray, tmin, tmax, hit)) {
+					is_intersect = true;
+					tmax = hit.t;
+				}
+			}
+			return is_intersect;
+		});
+	}
+
+	const IndexBVH* index_bvh = nullptr;
+	if (const auto* spheres = dynamic_cast<const SphereSet*>(&object))
+		index_bvh = &spheres->bvh;
+	else if (const auto* mesh = dynamic_cast<const TriangleMesh*>(&object))
+		index_bvh = &mesh->bvh;
+
+	if (index_bvh != nullptr && !index_bvh->empty()) {
+		const bool is_intersect = object.closest_hit(ray, t_min, t_max, hit);
+		trace(index_bvh->nodes.data(), ray, t_min, is_intersect ? hit.t : t_max, [&](uint32_t /*offset*/, uint16_t count, double /*tmin*/, double& /*tmax*/) {
+			stats.primitives_tested += count;
+			return false;
+		});
+		return is_intersect;
+	}
+
+	stats.primitives_tested += 1;
+	return object.closest_hit(ray, t_min, t_max, hit);
+}
+
+
+bool BVHStatsCollector::trace(const BVH_Node& node, const Ray& ray, double t_min, double t_max, HitInfo& hit)
+{
+	stats.nodes_visited += 1;
+	if (!node.box.intersect(ray, t_min, t_max))
+		return false;
+
+	if (node.is_leaf()) {
+		bool is_intersect = false;
+		for (const auto& object : node.objects) {
+			if (trace(*object, ray, t_min, t_max, hit)) {
+				is_intersect = true;
+				t_max = hit.t;
+			}
+		}
+		return is_intersect;
+	}
+
+	bool intersect_left = trace(*node.left, ray, t_min, t_max, hit);
+	bool intersect_right = trace(*node.right, ray, t_min, intersect_left ? hit.t : t_max, hit);
+	return intersect_left || intersect_right;
+}
+
+
+// ordered traversal of FlatBVH::closest_hit over a node array of FlatBVH or IndexBVH
+template<typename LeafHit>
+bool BVHStatsCollector::trace(const LinearBVHNode* nodes, const Ray& ray, double t_min, double t_max, LeafHit&& leaf)
+{
+	const vec3 inv_dir = real(1) / ray.direction();
+	const int dir_is_neg[3] = { inv_dir.x < 0.0, inv_dir.y < 0.0, inv_dir.z < 0.0 };
+
+	uint32_t to_visit[FlatBVH::max_depth];
+	size_t to_visit_count = 0;
+	uint32_t current = 0;
+	bool is_intersect = false;
+
+	while (true) {
+		const auto& node = nodes[current];
+		stats.nodes_visited += 1;
+		if (node.box.intersect(ray, inv_dir, dir_is_neg, t_min, t_max)) {
+			if (node.primitives_count > 0) {
+				if (leaf(node.primitives_offset, node.primitives_count, t_min, t_max))
+					is_intersect = true;
+				if (to_visit_count == 0)
+					break;
+				current = to_visit[--to_visit_count];
+			}
+			else if (dir_is_neg[node.axis]) {
+				to_visit[to_visit_count++] = current + 1;
+				current = node.second_child_offset;
+			}
+			else {
+				to_visit[to_visit_count++] = node.second_child_offset;
+				current = current + 1;
+			}
+		}
+		else {
+			if (to_visit_count == 0)
+				break;
+			current = to_visit[--to_visit_count];
+		}
+	}
+	return is_intersect;
+}
+
+
+void write_json_array(std::ostream& os, const std::vector<size_t>& values)
+{
+	os << "[";
+	for (size_t i = 0; i < values.size(); ++i)
+		os << (i > 0 ? ", " : "") << values[i];
+	os << "]";
+}
+
+
+std::ostream& write_json(std::ostream& os, const BVHStats& stats)
+{
+	const double rays = stats.rays > 0 ? static_cast<double>(stats.rays) : 1.0;
+
+	os << "{\n";
+	os << "\t\"hierarchies\": " << stats.hierarchies << ",\n";
+	os << "\t\"instances\": " << stats.instances << ",\n";
+	os << "\t\"interior_nodes\": " << stats.interior_nodes << ",\n";
+	os << "\t\"leaf_nodes\": " << stats.leaf_nodes << ",\n";
+	os << "\t\"primitives\": " << stats.primitives << ",\n";
+	os << "\t\"other_objects\": " << stats.other_objects << ",\n";
+	os << "\t\"max_depth\": " << stats.max_depth << ",\n";
+	os << "\t\"depth_histogram\": ";
+	write_json_array(os, stats.depth_histogram);
+	os << ",\n\t\"leaf_size_histogram\": ";
+	write_json_array(os, stats.leaf_size_histogram);
+	os << ",\n";
+	os << "\t\"sah_cost\": " << stats.sah_cost << ",\n";
+	os << "\t\"mean_sibling_overlap\": " << stats.mean_sibling_overlap << ",\n";
+	os << "\t\"max_sibling_overlap\": " << stats.max_sibling_overlap << ",\n";
+	os << "\t\"rays\": " << stats.rays << ",\n";
+	os << "\t\"ray_hits\": " << stats.ray_hits << ",\n";
+	os << "\t\"nodes_per_ray\": " << stats.nodes_visited / rays << ",\n";
+	os << "\t\"primitives_per_ray\": " << stats.primitives_tested / rays << "\n";
+	os << "}\n";
+	return os;
+}
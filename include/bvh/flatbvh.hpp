@@ -0,0 +1,319 @@
+#pragma once
+#include <bvh/builder.hpp>
+#include <memory/mappedfile.hpp>
+#include <cstdint>
+
+/*
+	Flattened BVH - BVH_Node hierarchy compiled into one contiguous array of nodes in depth-first order:
+	the first child of an interior node directly follows it, the second child is addressed by index.
+	Primitives are reordered into leaf order, a leaf references a continuous range of them.
+	Node array is owned or memory-mapped from the BVH cache file (bvh/bvhcache.hpp).
+	Matt Pharr, Wenzel Jakob, Greg Humphreys, Physically Based Rendering, 3rd ed., chapter 4.3.4
+*/
+
+// double nodes fill a cache line, float nodes half of it
+constexpr size_t linear_bvh_node_size = sizeof(real) == sizeof(float) ? 32 : 64;
+
+struct alignas(linear_bvh_node_size) LinearBVHNode
+{
+	AABB box;
+	union {
+		uint32_t primitives_offset; // leaf: first primitive
+		uint32_t second_child_offset; // interior: index of the second child
+	};
+	uint16_t primitives_count = 0; // 0 - interior node
+	uint8_t axis = 0; // split axis of interior node
+};
+
+static_assert(sizeof(LinearBVHNode) == linear_bvh_node_size, "LinearBVHNode must fill one cache line (half of it with float)");
+
+
+class FlatBVH : public IIntersect
+{
+public:
+	static constexpr size_t max_depth = BVH_Node::max_depth + BVH_Node::leaf_split_depth; // size of traversal stack
+
+	FlatBVH(const BVH_Node& root);
+	FlatBVH(const IntersectList& ilist, real time0, real time1, const BVHBuildOption& option = BVHBuildOption()) :
+		FlatBVH(*build_bvh(ilist, time0, time1, option)) {}
+	// nodes are used in place, the mapping is kept alive by the hierarchy
+	FlatBVH(shared_ptr<MappedFile> file, const LinearBVHNode* mapped_nodes, size_t count, std::vector<shared_ptr<IIntersect>>&& leaf_primitives) :
+		nodes(mapped_nodes), node_count(count), primitives(std::move(leaf_primitives)), mapping(file) {}
+
+	// nodes may point into node_storage
+	FlatBVH(const FlatBVH&) = delete;
+	FlatBVH& operator=(const FlatBVH&) = delete;
+
+	virtual bool closest_hit(const Ray& ray, real t_min, real t_max, HitInfo& hit) const override;
+	virtual bool occluded(const Ray& ray, real t_min, real t_max) const override;
+	virtual bool bounding_box(real time0, real time1, AABB& output_box) const override;
+	virtual void intersect_packet(RayPacket& packet, real t_min, size_t first = 0) const override;
+	virtual int instance_depth() const override { return nested_instance_depth(primitives); }
+
+	BVHCostReport cost_report(const BVHBuildOption& option = BVHBuildOption()) const;
+
+public:
+	const LinearBVHNode* nodes = nullptr; // depth-first node array
+	size_t node_count = 0;
+	std::vector<shared_ptr<IIntersect>> primitives; // primitives in leaf order
+
+private:
+	std::vector<LinearBVHNode> node_storage; // nodes of a built hierarchy
+	shared_ptr<MappedFile> mapping; // nodes of a loaded hierarchy
+
+	uint32_t flatten(const BVH_Node& node, const size_t depth);
+	uint32_t flatten_leaf(const AABB& box, const size_t offset, const size_t count);
+	void collect_cost(BVHCostReport& report, const BVHBuildOption& option, const uint32_t index, const real root_area, const size_t depth) const;
+};
+
+
+FlatBVH::FlatBVH(const BVH_Node& root)
+{
+	auto report = root.cost_report();
+	node_storage.reserve(report.interior_nodes + report.leaf_nodes);
+	primitives.reserve(report.primitives);
+	flatten(root, 1);
+	nodes = node_storage.data();
+	node_count = node_storage.size();
+}
+
+
+uint32_t FlatBVH::flatten(const BVH_Node& node, const size_t depth)
+{
+	// LBVH and SBVH builds have no depth limit, deeper subtrees are compiled into one leaf
+	if (node.is_leaf() || depth >= BVH_Node::max_depth) {
+		const auto offset = primitives.size();
+		node.collect_objects(primitives);
+		return flatten_leaf(node.box, offset, primitives.size() - offset);
+	}
+
+	const auto index = static_cast<uint32_t>(node_storage.size());
+	node_storage.emplace_back();
+	node_storage[index].box = node.box;
+	node_storage[index].axis = static_cast<uint8_t>(node.axis);
+	flatten(*node.left, depth + 1);
+	// nodes may be reallocated by the recursive calls - index instead of reference
+	auto second_child = flatten(*node.right, depth + 1);
+	node_storage[index].second_child_offset = second_child;
+	return index;
+}
+
+
+// leaf of a primitive range, a range longer than a leaf counts is split into halves of whole leaves
+// (at most leaf_split_depth levels), the nodes of the split share the box of the range
+uint32_t FlatBVH::flatten_leaf(const AABB& box, const size_t offset, const size_t count)
+{
+	const auto index = static_cast<uint32_t>(node_storage.size());
+	node_storage.emplace_back();
+	node_storage[index].box = box;
+	if (count <= UINT16_MAX) {
+		node_storage[index].primitives_offset = static_cast<uint32_t>(offset);
+		node_storage[index].primitives_count = static_cast<uint16_t>(count);
+		return index;
+	}
+
+	const size_t leaves = (count + UINT16_MAX - 1) / UINT16_MAX;
+	const size_t first_count = leaves / 2 * UINT16_MAX;
+	flatten_leaf(box, offset, first_count);
+	// nodes may be reallocated by the recursive calls - index instead of reference
+	auto second_child = flatten_leaf(box, offset + first_count, count - first_count);
+	node_storage[index].second_child_offset = second_child;
+	return index;
+}
+
+
+bool FlatBVH::closest_hit(const Ray& ray, real t_min, real t_max, HitInfo& hit) const
+{
+	if (node_count == 0)
+		return false;
+
+	const vec3 inv_dir = real(1) / ray.direction();
+	const int dir_is_neg[3] = { inv_dir.x < 0.0, inv_dir.y < 0.0, inv_dir.z < 0.0 };
+
+	uint32_t to_visit[max_depth];
+	size_t to_visit_count = 0;
+	uint32_t current = 0;
+	bool is_intersect = false;
+
+	while (true) {
+		const auto& node = nodes[current];
+		if (node.box.intersect(ray, inv_dir, dir_is_neg, t_min, t_max)) {
+			if (node.primitives_count > 0) {
+				const auto* objects = primitives.data() + node.primitives_offset;
+				for (uint16_t i = 0; i < node.primitives_count; ++i) {
+					if (objects[i]->closest_hit(ray, t_min, t_max, hit)) {
+						is_intersect = true;
+						t_max = hit.t;
+					}
+				}
+				if (to_visit_count == 0)
+					break;
+				current = to_visit[--to_visit_count];
+			}
+			else {
+				// visit the near child first, the far one may be culled by the closer hit
+				if (dir_is_neg[node.axis]) {
+					to_visit[to_visit_count++] = current + 1;
+					current = node.second_child_offset;
+				}
+				else {
+					to_visit[to_visit_count++] = node.second_child_offset;
+					current = current + 1;
+				}
+			}
+		}
+		else {
+			if (to_visit_count == 0)
+				break;
+			current = to_visit[--to_visit_count];
+		}
+	}
+
+	return is_intersect;
+}
+
+
+/*
+	Packet traversal: a node is skipped by one interval test of a coherent packet, otherwise rays are tested
+	from the first active one - rays before it missed the node and miss its children too (first-hit traversal).
+	Order of children is by the direction signs of the packet.
+*/
+void FlatBVH::intersect_packet(RayPacket& packet, real t_min, size_t first) const
+{
+	if (node_count == 0)
+		return;
+
+	struct StackEntry
+	{
+		uint32_t node;
+		uint32_t first;
+	};
+	StackEntry to_visit[max_depth];
+	size_t to_visit_count = 0;
+	uint32_t current = 0;
+	auto active = static_cast<uint32_t>(first);
+
+	while (true) {
+		const auto& node = nodes[current];
+		// first ray of the packet which hits the node box
+		uint32_t hit_first = static_cast<uint32_t>(packet.size);
+		if (!packet.miss(node.box, t_min)) {
+			for (uint32_t i = active; i < packet.size; ++i) {
+				if (node.box.intersect(packet.rays[i], packet.inv_dir[i], packet.dir_signs[i], t_min, packet.t_max[i])) {
+					hit_first = i;
+					break;
+				}
+			}
+		}
+
+		if (hit_first < packet.size) {
+			if (node.primitives_count > 0) {
+				const auto* objects = primitives.data() + node.primitives_offset;
+				for (uint16_t i = 0; i < node.primitives_count; ++i)
+					objects[i]->intersect_packet(packet, t_min, hit_first);
+				packet.update_t_max();
+				if (to_visit_count == 0)
+					break;
+				current = to_visit[--to_visit_count].node;
+				active = to_visit[to_visit_count].first;
+			}
+			else {
+				// near child first, the far one may be culled by the closer hits
+				const uint32_t near_child = packet.dir_is_neg[node.axis] ? node.second_child_offset : current + 1;
+				const uint32_t far_child = packet.dir_is_neg[node.axis] ? current + 1 : node.second_child_offset;
+				to_visit[to_visit_count++] = { far_child, hit_first };
+				current = near_child;
+				active = hit_first;
+			}
+		}
+		else {
+			if (to_visit_count == 0)
+				break;
+			current = to_visit[--to_visit_count].node;
+			active = to_visit[to_visit_count].first;
+		}
+	}
+}
+
+
+// any hit - children are visited in stack order, the first hit ends the traversal
+bool FlatBVH::occluded(const Ray& ray, real t_min, real t_max) const
+{
+	if (node_count == 0)
+		return false;
+
+	const vec3 inv_dir = real(1) / ray.direction();
+	const int dir_is_neg[3] = { inv_dir.x < 0.0, inv_dir.y < 0.0, inv_dir.z < 0.0 };
+
+	uint32_t to_visit[max_depth];
+	size_t to_visit_count = 0;
+	uint32_t current = 0;
+
+	while (true) {
+		const auto& node = nodes[current];
+		if (node.box.intersect(ray, inv_dir, dir_is_neg, t_min, t_max)) {
+			if (node.primitives_count > 0) {
+				const auto* objects = primitives.data() + node.primitives_offset;
+				for (uint16_t i = 0; i < node.primitives_count; ++i) {
+					if (objects[i]->occluded(ray, t_min, t_max))
+						return true;
+				}
+				if (to_visit_count == 0)
+					break;
+				current = to_visit[--to_visit_count];
+			}
+			else {
+				to_visit[to_visit_count++] = node.second_child_offset;
+				current = current + 1;
+			}
+		}
+		else {
+			if (to_visit_count == 0)
+				break;
+			current = to_visit[--to_visit_count];
+		}
+	}
+
+	return false;
+}
+
+
+bool FlatBVH::bounding_box(real /*time0*/, real /*time1*/, AABB& output_box) const
+{
+	if (node_count == 0)
+		return false;
+	output_box = nodes[0].box;
+	return true;
+}
+
+
+BVHCostReport FlatBVH::cost_report(const BVHBuildOption& option) const
+{
+	BVHCostReport report;
+	if (node_count > 0)
+		collect_cost(report, option, 0, nodes[0].box.surface_area(), 1);
+	report.memory = node_count * sizeof(LinearBVHNode) + primitives.size() * sizeof(shared_ptr<IIntersect>);
+	if (option.builder == BVH_BUILDER_SBVH)
+		report.duplicates = duplicate_references(primitives);
+	return report;
+}
+
+
+void FlatBVH::collect_cost(BVHCostReport& report, const BVHBuildOption& option, const uint32_t index, const real root_area, const size_t depth) const
+{
+	const auto& node = nodes[index];
+	auto area_ratio = root_area > 0.0 ? node.box.surface_area() / root_area : 1.0;
+	report.max_depth = std::max(report.max_depth, depth);
+
+	if (node.primitives_count > 0) {
+		report.leaf_nodes += 1;
+		report.primitives += node.primitives_count;
+		report.sah_cost += area_ratio * option.intersect_cost * node.primitives_count;
+		return;
+	}
+
+	report.interior_nodes += 1;
+	report.sah_cost += area_ratio * option.traversal_cost;
+	collect_cost(report, option, index + 1, root_area, depth + 1);
+	collect_cost(report, option, node.second_child_offset, root_area, depth + 1);
+}
@@ -0,0 +1,351 @@
+#pragma once
+#include <bvh/flatbvh.hpp>
+
+/*
+	BVH over primitive references - a bounding box and an index per primitive, for primitives which are
+	stored by their owner in plain arrays (triangles of a mesh) instead of heap objects behind IIntersect.
+	Built top-down with binned SAH as BVH_Node, nodes are laid out as FlatBVH (LinearBVHNode),
+	a leaf addresses a range of primitive indices, the owner tests the primitives by a callback.
+	An owner with its own leaf data (TriangleMesh packets) may point primitives_offset of the leaves at it
+	and use the traversal by leaves.
+*/
+class IndexBVH
+{
+public:
+	static constexpr size_t max_depth = FlatBVH::max_depth; // size of traversal stack
+
+	IndexBVH() {}
+	IndexBVH(const std::vector<AABB>& boxes, const BVHBuildOption& option = BVHBuildOption()) { build(boxes, option); }
+
+	// leaf_width - primitives tested in one SIMD pass, a leaf of n primitives costs ceil(n / leaf_width) tests
+	void build(const std::vector<AABB>& boxes, const BVHBuildOption& option = BVHBuildOption(), const size_t leaf_width = 1);
+
+	/*
+		closest hit - hit(index, t_min, t_max) tests the primitive in [t_min, t_max],
+		returns true and shortens t_max to the distance of the hit
+	*/
+	template<typename PrimitiveHit>
+	bool intersect(const Ray& ray, real t_min, real& t_max, PrimitiveHit&& hit) const;
+	// any hit - occluded(index, t_min, t_max)
+	template<typename PrimitiveOccluded>
+	bool occluded(const Ray& ray, real t_min, real t_max, PrimitiveOccluded&& occluded) const;
+
+	// traversal by leaves - hit(primitives_offset, primitives_count, t_min, t_max) of a leaf as for primitives
+	template<typename LeafHit>
+	bool intersect_leaves(const Ray& ray, real t_min, real& t_max, LeafHit&& hit) const;
+	template<typename LeafOccluded>
+	bool occluded_leaves(const Ray& ray, real t_min, real t_max, LeafOccluded&& occluded) const;
+
+	bool empty() const { return nodes.empty(); }
+	const AABB& bounds() const { return nodes.front().box; }
+	BVHCostReport cost_report(const BVHBuildOption& option = BVHBuildOption()) const;
+
+public:
+	std::vector<LinearBVHNode> nodes; // depth-first node array
+	std::vector<uint32_t> indices; // primitive indices in leaf order
+
+private:
+	static constexpr size_t max_sah_bins = 64;
+
+	struct BuildEntry
+	{
+		AABB box;
+		point3 centroid;
+		uint32_t index;
+	};
+
+	uint32_t build_node(std::vector<BuildEntry>& entries, size_t start, size_t end, const BVHBuildOption& option, const size_t leaf_width, const size_t depth);
+	uint32_t make_leaf(const std::vector<BuildEntry>& entries, size_t start, size_t end, const AABB& box);
+	uint32_t make_interior(std::vector<BuildEntry>& entries, size_t start, size_t mid, size_t end, const AABB& box, const int axis,
+		const BVHBuildOption& option, const size_t leaf_width, const size_t depth);
+	void collect_cost(BVHCostReport& report, const BVHBuildOption& option, const uint32_t index, const real root_area, const size_t depth) const;
+};
+
+
+void IndexBVH::build(const std::vector<AABB>& boxes, const BVHBuildOption& option, const size_t leaf_width)
+{
+	assert(option.sah_bins <= max_sah_bins);
+	nodes.clear();
+	indices.clear();
+	if (boxes.empty())
+		return;
+
+	std::vector<BuildEntry> entries(boxes.size());
+	for (size_t i = 0; i < boxes.size(); ++i) {
+		entries[i].box = boxes[i];
+		entries[i].centroid = real(0.5) * (boxes[i].min() + boxes[i].max());
+		entries[i].index = static_cast<uint32_t>(i);
+	}
+
+	indices.reserve(boxes.size());
+	build_node(entries, 0, entries.size(), option, std::max<size_t>(leaf_width, 1), 1);
+	// count of nodes is known after the build only
+	nodes.shrink_to_fit();
+}
+
+
+uint32_t IndexBVH::build_node(std::vector<BuildEntry>& entries, size_t start, size_t end, const BVHBuildOption& option, const size_t leaf_width, const size_t depth)
+{
+	const size_t span = end - start;
+	AABB box = entries[start].box;
+	point3 centroid_min = entries[start].centroid;
+	point3 centroid_max = entries[start].centroid;
+	for (size_t i = start + 1; i < end; ++i) {
+		box = surrounding_box(box, entries[i].box);
+		centroid_min = glm::min(centroid_min, entries[i].centroid);
+		centroid_max = glm::max(centroid_max, entries[i].centroid);
+	}
+
+	// the stack of the traversal bounds the depth, deeper ranges end in one leaf - a range longer than
+	// a leaf counts is split into halves of whole leaves (at most BVH_Node::leaf_split_depth levels)
+	if (span == 1 || depth >= BVH_Node::max_depth) {
+		if (span <= UINT16_MAX)
+			return make_leaf(entries, start, end, box);
+		const size_t leaves = (span + UINT16_MAX - 1) / UINT16_MAX;
+		return make_interior(entries, start, start + leaves / 2 * UINT16_MAX, end, box, 0, option, leaf_width, depth);
+	}
+
+	// binned SAH, candidate planes between equal-width centroid bins of each axis
+	const size_t bin_count = std::min(std::max<size_t>(option.sah_bins, 2), max_sah_bins);
+	const real inv_area = box.surface_area() > 0.0 ? 1.0 / box.surface_area() : 1.0;
+	int best_axis = -1;
+	size_t best_bin = 0;
+	real best_cost = infinity;
+	real best_scale = 0.0;
+
+	std::array<AABB, max_sah_bins> bin_box;
+	std::array<size_t, max_sah_bins> bin_size;
+	std::array<real, max_sah_bins> right_cost;
+	for (int a = 0; a < 3; ++a) { // xyz
+		const real extent = centroid_max[a] - centroid_min[a];
+		if (extent <= 0.0)
+			continue;
+		const real scale = bin_count / extent;
+		auto bin_index = [&](const point3& centroid) {
+			auto b = static_cast<size_t>((centroid[a] - centroid_min[a]) * scale);
+			return b < bin_count ? b : bin_count - 1;
+		};
+
+		std::fill(bin_size.begin(), bin_size.begin() + bin_count, 0);
+		for (size_t i = start; i < end; ++i) {
+			const auto b = bin_index(entries[i].centroid);
+			bin_box[b] = bin_size[b] == 0 ? entries[i].box : surrounding_box(bin_box[b], entries[i].box);
+			bin_size[b] += 1;
+		}
+
+		AABB acc_box;
+		size_t acc_count = 0;
+		for (size_t b = bin_count - 1; b > 0; --b) {
+			if (bin_size[b] > 0) {
+				acc_box = acc_count == 0 ? bin_box[b] : surrounding_box(acc_box, bin_box[b]);
+				acc_count += bin_size[b];
+			}
+			right_cost[b] = acc_count > 0 ? acc_box.surface_area() * acc_count : 0.0;
+		}
+
+		acc_count = 0;
+		for (size_t b = 0; b + 1 < bin_count; ++b) {
+			if (bin_size[b] > 0) {
+				acc_box = acc_count == 0 ? bin_box[b] : surrounding_box(acc_box, bin_box[b]);
+				acc_count += bin_size[b];
+			}
+			if (acc_count == 0 || acc_count == span)
+				continue;
+
+			const real cost = option.traversal_cost +
+				option.intersect_cost * (acc_box.surface_area() * acc_count + right_cost[b + 1]) * inv_area;
+			if (cost < best_cost) {
+				best_axis = a;
+				best_bin = b;
+				best_cost = cost;
+				best_scale = scale;
+			}
+		}
+	}
+
+	const real leaf_cost = option.intersect_cost * ((span + leaf_width - 1) / leaf_width);
+	if (span <= std::min<size_t>(std::max(option.max_leaf_size, leaf_width), UINT16_MAX) && (best_axis < 0 || best_cost >= leaf_cost))
+		return make_leaf(entries, start, end, box);
+
+	size_t mid = start + (span >> 1);
+	int axis = best_axis;
+	if (best_axis >= 0) {
+		auto it = std::partition(entries.begin() + start, entries.begin() + end, [&](const BuildEntry& entry) {
+			auto b = static_cast<size_t>((entry.centroid[best_axis] - centroid_min[best_axis]) * best_scale);
+			return std::min(b, bin_count - 1) <= best_bin;
+		});
+		mid = static_cast<size_t>(it - entries.begin());
+	}
+	else {
+		// all centroids coincide - split the range in halves
+		auto extent = box.max() - box.min();
+		axis = (extent.x > extent.y && extent.x > extent.z) ? 0 : (extent.y > extent.z ? 1 : 2);
+	}
+
+	return make_interior(entries, start, mid, end, box, axis, option, leaf_width, depth);
+}
+
+
+uint32_t IndexBVH::make_interior(std::vector<BuildEntry>& entries, size_t start, size_t mid, size_t end, const AABB& box, const int axis,
+	const BVHBuildOption& option, const size_t leaf_width, const size_t depth)
+{
+	const auto index = static_cast<uint32_t>(nodes.size());
+	nodes.emplace_back();
+	nodes[index].box = box;
+	nodes[index].axis = static_cast<uint8_t>(axis);
+	build_node(entries, start, mid, option, leaf_width, depth + 1);
+	// nodes may be reallocated by the recursive calls - index instead of reference
+	const auto second_child = build_node(entries, mid, end, option, leaf_width, depth + 1);
+	nodes[index].second_child_offset = second_child;
+	return index;
+}
+
+
+uint32_t IndexBVH::make_leaf(const std::vector<BuildEntry>& entries, size_t start, size_t end, const AABB& box)
+{
+	const auto index = static_cast<uint32_t>(nodes.size());
+	nodes.emplace_back();
+	nodes[index].box = box;
+	nodes[index].primitives_offset = static_cast<uint32_t>(indices.size());
+	nodes[index].primitives_count = static_cast<uint16_t>(end - start);
+	for (size_t i = start; i < end; ++i)
+		indices.push_back(entries[i].index);
+	return index;
+}
+
+
+template<typename PrimitiveHit>
+bool IndexBVH::intersect(const Ray& ray, real t_min, real& t_max, PrimitiveHit&& hit) const
+{
+	return intersect_leaves(ray, t_min, t_max, [&](uint32_t offset, uint16_t count, real tmin, real& tmax) {
+		bool is_intersect = false;
+		for (uint16_t i = 0; i < count; ++i)
+			is_intersect |= hit(indices[offset + i], tmin, tmax);
+		return is_intersect;
+	});
+}
+
+
+template<typename PrimitiveOccluded>
+bool IndexBVH::occluded(const Ray& ray, real t_min, real t_max, PrimitiveOccluded&& occluded) const
+{
+	return occluded_leaves(ray, t_min, t_max, [&](uint32_t offset, uint16_t count, real tmin, real tmax) {
+		for (uint16_t i = 0; i < count; ++i) {
+			if (occluded(indices[offset + i], tmin, tmax))
+				return true;
+		}
+		return false;
+	});
+}
+
+
+template<typename LeafHit>
+bool IndexBVH::intersect_leaves(const Ray& ray, real t_min, real& t_max, LeafHit&& hit) const
+{
+	if (nodes.empty())
+		return false;
+
+	const vec3 inv_dir = real(1) / ray.direction();
+	const int dir_is_neg[3] = { inv_dir.x < 0.0, inv_dir.y < 0.0, inv_dir.z < 0.0 };
+
+	uint32_t to_visit[max_depth];
+	size_t to_visit_count = 0;
+	uint32_t current = 0;
+	bool is_intersect = false;
+
+	while (true) {
+		const auto& node = nodes[current];
+		if (node.box.intersect(ray, inv_dir, dir_is_neg, t_min, t_max)) {
+			if (node.primitives_count > 0) {
+				is_intersect |= hit(node.primitives_offset, node.primitives_count, t_min, t_max);
+				if (to_visit_count == 0)
+					break;
+				current = to_visit[--to_visit_count];
+			}
+			else if (dir_is_neg[node.axis]) {
+				to_visit[to_visit_count++] = current + 1;
+				current = node.second_child_offset;
+			}
+			else {
+				to_visit[to_visit_count++] = node.second_child_offset;
+				current = current + 1;
+			}
+		}
+		else {
+			if (to_visit_count == 0)
+				break;
+			current = to_visit[--to_visit_count];
+		}
+	}
+
+	return is_intersect;
+}
+
+
+template<typename LeafOccluded>
+bool IndexBVH::occluded_leaves(const Ray& ray, real t_min, real t_max, LeafOccluded&& occluded) const
+{
+	if (nodes.empty())
+		return false;
+
+	const vec3 inv_dir = real(1) / ray.direction();
+	const int dir_is_neg[3] = { inv_dir.x < 0.0, inv_dir.y < 0.0, inv_dir.z < 0.0 };
+
+	uint32_t to_visit[max_depth];
+	size_t to_visit_count = 0;
+	uint32_t current = 0;
+
+	while (true) {
+		const auto& node = nodes[current];
+		if (node.box.intersect(ray, inv_dir, dir_is_neg, t_min, t_max)) {
+			if (node.primitives_count > 0) {
+				if (occluded(node.primitives_offset, node.primitives_count, t_min, t_max))
+					return true;
+				if (to_visit_count == 0)
+					break;
+				current = to_visit[--to_visit_count];
+			}
+			else {
+				to_visit[to_visit_count++] = node.second_child_offset;
+				current = current + 1;
+			}
+		}
+		else {
+			if (to_visit_count == 0)
+				break;
+			current = to_visit[--to_visit_count];
+		}
+	}
+
+	return false;
+}
+
+
+BVHCostReport IndexBVH::cost_report(const BVHBuildOption& option) const
+{
+	BVHCostReport report;
+	if (!nodes.empty())
+		collect_cost(report, option, 0, nodes[0].box.surface_area(), 1);
+	report.memory = nodes.size() * sizeof(LinearBVHNode) + indices.size() * sizeof(uint32_t);
+	return report;
+}
+
+
+void IndexBVH::collect_cost(BVHCostReport& report, const BVHBuildOption& option, const uint32_t index, const real root_area, const size_t depth) const
+{
+	const auto& node = nodes[index];
+	auto area_ratio = root_area > 0.0 ? node.box.surface_area() / root_area : 1.0;
+	report.max_depth = std::max(report.max_depth, depth);
+
+	if (node.primitives_count > 0) {
+		report.leaf_nodes += 1;
+		report.primitives += node.primitives_count;
+		report.sah_cost += area_ratio * option.intersect_cost * node.primitives_count;
+		return;
+	}
+
+	report.interior_nodes += 1;
+	report.sah_cost += area_ratio * option.traversal_cost;
+	collect_cost(report, option, index + 1, root_area, depth + 1);
+	collect_cost(report, option, node.second_child_offset, root_area, depth + 1);
+}
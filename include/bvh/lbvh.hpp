@@ -0,0 +1,550 @@
+#pragma once
+#include <Intersect.hpp>
+#include <cstdint>
+#include <memory>
+
+/*
+	Linear BVH - primitives are sorted along the Morton curve of their centroids and the hierarchy
+	is emitted in one top-down pass over the sorted codes, a node is split at the highest differing bit.
+	Build is linear after the radix sort, tree quality is lower than of the binned SAH builder.
+	Christian Lauterbach et al., "Fast BVH Construction on GPUs", 2009
+	Treelet reoptimization replaces treelets of up to 7 leaves with the topology of minimal SAH cost:
+	Tero Karras, Timo Aila, "Fast Parallel Construction of High-Quality Bounding Volume Hierarchies", 2013
+*/
+
+class LBVHBuilder
+{
+public:
+	static constexpr size_t max_treelet_size = 7;
+
+	LBVHBuilder(const BVHBuildOption& opt = BVHBuildOption()) : option(opt) {}
+
+	shared_ptr<BVH_Node> build(const std::vector<shared_ptr<IIntersect>>& src_objects,
+		size_t start, size_t end, real time0, real time1) const;
+
+private:
+	static constexpr size_t radix_bits = 8;
+	static constexpr size_t radix_buckets = 1 << radix_bits;
+
+	struct MortonPrimitive
+	{
+		uint64_t code;
+		uint32_t index; // index of the object relative to the start of the range
+	};
+
+	// build nodes are preallocated: a subtree of primitives [first, last) owns 2 * (last - first) - 1 slots
+	struct LBVHNode
+	{
+		AABB box;
+		uint32_t left = 0;
+		uint32_t right = 0;
+		uint32_t first = 0; // first sorted primitive of the subtree
+		uint32_t span = 0; // count of primitives in the subtree
+		uint8_t axis = 0;
+		bool leaf = false; // leaf with children is a collapsed subtree
+		real cost = 0.0; // SAH cost of the subtree, not normalized by the root area
+	};
+
+	struct BuildContext
+	{
+		BuildContext(const std::vector<shared_ptr<IIntersect>>& objs, size_t offset) : objects(objs), start(offset) {}
+
+		const std::vector<shared_ptr<IIntersect>>& objects;
+		const size_t start;
+		std::vector<AABB> boxes; // cached bounds of the objects
+		std::vector<MortonPrimitive> primitives;
+		std::vector<LBVHNode> nodes;
+		std::vector<uint32_t> top_nodes; // nodes above the task subtrees in pre-order
+		std::vector<uint32_t> task_roots;
+		size_t chunk_count = 1;
+#ifdef _USE_THREAD
+		ThreadPool* pool = nullptr;
+		std::vector<std::future<void>> tasks;
+#endif
+	};
+
+	template<typename Func>
+	void spawn(BuildContext& context, Func func) const;
+	void wait(BuildContext& context) const;
+	template<typename Func>
+	void for_each_chunk(BuildContext& context, size_t count, Func func) const;
+
+	void compute_codes(BuildContext& context, real time0, real time1) const;
+	void radix_sort(BuildContext& context) const;
+	size_t find_split(const BuildContext& context, size_t first, size_t last, uint8_t& axis) const;
+	void emit_top(BuildContext& context, uint32_t index, size_t first, size_t last) const;
+	void emit(BuildContext& context, uint32_t index, size_t first, size_t last) const;
+	void optimize(BuildContext& context, uint32_t index) const;
+	void optimize_treelet(BuildContext& context, uint32_t root) const;
+	void collapse(BuildContext& context, uint32_t index) const;
+	shared_ptr<BVH_Node> materialize_top(BuildContext& context, uint32_t index) const;
+	void materialize(const BuildContext& context, BVH_Node& node, uint32_t index) const;
+	void gather(const BuildContext& context, BVH_Node& node, uint32_t index) const;
+
+	BVHBuildOption option;
+};
+
+
+// insert two zero bits after each of the 10 low bits
+inline uint64_t expand_bits_10(uint64_t v)
+{
+	v &= 0x3ff;
+	v = (v | v << 16) & 0x30000ff;
+	v = (v | v << 8) & 0x300f00f;
+	v = (v | v << 4) & 0x30c30c3;
+	v = (v | v << 2) & 0x9249249;
+	return v;
+}
+
+// insert two zero bits after each of the 21 low bits
+inline uint64_t expand_bits_21(uint64_t v)
+{
+	v &= 0x1fffff;
+	v = (v | v << 32) & 0x1f00000000ffff;
+	v = (v | v << 16) & 0x1f0000ff0000ff;
+	v = (v | v << 8) & 0x100f00f00f00f00f;
+	v = (v | v << 4) & 0x10c30c30c30c30c3;
+	v = (v | v << 2) & 0x1249249249249249;
+	return v;
+}
+
+inline int highest_bit(uint64_t v)
+{
+	int bit = -1;
+	while (v != 0) {
+		v >>= 1;
+		++bit;
+	}
+	return bit;
+}
+
+
+shared_ptr<BVH_Node> LBVHBuilder::build(const std::vector<shared_ptr<IIntersect>>& src_objects,
+										size_t start, size_t end, real time0, real time1) const
+{
+	assert(end > start && "Empty object list in LBVHBuilder.\n");
+	assert(end - start < UINT32_MAX);
+	assert((option.morton_bits == 30 || option.morton_bits == 63) && "Morton code length must be 30 or 63 bits.\n");
+	assert(option.treelet_size <= max_treelet_size);
+
+	const size_t count = end - start;
+	BuildContext context(src_objects, start);
+	context.boxes.resize(count);
+	context.primitives.resize(count);
+	context.nodes.resize(2 * count - 1);
+
+#ifdef _USE_THREAD
+	std::unique_ptr<ThreadPool> pool;
+	if (count >= option.parallel_min_span) {
+		size_t thread_num = option.build_threads > 0 ? option.build_threads : std::thread::hardware_concurrency();
+		thread_num = std::max<size_t>(thread_num, 1);
+		pool = std::make_unique<ThreadPool>(thread_num);
+		context.pool = pool.get();
+		context.chunk_count = thread_num;
+	}
+#endif
+
+	compute_codes(context, time0, time1);
+	radix_sort(context);
+
+	// subtrees below parallel_min_span primitives are tasks, nodes above them are refitted afterwards
+	emit_top(context, 0, 0, count);
+	wait(context);
+	for (auto it = context.top_nodes.rbegin(); it != context.top_nodes.rend(); ++it) {
+		auto& node = context.nodes[*it];
+		const auto& left = context.nodes[node.left];
+		const auto& right = context.nodes[node.right];
+		node.box = surrounding_box(left.box, right.box);
+		node.cost = option.traversal_cost * node.box.surface_area() + left.cost + right.cost;
+	}
+
+	if (option.treelet_size >= 3) {
+		for (auto root : context.task_roots)
+			spawn(context, [this, &context, root]() { optimize(context, root); });
+		wait(context);
+		// children of a top node precede it in reverse pre-order
+		for (auto it = context.top_nodes.rbegin(); it != context.top_nodes.rend(); ++it) {
+			optimize_treelet(context, *it);
+			collapse(context, *it);
+		}
+	}
+
+	auto root = materialize_top(context, 0);
+	wait(context);
+	return root;
+}
+
+
+template<typename Func>
+void LBVHBuilder::spawn(BuildContext& context, Func func) const
+{
+#ifdef _USE_THREAD
+	if (context.pool != nullptr) {
+		context.tasks.push_back(context.pool->enqueue(func));
+		return;
+	}
+#endif
+	func();
+}
+
+
+void LBVHBuilder::wait(BuildContext& context) const
+{
+#ifdef _USE_THREAD
+	for (auto& task : context.tasks)
+		task.get();
+	context.tasks.clear();
+#endif
+}
+
+
+// func(chunk, first, last) is called for context.chunk_count equal ranges of [0, count)
+template<typename Func>
+void LBVHBuilder::for_each_chunk(BuildContext& context, size_t count, Func func) const
+{
+	const size_t chunk = (count + context.chunk_count - 1) / context.chunk_count;
+	for (size_t c = 0; c < context.chunk_count; ++c) {
+		const size_t first = std::min(c * chunk, count);
+		const size_t last = std::min(first + chunk, count);
+		spawn(context, [func, c, first, last]() { func(c, first, last); });
+	}
+	wait(context);
+}
+
+
+void LBVHBuilder::compute_codes(BuildContext& context, real time0, real time1) const
+{
+	const size_t count = context.primitives.size();
+	std::vector<point3> chunk_min(context.chunk_count, point3(infinity));
+	std::vector<point3> chunk_max(context.chunk_count, point3(-infinity));
+
+	for_each_chunk(context, count, [&](size_t c, size_t first, size_t last) {
+		for (size_t i = first; i < last; ++i) {
+			if (!context.objects[context.start + i]->bounding_box(time0, time1, context.boxes[i]))
+				assert(false && "No bounding box in LBVHBuilder.\n");
+			const point3 centroid = real(0.5) * (context.boxes[i].min() + context.boxes[i].max());
+			chunk_min[c] = glm::min(chunk_min[c], centroid);
+			chunk_max[c] = glm::max(chunk_max[c], centroid);
+		}
+	});
+
+	point3 centroid_min = chunk_min[0];
+	point3 centroid_max = chunk_max[0];
+	for (size_t c = 1; c < context.chunk_count; ++c) {
+		centroid_min = glm::min(centroid_min, chunk_min[c]);
+		centroid_max = glm::max(centroid_max, chunk_max[c]);
+	}
+
+	// centroids are quantized to a grid of 2^10 or 2^21 cells per axis
+	const bool long_code = option.morton_bits == 63;
+	const real cells = long_code ? static_cast<real>(1 << 21) : static_cast<real>(1 << 10);
+	vec3 scale;
+	for (int a = 0; a < 3; ++a) {
+		auto extent = centroid_max[a] - centroid_min[a];
+		scale[a] = extent > 0.0 ? cells / extent : 0.0;
+	}
+
+	for_each_chunk(context, count, [&](size_t, size_t first, size_t last) {
+		for (size_t i = first; i < last; ++i) {
+			const point3 centroid = real(0.5) * (context.boxes[i].min() + context.boxes[i].max());
+			uint64_t cell[3];
+			for (int a = 0; a < 3; ++a)
+				cell[a] = static_cast<uint64_t>(std::min((centroid[a] - centroid_min[a]) * scale[a], cells - 1));
+
+			auto& primitive = context.primitives[i];
+			primitive.index = static_cast<uint32_t>(i);
+			if (long_code)
+				primitive.code = (expand_bits_21(cell[0]) << 2) | (expand_bits_21(cell[1]) << 1) | expand_bits_21(cell[2]);
+			else
+				primitive.code = (expand_bits_10(cell[0]) << 2) | (expand_bits_10(cell[1]) << 1) | expand_bits_10(cell[2]);
+		}
+	});
+}
+
+
+/*
+	LSD radix sort, 8 bits per pass. Every chunk counts its digits, the bucket offsets are
+	ordered by digit and then by chunk, so the parallel scatter keeps the sort stable.
+*/
+void LBVHBuilder::radix_sort(BuildContext& context) const
+{
+	auto& primitives = context.primitives;
+	std::vector<MortonPrimitive> sorted(primitives.size());
+	std::vector<size_t> offsets(context.chunk_count * radix_buckets);
+
+	for (size_t shift = 0; shift < option.morton_bits; shift += radix_bits) {
+		std::fill(offsets.begin(), offsets.end(), 0);
+		for_each_chunk(context, primitives.size(), [&](size_t c, size_t first, size_t last) {
+			size_t* histogram = offsets.data() + c * radix_buckets;
+			for (size_t i = first; i < last; ++i)
+				histogram[(primitives[i].code >> shift) & (radix_buckets - 1)] += 1;
+		});
+
+		size_t total = 0;
+		for (size_t digit = 0; digit < radix_buckets; ++digit) {
+			for (size_t c = 0; c < context.chunk_count; ++c) {
+				auto bucket_count = offsets[c * radix_buckets + digit];
+				offsets[c * radix_buckets + digit] = total;
+				total += bucket_count;
+			}
+		}
+
+		for_each_chunk(context, primitives.size(), [&](size_t c, size_t first, size_t last) {
+			size_t* offset = offsets.data() + c * radix_buckets;
+			for (size_t i = first; i < last; ++i)
+				sorted[offset[(primitives[i].code >> shift) & (radix_buckets - 1)]++] = primitives[i];
+		});
+		primitives.swap(sorted);
+	}
+}
+
+
+// codes of the range share the bits above the highest differing one, the split is the first code with this bit set
+size_t LBVHBuilder::find_split(const BuildContext& context, size_t first, size_t last, uint8_t& axis) const
+{
+	const auto& primitives = context.primitives;
+	const int bit = highest_bit(primitives[first].code ^ primitives[last - 1].code);
+	if (bit < 0) {
+		// equal codes - split the range in halves
+		axis = 0;
+		return first + ((last - first) >> 1);
+	}
+
+	axis = static_cast<uint8_t>(2 - bit % 3); // bits of x, y, z are interleaved from the top
+	auto it = std::partition_point(primitives.begin() + first, primitives.begin() + last,
+		[bit](const MortonPrimitive& primitive) { return ((primitive.code >> bit) & 1) == 0; });
+	return static_cast<size_t>(it - primitives.begin());
+}
+
+
+void LBVHBuilder::emit_top(BuildContext& context, uint32_t index, size_t first, size_t last) const
+{
+	if (last - first < option.parallel_min_span || last - first <= option.max_leaf_size) {
+		context.task_roots.push_back(index);
+		spawn(context, [this, &context, index, first, last]() { emit(context, index, first, last); });
+		return;
+	}
+
+	context.top_nodes.push_back(index);
+	auto& node = context.nodes[index];
+	node.first = static_cast<uint32_t>(first);
+	node.span = static_cast<uint32_t>(last - first);
+	const size_t mid = find_split(context, first, last, node.axis);
+	node.left = index + 1;
+	node.right = static_cast<uint32_t>(index + 2 * (mid - first));
+	emit_top(context, node.left, first, mid);
+	emit_top(context, node.right, mid, last);
+}
+
+
+void LBVHBuilder::emit(BuildContext& context, uint32_t index, size_t first, size_t last) const
+{
+	auto& node = context.nodes[index];
+	node.first = static_cast<uint32_t>(first);
+	node.span = static_cast<uint32_t>(last - first);
+
+	// treelets are built over single primitives, collapse() forms the leaves afterwards
+	const size_t leaf_size = option.treelet_size >= 3 ? 1 : std::max<size_t>(option.max_leaf_size, 1);
+	if (last - first <= leaf_size) {
+		node.leaf = true;
+		node.box = context.boxes[context.primitives[first].index];
+		for (size_t i = first + 1; i < last; ++i)
+			node.box = surrounding_box(node.box, context.boxes[context.primitives[i].index]);
+		node.cost = option.intersect_cost * node.span * node.box.surface_area();
+		return;
+	}
+
+	const size_t mid = find_split(context, first, last, node.axis);
+	node.left = index + 1;
+	node.right = static_cast<uint32_t>(index + 2 * (mid - first));
+	emit(context, node.left, first, mid);
+	emit(context, node.right, mid, last);
+
+	const auto& left = context.nodes[node.left];
+	const auto& right = context.nodes[node.right];
+	node.box = surrounding_box(left.box, right.box);
+	node.cost = option.traversal_cost * node.box.surface_area() + left.cost + right.cost;
+}
+
+
+// bottom-up: treelets of the children are optimized before the treelet of the node
+void LBVHBuilder::optimize(BuildContext& context, uint32_t index) const
+{
+	if (context.nodes[index].leaf)
+		return;
+	optimize(context, context.nodes[index].left);
+	optimize(context, context.nodes[index].right);
+	optimize_treelet(context, index);
+	collapse(context, index);
+}
+
+
+// subtree becomes a leaf if it is not more expensive than the hierarchy over its primitives
+void LBVHBuilder::collapse(BuildContext& context, uint32_t index) const
+{
+	auto& node = context.nodes[index];
+	if (node.leaf || node.span > option.max_leaf_size)
+		return;
+
+	auto leaf_cost = option.intersect_cost * node.span * node.box.surface_area();
+	if (leaf_cost <= node.cost) {
+		node.leaf = true;
+		node.cost = leaf_cost;
+	}
+}
+
+
+/*
+	Treelet is grown from the root by opening the treelet leaf of the largest surface area.
+	Optimal topology over the treelet leaves is found by dynamic programming over leaf subsets:
+	C(S) = C_trav * A(S) + min over partitions {P, S \ P} of C(P) + C(S \ P)
+	Subtree costs are not normalized, leaf subtrees keep their cost.
+*/
+void LBVHBuilder::optimize_treelet(BuildContext& context, uint32_t root) const
+{
+	auto& nodes = context.nodes;
+	if (nodes[root].leaf)
+		return;
+
+	uint32_t leaves[max_treelet_size] = { nodes[root].left, nodes[root].right };
+	uint32_t interiors[max_treelet_size - 1] = { root };
+	size_t leaf_count = 2;
+	size_t interior_count = 1;
+	while (leaf_count < option.treelet_size) {
+		size_t largest = leaf_count;
+		real largest_area = -1.0;
+		for (size_t i = 0; i < leaf_count; ++i) {
+			const auto& leaf = nodes[leaves[i]];
+			auto area = leaf.box.surface_area();
+			if (!leaf.leaf && area > largest_area) {
+				largest = i;
+				largest_area = area;
+			}
+		}
+		if (largest == leaf_count)
+			break;
+
+		const auto opened = leaves[largest];
+		interiors[interior_count++] = opened;
+		leaves[largest] = nodes[opened].left;
+		leaves[leaf_count++] = nodes[opened].right;
+	}
+	if (leaf_count < 3)
+		return;
+
+	const size_t subset_count = size_t(1) << leaf_count;
+	AABB boxes[size_t(1) << max_treelet_size];
+	real costs[size_t(1) << max_treelet_size];
+	uint8_t partitions[size_t(1) << max_treelet_size];
+
+	// every subset is larger than its subsets, ascending order evaluates subsets first
+	for (size_t s = 1; s < subset_count; ++s) {
+		const size_t low = s & (~s + 1);
+		const size_t rest = s ^ low;
+		if (rest == 0) {
+			const auto& leaf = nodes[leaves[highest_bit(low)]];
+			boxes[s] = leaf.box;
+			costs[s] = leaf.cost;
+			continue;
+		}
+
+		boxes[s] = surrounding_box(boxes[rest], boxes[low]);
+		real best_cost = infinity;
+		// one side of a partition contains the lowest leaf of the subset
+		for (size_t p = (s - 1) & s; p != 0; p = (p - 1) & s) {
+			if ((p & low) == 0)
+				continue;
+			auto cost = costs[p] + costs[s ^ p];
+			if (cost < best_cost) {
+				best_cost = cost;
+				partitions[s] = static_cast<uint8_t>(p);
+			}
+		}
+		costs[s] = option.traversal_cost * boxes[s].surface_area() + best_cost;
+	}
+
+	const size_t full = subset_count - 1;
+	if (costs[full] >= nodes[root].cost * (1.0 - 1e-9))
+		return;
+
+	// interior nodes of the treelet are rewired, the root keeps its index
+	size_t next_interior = 1;
+	auto assign = [&](auto&& self, size_t s, uint32_t index) -> void {
+		const size_t subsets[2] = { partitions[s], s ^ partitions[s] };
+		uint32_t children[2];
+		for (int i = 0; i < 2; ++i) {
+			if ((subsets[i] & (subsets[i] - 1)) == 0) {
+				children[i] = leaves[highest_bit(subsets[i])];
+				continue;
+			}
+			children[i] = interiors[next_interior++];
+			self(self, subsets[i], children[i]);
+		}
+
+		auto& node = nodes[index];
+		const auto& left = nodes[children[0]];
+		const auto& right = nodes[children[1]];
+		const vec3 offset = (right.box.min() + right.box.max()) - (left.box.min() + left.box.max());
+		const vec3 distance = glm::abs(offset);
+		node.axis = (distance.x > distance.y && distance.x > distance.z) ? 0 : (distance.y > distance.z ? 1 : 2);
+		// left child is the lower one along the axis, traversal visits it first for positive directions
+		const bool swap = offset[node.axis] < 0.0;
+		node.left = children[swap ? 1 : 0];
+		node.right = children[swap ? 0 : 1];
+		node.box = boxes[s];
+		node.cost = costs[s];
+		node.span = left.span + right.span;
+	};
+	assign(assign, full, root);
+}
+
+
+shared_ptr<BVH_Node> LBVHBuilder::materialize_top(BuildContext& context, uint32_t index) const
+{
+	auto node = make_shared<BVH_Node>();
+	const auto& lnode = context.nodes[index];
+	if (lnode.leaf || lnode.span < option.parallel_min_span) {
+		BVH_Node* target = node.get();
+		spawn(context, [this, &context, target, index]() { materialize(context, *target, index); });
+		return node;
+	}
+
+	node->box = lnode.box;
+	node->axis = lnode.axis;
+	node->left = materialize_top(context, lnode.left);
+	node->right = materialize_top(context, lnode.right);
+	return node;
+}
+
+
+void LBVHBuilder::materialize(const BuildContext& context, BVH_Node& node, uint32_t index) const
+{
+	const auto& lnode = context.nodes[index];
+	node.box = lnode.box;
+	if (lnode.leaf) {
+		node.objects.reserve(lnode.span);
+		gather(context, node, index);
+		return;
+	}
+
+	node.axis = lnode.axis;
+	node.left = make_shared<BVH_Node>();
+	node.right = make_shared<BVH_Node>();
+	materialize(context, *node.left, lnode.left);
+	materialize(context, *node.right, lnode.right);
+}
+
+
+// primitives of a collapsed subtree are not continuous in the sorted order after treelet rewiring
+void LBVHBuilder::gather(const BuildContext& context, BVH_Node& node, uint32_t index) const
+{
+	const auto& lnode = context.nodes[index];
+	if (lnode.left == 0) { // emitted leaf, the root is never a child
+		for (size_t i = lnode.first; i < lnode.first + lnode.span; ++i)
+			node.objects.push_back(context.objects[context.start + context.primitives[i].index]);
+		return;
+	}
+	gather(context, node, lnode.left);
+	gather(context, node, lnode.right);
+}
+
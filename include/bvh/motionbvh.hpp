@@ -0,0 +1,323 @@
+#pragma once
+#include <bvh/builder.hpp>
+#include <cstdint>
+
+/*
+	Motion BVH - every node stores its bounds at the start and at the end of a time segment,
+	traversal interpolates the node box at the ray time instead of testing the box swept over the shutter.
+	Shutter interval may be split into segments with separate subtrees, a ray descends the subtree of its segment.
+	Motion of primitives is assumed linear inside a segment (AnimationSphere), static primitives have equal keyframes.
+	Matt Pharr, Wenzel Jakob, Greg Humphreys, Physically Based Rendering, 3rd ed., chapter 2.9.4
+*/
+
+struct alignas(64) MotionBVHNode
+{
+	point3 lower[2]; // box corners at the start and at the end of the segment
+	point3 upper[2];
+	union {
+		uint32_t primitives_offset; // leaf: first primitive
+		uint32_t second_child_offset; // interior: index of the second child
+	};
+	uint16_t primitives_count = 0; // 0 - interior node
+	uint8_t axis = 0; // split axis of interior node
+
+	AABB box(real u) const {
+		return AABB((1 - u) * lower[0] + u * lower[1], (1 - u) * upper[0] + u * upper[1]);
+	}
+
+	// slab test of the box at time u, only the planes picked by direction signs are interpolated
+	bool intersect(const point3& orig, const vec3& inv_dir, const int dir_is_neg[3], real u, real t_min, real t_max) const {
+		for (auto i = 0; i < 3; ++i) { // xyz
+			const auto& near = dir_is_neg[i] ? upper : lower;
+			const auto& far = dir_is_neg[i] ? lower : upper;
+			auto t0 = (near[0][i] + u * (near[1][i] - near[0][i]) - orig[i]) * inv_dir[i];
+			auto t1 = (far[0][i] + u * (far[1][i] - far[0][i]) - orig[i]) * inv_dir[i];
+			t_min = t0 > t_min ? t0 : t_min;
+			t_max = t1 < t_max ? t1 : t_max;
+			if (t_max <= t_min)
+				return false;
+		}
+		return true;
+	}
+};
+
+static_assert(sizeof(MotionBVHNode) == 16 * sizeof(real), "MotionBVHNode must fill two cache lines (one with float)");
+
+
+class MotionBVH : public IIntersect
+{
+public:
+	static constexpr size_t max_depth = BVH_Node::max_depth + BVH_Node::leaf_split_depth; // size of traversal stack
+
+	struct Segment
+	{
+		real time0;
+		real time1;
+		uint32_t root; // index of the root node of the segment subtree
+	};
+
+	MotionBVH(const IntersectList& ilist, real time0, real time1, const BVHBuildOption& option = BVHBuildOption());
+
+	virtual bool closest_hit(const Ray& ray, real t_min, real t_max, HitInfo& hit) const override;
+	virtual bool occluded(const Ray& ray, real t_min, real t_max) const override;
+	virtual bool bounding_box(real time0, real time1, AABB& output_box) const override;
+	virtual int instance_depth() const override { return nested_instance_depth(primitives); }
+
+	BVHCostReport cost_report(const BVHBuildOption& option = BVHBuildOption()) const;
+
+public:
+	std::vector<Segment> segments;
+	std::vector<MotionBVHNode> nodes;
+	std::vector<shared_ptr<IIntersect>> primitives; // primitives in leaf order of all segments
+
+private:
+	uint32_t flatten(const BVH_Node& node, const Segment& segment, const size_t depth);
+	uint32_t flatten_leaf(const Segment& segment, const size_t offset, const size_t count);
+	void collect_cost(BVHCostReport& report, const BVHBuildOption& option, const uint32_t index, const real root_area, const size_t depth) const;
+};
+
+
+MotionBVH::MotionBVH(const IntersectList& ilist, real time0, real time1, const BVHBuildOption& option)
+{
+	assert(!ilist.objects.empty() && "Empty object list in MotionBVH constructor.\n");
+	const size_t segment_count = std::max<size_t>(option.motion_segments, 1);
+
+	for (size_t s = 0; s < segment_count; ++s) {
+		Segment segment;
+		segment.time0 = time0 + (time1 - time0) * s / segment_count;
+		segment.time1 = time0 + (time1 - time0) * (s + 1) / segment_count;
+
+		// topology is built over the bounds swept in the segment, keyframe bounds are refitted by flatten
+		auto root = build_bvh(ilist, segment.time0, segment.time1, option);
+		segment.root = flatten(*root, segment, 1);
+		segments.push_back(segment);
+	}
+}
+
+
+uint32_t MotionBVH::flatten(const BVH_Node& node, const Segment& segment, const size_t depth)
+{
+	// subtrees below the depth limit are compiled into one leaf (as by FlatBVH)
+	if (node.is_leaf() || depth >= BVH_Node::max_depth) {
+		const auto offset = primitives.size();
+		node.collect_objects(primitives);
+		return flatten_leaf(segment, offset, primitives.size() - offset);
+	}
+
+	const auto index = static_cast<uint32_t>(nodes.size());
+	nodes.emplace_back();
+	nodes[index].axis = static_cast<uint8_t>(node.axis);
+	auto first_child = flatten(*node.left, segment, depth + 1);
+	// nodes may be reallocated by the recursive calls - index instead of reference
+	auto second_child = flatten(*node.right, segment, depth + 1);
+	for (int k = 0; k < 2; ++k) {
+		nodes[index].lower[k] = glm::min(nodes[first_child].lower[k], nodes[second_child].lower[k]);
+		nodes[index].upper[k] = glm::max(nodes[first_child].upper[k], nodes[second_child].upper[k]);
+	}
+	nodes[index].second_child_offset = second_child;
+	return index;
+}
+
+
+// leaf of a primitive range with its keyframe bounds, a range longer than a leaf counts is split
+// into halves of whole leaves (as by FlatBVH::flatten_leaf)
+uint32_t MotionBVH::flatten_leaf(const Segment& segment, const size_t offset, const size_t count)
+{
+	const auto index = static_cast<uint32_t>(nodes.size());
+	nodes.emplace_back();
+
+	if (count <= UINT16_MAX) {
+		AABB key_box[2];
+		for (size_t i = 0; i < count; ++i) {
+			for (int k = 0; k < 2; ++k) {
+				const real time = k == 0 ? segment.time0 : segment.time1;
+				AABB object_box;
+				if (!primitives[offset + i]->bounding_box(time, time, object_box))
+					assert(false && "No bounding box in MotionBVH constructor.\n");
+				key_box[k] = i == 0 ? object_box : surrounding_box(key_box[k], object_box);
+			}
+		}
+		for (int k = 0; k < 2; ++k) {
+			nodes[index].lower[k] = key_box[k].min();
+			nodes[index].upper[k] = key_box[k].max();
+		}
+		nodes[index].primitives_offset = static_cast<uint32_t>(offset);
+		nodes[index].primitives_count = static_cast<uint16_t>(count);
+		return index;
+	}
+
+	const size_t leaves = (count + UINT16_MAX - 1) / UINT16_MAX;
+	const size_t first_count = leaves / 2 * UINT16_MAX;
+	auto first_child = flatten_leaf(segment, offset, first_count);
+	// nodes may be reallocated by the recursive calls - index instead of reference
+	auto second_child = flatten_leaf(segment, offset + first_count, count - first_count);
+	for (int k = 0; k < 2; ++k) {
+		nodes[index].lower[k] = glm::min(nodes[first_child].lower[k], nodes[second_child].lower[k]);
+		nodes[index].upper[k] = glm::max(nodes[first_child].upper[k], nodes[second_child].upper[k]);
+	}
+	nodes[index].second_child_offset = second_child;
+	return index;
+}
+
+
+bool MotionBVH::closest_hit(const Ray& ray, real t_min, real t_max, HitInfo& hit) const
+{
+	if (segments.empty())
+		return false;
+
+	// rays outside of the shutter use the first or the last segment, linear motion is extrapolated
+	const real shutter = segments.back().time1 - segments.front().time0;
+	const real position = shutter > 0.0 ? (ray.time() - segments.front().time0) / shutter * segments.size() : 0.0;
+	const auto& segment = segments[static_cast<size_t>(glm::clamp(position, real(0), static_cast<real>(segments.size() - 1)))];
+	const real duration = segment.time1 - segment.time0;
+	const real u = duration > 0.0 ? (ray.time() - segment.time0) / duration : 0.0;
+
+	const point3 orig = ray.origin();
+	const vec3 inv_dir = real(1) / ray.direction();
+	const int dir_is_neg[3] = { inv_dir.x < 0.0, inv_dir.y < 0.0, inv_dir.z < 0.0 };
+
+	uint32_t to_visit[max_depth];
+	size_t to_visit_count = 0;
+	uint32_t current = segment.root;
+	bool is_intersect = false;
+
+	while (true) {
+		const auto& node = nodes[current];
+		if (node.intersect(orig, inv_dir, dir_is_neg, u, t_min, t_max)) {
+			if (node.primitives_count > 0) {
+				const auto* objects = primitives.data() + node.primitives_offset;
+				for (uint16_t i = 0; i < node.primitives_count; ++i) {
+					if (objects[i]->closest_hit(ray, t_min, t_max, hit)) {
+						is_intersect = true;
+						t_max = hit.t;
+					}
+				}
+				if (to_visit_count == 0)
+					break;
+				current = to_visit[--to_visit_count];
+			}
+			else {
+				// visit the near child first, the far one may be culled by the closer hit
+				if (dir_is_neg[node.axis]) {
+					to_visit[to_visit_count++] = current + 1;
+					current = node.second_child_offset;
+				}
+				else {
+					to_visit[to_visit_count++] = node.second_child_offset;
+					current = current + 1;
+				}
+			}
+		}
+		else {
+			if (to_visit_count == 0)
+				break;
+			current = to_visit[--to_visit_count];
+		}
+	}
+
+	return is_intersect;
+}
+
+
+bool MotionBVH::occluded(const Ray& ray, real t_min, real t_max) const
+{
+	if (segments.empty())
+		return false;
+
+	const real shutter = segments.back().time1 - segments.front().time0;
+	const real position = shutter > 0.0 ? (ray.time() - segments.front().time0) / shutter * segments.size() : 0.0;
+	const auto& segment = segments[static_cast<size_t>(glm::clamp(position, real(0), static_cast<real>(segments.size() - 1)))];
+	const real duration = segment.time1 - segment.time0;
+	const real u = duration > 0.0 ? (ray.time() - segment.time0) / duration : 0.0;
+
+	const point3 orig = ray.origin();
+	const vec3 inv_dir = real(1) / ray.direction();
+	const int dir_is_neg[3] = { inv_dir.x < 0.0, inv_dir.y < 0.0, inv_dir.z < 0.0 };
+
+	uint32_t to_visit[max_depth];
+	size_t to_visit_count = 0;
+	uint32_t current = segment.root;
+
+	while (true) {
+		const auto& node = nodes[current];
+		if (node.intersect(orig, inv_dir, dir_is_neg, u, t_min, t_max)) {
+			if (node.primitives_count > 0) {
+				const auto* objects = primitives.data() + node.primitives_offset;
+				for (uint16_t i = 0; i < node.primitives_count; ++i) {
+					if (objects[i]->occluded(ray, t_min, t_max))
+						return true;
+				}
+				if (to_visit_count == 0)
+					break;
+				current = to_visit[--to_visit_count];
+			}
+			else {
+				to_visit[to_visit_count++] = node.second_child_offset;
+				current = current + 1;
+			}
+		}
+		else {
+			if (to_visit_count == 0)
+				break;
+			current = to_visit[--to_visit_count];
+		}
+	}
+
+	return false;
+}
+
+
+bool MotionBVH::bounding_box(real /*time0*/, real /*time1*/, AABB& output_box) const
+{
+	if (segments.empty())
+		return false;
+
+	// bounds of the whole shutter interval
+	for (size_t s = 0; s < segments.size(); ++s) {
+		const auto& root = nodes[segments[s].root];
+		AABB segment_box(glm::min(root.lower[0], root.lower[1]), glm::max(root.upper[0], root.upper[1]));
+		output_box = s == 0 ? segment_box : surrounding_box(output_box, segment_box);
+	}
+	return true;
+}
+
+
+// cost of a ray at a uniformly distributed time, node areas are taken at the middle of the segment
+BVHCostReport MotionBVH::cost_report(const BVHBuildOption& option) const
+{
+	BVHCostReport report;
+	for (const auto& segment : segments) {
+		BVHCostReport segment_report;
+		collect_cost(segment_report, option, segment.root, nodes[segment.root].box(0.5).surface_area(), 1);
+		report.interior_nodes += segment_report.interior_nodes;
+		report.leaf_nodes += segment_report.leaf_nodes;
+		report.primitives += segment_report.primitives;
+		report.max_depth = std::max(report.max_depth, segment_report.max_depth);
+		report.sah_cost += segment_report.sah_cost / segments.size();
+	}
+	report.memory = nodes.size() * sizeof(MotionBVHNode) + primitives.size() * sizeof(shared_ptr<IIntersect>);
+	// every segment references each primitive
+	if (option.builder == BVH_BUILDER_SBVH)
+		report.duplicates = duplicate_references(primitives, segments.size());
+	return report;
+}
+
+
+void MotionBVH::collect_cost(BVHCostReport& report, const BVHBuildOption& option, const uint32_t index, const real root_area, const size_t depth) const
+{
+	const auto& node = nodes[index];
+	auto area_ratio = root_area > 0.0 ? node.box(0.5).surface_area() / root_area : 1.0;
+	report.max_depth = std::max(report.max_depth, depth);
+
+	if (node.primitives_count > 0) {
+		report.leaf_nodes += 1;
+		report.primitives += node.primitives_count;
+		report.sah_cost += area_ratio * option.intersect_cost * node.primitives_count;
+		return;
+	}
+
+	report.interior_nodes += 1;
+	report.sah_cost += area_ratio * option.traversal_cost;
+	collect_cost(report, option, index + 1, root_area, depth + 1);
+	collect_cost(report, option, node.second_child_offset, root_area, depth + 1);
+}
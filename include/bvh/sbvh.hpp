@@ -0,0 +1,395 @@
+#pragma once
+#include <Intersect.hpp>
+#include <volumetric.hpp>
+#include <cstdint>
+
+/*
+	Spatial split BVH - besides binned object splits a node may be split by a plane which clips
+	the primitive references crossing it, so a primitive can be referenced by both children.
+	Spatial splits are tried only where children of the best object split overlap, and the count of
+	duplicated references is capped by BVHBuildOption::max_duplication.
+	Martin Stich, Heiko Friedrich, Andreas Dietrich, "Spatial Splits in Bounding Volume Hierarchies", 2009
+	Volumes are never duplicated: ConstantVolume samples its scattering distance randomly on every test.
+	The added references are reported as BVHCostReport::duplicates of the built structure.
+*/
+
+class SBVHBuilder
+{
+public:
+	SBVHBuilder(const BVHBuildOption& opt = BVHBuildOption()) : option(opt) {}
+
+	shared_ptr<BVH_Node> build(const std::vector<shared_ptr<IIntersect>>& src_objects,
+		size_t start, size_t end, real time0, real time1);
+
+private:
+	static constexpr size_t max_bins = 64;
+	static constexpr size_t max_spatial_depth = 48; // deeper nodes use object splits only, FlatBVH stack is 64
+
+	struct Reference
+	{
+		AABB box; // clipped bounds of the primitive
+		uint32_t index; // index of the object in the source list
+		bool splittable;
+	};
+
+	struct Bin
+	{
+		AABB box;
+		bool empty = true;
+		size_t count = 0; // object split: references, spatial split: references entering the bin
+		size_t exit = 0; // spatial split: references leaving the bin
+
+		void grow(const AABB& b) {
+			box = empty ? b : surrounding_box(box, b);
+			empty = false;
+		}
+	};
+
+	struct Split
+	{
+		int axis = -1;
+		size_t bin = 0; // last bin on the left side
+		real origin = 0.0;
+		real scale = 0.0;
+		real cost = infinity;
+		AABB left_box;
+		AABB right_box;
+	};
+
+	void build_node(BVH_Node& node, std::vector<Reference>& refs, size_t depth);
+	Split find_object_split(const std::vector<Reference>& refs, const AABB& box) const;
+	Split find_spatial_split(const std::vector<Reference>& refs, const AABB& box) const;
+	void ref_bins(const Reference& ref, const Split& split, size_t& first, size_t& last) const;
+	bool clip(const Reference& ref, const AABB& region, Reference& output) const;
+	size_t bin_count() const { return std::min(std::max<size_t>(option.sah_bins, 2), max_bins); }
+
+	BVHBuildOption option;
+	const std::vector<shared_ptr<IIntersect>>* objects = nullptr;
+	real tm0 = 0.0;
+	real tm1 = 1.0;
+	real root_area = 0.0;
+	size_t duplication_budget = 0;
+};
+
+
+shared_ptr<BVH_Node> SBVHBuilder::build(const std::vector<shared_ptr<IIntersect>>& src_objects,
+										size_t start, size_t end, real time0, real time1)
+{
+	assert(end > start && "Empty object list in SBVHBuilder.\n");
+	objects = &src_objects;
+	tm0 = time0;
+	tm1 = time1;
+	duplication_budget = static_cast<size_t>(option.max_duplication * (end - start));
+
+	std::vector<Reference> refs(end - start);
+	for (size_t i = start; i < end; ++i) {
+		auto& ref = refs[i - start];
+		ref.index = static_cast<uint32_t>(i);
+		ref.splittable = std::dynamic_pointer_cast<ConstantVolume>(src_objects[i]) == nullptr;
+		if (!src_objects[i]->bounding_box(time0, time1, ref.box))
+			assert(false && "No bounding box in SBVHBuilder.\n");
+	}
+
+	AABB root_box = refs[0].box;
+	for (const auto& ref : refs)
+		root_box = surrounding_box(root_box, ref.box);
+	root_area = root_box.surface_area();
+
+	auto root = make_shared<BVH_Node>();
+	build_node(*root, refs, 1);
+	return root;
+}
+
+
+void SBVHBuilder::build_node(BVH_Node& node, std::vector<Reference>& refs, size_t depth)
+{
+	node.box = refs[0].box;
+	for (const auto& ref : refs)
+		node.box = surrounding_box(node.box, ref.box);
+
+	Split split;
+	bool spatial = false;
+	if (refs.size() > 1) {
+		split = find_object_split(refs, node.box);
+
+		// spatial split only pays off where the children of the object split overlap
+		if (split.axis >= 0 && duplication_budget > 0 && depth < max_spatial_depth && root_area > 0.0) {
+			const point3 small = glm::max(split.left_box.min(), split.right_box.min());
+			const point3 big = glm::min(split.left_box.max(), split.right_box.max());
+			const bool overlap = small.x < big.x && small.y < big.y && small.z < big.z;
+			if (overlap && AABB(small, big).surface_area() / root_area > option.spatial_split_alpha) {
+				auto spatial_split = find_spatial_split(refs, node.box);
+				if (spatial_split.cost < split.cost) {
+					split = spatial_split;
+					spatial = true;
+				}
+			}
+		}
+		else if (split.axis < 0 && duplication_budget > 0 && depth < max_spatial_depth) {
+			// coincident centroids - only a plane may separate the references
+			auto spatial_split = find_spatial_split(refs, node.box);
+			if (spatial_split.axis >= 0) {
+				split = spatial_split;
+				spatial = true;
+			}
+		}
+	}
+
+	const real leaf_cost = option.intersect_cost * refs.size();
+	if (refs.size() == 1 || (refs.size() <= option.max_leaf_size && (split.axis < 0 || split.cost >= leaf_cost))) {
+		node.objects.reserve(refs.size());
+		for (const auto& ref : refs)
+			node.objects.push_back((*objects)[ref.index]);
+		return;
+	}
+
+	std::vector<Reference> left_refs;
+	std::vector<Reference> right_refs;
+	if (split.axis >= 0 && !spatial) {
+		for (const auto& ref : refs) {
+			const point3 centroid = real(0.5) * (ref.box.min() + ref.box.max());
+			auto b = static_cast<size_t>((centroid[split.axis] - split.origin) * split.scale);
+			(std::min(b, bin_count() - 1) <= split.bin ? left_refs : right_refs).push_back(ref);
+		}
+	}
+	else if (spatial) {
+		const real position = split.origin + (split.bin + 1) / split.scale;
+		for (const auto& ref : refs) {
+			size_t first, last;
+			ref_bins(ref, split, first, last);
+			if (last <= split.bin) {
+				left_refs.push_back(ref);
+				continue;
+			}
+			if (first > split.bin) {
+				right_refs.push_back(ref);
+				continue;
+			}
+
+			// reference crosses the plane - both parts are clipped, an empty part is dropped
+			point3 left_max = ref.box.max();
+			point3 right_min = ref.box.min();
+			left_max[split.axis] = position;
+			right_min[split.axis] = position;
+			Reference left_part, right_part;
+			const bool has_left = clip(ref, AABB(ref.box.min(), left_max), left_part);
+			const bool has_right = clip(ref, AABB(right_min, ref.box.max()), right_part);
+			if (has_left)
+				left_refs.push_back(left_part);
+			if (has_right)
+				right_refs.push_back(right_part);
+			if (!has_left && !has_right) // numerically empty clips, keep the reference whole
+				left_refs.push_back(ref);
+			if (has_left && has_right && duplication_budget > 0)
+				duplication_budget -= 1;
+		}
+	}
+	if (split.axis < 0 || left_refs.empty() || right_refs.empty()) {
+		// no plane separates the references - split the list in halves
+		left_refs.assign(refs.begin(), refs.begin() + refs.size() / 2);
+		right_refs.assign(refs.begin() + refs.size() / 2, refs.end());
+		auto extent = node.box.max() - node.box.min();
+		split.axis = (extent.x > extent.y && extent.x > extent.z) ? 0 : (extent.y > extent.z ? 1 : 2);
+		spatial = false;
+	}
+
+	node.axis = split.axis;
+	// references of the node are not needed during the build of its subtrees
+	std::vector<Reference>().swap(refs);
+
+	node.left = make_shared<BVH_Node>();
+	node.right = make_shared<BVH_Node>();
+	build_node(*node.left, left_refs, depth + 1);
+	build_node(*node.right, right_refs, depth + 1);
+}
+
+
+// binned SAH over reference centroids, see BVH_Node::find_split
+SBVHBuilder::Split SBVHBuilder::find_object_split(const std::vector<Reference>& refs, const AABB& box) const
+{
+	const size_t bins_per_axis = bin_count();
+	const real inv_area = box.surface_area() > 0.0 ? 1.0 / box.surface_area() : 1.0;
+
+	point3 centroid_min(infinity);
+	point3 centroid_max(-infinity);
+	for (const auto& ref : refs) {
+		const point3 centroid = real(0.5) * (ref.box.min() + ref.box.max());
+		centroid_min = glm::min(centroid_min, centroid);
+		centroid_max = glm::max(centroid_max, centroid);
+	}
+
+	Split best;
+	Bin bins[max_bins];
+	AABB right_boxes[max_bins];
+	size_t right_counts[max_bins];
+	for (int a = 0; a < 3; ++a) { // xyz
+		const real extent = centroid_max[a] - centroid_min[a];
+		if (extent <= 0.0)
+			continue;
+		const real scale = bins_per_axis / extent;
+
+		std::fill(bins, bins + bins_per_axis, Bin());
+		for (const auto& ref : refs) {
+			const point3 centroid = real(0.5) * (ref.box.min() + ref.box.max());
+			auto b = std::min(static_cast<size_t>((centroid[a] - centroid_min[a]) * scale), bins_per_axis - 1);
+			bins[b].grow(ref.box);
+			bins[b].count += 1;
+		}
+
+		AABB acc_box;
+		size_t acc_count = 0;
+		for (size_t b = bins_per_axis - 1; b > 0; --b) {
+			if (bins[b].count > 0) {
+				acc_box = acc_count == 0 ? bins[b].box : surrounding_box(acc_box, bins[b].box);
+				acc_count += bins[b].count;
+			}
+			right_boxes[b] = acc_box;
+			right_counts[b] = acc_count;
+		}
+
+		acc_count = 0;
+		for (size_t b = 0; b + 1 < bins_per_axis; ++b) {
+			if (bins[b].count > 0) {
+				acc_box = acc_count == 0 ? bins[b].box : surrounding_box(acc_box, bins[b].box);
+				acc_count += bins[b].count;
+			}
+			if (acc_count == 0 || right_counts[b + 1] == 0)
+				continue;
+
+			auto cost = option.traversal_cost + option.intersect_cost * inv_area *
+				(acc_box.surface_area() * acc_count + right_boxes[b + 1].surface_area() * right_counts[b + 1]);
+			if (cost < best.cost) {
+				best.axis = a;
+				best.bin = b;
+				best.origin = centroid_min[a];
+				best.scale = scale;
+				best.cost = cost;
+				best.left_box = acc_box;
+				best.right_box = right_boxes[b + 1];
+			}
+		}
+	}
+	return best;
+}
+
+
+/*
+	References are chopped into equal-width bins of the node bounds, a bin counts the references
+	entering and leaving it. A plane after bin b has entries of bins [0, b] on the left
+	and exits of bins (b, bin_count) on the right, crossing references on both sides.
+*/
+SBVHBuilder::Split SBVHBuilder::find_spatial_split(const std::vector<Reference>& refs, const AABB& box) const
+{
+	const size_t bins_per_axis = bin_count();
+	const real inv_area = box.surface_area() > 0.0 ? 1.0 / box.surface_area() : 1.0;
+
+	Split best;
+	Bin bins[max_bins];
+	AABB right_boxes[max_bins];
+	size_t right_counts[max_bins];
+	for (int a = 0; a < 3; ++a) { // xyz
+		const real extent = box.max()[a] - box.min()[a];
+		if (extent <= 0.0)
+			continue;
+
+		Split axis_split;
+		axis_split.axis = a;
+		axis_split.origin = box.min()[a];
+		axis_split.scale = bins_per_axis / extent;
+		const real width = extent / bins_per_axis;
+
+		std::fill(bins, bins + bins_per_axis, Bin());
+		for (const auto& ref : refs) {
+			size_t first, last;
+			ref_bins(ref, axis_split, first, last);
+			bins[first].count += 1;
+			bins[last].exit += 1;
+			if (first == last) {
+				bins[first].grow(ref.box);
+				continue;
+			}
+			for (size_t b = first; b <= last; ++b) {
+				point3 small = ref.box.min();
+				point3 big = ref.box.max();
+				small[a] = std::max(small[a], axis_split.origin + b * width);
+				big[a] = std::min(big[a], axis_split.origin + (b + 1) * width);
+				Reference part;
+				if (clip(ref, AABB(small, big), part))
+					bins[b].grow(part.box);
+			}
+		}
+
+		AABB acc_box;
+		bool acc_empty = true;
+		size_t acc_count = 0;
+		for (size_t b = bins_per_axis - 1; b > 0; --b) {
+			if (!bins[b].empty) {
+				acc_box = acc_empty ? bins[b].box : surrounding_box(acc_box, bins[b].box);
+				acc_empty = false;
+			}
+			acc_count += bins[b].exit;
+			right_boxes[b] = acc_box;
+			right_counts[b] = acc_count;
+		}
+
+		acc_empty = true;
+		acc_count = 0;
+		for (size_t b = 0; b + 1 < bins_per_axis; ++b) {
+			if (!bins[b].empty) {
+				acc_box = acc_empty ? bins[b].box : surrounding_box(acc_box, bins[b].box);
+				acc_empty = false;
+			}
+			acc_count += bins[b].count;
+			if (acc_count == 0 || right_counts[b + 1] == 0)
+				continue;
+			// duplicates above the remaining budget are not allowed
+			if (acc_count + right_counts[b + 1] - refs.size() > duplication_budget)
+				continue;
+
+			auto cost = option.traversal_cost + option.intersect_cost * inv_area *
+				(acc_box.surface_area() * acc_count + right_boxes[b + 1].surface_area() * right_counts[b + 1]);
+			if (cost < best.cost) {
+				best = axis_split;
+				best.bin = b;
+				best.cost = cost;
+				best.left_box = acc_box;
+				best.right_box = right_boxes[b + 1];
+			}
+		}
+	}
+	return best;
+}
+
+
+// bins covered by the reference, a volume is kept whole in the bin of its centroid
+void SBVHBuilder::ref_bins(const Reference& ref, const Split& split, size_t& first, size_t& last) const
+{
+	const size_t last_bin = bin_count() - 1;
+	auto bin = [&](real x) {
+		auto b = (x - split.origin) * split.scale;
+		return b <= 0.0 ? size_t(0) : std::min(static_cast<size_t>(b), last_bin);
+	};
+
+	if (!ref.splittable) {
+		first = last = bin(real(0.5) * (ref.box.min()[split.axis] + ref.box.max()[split.axis]));
+		return;
+	}
+	first = bin(ref.box.min()[split.axis]);
+	last = std::max(first, bin(ref.box.max()[split.axis]));
+}
+
+
+bool SBVHBuilder::clip(const Reference& ref, const AABB& region, Reference& output) const
+{
+	output = ref;
+	if (!(*objects)[ref.index]->clipped_bounding_box(tm0, tm1, region, output.box))
+		return false;
+
+	// clipped bounds never grow beyond the current reference
+	const point3 small = glm::max(output.box.min(), ref.box.min());
+	const point3 big = glm::min(output.box.max(), ref.box.max());
+	if (small.x > big.x || small.y > big.y || small.z > big.z)
+		return false;
+	output.box = AABB(small, big);
+	return true;
+}
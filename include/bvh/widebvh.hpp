@@ -0,0 +1,472 @@
+#pragma once
+#include <bvh/builder.hpp>
+#include <simd/cpufeatures.hpp>
+#include <cstdint>
+#include <cfloat>
+#include <cmath>
+
+/*
+	Wide BVH (BVH4/BVH8) - binary BVH_Node hierarchy collapsed into nodes with N children,
+	child boxes are stored as float SoA and a ray is tested against all of them in one SIMD slab test:
+	BVH4 - SSE, BVH8 - AVX, scalar loop as fallback if the CPU does not support the instruction set.
+	Holger Dammertz, Johannes Hanika, Alexander Keller, "Shallow Bounding Volume Hierarchies for Fast SIMD Ray Tracing of Incoherent Rays", 2008
+	Manfred Ernst, Guenther Greiner, "Multi Bounding Volume Hierarchies", 2008
+*/
+
+template<int N>
+struct alignas(32) WideBVHNode
+{
+	static constexpr uint32_t empty_slot = UINT32_MAX;
+
+	float lower[3][N]; // child boxes by axis, empty slot: lower = +inf, upper = -inf
+	float upper[3][N];
+	uint32_t child[N]; // interior: node index, leaf: first primitive, empty_slot - no child
+	uint16_t count[N]; // leaf: count of primitives, 0 - interior node
+};
+
+
+// Ray prepared for float slab tests, computed once per ray
+struct WideRay
+{
+	float orig_near[3]; // origin rounded to float so that the distance to the near plane is not overestimated
+	float orig_far[3]; // origin rounded to float so that the distance to the far plane is not underestimated
+	float inv_dir[3];
+	int dir_is_neg[3];
+	float t_min;
+	float t_max;
+};
+
+
+template<int N>
+class WideBVH : public IIntersect
+{
+public:
+	static constexpr size_t max_depth = BVH_Node::max_depth; // children of nodes at this depth are leaves
+	// leaves longer than the 16-bit count are split below max_depth - up to leaf_split_depth levels more
+	static constexpr size_t stack_size = (max_depth + BVH_Node::leaf_split_depth) * (N - 1) + 1;
+
+	WideBVH(const BVH_Node& root);
+	WideBVH(const IntersectList& ilist, real time0, real time1, const BVHBuildOption& option = BVHBuildOption()) :
+		WideBVH(*build_bvh(ilist, time0, time1, option)) {}
+
+	virtual bool closest_hit(const Ray& ray, real t_min, real t_max, HitInfo& hit) const override;
+	virtual bool occluded(const Ray& ray, real t_min, real t_max) const override;
+	virtual bool bounding_box(real /*time0*/, real /*time1*/, AABB& output_box) const override {
+		output_box = box;
+		return !nodes.empty();
+	}
+	virtual int instance_depth() const override { return nested_instance_depth(primitives); }
+
+	BVHCostReport cost_report(const BVHBuildOption& option = BVHBuildOption()) const;
+	bool is_simd() const { return node_test != intersect_node_scalar; }
+
+public:
+	std::vector<WideBVHNode<N>> nodes;
+	std::vector<shared_ptr<IIntersect>> primitives; // primitives in leaf order
+	AABB box;
+
+private:
+	using NodeTest = int (*)(const WideBVHNode<N>& node, const WideRay& ray, float tnear[N]);
+	NodeTest node_test = intersect_node_scalar;
+
+	uint32_t collapse(const BVH_Node& node, const size_t depth);
+	uint32_t collapse_leaf(const AABB& range_box, const size_t offset, const size_t count);
+	static WideBVHNode<N> empty_node();
+	void collect_cost(BVHCostReport& report, const BVHBuildOption& option, const uint32_t index, const real root_area, const size_t depth) const;
+
+	static int intersect_node_scalar(const WideBVHNode<N>& node, const WideRay& ray, float tnear[N]);
+#ifdef RT_X86
+	static int intersect_node_simd(const WideBVHNode<N>& node, const WideRay& ray, float tnear[N]);
+#endif
+};
+
+using BVH4 = WideBVH<4>;
+using BVH8 = WideBVH<8>;
+
+
+/*
+	Conversion of real boxes to float must not shrink them:
+	bounds are rounded outward and padded by a few float ulps
+*/
+inline float wide_round_down(const real x)
+{
+	auto f = static_cast<float>(x - std::fabs(x) * 0x1p-20);
+	return static_cast<real>(f) > x ? std::nextafter(f, -INFINITY) : f;
+}
+
+inline float wide_round_up(const real x)
+{
+	auto f = static_cast<float>(x + std::fabs(x) * 0x1p-20);
+	return static_cast<real>(f) < x ? std::nextafter(f, INFINITY) : f;
+}
+
+/*
+	Far slab distance is scaled by 1 + 2 * gamma(4) to be conservative for float slab test (PBRT 3rd ed., chapter 3.9):
+	the direction is rounded to float and inverted, the distance is a subtraction and a multiplication.
+	The origin is not in the bound - it is rounded outward of each slab by make_wide_ray.
+*/
+constexpr float wide_far_scale = 1.0f + 2.0f * (4.0f * 0x1p-24f) / (1.0f - 4.0f * 0x1p-24f);
+
+
+inline WideRay make_wide_ray(const Ray& ray, const real t_min, const real t_max)
+{
+	WideRay wray;
+	const auto orig = ray.origin();
+	const auto dir = ray.direction();
+	for (int a = 0; a < 3; ++a) {
+		const auto f = static_cast<float>(orig[a]);
+		const auto lower = static_cast<real>(f) > orig[a] ? std::nextafter(f, -INFINITY) : f;
+		const auto upper = static_cast<real>(f) < orig[a] ? std::nextafter(f, INFINITY) : f;
+		wray.inv_dir[a] = 1.0f / static_cast<float>(dir[a]);
+		wray.dir_is_neg[a] = wray.inv_dir[a] < 0.0f;
+		wray.orig_near[a] = wray.dir_is_neg[a] ? lower : upper;
+		wray.orig_far[a] = wray.dir_is_neg[a] ? upper : lower;
+	}
+	wray.t_min = wide_round_down(t_min);
+	wray.t_max = wide_round_up(t_max);
+	return wray;
+}
+
+
+template<int N>
+WideBVH<N>::WideBVH(const BVH_Node& root) : box(root.box)
+{
+	static_assert(N == 4 || N == 8, "WideBVH supports 4 and 8 children per node");
+#ifdef RT_X86
+	const auto& cpu = cpu_features();
+	if ((N == 4 && cpu.sse2) || (N == 8 && cpu.avx))
+		node_test = intersect_node_simd;
+#endif
+	collapse(root, 1);
+}
+
+
+template<int N>
+uint32_t WideBVH<N>::collapse(const BVH_Node& node, const size_t depth)
+{
+	// open the interior child with the largest surface area until node has N children
+	std::vector<const BVH_Node*> children;
+	if (node.is_leaf()) {
+		children.push_back(&node);
+	}
+	else {
+		children.push_back(node.left.get());
+		children.push_back(node.right.get());
+	}
+
+	while (children.size() < N) {
+		int best = -1;
+		real best_area = -infinity;
+		for (size_t i = 0; i < children.size(); ++i) {
+			if (children[i]->is_leaf())
+				continue;
+			auto area = children[i]->box.surface_area();
+			if (area > best_area) {
+				best_area = area;
+				best = static_cast<int>(i);
+			}
+		}
+		if (best < 0)
+			break;
+		const BVH_Node* opened = children[best];
+		children[best] = opened->left.get();
+		children.push_back(opened->right.get());
+	}
+
+	const auto index = static_cast<uint32_t>(nodes.size());
+	nodes.push_back(empty_node());
+
+	for (size_t i = 0; i < children.size(); ++i) {
+		const auto* child = children[i];
+		uint32_t child_index = 0;
+		uint16_t count = 0;
+		if (child->is_leaf() || depth >= max_depth) {
+			const auto offset = primitives.size();
+			child->collect_objects(primitives);
+			const auto range_count = primitives.size() - offset;
+			if (range_count <= UINT16_MAX) {
+				child_index = static_cast<uint32_t>(offset);
+				count = static_cast<uint16_t>(range_count);
+			}
+			else {
+				child_index = collapse_leaf(child->box, offset, range_count);
+			}
+		}
+		else {
+			child_index = collapse(*child, depth + 1);
+		}
+
+		// nodes may be reallocated by the recursive calls - index instead of reference
+		auto& wide = nodes[index];
+		for (int a = 0; a < 3; ++a) {
+			wide.lower[a][i] = wide_round_down(child->box.min()[a]);
+			wide.upper[a][i] = wide_round_up(child->box.max()[a]);
+		}
+		wide.child[i] = child_index;
+		wide.count[i] = count;
+	}
+
+	return index;
+}
+
+
+template<int N>
+WideBVHNode<N> WideBVH<N>::empty_node()
+{
+	WideBVHNode<N> wide;
+	for (int i = 0; i < N; ++i) {
+		for (int a = 0; a < 3; ++a) {
+			wide.lower[a][i] = INFINITY;
+			wide.upper[a][i] = -INFINITY;
+		}
+		wide.child[i] = WideBVHNode<N>::empty_slot;
+		wide.count[i] = 0;
+	}
+	return wide;
+}
+
+
+// node over a primitive range longer than a leaf counts: N parts of whole leaves, a part still longer
+// is split again (at most leaf_split_depth levels), the children share the box of the range
+template<int N>
+uint32_t WideBVH<N>::collapse_leaf(const AABB& range_box, const size_t offset, const size_t count)
+{
+	const auto index = static_cast<uint32_t>(nodes.size());
+	nodes.push_back(empty_node());
+
+	const size_t leaves = (count + UINT16_MAX - 1) / UINT16_MAX;
+	const size_t part_size = (leaves + N - 1) / N * UINT16_MAX;
+	size_t first = offset;
+	for (int i = 0; i < N && first < offset + count; ++i) {
+		const size_t part_count = std::min(part_size, offset + count - first);
+		uint32_t child_index = static_cast<uint32_t>(first);
+		uint16_t leaf_count = 0;
+		if (part_count <= UINT16_MAX)
+			leaf_count = static_cast<uint16_t>(part_count);
+		else
+			child_index = collapse_leaf(range_box, first, part_count);
+
+		// nodes may be reallocated by the recursive calls - index instead of reference
+		auto& wide = nodes[index];
+		for (int a = 0; a < 3; ++a) {
+			wide.lower[a][i] = wide_round_down(range_box.min()[a]);
+			wide.upper[a][i] = wide_round_up(range_box.max()[a]);
+		}
+		wide.child[i] = child_index;
+		wide.count[i] = leaf_count;
+		first += part_count;
+	}
+	return index;
+}
+
+
+template<int N>
+int WideBVH<N>::intersect_node_scalar(const WideBVHNode<N>& node, const WideRay& ray, float tnear[N])
+{
+	int mask = 0;
+	for (int i = 0; i < N; ++i) {
+		auto t_min = ray.t_min;
+		auto t_max = ray.t_max;
+		for (int a = 0; a < 3; ++a) { // xyz
+			auto t0 = ((ray.dir_is_neg[a] ? node.upper[a][i] : node.lower[a][i]) - ray.orig_near[a]) * ray.inv_dir[a];
+			auto t1 = ((ray.dir_is_neg[a] ? node.lower[a][i] : node.upper[a][i]) - ray.orig_far[a]) * ray.inv_dir[a];
+			t_min = t0 > t_min ? t0 : t_min;
+			t_max = t1 < t_max ? t1 : t_max;
+		}
+		tnear[i] = t_min;
+		if (t_min <= t_max * wide_far_scale)
+			mask |= 1 << i;
+	}
+	return mask;
+}
+
+
+#ifdef RT_X86
+/*
+	max(t0, t_min)/min(t1, t_max) return the second operand if the first one is NaN (0 * inf),
+	such slab does not restrict the interval - same as the scalar test
+*/
+template<>
+inline int WideBVH<4>::intersect_node_simd(const WideBVHNode<4>& node, const WideRay& ray, float tnear[4])
+{
+	__m128 t_min = _mm_set1_ps(ray.t_min);
+	__m128 t_max = _mm_set1_ps(ray.t_max);
+	for (int a = 0; a < 3; ++a) { // xyz
+		const float* near_plane = ray.dir_is_neg[a] ? node.upper[a] : node.lower[a];
+		const float* far_plane = ray.dir_is_neg[a] ? node.lower[a] : node.upper[a];
+		const __m128 orig_near = _mm_set1_ps(ray.orig_near[a]);
+		const __m128 orig_far = _mm_set1_ps(ray.orig_far[a]);
+		const __m128 inv_dir = _mm_set1_ps(ray.inv_dir[a]);
+		const __m128 t0 = _mm_mul_ps(_mm_sub_ps(_mm_load_ps(near_plane), orig_near), inv_dir);
+		const __m128 t1 = _mm_mul_ps(_mm_sub_ps(_mm_load_ps(far_plane), orig_far), inv_dir);
+		t_min = _mm_max_ps(t0, t_min);
+		t_max = _mm_min_ps(t1, t_max);
+	}
+	t_max = _mm_mul_ps(t_max, _mm_set1_ps(wide_far_scale));
+	_mm_storeu_ps(tnear, t_min);
+	return _mm_movemask_ps(_mm_cmple_ps(t_min, t_max));
+}
+
+
+template<>
+inline RT_TARGET("avx") int WideBVH<8>::intersect_node_simd(const WideBVHNode<8>& node, const WideRay& ray, float tnear[8])
+{
+	__m256 t_min = _mm256_set1_ps(ray.t_min);
+	__m256 t_max = _mm256_set1_ps(ray.t_max);
+	for (int a = 0; a < 3; ++a) { // xyz
+		const float* near_plane = ray.dir_is_neg[a] ? node.upper[a] : node.lower[a];
+		const float* far_plane = ray.dir_is_neg[a] ? node.lower[a] : node.upper[a];
+		const __m256 orig_near = _mm256_set1_ps(ray.orig_near[a]);
+		const __m256 orig_far = _mm256_set1_ps(ray.orig_far[a]);
+		const __m256 inv_dir = _mm256_set1_ps(ray.inv_dir[a]);
+		const __m256 t0 = _mm256_mul_ps(_mm256_sub_ps(_mm256_load_ps(near_plane), orig_near), inv_dir);
+		const __m256 t1 = _mm256_mul_ps(_mm256_sub_ps(_mm256_load_ps(far_plane), orig_far), inv_dir);
+		t_min = _mm256_max_ps(t0, t_min);
+		t_max = _mm256_min_ps(t1, t_max);
+	}
+	t_max = _mm256_mul_ps(t_max, _mm256_set1_ps(wide_far_scale));
+	_mm256_storeu_ps(tnear, t_min);
+	return _mm256_movemask_ps(_mm256_cmp_ps(t_min, t_max, _CMP_LE_OQ));
+}
+#endif
+
+
+template<int N>
+bool WideBVH<N>::closest_hit(const Ray& ray, real t_min, real t_max, HitInfo& hit) const
+{
+	if (nodes.empty())
+		return false;
+
+	WideRay wray = make_wide_ray(ray, t_min, t_max);
+
+	uint32_t to_visit[stack_size];
+	size_t to_visit_count = 0;
+	to_visit[to_visit_count++] = 0;
+	bool is_intersect = false;
+
+	while (to_visit_count > 0) {
+		const auto& node = nodes[to_visit[--to_visit_count]];
+		float tnear[N];
+		int mask = node_test(node, wray, tnear);
+		if (mask == 0)
+			continue;
+
+		// order hit children front to back
+		int order[N];
+		int hits = 0;
+		for (int i = 0; i < N; ++i) {
+			if (!(mask & (1 << i)) || node.child[i] == WideBVHNode<N>::empty_slot)
+				continue;
+			int k = hits++;
+			while (k > 0 && tnear[order[k - 1]] > tnear[i]) {
+				order[k] = order[k - 1];
+				--k;
+			}
+			order[k] = i;
+		}
+
+		// leaves are tested immediately, the closer hit shortens the ray for the remaining children
+		for (int k = 0; k < hits; ++k) {
+			const int i = order[k];
+			if (node.count[i] == 0)
+				continue;
+			const auto* objects = primitives.data() + node.child[i];
+			for (uint16_t p = 0; p < node.count[i]; ++p) {
+				if (objects[p]->closest_hit(ray, t_min, t_max, hit)) {
+					is_intersect = true;
+					t_max = hit.t;
+					wray.t_max = wide_round_up(t_max);
+				}
+			}
+		}
+
+		for (int k = hits - 1; k >= 0; --k) {
+			const int i = order[k];
+			if (node.count[i] == 0 && tnear[i] <= wray.t_max * wide_far_scale)
+				to_visit[to_visit_count++] = node.child[i];
+		}
+	}
+
+	return is_intersect;
+}
+
+
+template<int N>
+bool WideBVH<N>::occluded(const Ray& ray, real t_min, real t_max) const
+{
+	if (nodes.empty())
+		return false;
+
+	WideRay wray = make_wide_ray(ray, t_min, t_max);
+
+	uint32_t to_visit[stack_size];
+	size_t to_visit_count = 0;
+	to_visit[to_visit_count++] = 0;
+
+	// any hit - children are not ordered, the first hit ends the traversal
+	while (to_visit_count > 0) {
+		const auto& node = nodes[to_visit[--to_visit_count]];
+		float tnear[N];
+		const int mask = node_test(node, wray, tnear);
+		for (int i = 0; i < N; ++i) {
+			if (!(mask & (1 << i)) || node.child[i] == WideBVHNode<N>::empty_slot)
+				continue;
+			if (node.count[i] == 0) {
+				to_visit[to_visit_count++] = node.child[i];
+				continue;
+			}
+			const auto* objects = primitives.data() + node.child[i];
+			for (uint16_t p = 0; p < node.count[i]; ++p) {
+				if (objects[p]->occluded(ray, t_min, t_max))
+					return true;
+			}
+		}
+	}
+
+	return false;
+}
+
+
+template<int N>
+BVHCostReport WideBVH<N>::cost_report(const BVHBuildOption& option) const
+{
+	BVHCostReport report;
+	if (!nodes.empty())
+		collect_cost(report, option, 0, box.surface_area(), 1);
+	report.memory = nodes.size() * sizeof(WideBVHNode<N>) + primitives.size() * sizeof(shared_ptr<IIntersect>);
+	if (option.builder == BVH_BUILDER_SBVH)
+		report.duplicates = duplicate_references(primitives);
+	return report;
+}
+
+
+template<int N>
+void WideBVH<N>::collect_cost(BVHCostReport& report, const BVHBuildOption& option, const uint32_t index, const real root_area, const size_t depth) const
+{
+	const auto& node = nodes[index];
+	report.interior_nodes += 1;
+	report.max_depth = std::max(report.max_depth, depth);
+
+	bool first = true;
+	AABB node_box;
+	for (int i = 0; i < N; ++i) {
+		if (node.child[i] == WideBVHNode<N>::empty_slot)
+			continue;
+		AABB child_box(point3(node.lower[0][i], node.lower[1][i], node.lower[2][i]),
+					   point3(node.upper[0][i], node.upper[1][i], node.upper[2][i]));
+		node_box = first ? child_box : surrounding_box(node_box, child_box);
+		first = false;
+
+		if (node.count[i] > 0) {
+			auto area_ratio = root_area > 0.0 ? child_box.surface_area() / root_area : 1.0;
+			report.leaf_nodes += 1;
+			report.primitives += node.count[i];
+			report.sah_cost += area_ratio * option.intersect_cost * node.count[i];
+			report.max_depth = std::max(report.max_depth, depth + 1);
+		}
+		else {
+			collect_cost(report, option, node.child[i], root_area, depth + 1);
+		}
+	}
+	report.sah_cost += (root_area > 0.0 ? node_box.surface_area() / root_area : 1.0) * option.traversal_cost;
+}
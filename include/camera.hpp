@@ -1,5 +1,7 @@
+#pragma once
 #include <screen.hpp>
 #include <Ray.hpp>
+#include <Intersect.hpp>
 #include <utility.hpp>
 
 struct CameraOption
@@ -7,19 +9,19 @@ struct CameraOption
 	point3 lookfrom;
 	point3 lookat;
 	vec3 up;
-	double fovy = 20.0;
-	double aperture = 0.0; // depth of field: 0 - without blur and other value give a blur effect
-	double focus_dist = 10.0;
+	real fovy = 20.0;
+	real aperture = 0.0; // depth of field: 0 - without blur and other value give a blur effect
+	real focus_dist = 10.0;
 };
 
 
 class Camera
 {
 public:
-	Camera(const Screen& screen, const CameraOption& cameraopt, const double time0=0.0, const double time1=0.0)
+	Camera(const Screen& screen, const CameraOption& cameraopt, const real time0=0.0, const real time1=0.0)
 	{
 		auto theta = glm::radians(cameraopt.fovy); // vertical field-of-view in degrees
-		auto h = tan(theta / 2); 
+		real h = tan(theta / 2); 
 		auto aspect_ratio = screen.aspectratio;
 		auto viewport_height = screen.viewportheight * h;
 		auto viewport_width = aspect_ratio * viewport_height;
@@ -32,7 +34,7 @@ public:
 		origin = cameraopt.lookfrom;
 		horizontal = cameraopt.focus_dist * viewport_width * u; // horizontal NDC
 		vertical = cameraopt.focus_dist * viewport_height * v; // vertical NDC
-		lower_left_corner = origin - horizontal / 2.0 - vertical / 2.0 - cameraopt.focus_dist * w;
+		lower_left_corner = origin - horizontal / real(2) - vertical / real(2) - cameraopt.focus_dist * w;
 
 		lens_radius = cameraopt.aperture / 2.0;
 
@@ -43,18 +45,42 @@ public:
 		// time
 		tm0 = time0;
 		tm1 = time1;
+
+		// spread angle of the ray cone through a pixel
+		pixel_spread = atan(2 * h / img_height);
+	}
+
+	Ray get_ray(const real s, const real t) const {
+		const vec3 lens = random_unit_in_disk();
+		const real time = random_double();
+		return get_ray(s, t, lens, time);
 	}
 
-	Ray get_ray(const double s, const double t) const {
-		vec3 rd = lens_radius * random_unit_in_disk();
+	// lens - point of the unit disk, time - fraction of the shutter interval in [0, 1)
+	Ray get_ray(const real s, const real t, const vec3& lens, const real time) const {
+		vec3 rd = lens_radius * lens;
 		vec3 offset = u * rd.x + v * rd.y;
-		return Ray( origin + offset, 
+		Ray ray( origin + offset, 
 					lower_left_corner + s * horizontal + t * vertical - origin - offset, 
-					random_double(tm0, tm1));
+					tm0 + (tm1 - tm0) * time);
+		ray.setcone(0.0, pixel_spread);
+		return ray;
+	}
+
+	// one jittered ray per pixel of the tile [i0, i1) x [j0, j1), row by row
+	void get_ray_packet(const lint i0, const lint j0, const lint i1, const lint j1, RayPacket& packet) const {
+		assert((i1 - i0) * (j1 - j0) <= static_cast<lint>(RayPacket::max_size));
+		packet.clear();
+		for (lint j = j0; j < j1; ++j) {
+			for (lint i = i0; i < i1; ++i)
+				packet.add(get_ray((i + random_double()) / (img_width - 1), (j + random_double()) / (img_height - 1)));
+		}
 	}
 
 	lint get_screen_width() const { return img_width; }
 	lint get_screen_height() const { return img_height; }
+	real get_time0() const { return tm0; }
+	real get_time1() const { return tm1; }
 
 private:
 	point3 origin;
@@ -64,8 +90,9 @@ private:
 	vec3 u, v, w;
 	lint img_width;
 	lint img_height;
-	double lens_radius = 0.0;
+	real lens_radius = 0.0;
+	real pixel_spread = 0.0;
 	/* shutter open/close times - for motion blur */
-	double tm0;
-	double tm1;
+	real tm0;
+	real tm1;
 };
\ No newline at end of file
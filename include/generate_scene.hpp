@@ -6,8 +6,30 @@ enum scene_type {
 };
 
 
-shared_ptr<IntersectList> generate_random_scene()
+/*
+	Scene generation draws from its own generator, seeded per scene: object placement does not depend on
+	what was drawn before (other scenes, builders), and the random stream of the render is left as it was.
+	The default seed of std::mt19937 places the objects as the first scene of a run always was.
+*/
+class SceneRandom
 {
+public:
+	explicit SceneRandom(const std::mt19937::result_type seed = std::mt19937::default_seed) : render_stream(random_generator()) {
+		random_generator().seed(seed);
+	}
+	~SceneRandom() { random_generator() = render_stream; }
+
+	SceneRandom(const SceneRandom&) = delete;
+	SceneRandom& operator=(const SceneRandom&) = delete;
+
+private:
+	std::mt19937 render_stream;
+};
+
+
+shared_ptr<IntersectList> generate_random_scene(const BVHBuildOption& bvhopt = BVHBuildOption())
+{
+	SceneRandom scene_random;
 	shared_ptr<IntersectList> world = make_shared<IntersectionList>();
 	auto ground_material = make_shared<Lambertian>(color(0.5, 0.5, 0.5));
 
@@ -52,12 +74,14 @@ shared_ptr<IntersectList> generate_random_scene()
 	world->add(make_shared<Sphere>(point3(0, 1, 0), 1.0, material1));
 	world->add(make_shared<Triangle>(point3(1, 0, 0), point3(1, 2, 0), point3(4, 0, 0), material2));
 
-	return make_shared<IntersectList>(make_shared<BVH_Node>(*world, 0.0, 1.0));
+	return make_shared<IntersectList>(make_accel(*world, 0.0, 1.0, bvhopt));
 }
 
 
-shared_ptr<IntersectList> generate_final_scene()
+// textures - pool of image texture tiles, nullptr - images are loaded whole
+shared_ptr<IntersectList> generate_final_scene(const BVHBuildOption& bvhopt = BVHBuildOption(), const shared_ptr<TextureCache>& textures = nullptr)
 {
+	SceneRandom scene_random;
 	shared_ptr<IntersectList> boxes1 = make_shared<IntersectionList>();
 	auto ground = make_shared<Lambertian>(color(0.48, 0.83, 0.53));
 
@@ -78,7 +102,7 @@ shared_ptr<IntersectList> generate_final_scene()
 
 	shared_ptr<IntersectList> world = make_shared<IntersectionList>();
 
-	world->add(make_shared<BVH_Node>(*boxes1, 0.0, 1.0));
+	world->add(make_accel(*boxes1, 0.0, 1.0, bvhopt));
 
 	auto light = make_shared<DiffuseLight>(color(7, 7, 7));
 	world->add(make_shared<xzRect>(123, 423, 147, 412, 554, light));
@@ -105,22 +129,23 @@ shared_ptr<IntersectList> generate_final_scene()
 	world->add(make_shared<ConstantVolume>(boundary, 0.0001, color(1, 1, 1)));
 
 
-	auto emat = make_shared<Lambertian>(make_shared<ImageTexture>("earthmap.jpg"));
+	auto earth = textures ? make_shared<ImageTexture>("earthmap.jpg", textures) : make_shared<ImageTexture>("earthmap.jpg");
+	auto emat = make_shared<Lambertian>(earth);
 	world->add(make_shared<Sphere>(point3(400, 200, 400), 100, emat));
 	auto pertext = make_shared<PerlinTexture>(0.1);
 	world->add(make_shared<Sphere>(point3(220, 280, 300), 80, make_shared<Lambertian>(pertext)));
 
 
-	shared_ptr<IntersectList> boxes2 = make_shared<IntersectionList>();
+	std::vector<point3> centers;
 	auto white = make_shared<Lambertian>(color(.73, .73, .73));
 	int ns = 1000;
 	for (int j = 0; j < ns; j++) {
-		boxes2->add(make_shared<Sphere>(generate_random_vec(0, 165), 10, white));
+		centers.push_back(generate_random_vec(0, 165));
 	}
 	
-	world->add(make_shared<Translate>(
-					make_shared<Rotate>(make_shared<BVH_Node>(*boxes2, 0.0, 1.0), vec3(0, 1, 0), 15),
-			   vec3(-100, 270, 395)));
+	// sphere cluster is a SphereSet (SIMD batches in its own BVH) placed by an instance transform
+	world->add(make_shared<Instance>(make_shared<SphereSet>(centers, std::vector<real>(ns, 10.0), white, bvhopt),
+			   AffineTransform::translate(vec3(-100, 270, 395)) * AffineTransform::rotate(vec3(0, 1, 0), 15)));
 									  
 	return world;
 }
\ No newline at end of file
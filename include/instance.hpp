@@ -0,0 +1,117 @@
+#pragma once
+#include <Intersect.hpp>
+#include <transform.hpp>
+#include <cassert>
+#include <stdexcept>
+
+/*
+	Instance - placement of shared geometry (usually a bottom-level BVH) by an affine transformation.
+	A ray is transformed into object space once per instance, the bottom-level structure is not copied,
+	so many instances cost memory of the unique geometry only. A BVH built over instances is the top level.
+	Instance is the one transform node of the scene: an instance of an instance (Translate of Rotate etc.)
+	is folded at construction into a single matrix over the innermost object, a ray is transformed once per chain.
+*/
+class Instance : public IIntersect, public IInstance
+{
+public:
+	Instance(shared_ptr<IIntersect> object, const AffineTransform& object_to_world);
+
+	virtual bool closest_hit(const Ray& ray, real t_min, real t_max, HitInfo& hit) const override;
+	virtual Ray to_object(const Ray& ray) const override {
+		return transform.inverse_ray(ray);
+	}
+	virtual void to_world(const Ray& ray, IntersectRecord& irc) const override;
+	virtual bool occluded(const Ray& ray, real t_min, real t_max) const override;
+	virtual bool bounding_box(real /*time0*/, real /*time1*/, AABB& output_box) const override {
+		output_box = bbox;
+		return hasbox;
+	}
+	virtual int instance_depth() const override { return depth; }
+
+public:
+	shared_ptr<IIntersect> i_ptr;
+	AffineTransform transform;
+	bool hasbox;
+	AABB bbox; // world space bounds
+	int depth; // instances on the deepest path into the object, this one included
+
+	// instances the ray of this thread is inside of - nesting deeper than HitInfo holds (Instance over a BVH of Instances ...)
+	// is rejected at construction, the traversal stops there if a list was extended by deeper instances afterwards
+	static inline thread_local int traversal_depth = 0;
+};
+
+
+Instance::Instance(shared_ptr<IIntersect> object, const AffineTransform& object_to_world) : i_ptr(object), transform(object_to_world)
+{
+	// nested node is already folded, its transform is applied first
+	if (const auto* nested = dynamic_cast<const Instance*>(object.get())) {
+		transform = transform * nested->transform;
+		i_ptr = nested->i_ptr;
+	}
+	// a hit records every instance on its path
+	depth = 1 + i_ptr->instance_depth();
+	if (depth > HitInfo::max_instance_depth)
+		throw std::invalid_argument("Instance nesting is deeper than HitInfo::max_instance_depth.");
+	hasbox = i_ptr->bounding_box(0, 1, bbox);
+	if (hasbox)
+		bbox = transform.box(bbox);
+}
+
+
+bool Instance::closest_hit(const Ray& ray, real t_min, real t_max, HitInfo& hit) const
+{
+	assert(traversal_depth < HitInfo::max_instance_depth && "Instance nested deeper than HitInfo holds.\n");
+	if (traversal_depth == HitInfo::max_instance_depth)
+		return false;
+
+	// direction is not normalized in object space, t is the same in both spaces
+	++traversal_depth;
+	const bool is_hit = i_ptr->closest_hit(transform.inverse_ray(ray), t_min, t_max, hit);
+	--traversal_depth;
+	if (!is_hit)
+		return false;
+
+	// the surface is evaluated in object space and mapped back by to_world
+	hit.add_instance(this);
+	return true;
+}
+
+
+bool Instance::occluded(const Ray& ray, real t_min, real t_max) const
+{
+	assert(traversal_depth < HitInfo::max_instance_depth && "Instance nested deeper than HitInfo holds.\n");
+	if (traversal_depth == HitInfo::max_instance_depth)
+		return false;
+
+	++traversal_depth;
+	const bool is_occluded = i_ptr->occluded(transform.inverse_ray(ray), t_min, t_max);
+	--traversal_depth;
+	return is_occluded;
+}
+
+
+void Instance::to_world(const Ray& ray, IntersectRecord& irc) const
+{
+	irc.p = transform.point(irc.p);
+	// front_face of the object space record is kept, the world normal is oriented against the world ray
+	irc.set_face_normal(ray, irc.front_face ? transform.normal(irc.normal) : -transform.normal(irc.normal));
+	irc.uv_scale *= transform.scale();
+}
+
+
+
+/* ============================================== */
+//               Transformation
+class Translate : public Instance
+{
+public:
+	Translate(shared_ptr<IIntersect> i_p, const vec3& displacement) : Instance(i_p, AffineTransform::translate(displacement)) {}
+};
+
+
+// rotation around an arbitrary axis by angle in degrees
+class Rotate : public Instance
+{
+public:
+	Rotate(shared_ptr<IIntersect> i_p, const vec3& axis_rot, const real angle) : Instance(i_p, AffineTransform::rotate(axis_rot, angle)) {}
+};
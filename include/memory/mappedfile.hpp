@@ -0,0 +1,104 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+#ifdef _WIN32
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+/*
+	Read-only memory mapping of a whole file, pages are loaded by the OS on first access.
+	Failed open leaves the mapping empty - data() is nullptr.
+*/
+class MappedFile
+{
+public:
+	explicit MappedFile(const std::string& path);
+	~MappedFile();
+
+	MappedFile(const MappedFile&) = delete;
+	MappedFile& operator=(const MappedFile&) = delete;
+
+	const uint8_t* data() const { return mapped; }
+	size_t size() const { return mapped_size; }
+	bool is_open() const { return mapped != nullptr; }
+
+private:
+	const uint8_t* mapped = nullptr;
+	size_t mapped_size = 0;
+#ifdef _WIN32
+	HANDLE file = INVALID_HANDLE_VALUE;
+	HANDLE mapping = nullptr;
+#endif
+};
+
+
+#ifdef _WIN32
+
+MappedFile::MappedFile(const std::string& path)
+{
+	file = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+	if (file == INVALID_HANDLE_VALUE)
+		return;
+
+	LARGE_INTEGER file_size;
+	if (!GetFileSizeEx(file, &file_size) || file_size.QuadPart == 0)
+		return;
+
+	mapping = CreateFileMappingA(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+	if (mapping == nullptr)
+		return;
+
+	mapped = static_cast<const uint8_t*>(MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0));
+	if (mapped != nullptr)
+		mapped_size = static_cast<size_t>(file_size.QuadPart);
+}
+
+
+MappedFile::~MappedFile()
+{
+	if (mapped != nullptr)
+		UnmapViewOfFile(mapped);
+	if (mapping != nullptr)
+		CloseHandle(mapping);
+	if (file != INVALID_HANDLE_VALUE)
+		CloseHandle(file);
+}
+
+#else
+
+MappedFile::MappedFile(const std::string& path)
+{
+	const int fd = open(path.c_str(), O_RDONLY);
+	if (fd < 0)
+		return;
+
+	struct stat file_stat;
+	if (fstat(fd, &file_stat) == 0 && file_stat.st_size > 0) {
+		void* address = mmap(nullptr, static_cast<size_t>(file_stat.st_size), PROT_READ, MAP_PRIVATE, fd, 0);
+		if (address != MAP_FAILED) {
+			mapped = static_cast<const uint8_t*>(address);
+			mapped_size = static_cast<size_t>(file_stat.st_size);
+		}
+	}
+	// the mapping stays valid after the descriptor is closed
+	close(fd);
+}
+
+
+MappedFile::~MappedFile()
+{
+	if (mapped != nullptr)
+		munmap(const_cast<uint8_t*>(mapped), mapped_size);
+}
+
+#endif
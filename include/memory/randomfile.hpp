@@ -0,0 +1,135 @@
+#pragma once
+#include <algorithm>
+#include <cerrno>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+#ifdef _WIN32
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+/*
+	Read-only file with positional reads - a read does not move a shared file position,
+	so threads read one file concurrently without a lock (pread, ReadFile with an offset).
+	Failed open leaves the file closed - is_open() is false.
+*/
+class RandomAccessFile
+{
+public:
+	explicit RandomAccessFile(const std::string& path);
+	~RandomAccessFile();
+
+	RandomAccessFile(const RandomAccessFile&) = delete;
+	RandomAccessFile& operator=(const RandomAccessFile&) = delete;
+
+	bool is_open() const;
+	uint64_t size() const { return file_size; }
+	// reads size bytes at offset, false if the file is shorter
+	bool read(const uint64_t offset, void* data, const size_t size) const;
+
+private:
+	uint64_t file_size = 0;
+#ifdef _WIN32
+	HANDLE file = INVALID_HANDLE_VALUE;
+#else
+	int fd = -1;
+#endif
+};
+
+
+#ifdef _WIN32
+
+RandomAccessFile::RandomAccessFile(const std::string& path)
+{
+	file = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_FLAG_RANDOM_ACCESS, nullptr);
+	if (file == INVALID_HANDLE_VALUE)
+		return;
+
+	LARGE_INTEGER length;
+	if (GetFileSizeEx(file, &length))
+		file_size = static_cast<uint64_t>(length.QuadPart);
+}
+
+
+RandomAccessFile::~RandomAccessFile()
+{
+	if (file != INVALID_HANDLE_VALUE)
+		CloseHandle(file);
+}
+
+
+bool RandomAccessFile::is_open() const
+{
+	return file != INVALID_HANDLE_VALUE;
+}
+
+
+bool RandomAccessFile::read(const uint64_t offset, void* data, const size_t size) const
+{
+	auto* bytes = static_cast<uint8_t*>(data);
+	size_t done = 0;
+	while (done < size) {
+		OVERLAPPED position = {};
+		position.Offset = static_cast<DWORD>((offset + done) & 0xffffffffull);
+		position.OffsetHigh = static_cast<DWORD>((offset + done) >> 32);
+		DWORD count = 0;
+		const DWORD chunk = static_cast<DWORD>(std::min<size_t>(size - done, 1u << 30));
+		if (!ReadFile(file, bytes + done, chunk, &count, &position) || count == 0)
+			return false;
+		done += count;
+	}
+	return true;
+}
+
+#else
+
+RandomAccessFile::RandomAccessFile(const std::string& path)
+{
+	fd = open(path.c_str(), O_RDONLY);
+	if (fd < 0)
+		return;
+
+	struct stat file_stat;
+	if (fstat(fd, &file_stat) == 0)
+		file_size = static_cast<uint64_t>(file_stat.st_size);
+}
+
+
+RandomAccessFile::~RandomAccessFile()
+{
+	if (fd >= 0)
+		close(fd);
+}
+
+
+bool RandomAccessFile::is_open() const
+{
+	return fd >= 0;
+}
+
+
+bool RandomAccessFile::read(const uint64_t offset, void* data, const size_t size) const
+{
+	auto* bytes = static_cast<uint8_t*>(data);
+	size_t done = 0;
+	while (done < size) {
+		// short reads are continued, interrupted ones repeated
+		const ssize_t count = pread(fd, bytes + done, size - done, static_cast<off_t>(offset + done));
+		if (count < 0 && errno == EINTR)
+			continue;
+		if (count <= 0)
+			return false;
+		done += static_cast<size_t>(count);
+	}
+	return true;
+}
+
+#endif
@@ -0,0 +1,300 @@
+#pragma once
+#include <bvh/indexbvh.hpp>
+#include <triangle.hpp>
+#include <simd/trianglepacket.hpp>
+#include <cstdint>
+
+/*
+	Indexed triangle mesh - vertex positions in structure-of-arrays buffers, three 32-bit vertex indices
+	per triangle and one material for the whole mesh. Triangles are not separate objects: the mesh owns
+	a BVH over triangle indices (IndexBVH) and is a single primitive for the hierarchy of the scene.
+	Ray-triangle test as Triangle: Möller Tomas and Ben Trumbore, "Fast, minimum storage ray-triangle intersection", 1997
+	or, after precompute_transforms(), by the precomputed TriangleTransform of Baldwin and Weber.
+	With SIMD leaves the BVH is built with leaves of up to 4 (SSE) or 8 (AVX) triangles packed into TrianglePacket,
+	a leaf is tested by one float pass and only the hit lanes are confirmed by the real precision test.
+*/
+class TriangleMesh : public IIntersect
+{
+public:
+	TriangleMesh(const std::vector<point3>& positions, const std::vector<uint32_t>& triangle_indices,
+		shared_ptr<Material> m, const BVHBuildOption& option = BVHBuildOption(), const bool simd_leaves = true);
+
+	virtual bool closest_hit(const Ray& ray, real t_min, real t_max, HitInfo& hit) const override;
+	virtual void surface(const Ray& ray, const HitInfo& hit, IntersectRecord& irec) const override;
+	virtual bool occluded(const Ray& ray, real t_min, real t_max) const override;
+	virtual bool bounding_box(real time0, real time1, AABB& output_box) const override;
+
+	size_t vertex_count() const { return px.size(); }
+	size_t triangle_count() const { return indices.size() / 3; }
+	point3 vertex(const uint32_t v) const { return point3(px[v], py[v], pz[v]); }
+	AABB triangle_box(const size_t triangle) const;
+	size_t memory() const; // bytes of vertex, index, transform and BVH buffers
+
+	// opt-in: 12 values per triangle, faster test for meshes traced many times after the build
+	void precompute_transforms();
+
+private:
+	bool hit(const uint32_t triangle, const Ray& ray, real t_min, real t_max, real& t, real& u, real& v) const;
+
+	template<int N>
+	void pack_leaves(std::vector<TrianglePacket<N>>& packets);
+	// closest hit in the packets of a leaf, triangle, u and v of the hit
+	template<int N>
+	bool hit_packets(const std::vector<TrianglePacket<N>>& packets, TrianglePacketTest<N> test, uint32_t offset, uint16_t count,
+		const Ray& ray, PacketRay& packet_ray, real t_min, real& t_max, uint32_t& triangle, real& u, real& v) const;
+
+public:
+	std::vector<real> px, py, pz; // vertex positions
+	std::vector<uint32_t> indices; // 3 vertex indices per triangle
+	std::vector<TriangleTransform> transforms; // per triangle, empty - test on the vertices
+	shared_ptr<Material> material;
+	IndexBVH bvh; // leaves address packets if packet_width > 0
+	int packet_width = 0; // 4, 8 - SIMD leaves, 0 - triangles are tested one by one
+	std::vector<TrianglePacket<4>> packets4;
+	std::vector<TrianglePacket<8>> packets8;
+
+private:
+	TrianglePacketTest<4> packet_test4 = nullptr;
+	TrianglePacketTest<8> packet_test8 = nullptr;
+};
+
+
+TriangleMesh::TriangleMesh(const std::vector<point3>& positions, const std::vector<uint32_t>& triangle_indices,
+	shared_ptr<Material> m, const BVHBuildOption& option, const bool simd_leaves) : indices(triangle_indices), material(m)
+{
+	assert(indices.size() % 3 == 0 && "Count of triangle indices is not a multiple of 3.\n");
+	px.reserve(positions.size());
+	py.reserve(positions.size());
+	pz.reserve(positions.size());
+	for (const auto& p : positions) {
+		px.push_back(p.x);
+		py.push_back(p.y);
+		pz.push_back(p.z);
+	}
+
+	std::vector<AABB> boxes(triangle_count());
+	for (size_t i = 0; i < boxes.size(); ++i) {
+		assert(indices[3 * i] < px.size() && indices[3 * i + 1] < px.size() && indices[3 * i + 2] < px.size());
+		boxes[i] = triangle_box(i);
+	}
+
+	if (!simd_leaves) {
+		bvh.build(boxes, option);
+		return;
+	}
+
+#ifdef RT_X86
+	packet_width = cpu_features().avx ? 8 : 4;
+#else
+	packet_width = 4;
+#endif
+	bvh.build(boxes, option, packet_width);
+	if (packet_width == 8) {
+		packet_test8 = select_triangle_packet_test<8>();
+		pack_leaves(packets8);
+	}
+	else {
+		packet_test4 = select_triangle_packet_test<4>();
+		pack_leaves(packets4);
+	}
+}
+
+
+template<int N>
+void TriangleMesh::pack_leaves(std::vector<TrianglePacket<N>>& packets)
+{
+	// triangles of a leaf are packed in order, the leaf is pointed at its first packet
+	for (auto& node : bvh.nodes) {
+		if (node.primitives_count == 0)
+			continue;
+
+		const auto first_packet = static_cast<uint32_t>(packets.size());
+		for (uint16_t base = 0; base < node.primitives_count; base += N) {
+			TrianglePacket<N> packet = {};
+			for (int lane = 0; lane < N && base + lane < node.primitives_count; ++lane) {
+				const uint32_t triangle = bvh.indices[node.primitives_offset + base + lane];
+				const point3 A = vertex(indices[3 * triangle]);
+				const vec3 AB = vertex(indices[3 * triangle + 1]) - A;
+				const vec3 AC = vertex(indices[3 * triangle + 2]) - A;
+				for (int a = 0; a < 3; ++a) {
+					packet.v0[a][lane] = static_cast<float>(A[a]);
+					packet.e1[a][lane] = static_cast<float>(AB[a]);
+					packet.e2[a][lane] = static_cast<float>(AC[a]);
+				}
+				packet.triangle[lane] = triangle;
+			}
+			packets.push_back(packet);
+		}
+		node.primitives_offset = first_packet;
+	}
+
+	// packets replace the leaf order of triangle indices
+	bvh.indices.clear();
+	bvh.indices.shrink_to_fit();
+}
+
+
+AABB TriangleMesh::triangle_box(const size_t triangle) const
+{
+	const point3 A = vertex(indices[3 * triangle]);
+	const point3 B = vertex(indices[3 * triangle + 1]);
+	const point3 C = vertex(indices[3 * triangle + 2]);
+	// flat triangles get a small thickness as the rects
+	return AABB(glm::min(A, glm::min(B, C)) - vec3(0.0001), glm::max(A, glm::max(B, C)) + vec3(0.0001));
+}
+
+
+bool TriangleMesh::hit(const uint32_t triangle, const Ray& ray, real t_min, real t_max, real& t, real& u, real& v) const
+{
+	if (!transforms.empty())
+		return transforms[triangle].intersect(ray, t_min, t_max, t, u, v);
+
+	const uint32_t* tri = indices.data() + 3 * triangle;
+	const point3 A = vertex(tri[0]);
+	const vec3 AB = vertex(tri[1]) - A;
+	const vec3 AC = vertex(tri[2]) - A;
+	const auto pvec = glm::cross(ray.direction(), AC);
+	const real det = glm::dot(AB, pvec);
+
+	// close to zero - parallel
+	if (det < epsilon && det > neg_epsilon)
+		return false;
+
+	const real inv_det = 1.0 / det;
+	const auto tvec = ray.origin() - A;
+	u = glm::dot(tvec, pvec) * inv_det;
+	if (u < 0.0 || u > 1.0)
+		return false;
+
+	const auto qvec = glm::cross(tvec, AB);
+	v = glm::dot(ray.direction(), qvec) * inv_det;
+	if (v < 0.0 || u + v > 1.0)
+		return false;
+
+	t = glm::dot(AC, qvec) * inv_det;
+	return t >= t_min && t <= t_max;
+}
+
+
+template<int N>
+bool TriangleMesh::hit_packets(const std::vector<TrianglePacket<N>>& packets, TrianglePacketTest<N> test, uint32_t offset, uint16_t count,
+	const Ray& ray, PacketRay& packet_ray, real t_min, real& t_max, uint32_t& triangle, real& u, real& v) const
+{
+	bool is_intersect = false;
+	const uint32_t end = offset + (count + N - 1) / N;
+	for (uint32_t p = offset; p < end; ++p) {
+		packet_ray.set_interval(t_min, t_max);
+		float t_nearest;
+		const int mask = test(packets[p], packet_ray, t_nearest);
+		if (mask == 0)
+			continue;
+		for (int lane = 0; lane < N; ++lane) {
+			real t, lane_u, lane_v;
+			if ((mask & (1 << lane)) && hit(packets[p].triangle[lane], ray, t_min, t_max, t, lane_u, lane_v)) {
+				is_intersect = true;
+				t_max = t;
+				triangle = packets[p].triangle[lane];
+				u = lane_u;
+				v = lane_v;
+			}
+		}
+	}
+	return is_intersect;
+}
+
+
+bool TriangleMesh::closest_hit(const Ray& ray, real t_min, real t_max, HitInfo& hit) const
+{
+	uint32_t hit_triangle = 0;
+	real hit_u = 0.0, hit_v = 0.0;
+	bool is_intersect = false;
+	if (packet_width > 0) {
+		PacketRay packet_ray(ray);
+		is_intersect = bvh.intersect_leaves(ray, t_min, t_max, [&](uint32_t offset, uint16_t count, real tmin, real& tmax) {
+			return packet_width == 8 ?
+				hit_packets(packets8, packet_test8, offset, count, ray, packet_ray, tmin, tmax, hit_triangle, hit_u, hit_v) :
+				hit_packets(packets4, packet_test4, offset, count, ray, packet_ray, tmin, tmax, hit_triangle, hit_u, hit_v);
+		});
+	}
+	else {
+		is_intersect = bvh.intersect(ray, t_min, t_max, [&](uint32_t triangle, real tmin, real& tmax) {
+			real t, u, v;
+			if (!TriangleMesh::hit(triangle, ray, tmin, tmax, t, u, v))
+				return false;
+			tmax = t;
+			hit_triangle = triangle;
+			hit_u = u;
+			hit_v = v;
+			return true;
+		});
+	}
+	if (!is_intersect)
+		return false;
+
+	hit.set(t_max, this, hit_triangle, vec2(hit_u, hit_v));
+	return true;
+}
+
+
+void TriangleMesh::surface(const Ray& ray, const HitInfo& hit, IntersectRecord& irec) const
+{
+	const uint32_t* tri = indices.data() + 3 * hit.prim;
+	const point3 A = vertex(tri[0]);
+	const vec3 AB = vertex(tri[1]) - A;
+	const vec3 AC = vertex(tri[2]) - A;
+	const vec3 cross = glm::cross(AB, AC);
+	const vec3 outward_normal = glm::normalize(cross);
+	irec.p = A + hit.uv.x * AB + hit.uv.y * AC;
+	irec.uv = hit.uv;
+	// barycentrics map the triangle to half of the unit square
+	irec.uv_scale = std::sqrt(glm::length(cross));
+	irec.set_face_normal(ray, outward_normal);
+	irec.material = material.get();
+}
+
+
+bool TriangleMesh::occluded(const Ray& ray, real t_min, real t_max) const
+{
+	if (packet_width > 0) {
+		// any hit lane confirmed in real precision ends the traversal
+		PacketRay packet_ray(ray);
+		uint32_t triangle;
+		real u, v;
+		return bvh.occluded_leaves(ray, t_min, t_max, [&](uint32_t offset, uint16_t count, real tmin, real tmax) {
+			return packet_width == 8 ?
+				hit_packets(packets8, packet_test8, offset, count, ray, packet_ray, tmin, tmax, triangle, u, v) :
+				hit_packets(packets4, packet_test4, offset, count, ray, packet_ray, tmin, tmax, triangle, u, v);
+		});
+	}
+
+	return bvh.occluded(ray, t_min, t_max, [&](uint32_t triangle, real tmin, real tmax) {
+		real t, u, v;
+		return hit(triangle, ray, tmin, tmax, t, u, v);
+	});
+}
+
+
+bool TriangleMesh::bounding_box(real /*time0*/, real /*time1*/, AABB& output_box) const
+{
+	if (bvh.empty())
+		return false;
+	output_box = bvh.bounds();
+	return true;
+}
+
+
+void TriangleMesh::precompute_transforms()
+{
+	transforms.resize(triangle_count());
+	for (size_t i = 0; i < transforms.size(); ++i)
+		transforms[i].set(vertex(indices[3 * i]), vertex(indices[3 * i + 1]), vertex(indices[3 * i + 2]));
+}
+
+
+size_t TriangleMesh::memory() const
+{
+	return 3 * px.capacity() * sizeof(real) + indices.capacity() * sizeof(uint32_t) +
+		transforms.capacity() * sizeof(TriangleTransform) +
+		packets4.capacity() * sizeof(TrianglePacket<4>) + packets8.capacity() * sizeof(TrianglePacket<8>) +
+		bvh.nodes.capacity() * sizeof(LinearBVHNode) + bvh.indices.capacity() * sizeof(uint32_t);
+}
@@ -0,0 +1,216 @@
+#pragma once
+#include <Image.hpp>
+#include <vector>
+#include <cmath>
+
+/*
+	Texels and weights of a bilinear lookup at (u, v) of a level - texel centers are at half-integer
+	coordinates, the edges are clamped. Shared by in-memory and cached (TextureCache) pyramids.
+*/
+struct BilinearTexels
+{
+	BilinearTexels(const real u, const real v, const int width, const int height);
+	// channels are blended in float, the color is made once
+	color blend(const float* t00, const float* t10, const float* t01, const float* t11) const;
+
+	int x0, x1, y0, y1;
+	float wx, wy;
+};
+
+
+BilinearTexels::BilinearTexels(const real u, const real v, const int width, const int height)
+{
+	const float x = static_cast<float>(u * width) - 0.5f;
+	const float y = static_cast<float>(v * height) - 0.5f;
+	const float fx = std::floor(x), fy = std::floor(y);
+	wx = x - fx;
+	wy = y - fy;
+	x0 = glm::clamp(static_cast<int>(fx), 0, width - 1);
+	x1 = glm::clamp(static_cast<int>(fx) + 1, 0, width - 1);
+	y0 = glm::clamp(static_cast<int>(fy), 0, height - 1);
+	y1 = glm::clamp(static_cast<int>(fy) + 1, 0, height - 1);
+}
+
+
+color BilinearTexels::blend(const float* t00, const float* t10, const float* t01, const float* t11) const
+{
+	float c[3];
+	for (int k = 0; k < 3; ++k) {
+		const float top = t00[k] + wx * (t10[k] - t00[k]);
+		const float bottom = t01[k] + wx * (t11[k] - t01[k]);
+		c[k] = top + wy * (bottom - top);
+	}
+	return color(c[0], c[1], c[2]);
+}
+
+
+/*
+	Trilinear lookup of a pyramid of level_count levels, level 0 of width x height texels:
+	bilinear(level, u, v) samples one level. footprint - width of the ray cone in uv units.
+*/
+template<typename Bilinear>
+color trilinear_sample(real u, real v, const real footprint, const int width, const int height, const int level_count, const Bilinear& bilinear)
+{
+	u = glm::clamp(u, real(0), real(1));
+	v = glm::clamp(v, real(0), real(1));
+	// level of detail - log2 of the texels of level 0 covered by the footprint
+	const real texels = footprint * std::sqrt(static_cast<real>(width) * height);
+	const real lod = texels > 1 ? std::log2(texels) : 0;
+	const int last = level_count - 1;
+	if (lod <= 0)
+		return bilinear(0, u, v);
+	if (lod >= last)
+		return bilinear(last, u, v);
+
+	const int level = static_cast<int>(lod);
+	const real w = lod - level;
+	return (1 - w) * bilinear(level, u, v) + w * bilinear(level + 1, u, v);
+}
+
+
+/*
+	MIP pyramid of a texture image - texels are converted once at load to float RGB
+	(scaled by 1/255 as the 8-bit lookup did), every level halves the previous one by a 2x2 box filter down to 1x1.
+	A level is stored in tiles of tile_side x tile_side texels (768 bytes), so the texels of a bilinear lookup
+	share one or a few tiles instead of image rows far apart.
+	A lookup takes the footprint of a ray cone in uv units, picks the two levels around it and blends
+	their bilinear samples (trilinear filtering): distant and secondary hits read small levels which stay in cache.
+	Lance Williams, "Pyramidal Parametrics", 1983
+	Tomas Akenine-Moller et al., "Texture Level of Detail Strategies for Real-Time Ray Tracing", Ray Tracing Gems, 2019
+*/
+class MipPyramid
+{
+public:
+	static constexpr int tile_side = 8;
+	static constexpr size_t tile_floats = 3 * tile_side * tile_side; // RGB texels of a tile
+
+	MipPyramid() {}
+	MipPyramid(const Image& image);
+
+	bool empty() const { return levels.empty(); }
+	int level_count() const { return static_cast<int>(levels.size()); }
+	int width(const int level = 0) const { return levels[level].width; }
+	int height(const int level = 0) const { return levels[level].height; }
+	int tiles_x(const int level) const { return levels[level].tiles_x; }
+	int tiles_y(const int level) const { return (levels[level].height + tile_side - 1) / tile_side; }
+	size_t memory() const; // bytes of all levels
+
+	// texels of a tile, tile index counts rows of tiles from the top
+	const float* tile(const int level, const size_t index) const { return levels[level].texels.data() + index * tile_floats; }
+	// offset of texel (x, y) of a level inside its tile
+	static size_t tile_texel(const int x, const int y) { return 3 * static_cast<size_t>((y % tile_side) * tile_side + x % tile_side); }
+
+	// texel (x, y) of a level, y from the top row of the image
+	color texel(const int level, const int x, const int y) const;
+	// trilinear lookup, footprint - width of the ray cone in uv units (0 - the full resolution level)
+	color sample(real u, real v, const real footprint) const;
+
+private:
+	struct Level
+	{
+		int width = 0;
+		int height = 0;
+		int tiles_x = 0; // tiles per row
+		std::vector<float> texels; // RGB, tile by tile, rows of a tile are contiguous
+	};
+
+	static size_t texel_offset(const Level& level, const int x, const int y);
+	static Level make_level(const int width, const int height);
+	color bilinear(const int level, const real u, const real v) const;
+
+private:
+	std::vector<Level> levels;
+};
+
+
+size_t MipPyramid::texel_offset(const Level& level, const int x, const int y)
+{
+	const size_t tile = static_cast<size_t>(y / tile_side) * level.tiles_x + x / tile_side;
+	return tile * tile_floats + tile_texel(x, y);
+}
+
+
+MipPyramid::Level MipPyramid::make_level(const int width, const int height)
+{
+	Level level;
+	level.width = width;
+	level.height = height;
+	level.tiles_x = (width + tile_side - 1) / tile_side;
+	const int tiles_y = (height + tile_side - 1) / tile_side;
+	level.texels.assign(static_cast<size_t>(level.tiles_x) * tiles_y * tile_floats, 0.0f);
+	return level;
+}
+
+
+MipPyramid::MipPyramid(const Image& image)
+{
+	if (image.get_framebuffer_ptr() == nullptr)
+		return;
+
+	const int channels = static_cast<int>(image.get_num_ch());
+	const byte* data = image.get_framebuffer_ptr();
+	constexpr float color_scale = 1.0f / 255.0f;
+	levels.push_back(make_level(static_cast<int>(image.get_width()), static_cast<int>(image.get_height())));
+	for (int y = 0; y < levels[0].height; ++y) {
+		for (int x = 0; x < levels[0].width; ++x) {
+			const byte* pixel = data + static_cast<size_t>(channels) * (static_cast<size_t>(y) * levels[0].width + x);
+			float* texel = levels[0].texels.data() + texel_offset(levels[0], x, y);
+			// gray images replicate the channel, alpha is dropped
+			for (int c = 0; c < 3; ++c)
+				texel[c] = color_scale * pixel[channels >= 3 ? c : 0];
+		}
+	}
+
+	while (levels.back().width > 1 || levels.back().height > 1) {
+		const Level& src = levels.back();
+		Level dst = make_level(std::max(src.width / 2, 1), std::max(src.height / 2, 1));
+		for (int y = 0; y < dst.height; ++y) {
+			for (int x = 0; x < dst.width; ++x) {
+				// odd sizes - the last row or column is repeated
+				const int x0 = std::min(2 * x, src.width - 1), x1 = std::min(2 * x + 1, src.width - 1);
+				const int y0 = std::min(2 * y, src.height - 1), y1 = std::min(2 * y + 1, src.height - 1);
+				const float* t00 = src.texels.data() + texel_offset(src, x0, y0);
+				const float* t10 = src.texels.data() + texel_offset(src, x1, y0);
+				const float* t01 = src.texels.data() + texel_offset(src, x0, y1);
+				const float* t11 = src.texels.data() + texel_offset(src, x1, y1);
+				float* texel = dst.texels.data() + texel_offset(dst, x, y);
+				for (int c = 0; c < 3; ++c)
+					texel[c] = 0.25f * (t00[c] + t10[c] + t01[c] + t11[c]);
+			}
+		}
+		levels.push_back(std::move(dst));
+	}
+}
+
+
+size_t MipPyramid::memory() const
+{
+	size_t bytes = 0;
+	for (const auto& level : levels)
+		bytes += level.texels.capacity() * sizeof(float);
+	return bytes;
+}
+
+
+color MipPyramid::texel(const int level, const int x, const int y) const
+{
+	const float* t = levels[level].texels.data() + texel_offset(levels[level], x, y);
+	return color(t[0], t[1], t[2]);
+}
+
+
+color MipPyramid::bilinear(const int level, const real u, const real v) const
+{
+	const Level& lv = levels[level];
+	const BilinearTexels b(u, v, lv.width, lv.height);
+	const float* texels = lv.texels.data();
+	return b.blend(texels + texel_offset(lv, b.x0, b.y0), texels + texel_offset(lv, b.x1, b.y0),
+		texels + texel_offset(lv, b.x0, b.y1), texels + texel_offset(lv, b.x1, b.y1));
+}
+
+
+color MipPyramid::sample(real u, real v, const real footprint) const
+{
+	return trilinear_sample(u, v, footprint, levels[0].width, levels[0].height, level_count(),
+		[this](const int level, const real lu, const real lv) { return bilinear(level, lu, lv); });
+}
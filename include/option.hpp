@@ -1,7 +1,62 @@
 #pragma once
+#include <types.hpp>
+#include <string>
+
+// Acceleration structure used for ray traversal
+enum accel_type {
+	ACCEL_BVH_TREE = 0, // tree of BVH_Node
+	ACCEL_BVH_FLAT, // BVH_Node compiled into FlatBVH node array
+	ACCEL_BVH4, // BVH_Node collapsed into 4-wide BVH, SSE node test
+	ACCEL_BVH8, // BVH_Node collapsed into 8-wide BVH, AVX node test
+	ACCEL_MOTION_BVH // node bounds at keyframes interpolated by ray time, for moving primitives
+};
+
+// Hierarchy construction algorithm
+enum bvh_builder_type {
+	BVH_BUILDER_SAH = 0, // top-down binned SAH, best tree quality
+	BVH_BUILDER_LBVH, // Morton code linear BVH, fastest build for per-frame rebuilds
+	BVH_BUILDER_SBVH // binned SAH with spatial splits, for long, thin and overlapping primitives
+};
+
+// Light transport integrator of the renderer
+enum integrator_type {
+	INTEGRATOR_RECURSIVE = 0, // depth-first recursion per camera ray, the reference
+	INTEGRATOR_WAVEFRONT // queues of path states, stages as batched loops binned by material
+};
+
+// Bounding volume hierarchy build parameters
+struct BVHBuildOption
+{
+	accel_type accel = ACCEL_BVH_FLAT;
+	bvh_builder_type builder = BVH_BUILDER_SAH;
+	size_t max_leaf_size = 4; // maximum count of primitives in a leaf node
+	size_t sah_bins = 16; // number of centroid bins per axis for SAH split search
+	double traversal_cost = 1.0; // SAH cost of one interior node visit
+	double intersect_cost = 1.0; // SAH cost of one primitive intersection
+	size_t parallel_min_span = 4096; // subtrees with more primitives are built by the thread pool (_USE_THREAD)
+	size_t build_threads = 0; // 0 - hardware concurrency
+	size_t morton_bits = 30; // LBVH: length of Morton codes, 30 or 63 bits
+	size_t treelet_size = 0; // LBVH: leaves of a treelet for SAH reoptimization, 0 - disabled, at most 7
+	double max_duplication = 0.3; // SBVH: duplicated references per primitive at most
+	double spatial_split_alpha = 1e-5; // SBVH: spatial splits are tried if children overlap more than alpha * root area
+	size_t motion_segments = 1; // motion BVH: shutter interval is split into segments with separate subtrees
+	std::string cache_dir; // directory of the on-disk FlatBVH cache, empty - cache is disabled; SBVH builds are not cached
+};
+
+// Image textures
+struct TextureOption
+{
+	size_t cache_size = 0; // bytes of the tile pool shared by image textures (TextureCache), 0 - textures are loaded whole into memory
+	std::string tile_dir; // directory of the tiled texture files, empty - next to the source images
+	size_t max_open_files = 64; // tiled texture files open at a time, the least recently used is closed
+};
 
 using Option = struct RayTracerOption
 {
 	const int maxdepth = 25;
 	const lint sample_per_pixel = 1500;
+	int packet_side = 0; // 0 - ray by ray, otherwise camera rays of packet_side x packet_side pixel tiles are traced as packets (at most 8)
+	const integrator_type integrator = INTEGRATOR_RECURSIVE;
+	BVHBuildOption bvh;
+	TextureOption texture;
 };
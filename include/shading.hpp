@@ -0,0 +1,62 @@
+#pragma once
+#include <Intersect.hpp>
+#include <Material.hpp>
+#include <Light.hpp>
+
+/*
+	Evaluation of the material of a hit by a switch over material_type - built-in materials are final,
+	the calls below are direct and their constant textures are folded (TextureRef), so a bounce
+	off a Lambertian with a solid albedo makes no indirect call. User-defined materials are called virtually.
+*/
+
+inline bool material_scatter(const Material& m, const Ray& ray, const IntersectRecord& irc, color& attenuation, Ray& scattered)
+{
+	switch (m.type) {
+	case MATERIAL_LAMBERTIAN:
+		return static_cast<const Lambertian&>(m).scatter(ray, irc, attenuation, scattered);
+	case MATERIAL_METAL:
+		return static_cast<const Metal&>(m).scatter(ray, irc, attenuation, scattered);
+	case MATERIAL_DIELECTRIC:
+		return static_cast<const Dielectric&>(m).scatter(ray, irc, attenuation, scattered);
+	case MATERIAL_ISOTROPIC:
+		return static_cast<const Isotropic&>(m).scatter(ray, irc, attenuation, scattered);
+	case MATERIAL_DIFFUSE_LIGHT:
+		return false;
+	default:
+		return m.scatter(ray, irc, attenuation, scattered);
+	}
+}
+
+
+/*
+	Spread angle a scatter adds to the ray cone: none for mirrors and glass (the curvature of the surface
+	is not accounted), the fuzz for fuzzy metals and a wide cone for diffuse lobes - a diffuse bounce
+	lands far from the texels around its ray and needs a coarse level only.
+*/
+const real diffuse_cone_spread = pi / 4;
+
+inline real material_cone_spread(const Material& m)
+{
+	switch (m.type) {
+	case MATERIAL_METAL:
+		return static_cast<const Metal&>(m).fuzzier;
+	case MATERIAL_DIELECTRIC:
+		return 0.0;
+	default:
+		return diffuse_cone_spread;
+	}
+}
+
+
+// only lights of the built-in materials emit
+inline color material_emitted(const Material& m, real u, real v, const point3& p)
+{
+	switch (m.type) {
+	case MATERIAL_DIFFUSE_LIGHT:
+		return static_cast<const DiffuseLight&>(m).emitted(u, v, p);
+	case MATERIAL_USER:
+		return m.emitted(u, v, p);
+	default:
+		return blackcolor;
+	}
+}
@@ -0,0 +1,71 @@
+#pragma once
+
+/*
+	Runtime CPU feature check for SIMD code paths.
+	SIMD kernels are compiled with per-function target attributes and selected at runtime,
+	the binary itself does not require any instruction set beyond the compiler default.
+*/
+
+#if defined(__x86_64__) || defined(_M_X64) || defined(__i386__) || defined(_M_IX86)
+#define RT_X86 1
+#include <immintrin.h>
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+#endif
+
+#if defined(RT_X86) && (defined(__GNUC__) || defined(__clang__))
+#define RT_TARGET(isa) __attribute__((target(isa)))
+#else
+#define RT_TARGET(isa)
+#endif
+
+
+struct CPUFeatures
+{
+	bool sse2 = false;
+	bool sse41 = false;
+	bool avx = false;
+	bool avx2 = false;
+	bool fma = false;
+};
+
+
+inline CPUFeatures detect_cpu_features()
+{
+	CPUFeatures features;
+#if defined(RT_X86) && defined(_MSC_VER)
+	int info[4] = { 0 };
+	__cpuid(info, 0);
+	const int max_leaf = info[0];
+
+	__cpuid(info, 1);
+	features.sse2 = (info[3] & (1 << 26)) != 0;
+	features.sse41 = (info[2] & (1 << 19)) != 0;
+	features.fma = (info[2] & (1 << 12)) != 0;
+	// AVX state must be enabled by OS (OSXSAVE and XCR0 bits of XMM/YMM)
+	const bool os_avx = (info[2] & (1 << 27)) != 0 && (_xgetbv(0) & 0x6) == 0x6;
+	features.avx = os_avx && (info[2] & (1 << 28)) != 0;
+	features.fma = features.fma && os_avx;
+
+	if (max_leaf >= 7) {
+		__cpuidex(info, 7, 0);
+		features.avx2 = os_avx && (info[1] & (1 << 5)) != 0;
+	}
+#elif defined(RT_X86)
+	__builtin_cpu_init();
+	features.sse2 = __builtin_cpu_supports("sse2");
+	features.sse41 = __builtin_cpu_supports("sse4.1");
+	features.avx = __builtin_cpu_supports("avx");
+	features.avx2 = __builtin_cpu_supports("avx2");
+	features.fma = __builtin_cpu_supports("fma");
+#endif
+	return features;
+}
+
+
+inline const CPUFeatures& cpu_features()
+{
+	static const CPUFeatures features = detect_cpu_features();
+	return features;
+}
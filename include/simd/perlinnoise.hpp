@@ -0,0 +1,247 @@
+#pragma once
+#include <simd/cpufeatures.hpp>
+#include <cassert>
+#include <cstdint>
+#include <cmath>
+
+/*
+	Perlin turbulence with the octaves in parallel float lanes - octave s of a lane is noise at p * 2^s
+	with weight 2^-s, 4 (SSE4.1) or 8 (AVX2) octaves per pass, the lanes are summed at the end.
+	The point is split once in double precision into an integer cell and a fraction in [0, 1]:
+	cell of octave s is (cell << s) + floor(fraction * 2^s), so cells of all octaves are exact
+	and only the fraction and the gradients are in float.
+	Tables are the permutations and gradients of PerlinTexture in structure-of-arrays buffers.
+*/
+
+struct PerlinTables
+{
+	static constexpr int count_pts = 256;
+	int32_t perm[3][count_pts]; // by axis
+	float grad[3][count_pts]; // gradient by axis
+};
+
+
+// point of the turbulence split into the cell of octave 0 and the fraction inside it
+struct TurbulencePoint
+{
+	int32_t cell[3];
+	float frac[3];
+
+	template<typename Point>
+	TurbulencePoint(const Point& p) {
+		for (int i = 0; i < 3; ++i) {
+			const double fl = std::floor(static_cast<double>(p[i]));
+			cell[i] = static_cast<int32_t>(fl);
+			frac[i] = static_cast<float>(static_cast<double>(p[i]) - fl);
+		}
+	}
+};
+
+
+// |sum of depth octaves of noise|
+using TurbulenceKernel = float (*)(const PerlinTables& tables, const TurbulencePoint& p, const int depth);
+
+
+struct PerlinKernel
+{
+	TurbulenceKernel turbulence;
+	int lanes;
+};
+
+
+// Hermitian cubic (smoothing)
+inline float perlin_smooth(const float t)
+{
+	return t * t * (3.0f - 2.0f * t);
+}
+
+
+inline float turbulence_scalar(const PerlinTables& tables, const TurbulencePoint& p, const int depth)
+{
+	assert(depth <= 24 && "Octaves beyond 24 have no bits of the fraction left.\n");
+	float accum = 0.0f;
+	for (int s = 0; s < depth; ++s) {
+		const float scale = static_cast<float>(1 << s);
+		int32_t i0[3], i1[3];
+		float f[3];
+		for (int a = 0; a < 3; ++a) {
+			const float fs = p.frac[a] * scale;
+			const float c = std::floor(fs);
+			f[a] = fs - c;
+			const uint32_t cell = (static_cast<uint32_t>(p.cell[a]) << s) + static_cast<uint32_t>(c);
+			i0[a] = tables.perm[a][cell & 255];
+			i1[a] = tables.perm[a][(cell + 1) & 255];
+		}
+
+		float d[2][2][2];
+		for (int di = 0; di < 2; ++di)
+			for (int dj = 0; dj < 2; ++dj)
+				for (int dk = 0; dk < 2; ++dk) {
+					const int32_t h = (di ? i1[0] : i0[0]) ^ (dj ? i1[1] : i0[1]) ^ (dk ? i1[2] : i0[2]);
+					d[di][dj][dk] = tables.grad[0][h] * (f[0] - di) + tables.grad[1][h] * (f[1] - dj) + tables.grad[2][h] * (f[2] - dk);
+				}
+
+		const float uu = perlin_smooth(f[0]), vv = perlin_smooth(f[1]), ww = perlin_smooth(f[2]);
+		const float d00 = d[0][0][0] + uu * (d[1][0][0] - d[0][0][0]);
+		const float d10 = d[0][1][0] + uu * (d[1][1][0] - d[0][1][0]);
+		const float d01 = d[0][0][1] + uu * (d[1][0][1] - d[0][0][1]);
+		const float d11 = d[0][1][1] + uu * (d[1][1][1] - d[0][1][1]);
+		const float d0 = d00 + vv * (d10 - d00);
+		const float d1 = d01 + vv * (d11 - d01);
+		accum += (d0 + ww * (d1 - d0)) / scale;
+	}
+	return std::fabs(accum);
+}
+
+
+#ifdef RT_X86
+inline RT_TARGET("sse4.1") __m128i gather4(const int32_t* table, const __m128i index)
+{
+	return _mm_set_epi32(table[_mm_extract_epi32(index, 3)], table[_mm_extract_epi32(index, 2)],
+		table[_mm_extract_epi32(index, 1)], table[_mm_extract_epi32(index, 0)]);
+}
+
+
+inline RT_TARGET("sse4.1") __m128 gather4(const float* table, const __m128i index)
+{
+	return _mm_set_ps(table[_mm_extract_epi32(index, 3)], table[_mm_extract_epi32(index, 2)],
+		table[_mm_extract_epi32(index, 1)], table[_mm_extract_epi32(index, 0)]);
+}
+
+
+inline __m128 lerp4(const __m128 a, const __m128 b, const __m128 t)
+{
+	return _mm_add_ps(a, _mm_mul_ps(t, _mm_sub_ps(b, a)));
+}
+
+
+inline RT_TARGET("sse4.1") float turbulence_simd4(const PerlinTables& tables, const TurbulencePoint& p, const int depth)
+{
+	assert(depth <= 24 && "Octaves beyond 24 have no bits of the fraction left.\n");
+	const __m128i mask = _mm_set1_epi32(255);
+	const __m128i one = _mm_set1_epi32(1);
+	const __m128 three = _mm_set1_ps(3.0f);
+	const __m128 two = _mm_set1_ps(2.0f);
+	__m128 accum = _mm_setzero_ps();
+	for (int base = 0; base < depth; base += 4) {
+		const __m128i octave = _mm_add_epi32(_mm_set1_epi32(base), _mm_set_epi32(3, 2, 1, 0));
+		// 2^s and 2^-s from the exponent bits, lanes past the depth weigh 0
+		const __m128 scale = _mm_castsi128_ps(_mm_slli_epi32(_mm_add_epi32(octave, _mm_set1_epi32(127)), 23));
+		const __m128 weight = _mm_and_ps(_mm_castsi128_ps(_mm_slli_epi32(_mm_sub_epi32(_mm_set1_epi32(127), octave), 23)),
+			_mm_castsi128_ps(_mm_cmplt_epi32(octave, _mm_set1_epi32(depth))));
+		const __m128i int_scale = _mm_cvtps_epi32(scale);
+
+		__m128 f[3];
+		__m128i i0[3], i1[3];
+		for (int a = 0; a < 3; ++a) {
+			const __m128 fs = _mm_mul_ps(_mm_set1_ps(p.frac[a]), scale);
+			const __m128 c = _mm_floor_ps(fs);
+			f[a] = _mm_sub_ps(fs, c);
+			const __m128i cell = _mm_add_epi32(_mm_mullo_epi32(_mm_set1_epi32(p.cell[a]), int_scale), _mm_cvttps_epi32(c));
+			i0[a] = gather4(tables.perm[a], _mm_and_si128(cell, mask));
+			i1[a] = gather4(tables.perm[a], _mm_and_si128(_mm_add_epi32(cell, one), mask));
+		}
+
+		__m128 d[2][2][2];
+		for (int di = 0; di < 2; ++di)
+			for (int dj = 0; dj < 2; ++dj)
+				for (int dk = 0; dk < 2; ++dk) {
+					const __m128i h = _mm_xor_si128(_mm_xor_si128(di ? i1[0] : i0[0], dj ? i1[1] : i0[1]), dk ? i1[2] : i0[2]);
+					const __m128 x = di ? _mm_sub_ps(f[0], _mm_set1_ps(1.0f)) : f[0];
+					const __m128 y = dj ? _mm_sub_ps(f[1], _mm_set1_ps(1.0f)) : f[1];
+					const __m128 z = dk ? _mm_sub_ps(f[2], _mm_set1_ps(1.0f)) : f[2];
+					d[di][dj][dk] = _mm_add_ps(_mm_add_ps(_mm_mul_ps(gather4(tables.grad[0], h), x), _mm_mul_ps(gather4(tables.grad[1], h), y)),
+						_mm_mul_ps(gather4(tables.grad[2], h), z));
+				}
+
+		__m128 smooth[3];
+		for (int a = 0; a < 3; ++a)
+			smooth[a] = _mm_mul_ps(_mm_mul_ps(f[a], f[a]), _mm_sub_ps(three, _mm_mul_ps(two, f[a])));
+		const __m128 d00 = lerp4(d[0][0][0], d[1][0][0], smooth[0]);
+		const __m128 d10 = lerp4(d[0][1][0], d[1][1][0], smooth[0]);
+		const __m128 d01 = lerp4(d[0][0][1], d[1][0][1], smooth[0]);
+		const __m128 d11 = lerp4(d[0][1][1], d[1][1][1], smooth[0]);
+		const __m128 noise = lerp4(lerp4(d00, d10, smooth[1]), lerp4(d01, d11, smooth[1]), smooth[2]);
+		accum = _mm_add_ps(accum, _mm_mul_ps(noise, weight));
+	}
+
+	alignas(16) float lane[4];
+	_mm_store_ps(lane, accum);
+	return std::fabs((lane[0] + lane[1]) + (lane[2] + lane[3]));
+}
+
+
+inline RT_TARGET("avx2") __m256 lerp8(const __m256 a, const __m256 b, const __m256 t)
+{
+	return _mm256_add_ps(a, _mm256_mul_ps(t, _mm256_sub_ps(b, a)));
+}
+
+
+inline RT_TARGET("avx2") float turbulence_simd8(const PerlinTables& tables, const TurbulencePoint& p, const int depth)
+{
+	assert(depth <= 24 && "Octaves beyond 24 have no bits of the fraction left.\n");
+	const __m256i mask = _mm256_set1_epi32(255);
+	const __m256i one = _mm256_set1_epi32(1);
+	const __m256 three = _mm256_set1_ps(3.0f);
+	const __m256 two = _mm256_set1_ps(2.0f);
+	__m256 accum = _mm256_setzero_ps();
+	for (int base = 0; base < depth; base += 8) {
+		const __m256i octave = _mm256_add_epi32(_mm256_set1_epi32(base), _mm256_set_epi32(7, 6, 5, 4, 3, 2, 1, 0));
+		// 2^s and 2^-s from the exponent bits, lanes past the depth weigh 0
+		const __m256 scale = _mm256_castsi256_ps(_mm256_slli_epi32(_mm256_add_epi32(octave, _mm256_set1_epi32(127)), 23));
+		const __m256 weight = _mm256_and_ps(_mm256_castsi256_ps(_mm256_slli_epi32(_mm256_sub_epi32(_mm256_set1_epi32(127), octave), 23)),
+			_mm256_castsi256_ps(_mm256_cmpgt_epi32(_mm256_set1_epi32(depth), octave)));
+
+		__m256 f[3];
+		__m256i i0[3], i1[3];
+		for (int a = 0; a < 3; ++a) {
+			const __m256 fs = _mm256_mul_ps(_mm256_set1_ps(p.frac[a]), scale);
+			const __m256 c = _mm256_floor_ps(fs);
+			f[a] = _mm256_sub_ps(fs, c);
+			const __m256i cell = _mm256_add_epi32(_mm256_sllv_epi32(_mm256_set1_epi32(p.cell[a]), octave), _mm256_cvttps_epi32(c));
+			i0[a] = _mm256_i32gather_epi32(tables.perm[a], _mm256_and_si256(cell, mask), 4);
+			i1[a] = _mm256_i32gather_epi32(tables.perm[a], _mm256_and_si256(_mm256_add_epi32(cell, one), mask), 4);
+		}
+
+		__m256 d[2][2][2];
+		for (int di = 0; di < 2; ++di)
+			for (int dj = 0; dj < 2; ++dj)
+				for (int dk = 0; dk < 2; ++dk) {
+					const __m256i h = _mm256_xor_si256(_mm256_xor_si256(di ? i1[0] : i0[0], dj ? i1[1] : i0[1]), dk ? i1[2] : i0[2]);
+					const __m256 x = di ? _mm256_sub_ps(f[0], _mm256_set1_ps(1.0f)) : f[0];
+					const __m256 y = dj ? _mm256_sub_ps(f[1], _mm256_set1_ps(1.0f)) : f[1];
+					const __m256 z = dk ? _mm256_sub_ps(f[2], _mm256_set1_ps(1.0f)) : f[2];
+					d[di][dj][dk] = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(_mm256_i32gather_ps(tables.grad[0], h, 4), x),
+						_mm256_mul_ps(_mm256_i32gather_ps(tables.grad[1], h, 4), y)), _mm256_mul_ps(_mm256_i32gather_ps(tables.grad[2], h, 4), z));
+				}
+
+		__m256 smooth[3];
+		for (int a = 0; a < 3; ++a)
+			smooth[a] = _mm256_mul_ps(_mm256_mul_ps(f[a], f[a]), _mm256_sub_ps(three, _mm256_mul_ps(two, f[a])));
+		const __m256 d00 = lerp8(d[0][0][0], d[1][0][0], smooth[0]);
+		const __m256 d10 = lerp8(d[0][1][0], d[1][1][0], smooth[0]);
+		const __m256 d01 = lerp8(d[0][0][1], d[1][0][1], smooth[0]);
+		const __m256 d11 = lerp8(d[0][1][1], d[1][1][1], smooth[0]);
+		const __m256 noise = lerp8(lerp8(d00, d10, smooth[1]), lerp8(d01, d11, smooth[1]), smooth[2]);
+		accum = _mm256_add_ps(accum, _mm256_mul_ps(noise, weight));
+	}
+
+	alignas(32) float lane[8];
+	_mm256_store_ps(lane, accum);
+	return std::fabs(((lane[0] + lane[1]) + (lane[2] + lane[3])) + ((lane[4] + lane[5]) + (lane[6] + lane[7])));
+}
+#endif
+
+
+// AVX2 - 8 lanes, SSE4.1 - 4 lanes if the CPU supports it, scalar float loop otherwise
+inline PerlinKernel select_perlin_kernel()
+{
+#ifdef RT_X86
+	const auto& cpu = cpu_features();
+	if (cpu.avx2)
+		return { turbulence_simd8, 8 };
+	if (cpu.sse41)
+		return { turbulence_simd4, 4 };
+#endif
+	return { turbulence_scalar, 1 };
+}
@@ -0,0 +1,188 @@
+#pragma once
+#include <simd/cpufeatures.hpp>
+#include <Ray.hpp>
+#include <cstdint>
+#include <cmath>
+
+/*
+	Nearest hit of one ray among a batch of spheres stored in structure-of-arrays buffers
+	(center by axis and squared radius), 2 (SSE2) or 4 (AVX) spheres per pass in double lanes.
+	Lanes evaluate sphere_root with the same operations in the same order, so a SIMD pass
+	gives the roots of the scalar test bit for bit - there is no confirmation pass.
+	Buffers are read in whole passes: the owner pads them by lanes - 1 entries, the tail lanes are masked.
+*/
+
+// Ray prepared for sphere batch tests
+struct SphereBatchRay
+{
+	double orig[3];
+	double dir[3];
+	double a; // |D|^2 of the quadratic
+
+	SphereBatchRay(const Ray& ray) {
+		for (int i = 0; i < 3; ++i) {
+			orig[i] = ray.origin()[i];
+			dir[i] = ray.direction()[i];
+		}
+		a = dir[0] * dir[0] + dir[1] * dir[1] + dir[2] * dir[2];
+	}
+};
+
+
+// nearest sphere of count spheres in [t_min, t_max], its distance replaces t_max
+using SphereBatchTest = bool (*)(const double* const center[3], const double* radius2, const uint32_t count,
+	const SphereBatchRay& ray, double t_min, double& t_max, uint32_t& nearest);
+
+
+struct SphereBatchKernel
+{
+	SphereBatchTest test;
+	int lanes;
+};
+
+
+inline bool intersect_spheres_scalar(const double* const center[3], const double* radius2, const uint32_t count,
+	const SphereBatchRay& ray, double t_min, double& t_max, uint32_t& nearest)
+{
+	bool is_intersect = false;
+	for (uint32_t i = 0; i < count; ++i) {
+		const double oc[3] = { ray.orig[0] - center[0][i], ray.orig[1] - center[1][i], ray.orig[2] - center[2][i] };
+		const double half_b = oc[0] * ray.dir[0] + oc[1] * ray.dir[1] + oc[2] * ray.dir[2];
+		const double c = (oc[0] * oc[0] + oc[1] * oc[1] + oc[2] * oc[2]) - radius2[i];
+		const double discriminant = half_b * half_b - ray.a * c;
+		if (discriminant < 0)
+			continue;
+		const double sqrtd = sqrt(discriminant);
+
+		double root = (-half_b - sqrtd) / ray.a;
+		if (root < t_min || root > t_max) {
+			root = (-half_b + sqrtd) / ray.a;
+			if (root < t_min || root > t_max)
+				continue;
+		}
+		is_intersect = true;
+		t_max = root;
+		nearest = i;
+	}
+	return is_intersect;
+}
+
+
+#ifdef RT_X86
+// picks the nearest of the lanes of one pass, later spheres win ties as in the scalar loop
+template<int L>
+inline bool nearest_lane(const double (&root)[L], const int mask, const uint32_t base, double& t_max, uint32_t& nearest)
+{
+	bool is_intersect = false;
+	for (int i = 0; i < L; ++i) {
+		if ((mask & (1 << i)) && root[i] <= t_max) {
+			is_intersect = true;
+			t_max = root[i];
+			nearest = base + i;
+		}
+	}
+	return is_intersect;
+}
+
+
+inline bool intersect_spheres_simd2(const double* const center[3], const double* radius2, const uint32_t count,
+	const SphereBatchRay& ray, double t_min, double& t_max, uint32_t& nearest)
+{
+	__m128d orig[3], dir[3];
+	for (int i = 0; i < 3; ++i) {
+		orig[i] = _mm_set1_pd(ray.orig[i]);
+		dir[i] = _mm_set1_pd(ray.dir[i]);
+	}
+	const __m128d a = _mm_set1_pd(ray.a);
+	const __m128d sign = _mm_set1_pd(-0.0);
+	const __m128d lane = _mm_set_pd(1.0, 0.0);
+
+	bool is_intersect = false;
+	for (uint32_t base = 0; base < count; base += 2) {
+		const __m128d tmin = _mm_set1_pd(t_min);
+		const __m128d tmax = _mm_set1_pd(t_max);
+		const __m128d oc0 = _mm_sub_pd(orig[0], _mm_loadu_pd(center[0] + base));
+		const __m128d oc1 = _mm_sub_pd(orig[1], _mm_loadu_pd(center[1] + base));
+		const __m128d oc2 = _mm_sub_pd(orig[2], _mm_loadu_pd(center[2] + base));
+		const __m128d half_b = _mm_add_pd(_mm_add_pd(_mm_mul_pd(oc0, dir[0]), _mm_mul_pd(oc1, dir[1])), _mm_mul_pd(oc2, dir[2]));
+		const __m128d c = _mm_sub_pd(_mm_add_pd(_mm_add_pd(_mm_mul_pd(oc0, oc0), _mm_mul_pd(oc1, oc1)), _mm_mul_pd(oc2, oc2)),
+			_mm_loadu_pd(radius2 + base));
+		const __m128d discriminant = _mm_sub_pd(_mm_mul_pd(half_b, half_b), _mm_mul_pd(a, c));
+		const __m128d valid = _mm_and_pd(_mm_cmpge_pd(discriminant, _mm_setzero_pd()),
+			_mm_cmplt_pd(lane, _mm_set1_pd(static_cast<double>(count - base))));
+		if (_mm_movemask_pd(valid) == 0)
+			continue;
+
+		const __m128d sqrtd = _mm_sqrt_pd(discriminant);
+		const __m128d neg_half_b = _mm_xor_pd(half_b, sign);
+		const __m128d root0 = _mm_div_pd(_mm_sub_pd(neg_half_b, sqrtd), a);
+		const __m128d root1 = _mm_div_pd(_mm_add_pd(neg_half_b, sqrtd), a);
+		const __m128d in0 = _mm_and_pd(_mm_cmpge_pd(root0, tmin), _mm_cmple_pd(root0, tmax));
+		const __m128d in1 = _mm_and_pd(_mm_cmpge_pd(root1, tmin), _mm_cmple_pd(root1, tmax));
+
+		alignas(16) double root[2];
+		_mm_store_pd(root, _mm_or_pd(_mm_and_pd(in0, root0), _mm_andnot_pd(in0, root1)));
+		const int mask = _mm_movemask_pd(_mm_and_pd(valid, _mm_or_pd(in0, in1)));
+		is_intersect |= nearest_lane(root, mask, base, t_max, nearest);
+	}
+	return is_intersect;
+}
+
+
+inline RT_TARGET("avx") bool intersect_spheres_simd4(const double* const center[3], const double* radius2, const uint32_t count,
+	const SphereBatchRay& ray, double t_min, double& t_max, uint32_t& nearest)
+{
+	__m256d orig[3], dir[3];
+	for (int i = 0; i < 3; ++i) {
+		orig[i] = _mm256_set1_pd(ray.orig[i]);
+		dir[i] = _mm256_set1_pd(ray.dir[i]);
+	}
+	const __m256d a = _mm256_set1_pd(ray.a);
+	const __m256d sign = _mm256_set1_pd(-0.0);
+	const __m256d lane = _mm256_set_pd(3.0, 2.0, 1.0, 0.0);
+
+	bool is_intersect = false;
+	for (uint32_t base = 0; base < count; base += 4) {
+		const __m256d tmin = _mm256_set1_pd(t_min);
+		const __m256d tmax = _mm256_set1_pd(t_max);
+		const __m256d oc0 = _mm256_sub_pd(orig[0], _mm256_loadu_pd(center[0] + base));
+		const __m256d oc1 = _mm256_sub_pd(orig[1], _mm256_loadu_pd(center[1] + base));
+		const __m256d oc2 = _mm256_sub_pd(orig[2], _mm256_loadu_pd(center[2] + base));
+		const __m256d half_b = _mm256_add_pd(_mm256_add_pd(_mm256_mul_pd(oc0, dir[0]), _mm256_mul_pd(oc1, dir[1])), _mm256_mul_pd(oc2, dir[2]));
+		const __m256d c = _mm256_sub_pd(_mm256_add_pd(_mm256_add_pd(_mm256_mul_pd(oc0, oc0), _mm256_mul_pd(oc1, oc1)), _mm256_mul_pd(oc2, oc2)),
+			_mm256_loadu_pd(radius2 + base));
+		const __m256d discriminant = _mm256_sub_pd(_mm256_mul_pd(half_b, half_b), _mm256_mul_pd(a, c));
+		const __m256d valid = _mm256_and_pd(_mm256_cmp_pd(discriminant, _mm256_setzero_pd(), _CMP_GE_OQ),
+			_mm256_cmp_pd(lane, _mm256_set1_pd(static_cast<double>(count - base)), _CMP_LT_OQ));
+		if (_mm256_movemask_pd(valid) == 0)
+			continue;
+
+		const __m256d sqrtd = _mm256_sqrt_pd(discriminant);
+		const __m256d neg_half_b = _mm256_xor_pd(half_b, sign);
+		const __m256d root0 = _mm256_div_pd(_mm256_sub_pd(neg_half_b, sqrtd), a);
+		const __m256d root1 = _mm256_div_pd(_mm256_add_pd(neg_half_b, sqrtd), a);
+		const __m256d in0 = _mm256_and_pd(_mm256_cmp_pd(root0, tmin, _CMP_GE_OQ), _mm256_cmp_pd(root0, tmax, _CMP_LE_OQ));
+		const __m256d in1 = _mm256_and_pd(_mm256_cmp_pd(root1, tmin, _CMP_GE_OQ), _mm256_cmp_pd(root1, tmax, _CMP_LE_OQ));
+
+		alignas(32) double root[4];
+		_mm256_store_pd(root, _mm256_blendv_pd(root1, root0, in0));
+		const int mask = _mm256_movemask_pd(_mm256_and_pd(valid, _mm256_or_pd(in0, in1)));
+		is_intersect |= nearest_lane(root, mask, base, t_max, nearest);
+	}
+	return is_intersect;
+}
+#endif
+
+
+// AVX - 4 lanes, SSE2 - 2 lanes if the CPU supports it, scalar loop otherwise
+inline SphereBatchKernel select_sphere_batch_kernel()
+{
+#ifdef RT_X86
+	const auto& cpu = cpu_features();
+	if (cpu.avx)
+		return { intersect_spheres_simd4, 4 };
+	if (cpu.sse2)
+		return { intersect_spheres_simd2, 2 };
+#endif
+	return { intersect_spheres_scalar, 1 };
+}
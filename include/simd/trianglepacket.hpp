@@ -0,0 +1,213 @@
+#pragma once
+#include <simd/cpufeatures.hpp>
+#include <Ray.hpp>
+#include <cstdint>
+#include <cmath>
+
+/*
+	Packet of N triangles (4 - SSE, 8 - AVX) in float SoA lanes, one ray is tested against all of them in one pass
+	by Möller-Trumbore. The test is a conservative filter: barycentric and distance bounds are widened,
+	so float rounding never loses a hit and the owner confirms hit lanes in the precision of real.
+	Rounding of the float inputs and products is relative to the magnitude of the coordinates, not to the triangle:
+	the barycentric slack is that magnitude (origin, vertex, edges, origin - vertex) times the sensitivity
+	of u and v to a displacement (|D x e2| / det, |D| * |e1| / det) times a few float ulps.
+	Empty lanes have zero edges - det is 0 and the NaN/inf of the division fail every comparison.
+	Ingo Wald, "Realtime Ray Tracing and Interactive Global Illumination", PhD thesis, 2004, chapter 7
+*/
+
+template<int N>
+struct alignas(32) TrianglePacket
+{
+	float v0[3][N]; // first vertex by axis
+	float e1[3][N]; // v1 - v0
+	float e2[3][N]; // v2 - v0
+	uint32_t triangle[N]; // index of the triangle of the owner
+};
+
+
+// Ray prepared for float packet tests
+struct PacketRay
+{
+	float orig[3];
+	float dir[3];
+	float orig_norm; // L1 norms
+	float dir_norm;
+	float t_min;
+	float t_max;
+
+	PacketRay(const Ray& ray) {
+		for (int a = 0; a < 3; ++a) {
+			orig[a] = static_cast<float>(ray.origin()[a]);
+			dir[a] = static_cast<float>(ray.direction()[a]);
+		}
+		orig_norm = std::fabs(orig[0]) + std::fabs(orig[1]) + std::fabs(orig[2]);
+		dir_norm = std::fabs(dir[0]) + std::fabs(dir[1]) + std::fabs(dir[2]);
+	}
+
+	void set_interval(const real tmin, const real tmax) {
+		t_min = static_cast<float>(tmin - std::fabs(tmin) * triangle_packet_slack);
+		t_max = static_cast<float>(tmax + std::fabs(tmax) * triangle_packet_slack);
+	}
+
+	static constexpr float triangle_packet_slack = 1e-4f; // relative widening of the distance interval
+	static constexpr float triangle_packet_error = 0x1p-24f; // barycentric slack per unit of magnitude times sensitivity
+};
+
+
+// mask of hit lanes and the nearest distance of them, infinity without a hit
+template<int N>
+using TrianglePacketTest = int (*)(const TrianglePacket<N>& packet, const PacketRay& ray, float& t_nearest);
+
+
+template<int N>
+int intersect_triangles_scalar(const TrianglePacket<N>& packet, const PacketRay& ray, float& t_nearest)
+{
+	auto norm = [](const float x[3]) { return std::fabs(x[0]) + std::fabs(x[1]) + std::fabs(x[2]); };
+	int mask = 0;
+	t_nearest = INFINITY;
+	for (int i = 0; i < N; ++i) {
+		const float v0[3] = { packet.v0[0][i], packet.v0[1][i], packet.v0[2][i] };
+		const float e1[3] = { packet.e1[0][i], packet.e1[1][i], packet.e1[2][i] };
+		const float e2[3] = { packet.e2[0][i], packet.e2[1][i], packet.e2[2][i] };
+		const float tv[3] = { ray.orig[0] - v0[0], ray.orig[1] - v0[1], ray.orig[2] - v0[2] };
+
+		// pvec = D x e2, qvec = T x e1
+		const float p[3] = { ray.dir[1] * e2[2] - ray.dir[2] * e2[1], ray.dir[2] * e2[0] - ray.dir[0] * e2[2], ray.dir[0] * e2[1] - ray.dir[1] * e2[0] };
+		const float q[3] = { tv[1] * e1[2] - tv[2] * e1[1], tv[2] * e1[0] - tv[0] * e1[2], tv[0] * e1[1] - tv[1] * e1[0] };
+		const float inv_det = 1.0f / (e1[0] * p[0] + e1[1] * p[1] + e1[2] * p[2]);
+		const float u = (tv[0] * p[0] + tv[1] * p[1] + tv[2] * p[2]) * inv_det;
+		const float v = (ray.dir[0] * q[0] + ray.dir[1] * q[1] + ray.dir[2] * q[2]) * inv_det;
+		const float t = (e2[0] * q[0] + e2[1] * q[1] + e2[2] * q[2]) * inv_det;
+
+		const float magnitude = ray.orig_norm + norm(v0) + norm(tv) + norm(e1) + norm(e2);
+		const float sensitivity = (norm(p) + ray.dir_norm * norm(e1)) * std::fabs(inv_det);
+		const float eps = PacketRay::triangle_packet_error * magnitude * sensitivity;
+		if (u >= -eps && v >= -eps && u + v <= 1.0f + eps && t >= ray.t_min && t <= ray.t_max) {
+			mask |= 1 << i;
+			t_nearest = t < t_nearest ? t : t_nearest;
+		}
+	}
+	return mask;
+}
+
+
+#ifdef RT_X86
+inline int intersect_triangles_simd(const TrianglePacket<4>& packet, const PacketRay& ray, float& t_nearest)
+{
+	const __m128 sign = _mm_set1_ps(-0.0f);
+	__m128 d[3], v0[3], e1[3], e2[3], tv[3];
+	for (int a = 0; a < 3; ++a) {
+		d[a] = _mm_set1_ps(ray.dir[a]);
+		v0[a] = _mm_load_ps(packet.v0[a]);
+		e1[a] = _mm_load_ps(packet.e1[a]);
+		e2[a] = _mm_load_ps(packet.e2[a]);
+		tv[a] = _mm_sub_ps(_mm_set1_ps(ray.orig[a]), v0[a]);
+	}
+	auto cross = [](const __m128 a[3], const __m128 b[3], __m128 c[3]) {
+		c[0] = _mm_sub_ps(_mm_mul_ps(a[1], b[2]), _mm_mul_ps(a[2], b[1]));
+		c[1] = _mm_sub_ps(_mm_mul_ps(a[2], b[0]), _mm_mul_ps(a[0], b[2]));
+		c[2] = _mm_sub_ps(_mm_mul_ps(a[0], b[1]), _mm_mul_ps(a[1], b[0]));
+	};
+	auto dot = [](const __m128 a[3], const __m128 b[3]) {
+		return _mm_add_ps(_mm_add_ps(_mm_mul_ps(a[0], b[0]), _mm_mul_ps(a[1], b[1])), _mm_mul_ps(a[2], b[2]));
+	};
+	auto norm = [&sign](const __m128 a[3]) {
+		return _mm_add_ps(_mm_add_ps(_mm_andnot_ps(sign, a[0]), _mm_andnot_ps(sign, a[1])), _mm_andnot_ps(sign, a[2]));
+	};
+
+	__m128 p[3], q[3];
+	cross(d, e2, p);
+	cross(tv, e1, q);
+	const __m128 inv_det = _mm_div_ps(_mm_set1_ps(1.0f), dot(e1, p));
+	const __m128 u = _mm_mul_ps(dot(tv, p), inv_det);
+	const __m128 v = _mm_mul_ps(dot(d, q), inv_det);
+	const __m128 t = _mm_mul_ps(dot(e2, q), inv_det);
+
+	const __m128 magnitude = _mm_add_ps(_mm_add_ps(_mm_add_ps(_mm_set1_ps(ray.orig_norm), norm(v0)), _mm_add_ps(norm(tv), norm(e1))), norm(e2));
+	const __m128 sensitivity = _mm_mul_ps(_mm_add_ps(norm(p), _mm_mul_ps(_mm_set1_ps(ray.dir_norm), norm(e1))), _mm_andnot_ps(sign, inv_det));
+	const __m128 eps = _mm_mul_ps(_mm_mul_ps(_mm_set1_ps(PacketRay::triangle_packet_error), magnitude), sensitivity);
+	const __m128 neg_eps = _mm_sub_ps(_mm_setzero_ps(), eps);
+	__m128 hit = _mm_and_ps(_mm_cmpge_ps(u, neg_eps), _mm_cmpge_ps(v, neg_eps));
+	hit = _mm_and_ps(hit, _mm_cmple_ps(_mm_add_ps(u, v), _mm_add_ps(_mm_set1_ps(1.0f), eps)));
+	hit = _mm_and_ps(hit, _mm_cmpge_ps(t, _mm_set1_ps(ray.t_min)));
+	hit = _mm_and_ps(hit, _mm_cmple_ps(t, _mm_set1_ps(ray.t_max)));
+
+	const int mask = _mm_movemask_ps(hit);
+	const __m128 masked_t = _mm_or_ps(_mm_and_ps(hit, t), _mm_andnot_ps(hit, _mm_set1_ps(INFINITY)));
+	__m128 nearest = _mm_min_ps(masked_t, _mm_shuffle_ps(masked_t, masked_t, _MM_SHUFFLE(2, 3, 0, 1)));
+	nearest = _mm_min_ps(nearest, _mm_shuffle_ps(nearest, nearest, _MM_SHUFFLE(1, 0, 3, 2)));
+	t_nearest = _mm_cvtss_f32(nearest);
+	return mask;
+}
+
+
+inline RT_TARGET("avx") int intersect_triangles_simd(const TrianglePacket<8>& packet, const PacketRay& ray, float& t_nearest)
+{
+	const __m256 sign = _mm256_set1_ps(-0.0f);
+	__m256 d[3], v0[3], e1[3], e2[3], tv[3];
+	for (int a = 0; a < 3; ++a) {
+		d[a] = _mm256_set1_ps(ray.dir[a]);
+		v0[a] = _mm256_load_ps(packet.v0[a]);
+		e1[a] = _mm256_load_ps(packet.e1[a]);
+		e2[a] = _mm256_load_ps(packet.e2[a]);
+		tv[a] = _mm256_sub_ps(_mm256_set1_ps(ray.orig[a]), v0[a]);
+	}
+
+	__m256 p[3], q[3];
+	p[0] = _mm256_sub_ps(_mm256_mul_ps(d[1], e2[2]), _mm256_mul_ps(d[2], e2[1]));
+	p[1] = _mm256_sub_ps(_mm256_mul_ps(d[2], e2[0]), _mm256_mul_ps(d[0], e2[2]));
+	p[2] = _mm256_sub_ps(_mm256_mul_ps(d[0], e2[1]), _mm256_mul_ps(d[1], e2[0]));
+	q[0] = _mm256_sub_ps(_mm256_mul_ps(tv[1], e1[2]), _mm256_mul_ps(tv[2], e1[1]));
+	q[1] = _mm256_sub_ps(_mm256_mul_ps(tv[2], e1[0]), _mm256_mul_ps(tv[0], e1[2]));
+	q[2] = _mm256_sub_ps(_mm256_mul_ps(tv[0], e1[1]), _mm256_mul_ps(tv[1], e1[0]));
+
+	const __m256 det = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(e1[0], p[0]), _mm256_mul_ps(e1[1], p[1])), _mm256_mul_ps(e1[2], p[2]));
+	const __m256 inv_det = _mm256_div_ps(_mm256_set1_ps(1.0f), det);
+	const __m256 u = _mm256_mul_ps(_mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(tv[0], p[0]), _mm256_mul_ps(tv[1], p[1])), _mm256_mul_ps(tv[2], p[2])), inv_det);
+	const __m256 v = _mm256_mul_ps(_mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(d[0], q[0]), _mm256_mul_ps(d[1], q[1])), _mm256_mul_ps(d[2], q[2])), inv_det);
+	const __m256 t = _mm256_mul_ps(_mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(e2[0], q[0]), _mm256_mul_ps(e2[1], q[1])), _mm256_mul_ps(e2[2], q[2])), inv_det);
+
+	// L1 norms, lambdas would not inherit the target of the function
+	__m256 norm_v0 = _mm256_setzero_ps(), norm_tv = _mm256_setzero_ps(), norm_e1 = _mm256_setzero_ps();
+	__m256 norm_e2 = _mm256_setzero_ps(), norm_p = _mm256_setzero_ps();
+	for (int a = 0; a < 3; ++a) {
+		norm_v0 = _mm256_add_ps(norm_v0, _mm256_andnot_ps(sign, v0[a]));
+		norm_tv = _mm256_add_ps(norm_tv, _mm256_andnot_ps(sign, tv[a]));
+		norm_e1 = _mm256_add_ps(norm_e1, _mm256_andnot_ps(sign, e1[a]));
+		norm_e2 = _mm256_add_ps(norm_e2, _mm256_andnot_ps(sign, e2[a]));
+		norm_p = _mm256_add_ps(norm_p, _mm256_andnot_ps(sign, p[a]));
+	}
+	const __m256 magnitude = _mm256_add_ps(_mm256_add_ps(_mm256_add_ps(_mm256_set1_ps(ray.orig_norm), norm_v0), _mm256_add_ps(norm_tv, norm_e1)), norm_e2);
+	const __m256 sensitivity = _mm256_mul_ps(_mm256_add_ps(norm_p, _mm256_mul_ps(_mm256_set1_ps(ray.dir_norm), norm_e1)), _mm256_andnot_ps(sign, inv_det));
+	const __m256 eps = _mm256_mul_ps(_mm256_mul_ps(_mm256_set1_ps(PacketRay::triangle_packet_error), magnitude), sensitivity);
+	const __m256 neg_eps = _mm256_sub_ps(_mm256_setzero_ps(), eps);
+	__m256 hit = _mm256_and_ps(_mm256_cmp_ps(u, neg_eps, _CMP_GE_OQ), _mm256_cmp_ps(v, neg_eps, _CMP_GE_OQ));
+	hit = _mm256_and_ps(hit, _mm256_cmp_ps(_mm256_add_ps(u, v), _mm256_add_ps(_mm256_set1_ps(1.0f), eps), _CMP_LE_OQ));
+	hit = _mm256_and_ps(hit, _mm256_cmp_ps(t, _mm256_set1_ps(ray.t_min), _CMP_GE_OQ));
+	hit = _mm256_and_ps(hit, _mm256_cmp_ps(t, _mm256_set1_ps(ray.t_max), _CMP_LE_OQ));
+
+	const int mask = _mm256_movemask_ps(hit);
+	alignas(32) float lane_t[8];
+	_mm256_store_ps(lane_t, t);
+	t_nearest = INFINITY;
+	for (int i = 0; i < 8; ++i) {
+		if ((mask & (1 << i)) && lane_t[i] < t_nearest)
+			t_nearest = lane_t[i];
+	}
+	return mask;
+}
+#endif
+
+
+// SSE for 4 lanes, AVX for 8 lanes if the CPU supports it, scalar loop otherwise
+template<int N>
+TrianglePacketTest<N> select_triangle_packet_test()
+{
+	static_assert(N == 4 || N == 8, "TrianglePacket supports 4 and 8 lanes");
+#ifdef RT_X86
+	const auto& cpu = cpu_features();
+	if ((N == 4 && cpu.sse2) || (N == 8 && cpu.avx))
+		return static_cast<TrianglePacketTest<N>>(intersect_triangles_simd);
+#endif
+	return intersect_triangles_scalar<N>;
+}
@@ -2,66 +2,95 @@
 #include <Intersect.hpp>
 #include <cassert>
 
+// nearest root of |O + tD - C|^2 = r^2 in [t_min, t_max]
+inline bool sphere_root(const Ray& ray, const point3& center, const real radius2, real t_min, real t_max, real& root)
+{
+	vec3 oc = ray.origin() - center;
+	auto a = glm::length2(ray.direction());
+	auto half_b = glm::dot(oc, ray.direction());
+	auto c = glm::length2(oc) - radius2;
+
+	auto discriminant = half_b * half_b - a * c;
+	if (discriminant < 0)
+		return false;
+	auto sqrtd = sqrt(discriminant);
+
+	// Find the nearest root that lies in the acceptable range.
+	root = (-half_b - sqrtd) / a;
+	if (root < t_min || root > t_max) {
+		root = (-half_b + sqrtd) / a;
+		if (root < t_min || root > t_max)
+			return false;
+	}
+	return true;
+}
+
+
 class Sphere : public IIntersect
 {
 public:
 	Sphere() : center(0.0), radius(0.0) {}
-	Sphere(const point3 c, double r, shared_ptr<Material> m) : center(c), radius(r), material(m) {}
+	Sphere(const point3 c, real r, shared_ptr<Material> m) : center(c), radius(r), material(m) {}
 
-	virtual bool intersect(const Ray& ray, double t_min, double t_max, IntersectRecord& irec) const override;
-	virtual bool bounding_box(double time0, double time1, AABB& output_box) const override;
+	virtual bool closest_hit(const Ray& ray, real t_min, real t_max, HitInfo& hit) const override;
+	virtual void surface(const Ray& ray, const HitInfo& hit, IntersectRecord& irec) const override;
+	virtual bool occluded(const Ray& ray, real t_min, real t_max) const override;
+	virtual bool bounding_box(real time0, real time1, AABB& output_box) const override;
 
-	double Radius() const { return radius; }
-	double Radius2() const { return radius * radius; }
+	real Radius() const { return radius; }
+	real Radius2() const { return radius * radius; }
 	point3 Center() const { return center; }
 
-	void set_radius(double r) noexcept { radius = r; }
+	void set_radius(real r) noexcept { radius = r; }
 	void set_center(point3 c) noexcept { center = c; }
 
-	static void get_uv(const point3& p, double& u, double& v) {
+	static void get_uv(const point3& p, real& u, real& v) {
 		auto theta = acos(-p.y);
 		auto phi = atan2(-p.z, p.x) + pi;
 
 		u = phi / (2 * pi);
 		v = theta / pi;
 	}
+	// world length of a unit of uv - geometric mean of the lengths of u (2 pi r) and v (pi r)
+	static real uv_length(const real r) { return pi * std::sqrt(real(2)) * std::abs(r); }
+	// p projected onto the sphere - ray.at(t) misses the surface by more than an offset of the origin allows
+	static point3 surface_point(const point3& p, const point3& c, const real r) {
+		const vec3 d = p - c;
+		return c + d * (std::abs(r) / glm::length(d));
+	}
 private:
 	point3 center;
-	double radius;
+	real radius;
 	shared_ptr<Material> material;
 };
 
-bool Sphere::intersect(const Ray& ray, double t_min, double t_max, IntersectRecord& irec) const
+bool Sphere::closest_hit(const Ray& ray, real t_min, real t_max, HitInfo& hit) const
 {
-	vec3 oc = ray.origin() - center;
-	auto a = glm::length2(ray.direction());
-	auto half_b = glm::dot(oc, ray.direction());
-	auto c = glm::length2(oc) - Radius2();
-	
-	auto discriminant = half_b * half_b - a * c;
-	if (discriminant < 0)
+	real root;
+	if (!sphere_root(ray, center, Radius2(), t_min, t_max, root))
 		return false;
-	auto sqrtd = sqrt(discriminant);
 
-	// Find the nearest root that lies in the acceptable range.
-	auto root = (-half_b - sqrtd) / a;
-	if (root < t_min || root > t_max) {
-		root = (-half_b + sqrtd) / a;
-		if (root < t_min || root > t_max)
-			return false;
-	}
+	hit.set(root, this);
+	return true;
+}
 
-	irec.t = root;
-	irec.p = ray.at(irec.t);
+void Sphere::surface(const Ray& ray, const HitInfo& hit, IntersectRecord& irec) const
+{
+	irec.p = surface_point(ray.at(hit.t), center, radius);
 	vec3 outward_normal = (irec.p - center) / radius;
 	irec.set_face_normal(ray, outward_normal);
 	get_uv(outward_normal, irec.uv.x, irec.uv.y);
-	irec.material = material;
+	irec.uv_scale = uv_length(radius);
+	irec.material = material.get();
+}
 
-	return true;
+bool Sphere::occluded(const Ray& ray, real t_min, real t_max) const
+{
+	real root;
+	return sphere_root(ray, center, Radius2(), t_min, t_max, root);
 }
 
-bool Sphere::bounding_box(double time0, double time1, AABB& output_box) const
+bool Sphere::bounding_box(real time0, real time1, AABB& output_box) const
 {
 	output_box = AABB(center - vec3(radius, radius, radius),
 					  center + vec3(radius, radius, radius));
@@ -74,67 +103,67 @@ class AnimationSphere : public IIntersect
 {
 public:
 	AnimationSphere() : center(0.0), radius(0.0), center_end(0.0), tm0(0.0), tm1(0.0) {}
-	AnimationSphere(const point3 c, const point3 c_end, const double time0, const double time1, double r, shared_ptr<Material> m) :
+	AnimationSphere(const point3 c, const point3 c_end, const real time0, const real time1, real r, shared_ptr<Material> m) :
 		center(c), center_end(c_end), tm0(time0), tm1(time1), radius(r), material(m) {}
 
-	virtual bool intersect(const Ray& ray, double t_min, double t_max, IntersectRecord& irec) const override;
-	virtual bool bounding_box(double time0, double time1, AABB& output_box) const override;
+	virtual bool closest_hit(const Ray& ray, real t_min, real t_max, HitInfo& hit) const override;
+	virtual void surface(const Ray& ray, const HitInfo& hit, IntersectRecord& irec) const override;
+	virtual bool occluded(const Ray& ray, real t_min, real t_max) const override;
+	virtual bool bounding_box(real time0, real time1, AABB& output_box) const override;
 
-	double Radius() const { return radius; }
-	double Radius2() const { return radius * radius; }
+	real Radius() const { return radius; }
+	real Radius2() const { return radius * radius; }
 	point3 Center() const { return center; }
 	point3 Center_end() const { return center_end; }
 
-	void set_radius(double r) noexcept { radius = r; }
+	void set_radius(real r) noexcept { radius = r; }
 	void set_center(point3 c) noexcept { center = c; }
 	void set_center_end(point3 c) noexcept { center_end = c; }
-	point3 move_center(double time) const;
+	point3 move_center(real time) const;
 private:
 	point3 center, center_end;
-	double radius;
+	real radius;
 	shared_ptr<Material> material;
 	/* animation time */
-	double tm0, tm1;
+	real tm0, tm1;
 };
 
 
-point3 AnimationSphere::move_center(double time) const
+point3 AnimationSphere::move_center(real time) const
 {
 	return center + ((time - tm0) / (tm1 - tm0)) * (center_end - center);
 }
 
 
-bool AnimationSphere::intersect(const Ray& ray, double t_min, double t_max, IntersectRecord& irec) const
+bool AnimationSphere::closest_hit(const Ray& ray, real t_min, real t_max, HitInfo& hit) const
 {
-	vec3 oc = ray.origin() - move_center(ray.time());
-	auto a = glm::length2(ray.direction());
-	auto half_b = glm::dot(oc, ray.direction());
-	auto c = glm::length2(oc) - Radius2();
-
-	auto discriminant = half_b * half_b - a * c;
-	if (discriminant < 0)
+	real root;
+	if (!sphere_root(ray, move_center(ray.time()), Radius2(), t_min, t_max, root))
 		return false;
-	auto sqrtd = sqrt(discriminant);
 
-	// Find the nearest root that lies in the acceptable range.
-	auto root = (-half_b - sqrtd) / a;
-	if (root < t_min || root > t_max) {
-		root = (-half_b + sqrtd) / a;
-		if (root < t_min || root > t_max)
-			return false;
-	}
+	hit.set(root, this);
+	return true;
+}
+
 
-	irec.t = root;
-	irec.p = ray.at(irec.t);
-	vec3 outward_normal = (irec.p - move_center(ray.time())) / radius;
+void AnimationSphere::surface(const Ray& ray, const HitInfo& hit, IntersectRecord& irec) const
+{
+	const point3 c = move_center(ray.time());
+	irec.p = Sphere::surface_point(ray.at(hit.t), c, radius);
+	vec3 outward_normal = (irec.p - c) / radius;
 	irec.set_face_normal(ray, outward_normal);
-	irec.material = material;
+	irec.material = material.get();
+}
 
-	return true;
+
+bool AnimationSphere::occluded(const Ray& ray, real t_min, real t_max) const
+{
+	real root;
+	return sphere_root(ray, move_center(ray.time()), Radius2(), t_min, t_max, root);
 }
 
 
-bool AnimationSphere::bounding_box(double time0, double time1, AABB& output_box) const
+bool AnimationSphere::bounding_box(real time0, real time1, AABB& output_box) const
 {
 	AABB box0(move_center(time0) - vec3(radius, radius, radius),
 			  move_center(time0) + vec3(radius, radius, radius));
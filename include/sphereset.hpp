@@ -0,0 +1,141 @@
+#pragma once
+#include <bvh/indexbvh.hpp>
+#include <sphere.hpp>
+#include <simd/spherebatch.hpp>
+#include <cstdint>
+
+/*
+	Set of static spheres with one material - centers and radii in structure-of-arrays buffers
+	and a BVH over sphere indices (IndexBVH), a single primitive for the hierarchy of the scene as TriangleMesh.
+	Buffers are sorted into the leaf order of the BVH, so a leaf is a contiguous batch tested
+	by SIMD lanes at once (SphereBatchTest). Normal and uv are evaluated for the final hit only.
+*/
+class SphereSet : public IIntersect
+{
+public:
+	SphereSet(const std::vector<point3>& centers, const std::vector<real>& radii,
+		shared_ptr<Material> m, const BVHBuildOption& option = BVHBuildOption());
+
+	virtual bool closest_hit(const Ray& ray, real t_min, real t_max, HitInfo& hit) const override;
+	virtual void surface(const Ray& ray, const HitInfo& hit, IntersectRecord& irec) const override;
+	virtual bool occluded(const Ray& ray, real t_min, real t_max) const override;
+	virtual bool bounding_box(real time0, real time1, AABB& output_box) const override;
+
+	size_t size() const { return sphere_count; }
+	point3 center(const uint32_t s) const { return point3(cx[s], cy[s], cz[s]); }
+	size_t memory() const; // bytes of sphere and BVH buffers
+
+private:
+	bool nearest(const Ray& ray, real t_min, real& t_max, uint32_t& sphere) const;
+
+public:
+	std::vector<double> cx, cy, cz; // centers in leaf order, padded to whole SIMD passes (double lanes in any build)
+	std::vector<double> radius, radius2;
+	shared_ptr<Material> material;
+	IndexBVH bvh; // leaves address the sphere buffers directly
+	size_t sphere_count = 0;
+
+private:
+	SphereBatchKernel kernel;
+};
+
+
+SphereSet::SphereSet(const std::vector<point3>& centers, const std::vector<real>& radii,
+	shared_ptr<Material> m, const BVHBuildOption& option) : material(m), sphere_count(centers.size()), kernel(select_sphere_batch_kernel())
+{
+	assert(centers.size() == radii.size() && "Count of sphere centers and radii differ.\n");
+	std::vector<AABB> boxes(sphere_count);
+	for (size_t i = 0; i < sphere_count; ++i)
+		boxes[i] = AABB(centers[i] - vec3(radii[i]), centers[i] + vec3(radii[i]));
+	// two SIMD passes per leaf amortize the traversal step better than one
+	bvh.build(boxes, option, 2 * kernel.lanes);
+
+	// leaves index the buffers in place of the leaf order of sphere indices
+	const size_t padded = sphere_count + kernel.lanes - 1;
+	cx.reserve(padded);
+	cy.reserve(padded);
+	cz.reserve(padded);
+	radius.reserve(padded);
+	radius2.reserve(padded);
+	for (const auto s : bvh.indices) {
+		cx.push_back(centers[s].x);
+		cy.push_back(centers[s].y);
+		cz.push_back(centers[s].z);
+		radius.push_back(radii[s]);
+		radius2.push_back(radii[s] * radii[s]);
+	}
+	cx.resize(padded, 0.0);
+	cy.resize(padded, 0.0);
+	cz.resize(padded, 0.0);
+	radius.resize(padded, 0.0);
+	radius2.resize(padded, 0.0);
+	bvh.indices.clear();
+	bvh.indices.shrink_to_fit();
+}
+
+
+bool SphereSet::nearest(const Ray& ray, real t_min, real& t_max, uint32_t& sphere) const
+{
+	const SphereBatchRay batch_ray(ray);
+	return bvh.intersect_leaves(ray, t_min, t_max, [&](uint32_t offset, uint16_t count, real tmin, real& tmax) {
+		const double* const batch_center[3] = { cx.data() + offset, cy.data() + offset, cz.data() + offset };
+		uint32_t nearest;
+		double batch_t_max = tmax;
+		if (!kernel.test(batch_center, radius2.data() + offset, count, batch_ray, tmin, batch_t_max, nearest))
+			return false;
+		tmax = static_cast<real>(batch_t_max);
+		sphere = offset + nearest;
+		return true;
+	});
+}
+
+
+bool SphereSet::closest_hit(const Ray& ray, real t_min, real t_max, HitInfo& hit) const
+{
+	uint32_t sphere;
+	if (!nearest(ray, t_min, t_max, sphere))
+		return false;
+
+	hit.set(t_max, this, sphere);
+	return true;
+}
+
+
+void SphereSet::surface(const Ray& ray, const HitInfo& hit, IntersectRecord& irec) const
+{
+	const auto r = static_cast<real>(radius[hit.prim]);
+	irec.p = Sphere::surface_point(ray.at(hit.t), center(hit.prim), r);
+	vec3 outward_normal = (irec.p - center(hit.prim)) / r;
+	irec.set_face_normal(ray, outward_normal);
+	Sphere::get_uv(outward_normal, irec.uv.x, irec.uv.y);
+	irec.uv_scale = Sphere::uv_length(r);
+	irec.material = material.get();
+}
+
+
+bool SphereSet::occluded(const Ray& ray, real t_min, real t_max) const
+{
+	const SphereBatchRay batch_ray(ray);
+	return bvh.occluded_leaves(ray, t_min, t_max, [&](uint32_t offset, uint16_t count, real tmin, real tmax) {
+		const double* const batch_center[3] = { cx.data() + offset, cy.data() + offset, cz.data() + offset };
+		uint32_t nearest;
+		double batch_t_max = tmax;
+		return kernel.test(batch_center, radius2.data() + offset, count, batch_ray, tmin, batch_t_max, nearest);
+	});
+}
+
+
+bool SphereSet::bounding_box(real /*time0*/, real /*time1*/, AABB& output_box) const
+{
+	if (bvh.empty())
+		return false;
+	output_box = bvh.bounds();
+	return true;
+}
+
+
+size_t SphereSet::memory() const
+{
+	return (3 * cx.capacity() + radius.capacity() + radius2.capacity()) * sizeof(double) +
+		bvh.nodes.capacity() * sizeof(LinearBVHNode) + bvh.indices.capacity() * sizeof(uint32_t);
+}
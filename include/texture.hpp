@@ -1,69 +1,135 @@
 #pragma once
 #include <utility.hpp>
 #include <Image.hpp>
+#include <mipmap.hpp>
+#include <texturecache.hpp>
+#include <simd/perlinnoise.hpp>
+#include <AABB.hpp>
+
+/*
+	Built-in textures are a closed set tagged by texture_type and evaluated by texture_value with a switch:
+	their classes are final, so the call is direct and may be inlined.
+	User-defined textures keep TEXTURE_USER and are evaluated by the virtual value.
+*/
+enum texture_type {
+	TEXTURE_USER = 0,
+	TEXTURE_SOLID,
+	TEXTURE_CHECKER,
+	TEXTURE_PERLIN,
+	TEXTURE_IMAGE
+};
+
 
 class Texture
 {
 public:
-	virtual color value(double u, double v, const point3& p) const = 0;
+	Texture() : type(TEXTURE_USER) {}
+private:
+	// only the built-in classes pass their tag - texture_value casts the object by it
+	Texture(const texture_type t) : type(t) {}
+	friend class SolidColor;
+	friend class CheckerTexture;
+	friend class PerlinTexture;
+	friend class ImageTexture;
+public:
+	virtual color value(real u, real v, const point3& p) const = 0;
+public:
+	const texture_type type;
 };
 
 
-class SolidColor : public Texture
+// footprint - width of the ray cone at the hit in uv units, the level of detail of image textures
+color texture_value(const Texture& tex, real u, real v, const point3& p, const real footprint = 0.0);
+
+
+class SolidColor final : public Texture
 {
 public:
-	SolidColor() : color_value(0.0) {}
-	SolidColor(const color c) : color_value(c) {}
+	SolidColor() : Texture(TEXTURE_SOLID), color_value(0.0) {}
+	SolidColor(const color c) : Texture(TEXTURE_SOLID), color_value(c) {}
 
-	SolidColor(const double r, const double g, const double b) :
+	SolidColor(const real r, const real g, const real b) :
 				SolidColor(color(r, g, b)) {}
 
-	virtual color value(double u, double v, const point3& p) const override {
+	virtual color value(real u, real v, const point3& p) const override {
 		return color_value;
 	}
+	color get_color() const { return color_value; }
 
 private:
 	color color_value;
 };
 
 
+/*
+	Texture of a material - a constant texture is folded into its color at construction,
+	it is read without a call.
+*/
+struct TextureRef
+{
+	TextureRef(const color& c) : texture(make_shared<SolidColor>(c)), constant(c), is_constant(true) {}
+	TextureRef(shared_ptr<Texture> tex) : texture(tex), constant(0.0), is_constant(tex->type == TEXTURE_SOLID) {
+		if (is_constant)
+			constant = static_cast<const SolidColor&>(*tex).get_color();
+	}
+
+	color value(real u, real v, const point3& p, const real footprint = 0.0) const {
+		return is_constant ? constant : texture_value(*texture, u, v, p, footprint);
+	}
+
+	shared_ptr<Texture> texture;
+	color constant;
+	bool is_constant;
+};
+
+
 
 /*
 	Checker Texture - alternation of rectangle colors
 */
 
-class CheckerTexture : public Texture
+class CheckerTexture final : public Texture
 {
 public:
-	shared_ptr<Texture> odd_rect;
-	shared_ptr<Texture> even_rect;
-	double freq = 0.0;
+	TextureRef odd_rect;
+	TextureRef even_rect;
+	real freq = 0.0;
 public:
-	CheckerTexture() {}
-	CheckerTexture(shared_ptr<Texture> even, shared_ptr<Texture> odd, const double fr = 10.0) : even_rect(even), odd_rect(odd), freq(fr) {}
-	CheckerTexture(const color c1, const color c2, const double fr = 10.0) :
-		even_rect(make_shared<SolidColor>(c1)), odd_rect(make_shared<SolidColor>(c2)), freq(fr) {}
+	CheckerTexture() : Texture(TEXTURE_CHECKER), odd_rect(color(0.0)), even_rect(color(0.0)) {}
+	CheckerTexture(shared_ptr<Texture> even, shared_ptr<Texture> odd, const real fr = 10.0) :
+		Texture(TEXTURE_CHECKER), odd_rect(odd), even_rect(even), freq(fr) {}
+	CheckerTexture(const color c1, const color c2, const real fr = 10.0) :
+		Texture(TEXTURE_CHECKER), odd_rect(c2), even_rect(c1), freq(fr) {}
 public:
-	double frequency() const { return freq; }
-	void set_frequency(double fr) { freq = fr; }
-	virtual color value(double u, double v, const point3& p) const override;
+	real frequency() const { return freq; }
+	void set_frequency(real fr) { freq = fr; }
+	virtual color value(real u, real v, const point3& p) const override;
 };
 
-color CheckerTexture::value(double u, double v, const point3& p) const
+color CheckerTexture::value(real u, real v, const point3& p) const
 {
 	auto sines = sin(freq * p.x) * sin(freq * p.y) * sin(freq * p.z);
 	if (sines < 0)
-		return odd_rect->value(u, v, p);
+		return odd_rect.value(u, v, p);
 	else
-		return even_rect->value(u, v, p);
+		return even_rect.value(u, v, p);
 }
 
 
 
-class PerlinTexture : public Texture
+// Evaluation of the turbulence of PerlinTexture
+enum perlin_mode {
+	PERLIN_SCALAR = 0, // octaves one by one in double precision, the reference
+	PERLIN_SIMD, // octaves in parallel float lanes (select_perlin_kernel)
+	PERLIN_BAKED // grid of turbulence over a box (bake) with trilinear lookups, SIMD outside of the box
+};
+
+
+class PerlinTexture final : public Texture
 {
 public:
-	PerlinTexture(const double scale=1.0) : ranvec(count_pts), freq(scale){
+	PerlinTexture(const real scale=1.0, const perlin_mode m = PERLIN_SIMD) :
+		Texture(TEXTURE_PERLIN), mode(m), ranvec(count_pts), freq(scale), kernel(select_perlin_kernel()) {
 		for (int i = 0; i < PerlinTexture::count_pts; ++i) {
 			ranvec[i] = random_unit_vector(-1.0, 1.0);
 		}
@@ -71,20 +137,43 @@ public:
 		perm_x = perlin_generate_perm();
 		perm_y = perlin_generate_perm();
 		perm_z = perlin_generate_perm();
+
+		// float copies for the SIMD kernels
+		for (int i = 0; i < PerlinTexture::count_pts; ++i) {
+			tables.perm[0][i] = perm_x[i];
+			tables.perm[1][i] = perm_y[i];
+			tables.perm[2][i] = perm_z[i];
+			for (int a = 0; a < 3; ++a)
+				tables.grad[a][i] = static_cast<float>(ranvec[i][a]);
+		}
 	}
 /*
-	virtual color value(double u, double v, const point3& p) const override {
-		return color(1, 1, 1) * 0.5 * (1.0 + noise(freq * p));
+	virtual color value(real u, real v, const point3& p) const override {
+		return color(1, 1, 1) * real(0.5) * (1.0 + noise(freq * p));
 	}
 */
-	virtual color value(double u, double v, const point3& p) const override {
+	virtual color value(real u, real v, const point3& p) const override {
 		/* return color(1, 1, 1) * turb(freq * p); */
 		// with phase adjusting
-		return color(1, 1, 1) * 0.5 * (1 + sin(freq * p.z + 10 * turb(p)));
+		return color(1, 1, 1) * real(0.5) * (1 + std::sin(freq * p.z + 10 * turbulence(p)));
 	}
 
+	// turbulence of the mode
+	real turbulence(const point3& p) const;
+
+	/*
+		Bakes the turbulence into a grid over box, resolution - nodes along the longest side.
+		Nodes are 4 bytes each, lookups blur the detail finer than the spacing of the nodes.
+		A box without extent or not finite is not baked, lookups use the SIMD kernel.
+	*/
+	void bake(const AABB& box, const int resolution);
+	size_t baked_memory() const { return grid.capacity() * sizeof(float); }
+
+public:
+	perlin_mode mode;
+
 protected:
-	double noise(const point3& p) const {
+	real noise(const point3& p) const {
 		auto u = p.x - floor(p.x);
 		auto v = p.y - floor(p.y);
 		auto w = p.z - floor(p.z);
@@ -106,7 +195,7 @@ protected:
 	}
 
 
-	double turb(const point3& p, const int depth = 7) const {
+	real turb(const point3& p, const int depth = 7) const {
 		auto accum = 0.0;
 		auto temp_p = p;
 		auto weight = 1.0;
@@ -126,9 +215,19 @@ private:
 	std::vector<int> perm_x;
 	std::vector<int> perm_y;
 	std::vector<int> perm_z;
-	double freq;
+	real freq;
+
+	PerlinTables tables;
+	PerlinKernel kernel;
+	// baked turbulence, x fastest
+	std::vector<float> grid;
+	point3 grid_min;
+	real grid_step = 0;
+	int grid_size[3] = { 0, 0, 0 };
 
-	double perlin_interp(const vec3 area[2][2][2], const double u, const double v, const double w) const {
+	bool baked_turbulence(const point3& p, real& turbulence) const;
+
+	real perlin_interp(const vec3 area[2][2][2], const real u, const real v, const real w) const {
 		/* Hermitian cubic(smoothing) */
 		auto uu = u * u * (3 - 2 * u);
 		auto vv = v * v * (3 - 2 * v);
@@ -170,38 +269,138 @@ private:
 
 
 
-class ImageTexture : public Texture
+real PerlinTexture::turbulence(const point3& p) const
+{
+	real turbulence = 0.0;
+	switch (mode) {
+	case PERLIN_SCALAR:
+		return turb(p);
+	case PERLIN_BAKED:
+		if (baked_turbulence(p, turbulence))
+			return turbulence;
+		break;
+	default:
+		break;
+	}
+	return kernel.turbulence(tables, TurbulencePoint(p), 7);
+}
+
+
+void PerlinTexture::bake(const AABB& box, const int resolution)
+{
+	assert(resolution > 1 && "Baked grid needs two nodes along a side at least.\n");
+	const vec3 extent = box.max() - box.min();
+	grid_step = std::max({ extent.x, extent.y, extent.z }) / (resolution - 1);
+	if (!(grid_step > 0) || !std::isfinite(grid_step) || !std::isfinite(box.min().x + box.min().y + box.min().z)) {
+		grid_step = 0;
+		grid_size[0] = grid_size[1] = grid_size[2] = 0;
+		std::vector<float>().swap(grid);
+		return;
+	}
+	grid_min = box.min();
+	for (int a = 0; a < 3; ++a)
+		grid_size[a] = std::max(static_cast<int>(std::ceil(extent[a] / grid_step)) + 1, 2);
+
+	grid.resize(static_cast<size_t>(grid_size[0]) * grid_size[1] * grid_size[2]);
+	size_t node = 0;
+	for (int z = 0; z < grid_size[2]; ++z)
+		for (int y = 0; y < grid_size[1]; ++y)
+			for (int x = 0; x < grid_size[0]; ++x)
+				grid[node++] = kernel.turbulence(tables, TurbulencePoint(grid_min + grid_step * vec3(x, y, z)), 7);
+}
+
+
+// false if p is out of the baked box
+bool PerlinTexture::baked_turbulence(const point3& p, real& turbulence) const
+{
+	if (grid.empty())
+		return false;
+
+	int cell[3];
+	float w[3];
+	for (int a = 0; a < 3; ++a) {
+		const real g = (p[a] - grid_min[a]) / grid_step;
+		if (!(g >= 0) || g > grid_size[a] - 1)
+			return false;
+		cell[a] = std::min(static_cast<int>(g), grid_size[a] - 2);
+		w[a] = static_cast<float>(g - cell[a]);
+	}
+
+	const size_t row = grid_size[0], slice = row * grid_size[1];
+	const float* n = grid.data() + cell[2] * slice + cell[1] * row + cell[0];
+	const float c00 = n[0] + w[0] * (n[1] - n[0]);
+	const float c10 = n[row] + w[0] * (n[row + 1] - n[row]);
+	const float c01 = n[slice] + w[0] * (n[slice + 1] - n[slice]);
+	const float c11 = n[slice + row] + w[0] * (n[slice + row + 1] - n[slice + row]);
+	const float c0 = c00 + w[1] * (c10 - c00);
+	const float c1 = c01 + w[1] * (c11 - c01);
+	turbulence = c0 + w[2] * (c1 - c0);
+	return true;
+}
+
+
+
+
+/*
+	Image texture - the image is converted at load into a float MIP pyramid (MipPyramid) and released,
+	a lookup filters the levels around the footprint of the ray cone.
+*/
+class ImageTexture final : public Texture
 {
 private:
 	const color def_color;
 public:
 	ImageTexture(const std::string& filepath) : 
-		def_color(0.0, 1.0, 1.0), img_tex(filepath), width(0), height(0) {
-		width = img_tex.get_width();
-		height = img_tex.get_height();
-	}
-	virtual color value(double u, double v, const point3& p) const override {
-
-		u = glm::clamp(u, 0.0, 1.0);
-		v = 1.0 - glm::clamp(v, 0.0, 1.0);
-		auto i = static_cast<int>(u * width);
-		auto j = static_cast<int>(v * height);
-		i = glm::clamp(i, 0, width - 1);
-		j = glm::clamp(j, 0, width - 1);
-
-		color pixel;
-		auto is_read = img_tex.get_color(i, j, pixel);
-		if (!is_read)
+		Texture(TEXTURE_IMAGE), def_color(0.0, 1.0, 1.0), mip(Image(filepath)), width(0), height(0) {
+		if (!mip.empty()) {
+			width = mip.width();
+			height = mip.height();
+		}
+	}
+	// tiles of the texture are read on demand into the pool of the cache, the image is not kept in memory
+	ImageTexture(const std::string& filepath, const shared_ptr<TextureCache>& texture_cache) :
+		Texture(TEXTURE_IMAGE), def_color(0.0, 1.0, 1.0), cache(texture_cache), cache_id(texture_cache->open(filepath)), width(0), height(0) {
+		if (cache_id >= 0) {
+			width = cache->width(cache_id);
+			height = cache->height(cache_id);
+		}
+	}
+	virtual color value(real u, real v, const point3& p) const override {
+		return sample(u, v, 0.0);
+	}
+	// footprint - width of the ray cone in uv units
+	color sample(real u, real v, const real footprint) const {
+		// rows of the image go from the top
+		if (cache)
+			return cache_id >= 0 ? cache->sample(cache_id, u, 1 - v, footprint) : def_color;
+		if (mip.empty())
 			return def_color;
-
-		constexpr auto color_scale = 1.0 / 255.0;
-
-		return color(color_scale * pixel[0], color_scale * pixel[1], color_scale * pixel[2]);
+		return mip.sample(u, 1 - v, footprint);
 	}
 	int get_width() const { return width; }
 	int get_height() const { return height; }
 
 private:
-	Image img_tex;
+	MipPyramid mip;
+	shared_ptr<TextureCache> cache;
+	int cache_id = -1;
 	int width, height;
-};
\ No newline at end of file
+};
+
+
+
+color texture_value(const Texture& tex, real u, real v, const point3& p, const real footprint)
+{
+	switch (tex.type) {
+	case TEXTURE_SOLID:
+		return static_cast<const SolidColor&>(tex).value(u, v, p);
+	case TEXTURE_CHECKER:
+		return static_cast<const CheckerTexture&>(tex).value(u, v, p);
+	case TEXTURE_PERLIN:
+		return static_cast<const PerlinTexture&>(tex).value(u, v, p);
+	case TEXTURE_IMAGE:
+		return static_cast<const ImageTexture&>(tex).sample(u, v, footprint);
+	default:
+		return tex.value(u, v, p);
+	}
+}
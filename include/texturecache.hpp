@@ -0,0 +1,492 @@
+#pragma once
+#include <mipmap.hpp>
+#include <memory/randomfile.hpp>
+#include <condition_variable>
+#include <cstdio>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <ostream>
+#include <unordered_map>
+#include <vector>
+
+/*
+	Out-of-core image textures. A texture is converted once to a tiled file - the levels of its MipPyramid
+	tile by tile, as they are laid out in memory - and tiles are read on demand into a pool of fixed size
+	shared by all textures of the cache, the least recently used tile is evicted. Memory of the textures is
+	bounded by the pool whatever the size of the texture set, only the conversion holds one image at a time.
+	Layout of a tiled file:
+		TiledTextureHeader, TiledLevel[level_count], tiles of texture_tile_bytes of every level at TiledLevel::offset
+	Files are native-endian and are not portable between architectures.
+	The pool is split into shards by a hash of the tile, a shard has its own lock, LRU list and counters,
+	so threads which read different tiles rarely wait for one another. A miss reads its tile outside the lock: the slot
+	is marked loading, lookups of that tile wait for the read, the other tiles of the shard are served meanwhile.
+	Tiled files are not kept open: a bounded LRU of open files is shared by all textures, a miss in a texture
+	whose file was closed opens it again - a texture set of any size stays within the descriptor limit.
+	Darwyn Peachey, "Texture on Demand", 1990
+*/
+
+constexpr uint32_t tiled_texture_version = 1;
+constexpr size_t texture_tile_bytes = MipPyramid::tile_floats * sizeof(float);
+
+struct TiledTextureHeader
+{
+	char magic[8];
+	uint32_t version;
+	uint32_t tile_side;
+	uint32_t level_count;
+	uint32_t reserved;
+	uint64_t source_hash; // of the source image, 0 - the file is used whatever the source
+};
+
+struct TiledLevel
+{
+	uint32_t width;
+	uint32_t height;
+	uint32_t tiles_x;
+	uint32_t tiles_y;
+	uint64_t offset; // of the first tile, tiles are in rows from the top
+};
+
+static constexpr char tiled_texture_magic[8] = { 'R', 'T', 'T', 'E', 'X', 'T', 0, 0 };
+
+
+// hash of the path, size and write time of a source image - an edited image is converted again
+uint64_t texture_source_hash(const std::string& path)
+{
+	uint64_t hash = 0xcbf29ce484222325ull;
+	hash = hash_value(hash, tiled_texture_version);
+	hash = hash_bytes(hash, path.data(), path.size());
+	std::error_code error;
+	const auto size = std::filesystem::file_size(path, error);
+	hash = hash_value(hash, static_cast<uint64_t>(error ? 0 : size));
+	const auto time = std::filesystem::last_write_time(path, error);
+	hash = hash_value(hash, static_cast<int64_t>(error ? 0 : time.time_since_epoch().count()));
+	return hash | 1; // never 0
+}
+
+
+// tiled file of a source image - next to it if tile_dir is empty
+std::string tiled_texture_path(const std::string& tile_dir, const std::string& source, uint64_t source_hash)
+{
+	if (tile_dir.empty())
+		return source + ".tiled";
+	char name[32];
+	std::snprintf(name, sizeof(name), "tex_%016llx.tiled", static_cast<unsigned long long>(source_hash));
+	return tile_dir + "/" + name;
+}
+
+
+bool write_tiled_texture(const std::string& path, const MipPyramid& mip, uint64_t source_hash)
+{
+	if (mip.empty())
+		return false;
+
+	TiledTextureHeader header;
+	std::memcpy(header.magic, tiled_texture_magic, sizeof(header.magic));
+	header.version = tiled_texture_version;
+	header.tile_side = MipPyramid::tile_side;
+	header.level_count = static_cast<uint32_t>(mip.level_count());
+	header.reserved = 0;
+	header.source_hash = source_hash;
+
+	std::vector<TiledLevel> levels(header.level_count);
+	uint64_t offset = sizeof(TiledTextureHeader) + levels.size() * sizeof(TiledLevel);
+	for (int l = 0; l < mip.level_count(); ++l) {
+		levels[l].width = static_cast<uint32_t>(mip.width(l));
+		levels[l].height = static_cast<uint32_t>(mip.height(l));
+		levels[l].tiles_x = static_cast<uint32_t>(mip.tiles_x(l));
+		levels[l].tiles_y = static_cast<uint32_t>(mip.tiles_y(l));
+		levels[l].offset = offset;
+		offset += static_cast<uint64_t>(levels[l].tiles_x) * levels[l].tiles_y * texture_tile_bytes;
+	}
+
+	// written under a temporary name, a concurrent reader never sees a partial file
+	const std::string temp_path = path + ".tmp";
+	{
+		std::ofstream file(temp_path, std::ios::binary | std::ios::trunc);
+		if (!file)
+			return false;
+
+		file.write(reinterpret_cast<const char*>(&header), sizeof(header));
+		file.write(reinterpret_cast<const char*>(levels.data()), levels.size() * sizeof(TiledLevel));
+		// tiles of a level are contiguous in the pyramid
+		for (int l = 0; l < mip.level_count(); ++l)
+			file.write(reinterpret_cast<const char*>(mip.tile(l, 0)), static_cast<std::streamsize>(levels[l].tiles_x) * levels[l].tiles_y * texture_tile_bytes);
+		if (!file)
+			return false;
+	}
+
+	std::remove(path.c_str());
+	return std::rename(temp_path.c_str(), path.c_str()) == 0;
+}
+
+
+struct TextureCacheStats
+{
+	uint64_t hits = 0;
+	uint64_t misses = 0; // tiles read from files
+	uint64_t evictions = 0;
+	uint64_t file_opens = 0; // tiled files opened by misses, again after the LRU of open files closed them
+	size_t resident = 0; // bytes of the tiles in the pool
+	size_t capacity = 0; // bytes of the pool
+};
+
+std::ostream& operator<<(std::ostream& os, const TextureCacheStats& stats)
+{
+	const uint64_t lookups = stats.hits + stats.misses;
+	os << "Texture cache: hits " << stats.hits
+	   << ", misses " << stats.misses
+	   << " (" << (lookups > 0 ? 100.0 * stats.misses / lookups : 0.0) << "%)"
+	   << ", evictions " << stats.evictions
+	   << ", file opens " << stats.file_opens
+	   << ", resident " << stats.resident / 1024 << " KB of " << stats.capacity / 1024 << " KB\n";
+	return os;
+}
+
+
+class TextureCache
+{
+public:
+	static constexpr size_t shard_count = 16;
+	static_assert(shard_count == 16, "shard_of takes the top 4 bits of the hash");
+
+	/*
+		capacity - bytes of the tile pool, rounded down to whole tiles per shard and at least a tile per shard
+		(shard_count * texture_tile_bytes), capacity() is the size of the pool.
+		tile_dir - directory of the tiled files, empty - next to the images.
+		max_open_files - tiled files open at a time (and a file per thread which reads a tile of a closed one).
+	*/
+	TextureCache(const size_t capacity, const std::string& tile_dir = std::string(), const size_t max_open_files = 64);
+
+	TextureCache(const TextureCache&) = delete;
+	TextureCache& operator=(const TextureCache&) = delete;
+
+	/*
+		id of a texture, -1 if the image or its tiled file can not be read. path is an image,
+		converted to a tiled file at first open, or a tiled file itself.
+		Textures are opened while the scene is built - open does not run concurrently with sample.
+	*/
+	int open(const std::string& path);
+	int width(const int id) const { return static_cast<int>(textures[id]->levels[0].width); }
+	int height(const int id) const { return static_cast<int>(textures[id]->levels[0].height); }
+
+	// trilinear lookup as MipPyramid::sample, v from the top row of the image
+	color sample(const int id, real u, real v, const real footprint);
+	TextureCacheStats stats() const;
+	size_t capacity() const { return shard_count * static_cast<size_t>(slots_per_shard) * texture_tile_bytes; }
+
+private:
+	static constexpr uint32_t no_slot = ~0u;
+
+	struct TiledTexture
+	{
+		std::string path;
+		std::vector<TiledLevel> levels;
+		// open while the texture is in the LRU of open files, a reader holds its own reference
+		std::shared_ptr<const RandomAccessFile> file;
+		std::list<int>::iterator open_entry;
+	};
+
+	struct Shard
+	{
+		std::mutex lock;
+		std::unique_ptr<float[]> tiles; // slot by slot, pages are touched by the first read into a slot
+		std::unordered_map<uint64_t, uint32_t> slot_of; // tile key to slot
+		std::vector<uint64_t> keys; // tile key by slot
+		std::vector<uint32_t> prev, next; // LRU list of the used slots
+		std::vector<uint8_t> loading; // by slot - the tile is being read, the slot is not evicted
+		std::vector<uint32_t> waiters; // by slot - lookups waiting for the read, the slot is not evicted
+		std::condition_variable loaded; // a read is done
+		uint32_t head = no_slot; // most recently used
+		uint32_t tail = no_slot; // evicted next
+		uint32_t used = 0;
+		uint64_t hits = 0, misses = 0, evictions = 0;
+	};
+
+	static std::unique_ptr<TiledTexture> load_tiled(const std::string& path, uint64_t source_hash);
+	static uint64_t tile_key(const int id, const int level, const uint32_t tile);
+	Shard& shard_of(const uint64_t key) const;
+	std::shared_ptr<const RandomAccessFile> file_of(const int id);
+	const float* acquire(Shard& shard, std::unique_lock<std::mutex>& lock, const uint64_t key, const int id, const TiledLevel& level, const uint32_t tile);
+	uint32_t free_slot(Shard& shard);
+	void unlink(Shard& shard, const uint32_t slot);
+	void push_front(Shard& shard, const uint32_t slot);
+	color bilinear(const int id, const int level, const real u, const real v);
+
+private:
+	std::string tile_dir;
+	uint32_t slots_per_shard;
+	std::unique_ptr<Shard[]> shards;
+	std::vector<std::unique_ptr<TiledTexture>> textures;
+
+	mutable std::mutex files_lock; // guards the open files and TiledTexture::file, taken without a shard lock
+	size_t max_open_files;
+	std::list<int> open_files; // ids of the textures with an open file, most recently used first
+	uint64_t file_opens = 0;
+};
+
+
+TextureCache::TextureCache(const size_t capacity, const std::string& dir, const size_t max_files) :
+	tile_dir(dir), max_open_files(std::max<size_t>(max_files, 1))
+{
+	// a lookup holds one tile of a shard at a time, so a slot per shard is enough
+	slots_per_shard = static_cast<uint32_t>(std::max<size_t>(capacity / texture_tile_bytes / shard_count, 1));
+	shards.reset(new Shard[shard_count]);
+	for (size_t s = 0; s < shard_count; ++s) {
+		Shard& shard = shards[s];
+		shard.tiles.reset(new float[static_cast<size_t>(slots_per_shard) * MipPyramid::tile_floats]);
+		shard.slot_of.reserve(slots_per_shard);
+		shard.keys.resize(slots_per_shard);
+		shard.prev.resize(slots_per_shard, no_slot);
+		shard.next.resize(slots_per_shard, no_slot);
+		shard.loading.resize(slots_per_shard, 0);
+		shard.waiters.resize(slots_per_shard, 0);
+	}
+}
+
+
+// nullptr if the file is missing, of other version or of other source; the file is closed, it is opened by misses
+std::unique_ptr<TextureCache::TiledTexture> TextureCache::load_tiled(const std::string& path, uint64_t source_hash)
+{
+	auto texture = std::make_unique<TiledTexture>();
+	texture->path = path;
+	const RandomAccessFile file(path);
+	TiledTextureHeader header;
+	if (!file.is_open() || !file.read(0, &header, sizeof(header)))
+		return nullptr;
+	if (std::memcmp(header.magic, tiled_texture_magic, sizeof(header.magic)) != 0 ||
+		header.version != tiled_texture_version ||
+		header.tile_side != MipPyramid::tile_side ||
+		header.level_count == 0 || header.level_count > 32 ||
+		(source_hash != 0 && header.source_hash != source_hash))
+		return nullptr;
+
+	texture->levels.resize(header.level_count);
+	if (!file.read(sizeof(header), texture->levels.data(), texture->levels.size() * sizeof(TiledLevel)))
+		return nullptr;
+	for (const auto& level : texture->levels) {
+		if (level.width == 0 || level.height == 0 ||
+			level.tiles_x != (level.width + MipPyramid::tile_side - 1) / MipPyramid::tile_side ||
+			level.tiles_y != (level.height + MipPyramid::tile_side - 1) / MipPyramid::tile_side ||
+			file.size() < level.offset + static_cast<uint64_t>(level.tiles_x) * level.tiles_y * texture_tile_bytes)
+			return nullptr;
+	}
+	return texture;
+}
+
+
+int TextureCache::open(const std::string& path)
+{
+	// a tiled file given as it is
+	auto texture = load_tiled(path, 0);
+	if (!texture) {
+		const uint64_t source_hash = texture_source_hash(path);
+		const std::string tiled_path = tiled_texture_path(tile_dir, path, source_hash);
+		texture = load_tiled(tiled_path, source_hash);
+		if (!texture) {
+			// the image is in memory while it is converted only
+			if (!write_tiled_texture(tiled_path, MipPyramid(Image(path)), source_hash))
+				return -1;
+			texture = load_tiled(tiled_path, source_hash);
+			if (!texture)
+				return -1;
+		}
+	}
+
+	assert(textures.size() < (1u << 24) && "Count of textures of a cache exceeds the tile key.\n");
+	textures.push_back(std::move(texture));
+	return static_cast<int>(textures.size() - 1);
+}
+
+
+// texture id (24 bits), level (8 bits) and tile index (32 bits)
+uint64_t TextureCache::tile_key(const int id, const int level, const uint32_t tile)
+{
+	return (static_cast<uint64_t>(id) << 40) | (static_cast<uint64_t>(level) << 32) | tile;
+}
+
+
+TextureCache::Shard& TextureCache::shard_of(const uint64_t key) const
+{
+	// Fibonacci hashing, neighbouring tiles fall into different shards
+	return shards[(key * 0x9e3779b97f4a7c15ull) >> 60];
+}
+
+
+void TextureCache::unlink(Shard& shard, const uint32_t slot)
+{
+	const uint32_t prev = shard.prev[slot], next = shard.next[slot];
+	if (prev != no_slot)
+		shard.next[prev] = next;
+	else
+		shard.head = next;
+	if (next != no_slot)
+		shard.prev[next] = prev;
+	else
+		shard.tail = prev;
+}
+
+
+void TextureCache::push_front(Shard& shard, const uint32_t slot)
+{
+	shard.prev[slot] = no_slot;
+	shard.next[slot] = shard.head;
+	if (shard.head != no_slot)
+		shard.prev[shard.head] = slot;
+	shard.head = slot;
+	if (shard.tail == no_slot)
+		shard.tail = slot;
+}
+
+
+// file of a texture, opened again if the LRU of open files closed it - the least recently used one is closed then
+std::shared_ptr<const RandomAccessFile> TextureCache::file_of(const int id)
+{
+	std::lock_guard<std::mutex> lock(files_lock);
+	TiledTexture& texture = *textures[id];
+	if (texture.file) {
+		open_files.splice(open_files.begin(), open_files, texture.open_entry);
+		return texture.file;
+	}
+
+	if (open_files.size() == max_open_files) {
+		// a reader of the closed file keeps it open until its read is done
+		textures[open_files.back()]->file.reset();
+		open_files.pop_back();
+	}
+	texture.file = std::make_shared<const RandomAccessFile>(texture.path);
+	open_files.push_front(id);
+	texture.open_entry = open_files.begin();
+	file_opens += 1;
+	return texture.file;
+}
+
+
+// slot for a missing tile - unused or the least recently used one which is neither read nor waited for, no_slot if none
+uint32_t TextureCache::free_slot(Shard& shard)
+{
+	if (shard.used < slots_per_shard)
+		return shard.used++;
+	for (uint32_t slot = shard.tail; slot != no_slot; slot = shard.prev[slot]) {
+		if (!shard.loading[slot] && shard.waiters[slot] == 0) {
+			unlink(shard, slot);
+			shard.slot_of.erase(shard.keys[slot]);
+			shard.evictions += 1;
+			return slot;
+		}
+	}
+	return no_slot;
+}
+
+
+// texels of a tile in the pool, read from its file on a miss; the shard is locked by the caller,
+// the lock is released while the tile is read or while a read of the tile by another thread is waited for
+const float* TextureCache::acquire(Shard& shard, std::unique_lock<std::mutex>& lock, const uint64_t key, const int id, const TiledLevel& level, const uint32_t tile)
+{
+	for (;;) {
+		const auto found = shard.slot_of.find(key);
+		if (found != shard.slot_of.end()) {
+			const uint32_t slot = found->second;
+			shard.hits += 1;
+			if (shard.loading[slot]) {
+				shard.waiters[slot] += 1;
+				shard.loaded.wait(lock, [&shard, slot] { return !shard.loading[slot]; });
+				shard.waiters[slot] -= 1;
+			}
+			if (slot != shard.head) {
+				unlink(shard, slot);
+				push_front(shard, slot);
+			}
+			return shard.tiles.get() + static_cast<size_t>(slot) * MipPyramid::tile_floats;
+		}
+
+		const uint32_t slot = free_slot(shard);
+		if (slot == no_slot) {
+			// every slot is being read or waited for - the tile may be read by another thread meanwhile
+			shard.loaded.wait(lock);
+			continue;
+		}
+
+		shard.misses += 1;
+		shard.keys[slot] = key;
+		shard.slot_of.emplace(key, slot);
+		shard.loading[slot] = 1;
+		push_front(shard, slot);
+
+		float* texels = shard.tiles.get() + static_cast<size_t>(slot) * MipPyramid::tile_floats;
+		lock.unlock();
+		// a tile which can not be read is black, it is not read again while it stays in the pool
+		if (!file_of(id)->read(level.offset + static_cast<uint64_t>(tile) * texture_tile_bytes, texels, texture_tile_bytes))
+			std::fill(texels, texels + MipPyramid::tile_floats, 0.0f);
+		lock.lock();
+		shard.loading[slot] = 0;
+		shard.loaded.notify_all();
+		return texels;
+	}
+}
+
+
+color TextureCache::bilinear(const int id, const int level, const real u, const real v)
+{
+	const TiledTexture& texture = *textures[id];
+	const TiledLevel& lv = texture.levels[level];
+	const BilinearTexels b(u, v, static_cast<int>(lv.width), static_cast<int>(lv.height));
+	const int xs[4] = { b.x0, b.x1, b.x0, b.x1 };
+	const int ys[4] = { b.y0, b.y0, b.y1, b.y1 };
+	uint32_t tiles[4];
+	for (int k = 0; k < 4; ++k)
+		tiles[k] = static_cast<uint32_t>(ys[k] / MipPyramid::tile_side) * lv.tiles_x + xs[k] / MipPyramid::tile_side;
+
+	// the texels are copied out under the lock, the tile may be evicted right after
+	float texels[4][3];
+	bool copied[4] = { false, false, false, false };
+	for (int k = 0; k < 4; ++k) {
+		if (copied[k])
+			continue;
+		const uint64_t key = tile_key(id, level, tiles[k]);
+		Shard& shard = shard_of(key);
+		std::unique_lock<std::mutex> lock(shard.lock);
+		const float* tile = acquire(shard, lock, key, id, lv, tiles[k]);
+		// texels of one tile take one lookup
+		for (int j = k; j < 4; ++j) {
+			if (tiles[j] != tiles[k])
+				continue;
+			std::memcpy(texels[j], tile + MipPyramid::tile_texel(xs[j], ys[j]), sizeof(texels[j]));
+			copied[j] = true;
+		}
+	}
+	return b.blend(texels[0], texels[1], texels[2], texels[3]);
+}
+
+
+color TextureCache::sample(const int id, real u, real v, const real footprint)
+{
+	const TiledTexture& texture = *textures[id];
+	return trilinear_sample(u, v, footprint, static_cast<int>(texture.levels[0].width), static_cast<int>(texture.levels[0].height),
+		static_cast<int>(texture.levels.size()),
+		[this, id](const int level, const real lu, const real lv) { return bilinear(id, level, lu, lv); });
+}
+
+
+TextureCacheStats TextureCache::stats() const
+{
+	TextureCacheStats stats;
+	for (size_t s = 0; s < shard_count; ++s) {
+		Shard& shard = shards[s];
+		std::lock_guard<std::mutex> lock(shard.lock);
+		stats.hits += shard.hits;
+		stats.misses += shard.misses;
+		stats.evictions += shard.evictions;
+		stats.resident += static_cast<size_t>(shard.used) * texture_tile_bytes;
+	}
+	{
+		std::lock_guard<std::mutex> lock(files_lock);
+		stats.file_opens = file_opens;
+	}
+	stats.capacity = capacity();
+	return stats;
+}
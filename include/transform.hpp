@@ -0,0 +1,117 @@
+#pragma once
+#include <AABB.hpp>
+#include <Ray.hpp>
+#include <limits>
+
+/*
+	Affine transformation p' = M * p + t, the inverse is computed once at construction.
+	Points and directions are mapped by M, normals by the inverse transpose of M.
+	For rigid motions (M is a rotation) the inverse transpose is M itself and unit normals stay unit.
+*/
+class AffineTransform
+{
+public:
+	AffineTransform() : linear(1.0), inv_linear(1.0), translation(0.0), inv_translation(0.0), rigid(true) {}
+	AffineTransform(const mat3& m, const vec3& t);
+
+	static AffineTransform translate(const vec3& offset) { return AffineTransform(mat3(1.0), offset); }
+	static AffineTransform rotate(const vec3& axis, const real angle);
+	static AffineTransform scale(const vec3& factor);
+
+	// composition, rhs is applied first
+	AffineTransform operator*(const AffineTransform& rhs) const {
+		return AffineTransform(linear * rhs.linear, linear * rhs.translation + translation);
+	}
+	AffineTransform inverse() const { return AffineTransform(inv_linear, inv_translation); }
+
+	point3 point(const point3& p) const { return linear * p + translation; }
+	vec3 vector(const vec3& v) const { return linear * v; }
+	vec3 normal(const vec3& n) const { return rigid ? linear * n : glm::normalize(normal_linear * n); }
+	point3 inverse_point(const point3& p) const { return inv_linear * p + inv_translation; }
+	vec3 inverse_vector(const vec3& v) const { return inv_linear * v; }
+
+	// mean scale factor of lengths, cube root of the volume scale
+	real scale() const { return rigid ? real(1) : std::cbrt(std::abs(glm::determinant(linear))); }
+
+	// ray parameter t is preserved, the direction is not normalized
+	Ray inverse_ray(const Ray& ray) const { return Ray(inverse_point(ray.origin()), inverse_vector(ray.direction()), ray.time()); }
+	AABB box(const AABB& box) const;
+
+	const mat3& matrix() const { return linear; }
+	const vec3& offset() const { return translation; }
+
+private:
+	mat3 linear;
+	mat3 inv_linear;
+	vec3 translation;
+	vec3 inv_translation;
+	mat3 normal_linear; // inverse transpose
+	bool rigid;
+};
+
+
+AffineTransform::AffineTransform(const mat3& m, const vec3& t) : linear(m), inv_linear(glm::inverse(m)), translation(t)
+{
+	inv_translation = -(inv_linear * t);
+	normal_linear = glm::transpose(inv_linear);
+
+	// rotation: M^-1 = M^T, up to the rounding of the inverse - a few ulps of the largest element
+	real magnitude = 0.0;
+	for (int i = 0; i < 3; ++i) {
+		for (int j = 0; j < 3; ++j)
+			magnitude = std::max<real>(magnitude, std::fabs(linear[i][j]));
+	}
+	const real tolerance = 64 * std::numeric_limits<real>::epsilon() * magnitude;
+	rigid = true;
+	for (int i = 0; i < 3; ++i) {
+		for (int j = 0; j < 3; ++j)
+			rigid = rigid && std::fabs(normal_linear[i][j] - linear[i][j]) <= tolerance;
+	}
+}
+
+
+// rotation around an arbitrary axis by angle in degrees, Rodrigues' formula
+AffineTransform AffineTransform::rotate(const vec3& axis, const real angle)
+{
+	const vec3 a = glm::normalize(axis);
+	const auto rad = glm::radians(angle);
+	const auto c = glm::cos(rad);
+	const auto s = glm::sin(rad);
+	const auto k = 1.0 - c;
+
+	mat3 m; // column-major: m[column][row]
+	m[0] = vec3(c + a.x * a.x * k, a.y * a.x * k + a.z * s, a.z * a.x * k - a.y * s);
+	m[1] = vec3(a.x * a.y * k - a.z * s, c + a.y * a.y * k, a.z * a.y * k + a.x * s);
+	m[2] = vec3(a.x * a.z * k + a.y * s, a.y * a.z * k - a.x * s, c + a.z * a.z * k);
+	return AffineTransform(m, vec3(0.0));
+}
+
+
+AffineTransform AffineTransform::scale(const vec3& factor)
+{
+	mat3 m(1.0);
+	m[0][0] = factor.x;
+	m[1][1] = factor.y;
+	m[2][2] = factor.z;
+	return AffineTransform(m, vec3(0.0));
+}
+
+
+/*
+	Bounds of a transformed box without transforming its 8 corners:
+	James Arvo, "Transforming Axis-Aligned Bounding Boxes", Graphics Gems, 1990
+*/
+AABB AffineTransform::box(const AABB& box) const
+{
+	point3 small = translation;
+	point3 big = translation;
+	for (int i = 0; i < 3; ++i) { // row
+		for (int j = 0; j < 3; ++j) { // column
+			auto a = linear[j][i] * box.min()[j];
+			auto b = linear[j][i] * box.max()[j];
+			small[i] += fmin(a, b);
+			big[i] += fmax(a, b);
+		}
+	}
+	return AABB(small, big);
+}
@@ -14,18 +14,25 @@ public:
 	Triangle() : A(0.0), B(0.0), C(0.0) {}
 	Triangle(const point3& p1, const point3& p2, const point3& p3, const shared_ptr<Material> m) : A(p1), B(p2), C(p3), material(m) {}
 
-	virtual bool intersect(const Ray& ray, double t_min, double t_max, IntersectRecord& irec) const override;
-	virtual bool bounding_box(double time0, double time1, AABB& output_box) const override;
+	virtual bool closest_hit(const Ray& ray, real t_min, real t_max, HitInfo& hit) const override;
+	virtual void surface(const Ray& ray, const HitInfo& hit, IntersectRecord& irec) const override;
+	virtual bool occluded(const Ray& ray, real t_min, real t_max) const override {
+		real t, u, v;
+		return hit(ray, t_min, t_max, t, u, v);
+	}
+	virtual bool bounding_box(real time0, real time1, AABB& output_box) const override;
+	virtual bool clipped_bounding_box(real time0, real time1, const AABB& region, AABB& output_box) const override;
 
 	void set_points(const point3& p1, const point3& p2, const point3& p3);
 	void set_material(const shared_ptr<Material> m) { material = m; }
 
-	void get_uv(const point3& p, double& u, double& v) const;
+	void get_uv(const point3& p, real& u, real& v) const;
 public:
 	vec3 normal() const;
 	bool get_barycentric_coord(const Ray& ray, barycentric& uvw) const;
 	bool get_barycentric_coord(const point3& pt, barycentric& uvw) const;
 private:
+	bool hit(const Ray& ray, real t_min, real t_max, real& t, real& u, real& v) const;
 	vec3 get_normal() const;
 	bool check_point_in(const point3& P, barycentric& uvw) const;
 private:
@@ -34,7 +41,7 @@ private:
 };
 
 
-bool Triangle::intersect(const Ray& ray, double t_min, double t_max, IntersectRecord& irec) const
+bool Triangle::hit(const Ray& ray, real t_min, real t_max, real& t, real& u, real& v) const
 {
 	/* 
 		Möller Tomas and Ben Trumbore. "Fast, minimum storage ray-triangle intersection." Journal of graphics tools 2.1 (1997): 21-28.
@@ -42,44 +49,59 @@ bool Triangle::intersect(const Ray& ray, double t_min, double t_max, IntersectRe
 	vec3 AB = B - A;
 	vec3 AC = C - A;
 	auto pvec = glm::cross(ray.direction(), AC);
-	const double det = glm::dot(AB, pvec);
+	const real det = glm::dot(AB, pvec);
 	
 	// close to zero - parallel
 	if (det < epsilon && det > neg_epsilon) {
 		return false;
 	}
 
-	const double inv_det = 1.0 / det;
+	const real inv_det = 1.0 / det;
 
 	auto tvec = ray.origin() - A;
 	
 	// calculate U parameterand test bounds	
-	auto u = glm::dot(tvec, pvec) * inv_det;
+	u = glm::dot(tvec, pvec) * inv_det;
 	if (u < 0.0 || u > 1.0)
 		return false;
 
 	auto qvec = glm::cross(tvec, AB);
-	auto v = glm::dot(ray.direction(), qvec) * inv_det;
+	v = glm::dot(ray.direction(), qvec) * inv_det;
 	if (v < 0.0 || u + v > 1.0)
 		return false;
 
-	double t = glm::dot(AC, qvec) * inv_det;
+	t = glm::dot(AC, qvec) * inv_det;
 	if (t < t_min || t > t_max) 
 		return false;
 	
 	// auto w = 1 - u - v;
+	return true;
+}
 
-	irec.t = t;
-	irec.p = ray.at(irec.t);
-	vec3 outward_normal = get_normal();
-	irec.uv.x = u; // u
-	irec.uv.y = v; // v
-	irec.set_face_normal(ray, outward_normal);
-	irec.material = material;
 
+bool Triangle::closest_hit(const Ray& ray, real t_min, real t_max, HitInfo& hit) const
+{
+	real t, u, v;
+	if (!Triangle::hit(ray, t_min, t_max, t, u, v))
+		return false;
+
+	hit.set(t, this, 0, vec2(u, v));
 	return true;
 }
 
+
+void Triangle::surface(const Ray& ray, const HitInfo& hit, IntersectRecord& irec) const
+{
+	// barycentric point is on the plane of the triangle, ray.at(t) carries the error of t
+	irec.p = A + hit.uv.x * (B - A) + hit.uv.y * (C - A);
+	vec3 outward_normal = get_normal();
+	irec.uv = hit.uv;
+	// barycentrics map the triangle to half of the unit square
+	irec.uv_scale = std::sqrt(glm::length(glm::cross(B - A, C - A)));
+	irec.set_face_normal(ray, outward_normal);
+	irec.material = material.get();
+}
+
 vec3 Triangle::normal() const
 {
 	vec3 normal = glm::cross((B - A), (C - A));
@@ -148,7 +170,7 @@ bool Triangle::get_barycentric_coord(const Ray& ray, barycentric& uvw) const
 	const vec3 edge2 = C - A;
 	const vec3 q = glm::cross(ray.direction(), edge2);
 
-	const double a = glm::dot(edge1, q);
+	const real a = glm::dot(edge1, q);
 
 	/* check parallel or behind the triangle */
 	if (fabs(a) <= epsilon)
@@ -172,7 +194,7 @@ bool Triangle::get_barycentric_coord(const point3& pt, barycentric& uvw) const
 
 
 
-bool Triangle::bounding_box(double time0, double time1, AABB& output_box) const
+bool Triangle::bounding_box(real time0, real time1, AABB& output_box) const
 {
 	auto min_x = std::min({ A.x, B.x, C.x });
 	auto min_y = std::min({ A.y, B.y, C.y });
@@ -185,13 +207,80 @@ bool Triangle::bounding_box(double time0, double time1, AABB& output_box) const
 	point3 a(min_x, min_y, min_z);
 	point3 b(max_x, max_y, max_z);
 
+	// The bounding box must have non-zero width in each dimension (axis-aligned triangle is flat)
+	for (auto i = 0; i < 3; ++i) {
+		if (b[i] - a[i] < 0.0001) {
+			a[i] -= 0.0001;
+			b[i] += 0.0001;
+		}
+	}
+
 	output_box = AABB(a, b);
 
 	return true;
 }
 
 
-void Triangle::get_uv(const point3& P, double& u, double& v) const
+/*
+	Exact bounds of the triangle part inside region: the triangle is clipped as a polygon by the six box planes
+	Ivan Sutherland, Gary Hodgman, "Reentrant Polygon Clipping", 1974
+*/
+bool Triangle::clipped_bounding_box(real time0, real time1, const AABB& region, AABB& output_box) const
+{
+	constexpr int max_vertices = 9; // every plane adds at most one vertex
+	point3 polygon[max_vertices] = { A, B, C };
+	point3 clipped[max_vertices];
+	int count = 3;
+
+	for (int plane = 0; plane < 6 && count > 0; ++plane) {
+		const int axis = plane >> 1;
+		const bool is_max = (plane & 1) != 0;
+		const real bound = is_max ? region.max()[axis] : region.min()[axis];
+		auto inside = [&](const point3& p) { return is_max ? p[axis] <= bound : p[axis] >= bound; };
+
+		int clipped_count = 0;
+		for (int i = 0; i < count; ++i) {
+			const point3& current = polygon[i];
+			const point3& next = polygon[(i + 1) % count];
+			if (inside(current))
+				clipped[clipped_count++] = current;
+			if (inside(current) != inside(next)) {
+				auto t = (bound - current[axis]) / (next[axis] - current[axis]);
+				point3 crossing = current + t * (next - current);
+				crossing[axis] = bound;
+				clipped[clipped_count++] = crossing;
+			}
+		}
+		count = clipped_count;
+		for (int i = 0; i < count; ++i)
+			polygon[i] = clipped[i];
+	}
+	if (count == 0)
+		return false;
+
+	point3 a = polygon[0];
+	point3 b = polygon[0];
+	for (int i = 1; i < count; ++i) {
+		a = glm::min(a, polygon[i]);
+		b = glm::max(b, polygon[i]);
+	}
+
+	// same padding of flat axes as bounding_box, kept inside the unclipped bounds
+	AABB full_box;
+	bounding_box(time0, time1, full_box);
+	for (auto i = 0; i < 3; ++i) {
+		if (b[i] - a[i] < 0.0001) {
+			a[i] = std::max<real>(a[i] - 0.0001, full_box.min()[i]);
+			b[i] = std::min<real>(b[i] + 0.0001, full_box.max()[i]);
+		}
+	}
+
+	output_box = AABB(a, b);
+	return true;
+}
+
+
+void Triangle::get_uv(const point3& P, real& u, real& v) const
 {
 	/* 
 		fast barycentric compute coordinates 
@@ -210,4 +299,134 @@ void Triangle::get_uv(const point3& P, double& u, double& v) const
 	auto gamma = 1 - alpha - beta;
 	u = alpha;
 	v = beta;
-}
\ No newline at end of file
+}
+
+
+
+/*
+	Precomputed world-to-barycentric transform of a triangle, 12 values computed once instead of
+	edges and normal on every test. Rows map [x y z 1] to barycentric u, v (P = A + u * AB + v * AC)
+	and to the distance w along the free axis, the coordinate axis where the normal is largest.
+	The plane of the triangle is w = 0: t = -w(O) / w(D), then u and v of the hit point are tested.
+	Doug Baldwin and Michael Weber, "Fast Ray-Triangle Intersections by Coordinate Transformation", JCGT, 2016
+*/
+struct TriangleTransform
+{
+	real m[3][4] = {}; // rows: u, v, w
+
+	// false for a degenerate triangle - the transform stays zero and is never hit
+	bool set(const point3& A, const point3& B, const point3& C);
+	bool intersect(const Ray& ray, real t_min, real t_max, real& t, real& u, real& v) const;
+	vec3 normal() const; // unit normal oriented as cross(AB, AC)
+};
+
+
+bool TriangleTransform::set(const point3& A, const point3& B, const point3& C)
+{
+	const vec3 e1 = B - A;
+	const vec3 e2 = C - A;
+	const vec3 n = glm::cross(e1, e2);
+	const int k = (fabs(n.x) > fabs(n.y) && fabs(n.x) > fabs(n.z)) ? 0 : (fabs(n.y) > fabs(n.z) ? 1 : 2);
+	if (fabs(n[k]) <= epsilon)
+		return false;
+
+	// free vector along +-axis k on the side of the normal, the w row is n / |n[k]|
+	vec3 f(0.0);
+	f[k] = n[k] > 0.0 ? 1.0 : -1.0;
+	mat3 basis; // columns: AB, AC, free vector
+	basis[0] = e1;
+	basis[1] = e2;
+	basis[2] = f;
+	const mat3 inv = glm::inverse(basis);
+	const vec3 offset = -(inv * A);
+	for (int r = 0; r < 3; ++r) {
+		for (int c = 0; c < 3; ++c)
+			m[r][c] = inv[c][r]; // glm is column-major
+		m[r][3] = offset[r];
+	}
+	return true;
+}
+
+
+bool TriangleTransform::intersect(const Ray& ray, real t_min, real t_max, real& t, real& u, real& v) const
+{
+	const auto o = ray.origin();
+	const auto d = ray.direction();
+
+	// plane first - most rays are rejected by t before u and v are computed
+	const real ow = m[2][0] * o.x + m[2][1] * o.y + m[2][2] * o.z + m[2][3];
+	const real dw = m[2][0] * d.x + m[2][1] * d.y + m[2][2] * d.z;
+	t = -ow / dw;
+	// also false for NaN of a parallel ray
+	if (!(t >= t_min && t <= t_max))
+		return false;
+
+	const point3 p = o + t * d;
+	u = m[0][0] * p.x + m[0][1] * p.y + m[0][2] * p.z + m[0][3];
+	if (u < 0.0 || u > 1.0)
+		return false;
+
+	v = m[1][0] * p.x + m[1][1] * p.y + m[1][2] * p.z + m[1][3];
+	return v >= 0.0 && u + v <= 1.0;
+}
+
+
+vec3 TriangleTransform::normal() const
+{
+	return glm::normalize(vec3(m[2][0], m[2][1], m[2][2]));
+}
+
+
+
+/*
+	Triangle with the precomputed transform instead of vertices - opt-in alternative of Triangle
+	for meshes which are traced much more often than built, vertices are not kept.
+*/
+class PrecomputedTriangle : public IIntersect
+{
+public:
+	PrecomputedTriangle(const point3& p1, const point3& p2, const point3& p3, const shared_ptr<Material> m);
+
+	virtual bool closest_hit(const Ray& ray, real t_min, real t_max, HitInfo& hit) const override;
+	virtual void surface(const Ray& ray, const HitInfo& hit, IntersectRecord& irec) const override;
+	virtual bool occluded(const Ray& ray, real t_min, real t_max) const override {
+		real t, u, v;
+		return transform.intersect(ray, t_min, t_max, t, u, v);
+	}
+	virtual bool bounding_box(real /*time0*/, real /*time1*/, AABB& output_box) const override {
+		output_box = bbox;
+		return true;
+	}
+
+public:
+	TriangleTransform transform;
+	AABB bbox;
+	shared_ptr<Material> material;
+};
+
+
+PrecomputedTriangle::PrecomputedTriangle(const point3& p1, const point3& p2, const point3& p3, const shared_ptr<Material> m) : material(m)
+{
+	transform.set(p1, p2, p3);
+	Triangle(p1, p2, p3, m).bounding_box(0.0, 0.0, bbox);
+}
+
+
+bool PrecomputedTriangle::closest_hit(const Ray& ray, real t_min, real t_max, HitInfo& hit) const
+{
+	real t, u, v;
+	if (!transform.intersect(ray, t_min, t_max, t, u, v))
+		return false;
+
+	hit.set(t, this, 0, vec2(u, v));
+	return true;
+}
+
+
+void PrecomputedTriangle::surface(const Ray& ray, const HitInfo& hit, IntersectRecord& irec) const
+{
+	irec.p = ray.at(hit.t);
+	irec.uv = hit.uv;
+	irec.set_face_normal(ray, transform.normal());
+	irec.material = material.get();
+}
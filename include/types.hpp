@@ -13,23 +13,30 @@ using byte = uchar;
 using lint = long long;
 
 
-using color3 = glm::dvec3;
-using color4 = glm::dvec4;
+// scalar of geometry, rays, colors and BVH nodes: float with _USE_FLOAT (CMake WITH_FLOAT), double otherwise
+#ifdef _USE_FLOAT
+using real = float;
+#else
+using real = double;
+#endif
+
+using color3 = glm::vec<3, real>;
+using color4 = glm::vec<4, real>;
 using icolor3 = glm::ivec3;
 using icolor4 = glm::ivec4;
 using color = color3;
 using icolor = icolor3;
 
-using vec2 = glm::dvec2;
-using vec3 = glm::dvec3;
-using vec4 = glm::dvec4;
+using vec2 = glm::vec<2, real>;
+using vec3 = glm::vec<3, real>;
+using vec4 = glm::vec<4, real>;
 
-using mat3 = glm::dmat3;
-using mat4 = glm::dmat4;
+using mat3 = glm::mat<3, 3, real>;
+using mat4 = glm::mat<4, 4, real>;
 
-using point2 = glm::dvec2;
-using point3 = glm::dvec3;
-using point4 = glm::dvec4;
+using point2 = vec2;
+using point3 = vec3;
+using point4 = vec4;
 
 
 using barycentric = vec3;
@@ -2,23 +2,32 @@
 #include <types.hpp>
 #include <string>
 #include <random>
+#include <algorithm>
 
 // Constants
-const double infinity = std::numeric_limits<double>::infinity();
-const double epsilon = std::numeric_limits<double>::epsilon();
-const double neg_epsilon = -std::numeric_limits<double>::epsilon();
-const double pi = 3.1415926535897932385;
-constexpr double bias = 0.00001;
+const real infinity = std::numeric_limits<real>::infinity();
+const real epsilon = std::numeric_limits<real>::epsilon();
+const real neg_epsilon = -std::numeric_limits<real>::epsilon();
+const real pi = 3.1415926535897932385;
+constexpr real bias = 0.00001;
 
 // helper function
-inline double random_double() {
-    static std::uniform_real_distribution<double> distribution(0.0, 1.0);
+// generator of random_double() - the random stream of scene generation and rendering
+inline std::mt19937& random_generator() {
     static std::mt19937 generator;
-    return distribution(generator);
+    return generator;
+}
+
+// drawn in double in both precisions - the float build generates the same scenes as the double build,
+// the rounding to float is kept below 1
+inline real random_double() {
+    static std::uniform_real_distribution<double> distribution(0.0, 1.0);
+    constexpr real below_one = 1 - std::numeric_limits<real>::epsilon() / 2;
+    return std::min(static_cast<real>(distribution(random_generator())), below_one);
 }
 
 
-template<typename Numeric = double, typename Generator = std::mt19937>
+template<typename Numeric = real, typename Generator = std::mt19937>
 Numeric random(Numeric from, Numeric to)
 {
     thread_local static Generator gen(std::random_device{}());
@@ -37,14 +46,14 @@ Numeric random(Numeric from, Numeric to)
 
 
 #ifdef off_cpp
-inline double random_double() {
+inline real random_double() {
     // Returns a random real in [0,1).
     return rand() / (RAND_MAX + 1.0);
 }
 #endif
 
 
-inline double random_double(double min, double max) {
+inline real random_double(real min, real max) {
     // Returns a random real in [min,max).
     return min + (max-min) * random_double();
 }
@@ -59,14 +68,32 @@ inline bool near_zero(const vec3& v) {
     return (fabs(v[0]) < epsilon) && (fabs(v[1]) < epsilon) && (fabs(v[2]) < epsilon);
 }
 
-vec3 generate_random_vec(const double min, const double max);
+// FNV-1a
+inline uint64_t hash_bytes(uint64_t hash, const void* data, size_t size)
+{
+    const auto* bytes = static_cast<const uint8_t*>(data);
+    for (size_t i = 0; i < size; ++i) {
+        hash ^= bytes[i];
+        hash *= 0x100000001b3ull;
+    }
+    return hash;
+}
+
+template<typename T>
+inline uint64_t hash_value(uint64_t hash, const T& value)
+{
+    return hash_bytes(hash, &value, sizeof(T));
+}
+
+
+vec3 generate_random_vec(const real min, const real max);
 vec3 random_unit_in_sphere();
 vec3 random_unit_vector();
-vec3 random_unit_vector(const double min, const double max);
+vec3 random_unit_vector(const real min, const real max);
 vec3 random_in_hemisphere(const vec3& normal);
 vec3 random_unit_in_disk();
 color random_color();
-color random_color(const double min, const double max);
+color random_color(const real min, const real max);
 
 
 /* pixel convert */
@@ -75,4 +102,4 @@ void RGBPixel(byte pixels[3], const vec3& lightcolor);
 void RGBPixel(icolor& color, const vec3& lightcolor);
 
 /* Anti-Aliasing pixel convert */
-void AA_RGBPixel(color& pixels, const vec3& lightcolor, const size_t sample_per_pixel, const double gamma);
\ No newline at end of file
+void AA_RGBPixel(color& pixels, const vec3& lightcolor, const size_t sample_per_pixel, const real gamma);
\ No newline at end of file
@@ -6,54 +6,81 @@
 class ConstantVolume : public IIntersect
 {
 public:
-	ConstantVolume(shared_ptr<IIntersect> bound, const double d, shared_ptr<Texture> tex) : 
+	ConstantVolume(shared_ptr<IIntersect> bound, const real d, shared_ptr<Texture> tex) : 
 		boundary(bound), neg_inv_density(-1 / d), phase_func(make_shared<Isotropic>(tex))  {}
-	ConstantVolume(shared_ptr<IIntersect> bound, const double d, const color c) : 
+	ConstantVolume(shared_ptr<IIntersect> bound, const real d, const color c) : 
 		boundary(bound), neg_inv_density(-1 / d), phase_func(make_shared<Isotropic>(c)) {}
 
-	virtual bool intersect(const Ray& ray, double t_min, double t_max, IntersectRecord& irec) const override;
+	virtual bool closest_hit(const Ray& ray, real t_min, real t_max, HitInfo& hit) const override;
+	virtual void surface(const Ray& ray, const HitInfo& hit, IntersectRecord& irec) const override;
+	// scattering distance is sampled again - the result is random as for intersect
+	virtual bool occluded(const Ray& ray, real t_min, real t_max) const override {
+		real t;
+		return sample_hit(ray, t_min, t_max, t);
+	}
 
-	virtual bool bounding_box(double time0, double time1, AABB& output_box) const override {
+	virtual bool bounding_box(real time0, real time1, AABB& output_box) const override {
 		return boundary->bounding_box(time0, time1, output_box);
 	}
+	virtual int instance_depth() const override { return boundary->instance_depth(); }
+private:
+	bool sample_hit(const Ray& ray, real t_min, real t_max, real& t) const;
 public:
 	shared_ptr<IIntersect> boundary;
 	shared_ptr<Material> phase_func;
-	double neg_inv_density;
+	real neg_inv_density;
 };
 
 
-bool ConstantVolume::intersect(const Ray& ray, double t_min, double t_max, IntersectRecord& irec) const
+bool ConstantVolume::sample_hit(const Ray& ray, real t_min, real t_max, real& t) const
 {
-	IntersectRecord irc1, irc2;
+	HitInfo hit1, hit2;
 
-	if (!boundary->intersect(ray, -infinity, infinity, irc1))
+	if (!boundary->closest_hit(ray, -infinity, infinity, hit1))
 		return false;
 
-	if (!boundary->intersect(ray, irc1.t + 0.0001, infinity, irc2))
+	// the exit is searched past the entry by a step relative to t - a fixed step is below the ulp
+	// of large t in float (the fog sphere of radius 5000), the entry is found again and the exit lost
+	const real exit_t_min = hit1.t + std::max<real>(0.0001, 64 * epsilon * std::fabs(hit1.t));
+	if (!boundary->closest_hit(ray, exit_t_min, infinity, hit2))
 		return false;
 
 
-	if (irc1.t < t_min) irc1.t = t_min;
-	if (irc2.t > t_max) irc2.t = t_max;
+	if (hit1.t < t_min) hit1.t = t_min;
+	if (hit2.t > t_max) hit2.t = t_max;
 
-	if (irc1.t >= irc2.t)
+	if (hit1.t >= hit2.t)
 		return false;
 
-	if (irc1.t < 0) irc1.t = 0;
+	if (hit1.t < 0) hit1.t = 0;
 		
 	const auto ray_length = ray.direction().length();
-	const auto dist_inside_boundary = (irc2.t - irc1.t) * ray_length;
+	const auto dist_inside_boundary = (hit2.t - hit1.t) * ray_length;
 	const auto hit_dist = neg_inv_density * glm::log(random_double());
 
 	if (hit_dist > dist_inside_boundary)
 		return false;
 
-	irec.t = irc1.t + hit_dist / ray_length;
-	irec.p = ray.at(irec.t);
-	irec.normal = vec3(1, 0, 0);  
-	irec.front_face = true;     
-	irec.material = phase_func;
+	t = hit1.t + hit_dist / ray_length;
+	return true;
+}
 
+
+bool ConstantVolume::closest_hit(const Ray& ray, real t_min, real t_max, HitInfo& hit) const
+{
+	real t;
+	if (!sample_hit(ray, t_min, t_max, t))
+		return false;
+
+	hit.set(t, this);
 	return true;
+}
+
+
+void ConstantVolume::surface(const Ray& ray, const HitInfo& hit, IntersectRecord& irec) const
+{
+	irec.p = ray.at(hit.t);
+	irec.normal = vec3(1, 0, 0);  
+	irec.front_face = true;     
+	irec.material = phase_func.get();
 }
\ No newline at end of file
@@ -0,0 +1,187 @@
+#pragma once
+#include <camera.hpp>
+#include <Intersect.hpp>
+#include <shading.hpp>
+#include <Image.hpp>
+#include <vector>
+
+/*
+	Wavefront path tracing - an alternative to the recursion of Scene::ray_color which gives the same estimate.
+	Paths of a wave (up to queue_size samples) are kept as states in queues and every stage is a loop over a queue:
+	generate (camera rays), extend (closest hits), shade (emission and scatter, paths binned by material type,
+	so one material code runs over a batch) and accumulate (radiance of finished paths into pixels).
+	The renderer has no light sampling, so there is no connect (shadow ray) stage.
+	Samuli Laine, Tero Karras, Timo Aila, "Megakernels Considered Harmful: Wavefront Path Tracing on GPUs", 2013
+*/
+class WavefrontIntegrator
+{
+public:
+	WavefrontIntegrator(const Camera& cam, const color& background, const int max_depth, const lint samples, const size_t queue_size = 1 << 16) :
+		camera(cam), backcolor(background), maxdepth(max_depth), sample_per_pixel(samples), capacity(queue_size) {}
+
+	// pixels of columns [i_begin, i_end) of all rows
+	void render(Image& image, const IntersectList& world, const lint i_begin, const lint i_end, const real gamma);
+
+private:
+	static constexpr size_t material_bins = MATERIAL_DIFFUSE_LIGHT + 1; // one per material_type
+
+	struct PathState
+	{
+		Ray ray;
+		color throughput;
+		color radiance;
+		lint pixel; // index in the rendered columns
+		int depth; // bounces left
+	};
+
+	void generate(const lint i_begin, const lint i_end, const size_t work_begin, const size_t work_end);
+	void extend(const IntersectList& world);
+	void sort_by_material();
+	void shade();
+	void accumulate();
+
+private:
+	const Camera& camera;
+	color backcolor;
+	int maxdepth;
+	lint sample_per_pixel;
+	size_t capacity;
+
+	std::vector<PathState> paths;
+	std::vector<IntersectRecord> hits; // closest hit of a path, by path index
+	std::vector<uint32_t> active; // paths to extend
+	std::vector<uint32_t> shade_queue; // paths with a hit, binned by material type
+	std::vector<uint32_t> finished; // paths to accumulate
+	std::vector<uint32_t> material_bin; // by path index
+	std::vector<color> pixel_color; // sum of samples of the rendered columns
+};
+
+
+void WavefrontIntegrator::render(Image& image, const IntersectList& world, const lint i_begin, const lint i_end, const real gamma)
+{
+	const lint height = camera.get_screen_height();
+	const lint columns = i_end - i_begin;
+	pixel_color.assign(columns * height, color(0, 0, 0));
+
+	// work item w is sample w % sample_per_pixel of pixel w / sample_per_pixel
+	const size_t work = static_cast<size_t>(columns * height * sample_per_pixel);
+	for (size_t wave = 0; wave < work; wave += capacity) {
+		generate(i_begin, i_end, wave, std::min(wave + capacity, work));
+		while (!active.empty()) {
+			extend(world);
+			sort_by_material();
+			shade();
+		}
+		accumulate();
+	}
+
+	color pixel{ 0 };
+	for (lint j = 0; j < height; ++j) {
+		for (lint i = i_begin; i < i_end; ++i) {
+			AA_RGBPixel(pixel, pixel_color[j * columns + (i - i_begin)], sample_per_pixel, gamma);
+			image.set_color((height - 1 - j) * camera.get_screen_width() + i, pixel);
+		}
+	}
+}
+
+
+void WavefrontIntegrator::generate(const lint i_begin, const lint i_end, const size_t work_begin, const size_t work_end)
+{
+	const lint columns = i_end - i_begin;
+	const lint width = camera.get_screen_width() - 1;
+	const lint height = camera.get_screen_height() - 1;
+
+	paths.resize(work_end - work_begin);
+	hits.resize(paths.size());
+	material_bin.resize(paths.size());
+	active.clear();
+	finished.clear();
+	for (size_t w = work_begin; w < work_end; ++w) {
+		const auto index = static_cast<uint32_t>(w - work_begin);
+		auto& path = paths[index];
+		path.pixel = static_cast<lint>(w / sample_per_pixel);
+		const lint i = i_begin + path.pixel % columns;
+		const lint j = path.pixel / columns;
+		path.ray = camera.get_ray((i + random_double()) / width, (j + random_double()) / height);
+		path.throughput = color(1.0, 1.0, 1.0);
+		path.radiance = color(0.0, 0.0, 0.0);
+		path.depth = maxdepth;
+		active.push_back(index);
+	}
+}
+
+
+void WavefrontIntegrator::extend(const IntersectList& world)
+{
+	shade_queue.clear();
+	for (const auto index : active) {
+		auto& path = paths[index];
+		if (world.intersect(path.ray, ray_t_min, infinity, hits[index])) {
+			shade_queue.push_back(index);
+		}
+		else {
+			path.radiance += path.throughput * backcolor;
+			finished.push_back(index);
+		}
+	}
+}
+
+
+void WavefrontIntegrator::sort_by_material()
+{
+	// counting sort of the hits by material_type tag, order inside a bin is kept; user materials share a bin
+	std::vector<uint32_t> bin_size(material_bins, 0);
+	for (const auto index : shade_queue) {
+		const auto bin = static_cast<uint32_t>(hits[index].material->type);
+		material_bin[index] = bin;
+		bin_size[bin] += 1;
+	}
+
+	std::vector<uint32_t> bin_offset(bin_size.size(), 0);
+	for (size_t b = 1; b < bin_size.size(); ++b)
+		bin_offset[b] = bin_offset[b - 1] + bin_size[b - 1];
+	active.resize(shade_queue.size());
+	for (const auto index : shade_queue)
+		active[bin_offset[material_bin[index]]++] = index;
+	std::swap(active, shade_queue);
+}
+
+
+void WavefrontIntegrator::shade()
+{
+	active.clear();
+	for (const auto index : shade_queue) {
+		auto& path = paths[index];
+		const auto& irc = hits[index];
+		path.radiance += path.throughput * material_emitted(*irc.material, irc.uv.x, irc.uv.y, irc.p);
+
+		Ray scattered;
+		color attenuation(0.0);
+		if (!material_scatter(*irc.material, path.ray, irc, attenuation, scattered)) {
+			finished.push_back(index);
+			continue;
+		}
+		path.throughput *= attenuation;
+		const real cone_width = path.ray.cone_width_at(irc.t);
+		const real cone_spread = path.ray.cone_spread() + material_cone_spread(*irc.material);
+		path.ray = Ray(offset_ray_origin(irc.p, glm::dot(scattered.direction(), irc.normal) < 0 ? -irc.normal : irc.normal),
+			scattered.direction(), scattered.time());
+		path.ray.setcone(cone_width, cone_spread);
+		path.depth -= 1;
+		// bounce limit - the recursion returns the background color
+		if (path.depth <= 0) {
+			path.radiance += path.throughput * backcolor;
+			finished.push_back(index);
+			continue;
+		}
+		active.push_back(index);
+	}
+}
+
+
+void WavefrontIntegrator::accumulate()
+{
+	for (const auto index : finished)
+		pixel_color[paths[index].pixel] += paths[index].radiance;
+	finished.clear();
+}
@@ -4,7 +4,8 @@
 #include <option.hpp>
 
 
-shared_ptr<IntersectList> generate_world(const scene_type num_scene, CameraOption& cameraopt, shared_ptr<Screen>& screen)
+shared_ptr<IntersectList> generate_world(const scene_type num_scene, const Option& option, CameraOption& cameraopt, shared_ptr<Screen>& screen,
+	const shared_ptr<TextureCache>& textures)
 {
 	cameraopt.lookfrom = point3(13, 2, 3);
 	cameraopt.lookat = point3(0, 0, 0);
@@ -14,7 +15,7 @@ shared_ptr<IntersectList> generate_world(const scene_type num_scene, CameraOptio
 	{
 	case RANDOM_SCENE: {
 		cameraopt.aperture = 0.1;
-		return generate_random_scene();
+		return generate_random_scene(option.bvh);
 	}
 	case FINAL_SCENE: {
 		cameraopt.lookfrom = point3(478, 278, -600);
@@ -24,7 +25,7 @@ shared_ptr<IntersectList> generate_world(const scene_type num_scene, CameraOptio
 		screen->screenwidth = 800;
 		screen->screenheight = static_cast<lint>(screen->screenwidth / screen->aspectratio);
 		screen->backgroundcolor = blackcolor;
-		return generate_final_scene();
+		return generate_final_scene(option.bvh, textures);
 	}
 	default:
 		break;
@@ -43,12 +44,35 @@ int main(int argc, char* argv[])
 	// Raytracer and Camera options;
 	Option option;
 	CameraOption cameraopt;
+	if (argc > 1)
+		option.bvh.cache_dir = argv[1]; // built hierarchies are stored there and reused by next runs
+	if (argc > 3)
+		option.texture.cache_size = std::stoull(argv[3]) << 20; // MB of image texture tiles in memory, the rest is read on demand
+	if (argc > 4)
+		option.packet_side = std::clamp(std::stoi(argv[4]), 0, 8); // camera rays of tiles of this side are traced as packets
+
+	shared_ptr<TextureCache> textures;
+	if (option.texture.cache_size > 0) {
+		textures = make_shared<TextureCache>(option.texture.cache_size, option.texture.tile_dir, option.texture.max_open_files);
+		if (textures->capacity() != option.texture.cache_size)
+			std::cout << "Texture cache: pool of " << textures->capacity() / 1024 << " KB for " << option.texture.cache_size / 1024 << " KB requested\n";
+	}
 	
 	// wolrd
-	shared_ptr<IntersectList> world = generate_world(FINAL_SCENE, cameraopt, screen);
+	shared_ptr<IntersectList> world = generate_world(FINAL_SCENE, option, cameraopt, screen, textures);
+	for (const auto& object : world->objects) {
+		BVHCostReport report;
+		if (accel_cost_report(object, option.bvh, report))
+			std::cout << report;
+	}
 
 	// camera
 	shared_ptr<Camera> camera = make_shared<Camera>(*screen, cameraopt, 0.0, 1.0);
+	if (argc > 2) {
+		// hierarchy quality and traversal statistics of camera rays, to track regressions between builds
+		std::ofstream stats_file(argv[2]);
+		write_json(stats_file, BVHStatsCollector(option.bvh).collect(*world, *camera, 100000));
+	}
 
 	// image
 	Image image(screen->screenwidth, screen->screenheight, screen->num_ch);
@@ -64,6 +88,8 @@ int main(int argc, char* argv[])
 		scene.render(image, *world);
 #endif
 	}
+	if (textures)
+		std::cout << textures->stats();
 
 
 	// save
@@ -3,7 +3,7 @@
 #include <cassert>
 
 
-void AA_RGBPixel(color& pixels, const vec3& lightcolor, const size_t sample_per_pixel, const double gamma)
+void AA_RGBPixel(color& pixels, const vec3& lightcolor, const size_t sample_per_pixel, const real gamma)
 {
 	assert(gamma > 0);
 	auto r = lightcolor[0];
@@ -17,28 +17,28 @@ void AA_RGBPixel(color& pixels, const vec3& lightcolor, const size_t sample_per_
 	g = glm::pow((g * scale), gammacorrection);
 	b = glm::pow((b * scale), gammacorrection);
 
-	pixels[0] = static_cast<byte>(glm::clamp(r, 0.0, 0.999) * 256);
-	pixels[1] = static_cast<byte>(glm::clamp(g, 0.0, 0.999) * 256);
-	pixels[2] = static_cast<byte>(glm::clamp(b, 0.0, 0.999) * 256);
+	pixels[0] = static_cast<byte>(glm::clamp(r, real(0), real(0.999)) * 256);
+	pixels[1] = static_cast<byte>(glm::clamp(g, real(0), real(0.999)) * 256);
+	pixels[2] = static_cast<byte>(glm::clamp(b, real(0), real(0.999)) * 256);
 }
 
 
 void RGBPixel(byte pixels[3], const vec3& lightcolor)
 {
-	pixels[0] = static_cast<byte>(glm::clamp(lightcolor[0], 0.0, 0.999) * 256);
-	pixels[1] = static_cast<byte>(glm::clamp(lightcolor[1], 0.0, 0.999) * 256);
-	pixels[2] = static_cast<byte>(glm::clamp(lightcolor[2], 0.0, 0.999) * 256);
+	pixels[0] = static_cast<byte>(glm::clamp(lightcolor[0], real(0), real(0.999)) * 256);
+	pixels[1] = static_cast<byte>(glm::clamp(lightcolor[1], real(0), real(0.999)) * 256);
+	pixels[2] = static_cast<byte>(glm::clamp(lightcolor[2], real(0), real(0.999)) * 256);
 }
 
 void RGBPixel(icolor& color, const vec3& lightcolor)
 {
-	color[0] = static_cast<byte>(glm::clamp(lightcolor[0], 0.0, 0.999) * 256);
-	color[1] = static_cast<byte>(glm::clamp(lightcolor[1], 0.0, 0.999) * 256);
-	color[2] = static_cast<byte>(glm::clamp(lightcolor[2], 0.0, 0.999) * 256);
+	color[0] = static_cast<byte>(glm::clamp(lightcolor[0], real(0), real(0.999)) * 256);
+	color[1] = static_cast<byte>(glm::clamp(lightcolor[1], real(0), real(0.999)) * 256);
+	color[2] = static_cast<byte>(glm::clamp(lightcolor[2], real(0), real(0.999)) * 256);
 }
 
 
-vec3 generate_random_vec(const double min, const double max) {
+vec3 generate_random_vec(const real min, const real max) {
 	return vec3(random_double(min, max), random_double(min, max), random_double(min, max));
 }
 
@@ -55,7 +55,7 @@ vec3 random_unit_vector() {
 	return glm::normalize(random_unit_in_sphere());
 }
 
-vec3 random_unit_vector(const double min, const double max) {
+vec3 random_unit_vector(const real min, const real max) {
 	return glm::normalize(vec3(random_double(min, max), random_double(min, max), random_double(min, max)));
 }
 
@@ -86,7 +86,7 @@ color random_color()
 	return color(random_double(), random_double(), random_double());
 }
 
-color random_color(const double min,const double max)
+color random_color(const real min,const real max)
 {
 	return color(random_double(min, max), random_double(min, max), random_double(min, max));
 }
\ No newline at end of file
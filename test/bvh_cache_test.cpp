@@ -0,0 +1,124 @@
+// bvh_cache_test.cpp : a cached FlatBVH is reused, a cache file with offsets out of range,
+// cycles or a truncated node array is rejected on load and the hierarchy is rebuilt.
+//
+#include <Scene.hpp>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <functional>
+#include <iostream>
+
+
+static std::vector<char> read_file(const std::string& path)
+{
+	std::ifstream file(path, std::ios::binary);
+	return std::vector<char>(std::istreambuf_iterator<char>(file), std::istreambuf_iterator<char>());
+}
+
+
+static void write_file(const std::string& path, const std::vector<char>& bytes)
+{
+	std::ofstream file(path, std::ios::binary | std::ios::trunc);
+	file.write(bytes.data(), bytes.size());
+}
+
+
+// rays at every sphere hit the same spheres as a plain list
+static size_t count_misses(const IIntersect& bvh, const IntersectList& list)
+{
+	size_t misses = 0;
+	for (const auto& object : list.objects) {
+		AABB box;
+		object->bounding_box(0.0, 1.0, box);
+		const Ray ray(real(0.5) * (box.min() + box.max()) - vec3(0, 0, 10), vec3(0, 0, 1));
+		HitInfo expected, hit;
+		const bool expected_hit = list.closest_hit(ray, 0.001, infinity, expected);
+		if (bvh.closest_hit(ray, 0.001, infinity, hit) != expected_hit || hit.object != expected.object)
+			++misses;
+	}
+	return misses;
+}
+
+
+int main()
+{
+	IntersectList list;
+	auto material = make_shared<Lambertian>(color(0.5, 0.5, 0.5));
+	for (int j = 0; j < 16; ++j) {
+		for (int i = 0; i < 16; ++i)
+			list.add(make_shared<Sphere>(point3(i, j, 0.1 * ((i * 7 + j) % 5)), 0.25, material));
+	}
+
+	const auto cache_dir = std::filesystem::temp_directory_path() / "rt_bvh_cache_test";
+	std::filesystem::remove_all(cache_dir);
+	std::filesystem::create_directories(cache_dir);
+
+	BVHBuildOption option;
+	option.cache_dir = cache_dir.string();
+	const auto scene_hash = bvh_scene_hash(list, 0.0, 1.0, option);
+	const auto path = bvh_cache_path(option.cache_dir, scene_hash);
+
+	int failures = 0;
+	const auto built = make_cached_flat_bvh(list, 0.0, 1.0, option);
+	const auto loaded = load_bvh_cache(path, list, scene_hash);
+	if (!loaded || count_misses(*loaded, list) > 0) {
+		std::cout << "valid cache file is not loaded\n";
+		++failures;
+	}
+	const auto original = read_file(path);
+
+	BVHCacheHeader header;
+	std::memcpy(&header, original.data(), sizeof(header));
+	auto node_at = [&](std::vector<char>& bytes, size_t index) {
+		return reinterpret_cast<LinearBVHNode*>(bytes.data() + header.nodes_offset + index * sizeof(LinearBVHNode));
+	};
+	size_t leaf = 0, interior = 0;
+	for (size_t i = 0; i < header.node_count; ++i) {
+		const auto* node = reinterpret_cast<const LinearBVHNode*>(original.data() + header.nodes_offset) + i;
+		(node->primitives_count > 0 ? leaf : interior) = i;
+	}
+
+	const std::vector<std::pair<const char*, std::function<void(std::vector<char>&)>>> corruptions = {
+		{ "second child past the nodes", [&](std::vector<char>& bytes) { node_at(bytes, interior)->second_child_offset = header.node_count + 5; } },
+		{ "second child before its parent", [&](std::vector<char>& bytes) { node_at(bytes, interior)->second_child_offset = 0; } },
+		{ "second child next to its parent", [&](std::vector<char>& bytes) { node_at(bytes, interior)->second_child_offset = interior + 1; } },
+		{ "leaf primitives past the list", [&](std::vector<char>& bytes) {
+			auto* node = node_at(bytes, leaf);
+			node->primitives_offset = header.primitive_count - node->primitives_count + 1;
+		} },
+		{ "leaf primitives offset overflow", [&](std::vector<char>& bytes) { node_at(bytes, leaf)->primitives_offset = UINT32_MAX; } },
+		{ "interior node as a leaf", [&](std::vector<char>& bytes) { node_at(bytes, 0)->primitives_count = 1; } },
+		{ "split axis", [&](std::vector<char>& bytes) { node_at(bytes, 0)->axis = 7; } },
+		{ "truncated node array", [&](std::vector<char>& bytes) {
+			BVHCacheHeader truncated = header;
+			truncated.node_count -= 1;
+			truncated.indices_offset -= sizeof(LinearBVHNode);
+			std::memcpy(bytes.data(), &truncated, sizeof(truncated));
+			bytes.erase(bytes.begin() + truncated.indices_offset, bytes.begin() + header.indices_offset);
+		} },
+		{ "node count overflow", [&](std::vector<char>& bytes) {
+			BVHCacheHeader overflow = header;
+			overflow.node_count = UINT64_MAX / sizeof(LinearBVHNode) + 2;
+			overflow.indices_offset = overflow.nodes_offset + overflow.node_count * sizeof(LinearBVHNode);
+			std::memcpy(bytes.data(), &overflow, sizeof(overflow));
+		} }
+	};
+
+	for (const auto& [name, corrupt] : corruptions) {
+		auto bytes = original;
+		corrupt(bytes);
+		write_file(path, bytes);
+		const bool rejected = load_bvh_cache(path, list, scene_hash) == nullptr;
+		// the miss rebuilds the hierarchy and replaces the file
+		const auto rebuilt = make_cached_flat_bvh(list, 0.0, 1.0, option);
+		const auto misses = count_misses(*rebuilt, list);
+		const bool restored = read_file(path) == original;
+		std::cout << name << ": " << (rejected ? "rejected" : "loaded") << ", rebuilt hierarchy misses " << misses
+				  << " rays, cache file " << (restored ? "restored" : "not restored") << "\n";
+		if (!rejected || misses > 0 || !restored)
+			++failures;
+	}
+
+	std::filesystem::remove_all(cache_dir);
+	return failures == 0 ? 0 : 1;
+}
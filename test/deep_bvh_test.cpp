@@ -0,0 +1,116 @@
+// deep_bvh_test.cpp : hierarchies of spheres at x = 1.5^i - every split separates the farthest sphere,
+// the tree is deeper than the traversal stacks; closest hits and occlusion must match a plain list.
+// Leaves of more primitives than the 16-bit count of compiled leaves must be split, no primitive is lost.
+//
+#include <Scene.hpp>
+#include <algorithm>
+#include <iostream>
+#include <type_traits>
+
+
+int main()
+{
+	// 1.5^i overflows float beyond ~200 spheres, the float tree stays within the stacks - a plain agreement check
+	const int count = std::is_same<real, float>::value ? 200 : 600;
+	const real radius = 0.25;
+
+	IntersectList list;
+	auto material = make_shared<Lambertian>(color(0.5, 0.5, 0.5));
+	for (int i = 0; i < count; ++i)
+		list.add(make_shared<Sphere>(point3(std::pow(real(1.5), i), 0, 0), radius, material));
+
+	// a ray at each sphere along z
+	std::vector<Ray> rays;
+	for (const auto& object : list.objects) {
+		AABB box;
+		object->bounding_box(0.0, 1.0, box);
+		const auto center = real(0.5) * (box.min() + box.max());
+		rays.emplace_back(center - vec3(0, 0, 10), vec3(0, 0, 1));
+	}
+
+	int failures = 0;
+	for (const auto builder : { BVH_BUILDER_SAH, BVH_BUILDER_LBVH, BVH_BUILDER_SBVH }) {
+		for (const auto accel : { ACCEL_BVH_TREE, ACCEL_BVH_FLAT, ACCEL_BVH4, ACCEL_BVH8, ACCEL_MOTION_BVH }) {
+			BVHBuildOption option;
+			option.builder = builder;
+			option.accel = accel;
+			const auto bvh = make_accel(list, 0.0, 1.0, option);
+
+			size_t misses = 0;
+			for (const auto& ray : rays) {
+				HitInfo expected, hit;
+				const bool expected_hit = list.closest_hit(ray, 0.001, infinity, expected);
+				const bool is_hit = bvh->closest_hit(ray, 0.001, infinity, hit);
+				if (is_hit != expected_hit || (is_hit && (hit.object != expected.object || hit.t != expected.t)))
+					++misses;
+				else if (bvh->occluded(ray, 0.001, infinity) != expected_hit)
+					++misses;
+			}
+
+			BVHCostReport report;
+			accel_cost_report(bvh, option, report);
+			std::cout << "builder " << builder << ", accel " << accel << ": depth " << report.max_depth
+					  << ", " << misses << " of " << rays.size() << " rays differ\n";
+			if (misses > 0)
+				++failures;
+		}
+	}
+
+	// a degenerate build: a chain of nodes, each with a leaf of one sphere, ends below the depth limit
+	// in a leaf of a grid of more spheres than a compiled leaf counts
+	const int side = 265;
+	auto grid_leaf = make_shared<BVH_Node>();
+	for (int j = 0; j < side; ++j) {
+		for (int i = 0; i < side; ++i)
+			grid_leaf->objects.push_back(make_shared<Sphere>(point3(i, j, 0), radius, material));
+	}
+	grid_leaf->box = AABB(point3(-radius), point3(side - 1 + radius, side - 1 + radius, radius));
+	auto root = grid_leaf;
+	for (int i = 0; i < 80; ++i) {
+		auto leaf = make_shared<BVH_Node>();
+		leaf->objects.push_back(make_shared<Sphere>(point3(-10 - i, 0, 0), radius, material));
+		leaf->objects.back()->bounding_box(0.0, 1.0, leaf->box);
+		auto node = make_shared<BVH_Node>();
+		node->left = leaf;
+		node->right = root;
+		node->box = surrounding_box(leaf->box, root->box);
+		root = node;
+	}
+
+	std::vector<std::pair<const char*, shared_ptr<IIntersect>>> compiled = {
+		{ "tree", root }, { "flat", make_shared<FlatBVH>(*root) }, { "BVH4", make_shared<BVH4>(*root) }, { "BVH8", make_shared<BVH8>(*root) } };
+	for (const auto& [name, bvh] : compiled) {
+		// a ray at every 7th sphere of the grid along z, it hits that sphere at t = 10 - radius
+		size_t misses = 0, ray_count = 0;
+		for (int k = 0; k < side * side; k += 7, ++ray_count) {
+			const Ray ray(point3(k % side, k / side, -10), vec3(0, 0, 1));
+			HitInfo hit;
+			if (!bvh->closest_hit(ray, 0.001, infinity, hit) || hit.t != 10 - radius || !bvh->occluded(ray, 0.001, infinity))
+				++misses;
+		}
+		std::cout << "leaf of " << grid_leaf->objects.size() << " spheres at depth 81, " << name << ": "
+				  << misses << " of " << ray_count << " rays miss\n";
+		if (misses > 0)
+			++failures;
+	}
+
+	// IndexBVH of coincident boxes allowed in one leaf by max_leaf_size - more than a leaf counts
+	{
+		const std::vector<AABB> boxes(70000, AABB(point3(-1), point3(1)));
+		BVHBuildOption option;
+		option.max_leaf_size = boxes.size();
+		IndexBVH bvh(boxes, option);
+		std::vector<int> visits(boxes.size(), 0);
+		real t_max = infinity;
+		bvh.intersect(Ray(point3(0, 0, -10), vec3(0, 0, 1)), 0.001, t_max, [&](uint32_t index, real, real&) {
+			visits[index] += 1;
+			return false;
+		});
+		const auto missed = static_cast<size_t>(std::count(visits.begin(), visits.end(), 0));
+		std::cout << "IndexBVH of " << boxes.size() << " coincident boxes: " << missed << " primitives not tested\n";
+		if (missed > 0)
+			++failures;
+	}
+
+	return failures == 0 ? 0 : 1;
+}
\ No newline at end of file
@@ -0,0 +1,43 @@
+// instance_depth_test.cpp : instances nested through hierarchies (Instance over a BVH of Instances ...)
+// are hit up to the depth HitInfo records, an instance nested deeper is rejected when it is built.
+//
+#include <Scene.hpp>
+#include <iostream>
+#include <stdexcept>
+
+
+int main()
+{
+	auto material = make_shared<Lambertian>(color(0.5, 0.5, 0.5));
+	shared_ptr<IIntersect> object = make_shared<Sphere>(point3(0, 0, 0), 0.5, material);
+
+	int failures = 0;
+	for (int depth = 1; depth <= HitInfo::max_instance_depth + 1; ++depth) {
+		// a chain of transforms is folded into one instance, a hierarchy between them is not
+		shared_ptr<IIntersect> instance;
+		try {
+			instance = make_shared<Translate>(make_shared<Rotate>(object, vec3(1, 0, 0), 90), vec3(1, 0, 0));
+		}
+		catch (const std::invalid_argument& error) {
+			const bool expected = depth > HitInfo::max_instance_depth;
+			std::cout << "depth " << depth << ": rejected (" << error.what() << ")\n";
+			if (!expected)
+				++failures;
+			break;
+		}
+		IntersectList list(instance);
+		object = make_accel(list, 0.0, 1.0);
+
+		const Ray ray(point3(depth, 0, -10), vec3(0, 0, 1));
+		HitInfo hit;
+		const bool is_hit = object->closest_hit(ray, 0.001, infinity, hit);
+		IntersectRecord rec;
+		if (is_hit)
+			hit.surface(ray, rec);
+		std::cout << "depth " << depth << ": hit " << is_hit << ", instances on the path " << hit.instance_count << "\n";
+		if (depth > HitInfo::max_instance_depth || !is_hit || hit.instance_count != depth ||
+			std::fabs(rec.p.z + real(0.5)) > 1e-3 || !object->occluded(ray, 0.001, infinity))
+			++failures;
+	}
+	return failures == 0 ? 0 : 1;
+}
@@ -0,0 +1,100 @@
+// texture_cache_stress_test.cpp : threads sample many tiled textures through a small TextureCache.
+// Every lookup must match the in-memory MipPyramid while tiles are read, evicted and waited for concurrently,
+// and the open tiled files stay within the limit of the cache (plus a file per reading thread).
+//
+#include <texture.hpp>
+#include <atomic>
+#include <filesystem>
+#include <iostream>
+#include <random>
+#include <string>
+#include <vector>
+#ifdef _USE_THREAD
+#include <thread>
+#endif
+
+
+// descriptors of the process, -1 where /proc is not available
+static int open_descriptors()
+{
+	std::error_code error;
+	int count = 0;
+	for (std::filesystem::directory_iterator it("/proc/self/fd", error), end; !error && it != end; it.increment(error))
+		++count;
+	return error ? -1 : count;
+}
+
+
+int main()
+{
+	const int texture_count = 40;
+	const size_t max_open_files = 3;
+#ifdef _USE_THREAD
+	const int thread_count = 8;
+#else
+	const int thread_count = 1;
+#endif
+
+	const auto tile_dir = std::filesystem::temp_directory_path() / "rt_texture_cache_test";
+	std::filesystem::remove_all(tile_dir);
+	std::filesystem::create_directories(tile_dir);
+
+	// textures of different sizes, levels have partial tiles
+	std::vector<MipPyramid> mips;
+	std::vector<std::string> paths;
+	for (int k = 0; k < texture_count; ++k) {
+		const lint width = 90 + k, height = 70 + 2 * k;
+		Image image(width, height, 3);
+		for (lint i = 0; i < width * height; ++i)
+			image.set_color(i, color((i + k) % 251, (i / 7 + k) % 253, (i / 300) % 255));
+		mips.emplace_back(image);
+		paths.push_back((tile_dir / ("t" + std::to_string(k) + ".tiled")).string());
+		write_tiled_texture(paths.back(), mips.back(), 0);
+	}
+
+	int failures = 0;
+	// a tile per shard - lookups wait for the reads of one another, and a pool of several tiles per shard
+	const size_t capacities[2] = { 1, 64 * TextureCache::shard_count * texture_tile_bytes };
+	for (const size_t capacity : capacities) {
+		TextureCache cache(capacity, tile_dir.string(), max_open_files);
+		std::vector<int> ids;
+		for (const auto& path : paths)
+			ids.push_back(cache.open(path));
+		const int descriptors = open_descriptors();
+
+		std::atomic<int> mismatches{ 0 }, max_files{ 0 };
+		auto worker = [&](const int seed) {
+			std::mt19937 generator(seed);
+			std::uniform_real_distribution<real> uniform(0.0, 1.0);
+			for (int i = 0; i < 20000; ++i) {
+				const int k = generator() % texture_count;
+				const real u = uniform(generator), v = uniform(generator);
+				const real footprint = uniform(generator) * uniform(generator) * real(0.2);
+				if (glm::length(cache.sample(ids[k], u, v, footprint) - mips[k].sample(u, v, footprint)) > 1e-6)
+					++mismatches;
+				if (i % 500 == 0 && descriptors >= 0) {
+					int files = open_descriptors() - descriptors;
+					for (int seen = max_files; files > seen && !max_files.compare_exchange_weak(seen, files);)
+						;
+				}
+			}
+		};
+#ifdef _USE_THREAD
+		std::vector<std::thread> threads;
+		for (int t = 0; t < thread_count; ++t)
+			threads.emplace_back(worker, t);
+		for (auto& thread : threads)
+			thread.join();
+#else
+		worker(0);
+#endif
+
+		std::cout << "pool of " << cache.capacity() / 1024 << " KB, " << thread_count << " threads: " << mismatches
+				  << " lookups differ from the pyramid, at most " << max_files << " files open\n" << cache.stats();
+		if (mismatches > 0 || max_files > static_cast<int>(max_open_files) + thread_count)
+			++failures;
+	}
+
+	std::filesystem::remove_all(tile_dir);
+	return failures == 0 ? 0 : 1;
+}
@@ -0,0 +1,75 @@
+// triangle_packet_test.cpp : closest hits of a mesh with SIMD leaves (float packet filter) against scalar leaves,
+// small triangles near the origin and far from it - float rounding of the filter scales with the coordinates
+//
+#include <Scene.hpp>
+#include <iostream>
+
+
+// grid of side x side quads of size cell in the xy plane at offset, vertices jittered in z
+shared_ptr<TriangleMesh> make_grid(const point3& offset, const int side, const real cell, const bool simd_leaves)
+{
+	std::vector<point3> positions;
+	std::vector<uint32_t> indices;
+	for (int j = 0; j <= side; ++j) {
+		for (int i = 0; i <= side; ++i)
+			positions.push_back(offset + point3(i * cell, j * cell, ((i * 7 + j * 13) % 5) * cell * 0.1));
+	}
+	for (int j = 0; j < side; ++j) {
+		for (int i = 0; i < side; ++i) {
+			const uint32_t a = j * (side + 1) + i;
+			const uint32_t b = a + 1, c = a + side + 1, d = c + 1;
+			indices.insert(indices.end(), { a, b, d, a, d, c });
+		}
+	}
+	auto material = make_shared<Lambertian>(color(0.5, 0.5, 0.5));
+	return make_shared<TriangleMesh>(positions, indices, material, BVHBuildOption(), simd_leaves);
+}
+
+
+// rays from a sphere of radius distance around the grid center at random points of the grid,
+// hits of scalar leaves the SIMD leaves miss or find farther
+size_t count_lost_hits(const point3& offset, const real distance, const size_t ray_count)
+{
+	constexpr int side = 100;
+	constexpr real cell = 0.02;
+	const auto simd = make_grid(offset, side, cell, true);
+	const auto scalar = make_grid(offset, side, cell, false);
+	const point3 center = offset + point3(side * cell * 0.5, side * cell * 0.5, 0.0);
+
+	std::mt19937 generator;
+	std::uniform_real_distribution<real> uniform(0.0, 1.0);
+	size_t lost = 0;
+	for (size_t i = 0; i < ray_count; ++i) {
+		const real x = uniform(generator), y = uniform(generator);
+		const point3 target = offset + point3(x * side * cell, y * side * cell, 0.0);
+		const real theta = uniform(generator) * pi * 0.45, phi = uniform(generator) * 2 * pi;
+		const point3 origin = center + distance * vec3(std::sin(theta) * std::cos(phi), std::sin(theta) * std::sin(phi), std::cos(theta));
+		const Ray ray(origin, target - origin);
+
+		HitInfo expected, hit;
+		if (!scalar->closest_hit(ray, 0.001, infinity, expected))
+			continue;
+		// triangles sharing an edge are hit at distances a few ulp apart, either one is the closest hit
+		const real tolerance = 16 * std::numeric_limits<real>::epsilon() * expected.t;
+		if (!simd->closest_hit(ray, 0.001, infinity, hit) || hit.t > expected.t + tolerance)
+			++lost;
+	}
+	return lost;
+}
+
+
+int main()
+{
+	const size_t ray_count = 200000;
+	int failures = 0;
+	for (const real offset : { 0.0, 500.0 }) {
+		for (const real distance : { 1.0, 800.0 }) {
+			const auto lost = count_lost_hits(point3(offset), distance, ray_count);
+			std::cout << "offset " << offset << ", ray origin distance " << distance << ": "
+					  << lost << " of " << ray_count << " rays lose the hit of scalar leaves\n";
+			if (lost > 0)
+				++failures;
+		}
+	}
+	return failures == 0 ? 0 : 1;
+}
@@ -0,0 +1,104 @@
+// wavefront_test.cpp : the wavefront integrator estimates the same image as the recursive one.
+// A small box lit from the ceiling with diffuse, metal, glass, fog and a user-defined material
+// is rendered by both; mean pixel values of the images must agree within the noise.
+//
+#include <Scene.hpp>
+#include <cmath>
+#include <iostream>
+
+
+// user-defined material - shaded by the virtual scatter, binned apart from the built-in ones
+class Mirror : public Material
+{
+public:
+	Mirror(const color& c) : albedo(c) {}
+
+	virtual bool scatter(const Ray& ray, const IntersectRecord& irc, color& attenuation, Ray& scattered) const override {
+		scattered = Ray(irc.p, glm::reflect(glm::normalize(ray.direction()), irc.normal), ray.time());
+		attenuation = albedo;
+		return glm::dot(scattered.direction(), irc.normal) > 0;
+	}
+
+private:
+	color albedo;
+};
+
+
+static shared_ptr<IntersectList> small_box()
+{
+	auto world = make_shared<IntersectList>();
+	auto red = make_shared<Lambertian>(color(.65, .05, .05));
+	auto white = make_shared<Lambertian>(color(.73, .73, .73));
+	auto green = make_shared<Lambertian>(color(.12, .45, .15));
+	auto light = make_shared<DiffuseLight>(color(15, 15, 15));
+
+	world->add(make_shared<yzRect>(0, 555, 0, 555, 555, green));
+	world->add(make_shared<yzRect>(0, 555, 0, 555, 0, red));
+	world->add(make_shared<xzRect>(163, 393, 177, 382, 554, light));
+	world->add(make_shared<xzRect>(0, 555, 0, 555, 0, white));
+	world->add(make_shared<xzRect>(0, 555, 0, 555, 555, white));
+	world->add(make_shared<xyRect>(0, 555, 0, 555, 555, white));
+
+	world->add(make_shared<Sphere>(point3(150, 100, 200), 100, make_shared<Dielectric>(1.5)));
+	world->add(make_shared<Sphere>(point3(400, 90, 380), 90, make_shared<Metal>(color(0.8, 0.8, 0.9), 0.2)));
+	world->add(make_shared<Box>(point3(300, 0, 100), point3(450, 120, 250), make_shared<Mirror>(color(0.9, 0.8, 0.7))));
+	auto boundary = make_shared<Sphere>(point3(200, 330, 380), 80, make_shared<Dielectric>(1.5));
+	world->add(make_shared<ConstantVolume>(boundary, 0.01, color(0.2, 0.4, 0.9)));
+	return world;
+}
+
+
+// mean of each channel over the image
+static color mean_pixel(const Image& image)
+{
+	color sum(0.0);
+	for (lint y = 0; y < image.get_height(); ++y) {
+		for (lint x = 0; x < image.get_width(); ++x) {
+			color pixel;
+			image.get_color(x, y, pixel);
+			sum += pixel;
+		}
+	}
+	return sum / real(image.get_width() * image.get_height());
+}
+
+
+int main()
+{
+	const lint side = 48;
+	const lint samples = 128;
+
+	auto world = small_box();
+	auto screen = make_shared<Screen>();
+	screen->aspectratio = 1.0;
+	screen->screenwidth = side;
+	screen->screenheight = side;
+	screen->backgroundcolor = blackcolor;
+
+	CameraOption cameraopt;
+	cameraopt.lookfrom = point3(278, 278, -800);
+	cameraopt.lookat = point3(278, 278, 0);
+	cameraopt.up = vec3(0, 1, 0);
+	cameraopt.fovy = 40.0;
+	auto camera = make_shared<Camera>(*screen, cameraopt, 0.0, 1.0);
+
+	color means[2];
+	const integrator_type integrators[2] = { INTEGRATOR_RECURSIVE, INTEGRATOR_WAVEFRONT };
+	for (int k = 0; k < 2; ++k) {
+		Option option{ 25, samples, 0, integrators[k] };
+		Image image(side, side, screen->num_ch);
+		Scene scene;
+		scene.init(screen, camera, option);
+		scene.render(image, *world);
+		means[k] = mean_pixel(image);
+		std::cout << (k == 0 ? "recursive" : "wavefront") << ": mean pixel " << means[k].r << ", " << means[k].g << ", " << means[k].b << "\n";
+	}
+
+	// 8-bit gamma corrected means of ~300k samples, the noise is well below 2% of the mean
+	int failures = 0;
+	for (int c = 0; c < 3; ++c) {
+		if (!(means[0][c] > 10) || std::fabs(means[1][c] - means[0][c]) > 0.02 * means[0][c] + 0.5)
+			++failures;
+	}
+	return failures == 0 ? 0 : 1;
+}
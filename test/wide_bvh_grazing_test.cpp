@@ -0,0 +1,77 @@
+// wide_bvh_grazing_test.cpp : rays from far origins that enter small boxes at their edges.
+// Wide BVHs test float slabs - the rounding of the ray origin and direction to float must not cull
+// a node the ray enters in real arithmetic; closest hits and occlusion must match a plain list.
+//
+#include <Scene.hpp>
+#include <iostream>
+#include <random>
+#include <type_traits>
+
+
+int main()
+{
+	if (std::is_same<real, float>::value) {
+		std::cout << "float build: ray origins are not rounded, nothing to compare\n";
+		return 0;
+	}
+
+	// boxes are their own bounds, with a box per leaf the node bounds touch the boxes
+	const int side = 8;
+	const real spacing = 0.25;
+	const real size = 0.1;
+
+	IntersectList list;
+	auto material = make_shared<Lambertian>(color(0.5, 0.5, 0.5));
+	for (int j = 0; j < side; ++j) {
+		for (int i = 0; i < side; ++i) {
+			const point3 low(i * spacing - 1, j * spacing - 1, 0.37 * size * ((i + j) % 3));
+			list.add(make_shared<Box>(low, low + vec3(size), material));
+		}
+	}
+
+	BVHBuildOption option;
+	option.max_leaf_size = 1;
+
+	// a point of the top face within size * 2^-k of an edge, or on the edge, seen from a far origin
+	// whose coordinates are not representable in float
+	std::mt19937 generator(7);
+	std::uniform_real_distribution<double> uniform(0.0, 1.0);
+	std::vector<Ray> rays;
+	for (const auto& object : list.objects) {
+		AABB box;
+		object->bounding_box(0.0, 1.0, box);
+		for (int r = 0; r < 256; ++r) {
+			const real distance = std::pow(10.0, 1 + 4 * uniform(generator));
+			const point3 origin(distance * (2 * uniform(generator) - 1), distance * (2 * uniform(generator) - 1),
+								box.max()[2] + distance * uniform(generator) + 1e-3);
+			const real inset = (r % 4 == 0) ? 0 : size * std::ldexp(real(1), -(8 + r % 40));
+			const int axis = r % 2;
+			point3 target(box.min()[0] + size * uniform(generator), box.min()[1] + size * uniform(generator), box.max()[2]);
+			target[axis] = (r / 2) % 2 ? box.max()[axis] - inset : box.min()[axis] + inset;
+			rays.emplace_back(origin, target - origin);
+		}
+	}
+
+	int failures = 0;
+	std::vector<std::pair<const char*, shared_ptr<IIntersect>>> wide = {
+		{ "BVH4", make_shared<BVH4>(list, 0.0, 1.0, option) }, { "BVH8", make_shared<BVH8>(list, 0.0, 1.0, option) } };
+	for (const auto& [name, bvh] : wide) {
+		size_t misses = 0, reference_hits = 0;
+		for (const auto& ray : rays) {
+			HitInfo expected, hit;
+			const bool expected_hit = list.closest_hit(ray, 0.001, infinity, expected);
+			const bool is_hit = bvh->closest_hit(ray, 0.001, infinity, hit);
+			reference_hits += expected_hit;
+			if (is_hit != expected_hit || (is_hit && (hit.object != expected.object || hit.t != expected.t)))
+				++misses;
+			else if (bvh->occluded(ray, 0.001, infinity) != list.occluded(ray, 0.001, infinity))
+				++misses;
+		}
+		std::cout << name << ": " << misses << " of " << rays.size() << " grazing rays differ from the list ("
+				  << reference_hits << " hits)\n";
+		if (misses > 0)
+			++failures;
+	}
+
+	return failures == 0 ? 0 : 1;
+}